@@ -0,0 +1,307 @@
+#include "aad.h"
+#include "matlib.h"
+#include <chrono>
+
+size_t Tape::recordInput()
+{
+    return nodes.push(TapeNode{{NOT_ON_TAPE, NOT_ON_TAPE}, {0.0, 0.0}});
+}
+
+size_t Tape::record(size_t a, double partialA, size_t b, double partialB)
+{
+    if (a == NOT_ON_TAPE)
+    {
+        // keep the recorded argument in the first slot
+        a = b;
+        partialA = partialB;
+        b = NOT_ON_TAPE;
+        partialB = 0.0;
+    }
+    return nodes.push(TapeNode{{a, b}, {partialA, partialB}});
+}
+
+void Tape::propagate(size_t output)
+{
+    adjoints.assign(nodes.size(), 0.0);
+    if (output == NOT_ON_TAPE)
+    {
+        return;
+    }
+    adjoints[output] = 1.0;
+    for (size_t i = output + 1; i-- > 0;)
+    {
+        double adjoint = adjoints[i];
+        if (adjoint == 0.0)
+        {
+            continue;
+        }
+        const TapeNode &node = nodes[i];
+        if (node.arguments[0] != NOT_ON_TAPE)
+        {
+            adjoints[node.arguments[0]] += node.partials[0] * adjoint;
+            if (node.arguments[1] != NOT_ON_TAPE)
+            {
+                adjoints[node.arguments[1]] += node.partials[1] * adjoint;
+            }
+        }
+    }
+}
+
+double Tape::adjoint(size_t index) const
+{
+    if (index == NOT_ON_TAPE || index >= adjoints.size())
+    {
+        return 0.0;
+    }
+    return adjoints[index];
+}
+
+void Tape::clear()
+{
+    nodes.rewind();
+    adjoints.clear();
+}
+
+Number Number::input(double value)
+{
+    return Number(value, tape().recordInput());
+}
+
+Tape &Number::tape()
+{
+    static thread_local Tape threadTape;
+    return threadTape;
+}
+
+void Number::propagateAdjoints() const
+{
+    tape().propagate(idx);
+}
+
+double Number::adjoint() const
+{
+    return tape().adjoint(idx);
+}
+
+Number &Number::operator+=(const Number &other)
+{
+    return *this = *this + other;
+}
+
+Number &Number::operator-=(const Number &other)
+{
+    return *this = *this - other;
+}
+
+Number &Number::operator*=(const Number &other)
+{
+    return *this = *this * other;
+}
+
+Number &Number::operator/=(const Number &other)
+{
+    return *this = *this / other;
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+static double normalDensity(double x)
+{
+    return std::exp(-0.5 * x * x) / ROOT_2_PI;
+}
+
+static void testArithmeticAdjoints()
+{
+    Number::tape().clear();
+    Number x = Number::input(1.5);
+    Number y = Number::input(0.5);
+    Number f = x * y + exp(x) / y - sqrt(x) + pow(y, 3.0) - 2.0 * log(x);
+    f.propagateAdjoints();
+    double dfdx = 0.5 + std::exp(1.5) / 0.5 - 0.5 / std::sqrt(1.5) - 2.0 / 1.5;
+    double dfdy = 1.5 - std::exp(1.5) / 0.25 + 3 * 0.25;
+    ASSERT_APPROX_EQUAL(x.adjoint(), dfdx, 1e-12);
+    ASSERT_APPROX_EQUAL(y.adjoint(), dfdy, 1e-12);
+    // constants are not recorded
+    Number c = Number(2.0) * Number(3.0);
+    ASSERT(c.index() == NOT_ON_TAPE);
+}
+
+static void testNormalDerivatives()
+{
+    double points[] = {-2.5, -0.3, 0.0, 0.7, 1.96};
+    for (double p : points)
+    {
+        Number::tape().clear();
+        Number x = Number::input(p);
+        Number y = normcdf(x);
+        ASSERT_APPROX_EQUAL(y.value(), normcdf(p), 1e-15);
+        y.propagateAdjoints();
+        ASSERT_APPROX_EQUAL(x.adjoint(), normalDensity(p), 1e-5);
+    }
+    Number::tape().clear();
+    Number u = Number::input(0.8);
+    Number z = norminv(u);
+    z.propagateAdjoints();
+    ASSERT_APPROX_EQUAL(u.adjoint(), 1.0 / normalDensity(norminv(0.8)), 1e-4);
+}
+
+static void testBlackScholesGreeks()
+{
+    double strike = 100, maturity = 0.5, spot = 105, volatility = 0.25, rate = 0.03;
+    Number::tape().clear();
+    Number k = Number::input(strike);
+    Number t = Number::input(maturity);
+    Number s = Number::input(spot);
+    Number v = Number::input(volatility);
+    Number r = Number::input(rate);
+    Number price = blackScholesCallPrice(k, t, s, v, r);
+    ASSERT_APPROX_EQUAL(price.value(), blackScholesCallPrice(strike, maturity, spot, volatility, rate), 1e-12);
+    price.propagateAdjoints();
+
+    double d1 = (std::log(spot / strike) + (rate + 0.5 * volatility * volatility) * maturity) / (volatility * std::sqrt(maturity));
+    double d2 = d1 - volatility * std::sqrt(maturity);
+    ASSERT_APPROX_EQUAL(s.adjoint(), normcdf(d1), 1e-5);
+    ASSERT_APPROX_EQUAL(v.adjoint(), spot * normalDensity(d1) * std::sqrt(maturity), 1e-3);
+    ASSERT_APPROX_EQUAL(r.adjoint(), strike * maturity * std::exp(-rate * maturity) * normcdf(d2), 1e-3);
+    ASSERT_APPROX_EQUAL(k.adjoint(), -std::exp(-rate * maturity) * normcdf(d2), 1e-5);
+}
+
+static void testMonteCarloPathwiseDelta()
+{
+    std::vector<double> normals = randn(2000);
+    double bump = 1e-4;
+    double up = monteCarloCallPrice(100.0, 1.0, 100.0 + bump, 0.2, 0.05, normals);
+    double down = monteCarloCallPrice(100.0, 1.0, 100.0 - bump, 0.2, 0.05, normals);
+
+    Number::tape().clear();
+    Number spot = Number::input(100.0);
+    Number price = monteCarloCallPrice(Number(100.0), Number(1.0), spot, Number(0.2), Number(0.05), normals);
+    price.propagateAdjoints();
+    ASSERT_APPROX_EQUAL(spot.adjoint(), (up - down) / (2 * bump), 1e-4);
+}
+
+static void testTapeReuse()
+{
+    Number::tape().clear();
+    Number x = Number::input(2.0);
+    (x * x + x).propagateAdjoints();
+    size_t recorded = Number::tape().size();
+    ASSERT_APPROX_EQUAL(x.adjoint(), 5.0, 1e-15);
+
+    Number::tape().clear();
+    ASSERT(Number::tape().size() == 0);
+    Number y = Number::input(3.0);
+    (y * y + y).propagateAdjoints();
+    ASSERT(Number::tape().size() == recorded);
+    ASSERT_APPROX_EQUAL(y.adjoint(), 7.0, 1e-15);
+}
+
+void testAad()
+{
+    TEST(testArithmeticAdjoints);
+    TEST(testNormalDerivatives);
+    TEST(testBlackScholesGreeks);
+    TEST(testMonteCarloPathwiseDelta);
+    TEST(testTapeReuse);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+/*  Value of a portfolio of calls, each described by 5 consecutive inputs */
+template <typename T>
+static T portfolioValue(const std::vector<T> &inputs, const std::vector<double> *normals)
+{
+    T total = 0.0;
+    for (size_t i = 0; i + 4 < inputs.size(); i += 5)
+    {
+        if (normals)
+        {
+            total += monteCarloCallPrice(inputs[i], inputs[i + 1], inputs[i + 2], inputs[i + 3], inputs[i + 4], *normals);
+        }
+        else
+        {
+            total += blackScholesCallPrice(inputs[i], inputs[i + 1], inputs[i + 2], inputs[i + 3], inputs[i + 4]);
+        }
+    }
+    return total;
+}
+
+static void benchmarkPortfolio(const char *name, const std::vector<double> *normals, int repeats)
+{
+    const size_t nInputs = 100;
+    std::vector<double> inputs(nInputs);
+    for (size_t i = 0; i < nInputs; i += 5)
+    {
+        inputs[i] = 80.0 + 2.0 * i / 5; // strike
+        inputs[i + 1] = 0.25 + 0.1 * i / 5; // maturity
+        inputs[i + 2] = 100.0;           // spot
+        inputs[i + 3] = 0.2;             // volatility
+        inputs[i + 4] = 0.03;            // rate
+    }
+
+    std::vector<double> bumpGradient(nInputs);
+    auto start = std::chrono::steady_clock::now();
+    for (int repeat = 0; repeat < repeats; repeat++)
+    {
+        double base = portfolioValue(inputs, normals);
+        for (size_t i = 0; i < nInputs; i++)
+        {
+            std::vector<double> bumped = inputs;
+            bumped[i] += 1e-6;
+            bumpGradient[i] = (portfolioValue(bumped, normals) - base) / 1e-6;
+        }
+    }
+    double bumpSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeats;
+
+    start = std::chrono::steady_clock::now();
+    for (int repeat = 0; repeat < repeats; repeat++)
+    {
+        portfolioValue(inputs, normals);
+    }
+    double priceSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeats;
+
+    std::vector<double> aadGradient(nInputs);
+    start = std::chrono::steady_clock::now();
+    for (int repeat = 0; repeat < repeats; repeat++)
+    {
+        Number::tape().clear();
+        std::vector<Number> variables;
+        for (double input : inputs)
+        {
+            variables.push_back(Number::input(input));
+        }
+        Number value = portfolioValue(variables, normals);
+        value.propagateAdjoints();
+        for (size_t i = 0; i < nInputs; i++)
+        {
+            aadGradient[i] = variables[i].adjoint();
+        }
+    }
+    double aadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeats;
+
+    double maxDifference = 0.0;
+    for (size_t i = 0; i < nInputs; i++)
+    {
+        maxDifference = std::max(maxDifference, std::fabs(aadGradient[i] - bumpGradient[i]));
+    }
+    std::cout << "aad " << name << " 100 inputs: price " << priceSeconds * 1e6 << "us"
+              << " bump-and-reprice " << bumpSeconds * 1e6 << "us (" << bumpSeconds / priceSeconds << "x)"
+              << " aad " << aadSeconds * 1e6 << "us (" << aadSeconds / priceSeconds << "x)"
+              << " tape " << Number::tape().size() << " nodes"
+              << " max gradient difference " << maxDifference << "\n";
+}
+
+void benchmarkAad()
+{
+    benchmarkPortfolio("black-scholes", nullptr, 1000);
+    std::vector<double> normals = randn(10000);
+    benchmarkPortfolio("monte carlo", &normals, 3);
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include "stdafx.h"
+#include <cstddef>
+#include <memory>
+
+/**
+ *  An append-only arena that grows in fixed size blocks.  Elements never
+ *  move once pushed, and rewind() keeps the blocks so a tape recorded
+ *  repeatedly stops allocating after the first recording.
+ */
+template <typename T, size_t BlockSize = 65536>
+class Arena
+{
+public:
+    T &operator[](size_t i) { return blocks[i / BlockSize][i % BlockSize]; }
+    const T &operator[](size_t i) const { return blocks[i / BlockSize][i % BlockSize]; }
+
+    size_t size() const { return used; }
+
+    /** Appends value and returns its index */
+    size_t push(const T &value)
+    {
+        if (used == blocks.size() * BlockSize)
+        {
+            blocks.emplace_back(new T[BlockSize]);
+        }
+        (*this)[used] = value;
+        return used++;
+    }
+
+    /** Forgets the contents but keeps the memory */
+    void rewind() { used = 0; }
+
+private:
+    std::vector<std::unique_ptr<T[]>> blocks;
+    size_t used = 0;
+};
+
+/*  Index of a value that is a constant rather than a recorded variable */
+const size_t NOT_ON_TAPE = (size_t)-1;
+
+/**
+ *  One recorded operation: the indices of its (at most two) arguments and
+ *  the partial derivatives of the result with respect to them
+ */
+struct TapeNode
+{
+    size_t arguments[2];
+    double partials[2];
+};
+
+/**
+ *  Records the operations performed on Numbers so that one reverse sweep
+ *  gives the derivatives of an output with respect to every input
+ */
+class Tape
+{
+public:
+    /** Records an independent variable */
+    size_t recordInput();
+    /** Records an operation with one or two arguments, constants are skipped */
+    size_t record(size_t a, double partialA, size_t b = NOT_ON_TAPE, double partialB = 0.0);
+
+    /** Sets the adjoint of output to one and propagates it back to the inputs */
+    void propagate(size_t output);
+    /** The adjoint of a recorded value after propagate, zero for constants */
+    double adjoint(size_t index) const;
+
+    /** Discards the recording, keeping the memory for the next one */
+    void clear();
+    size_t size() const { return nodes.size(); }
+
+private:
+    Arena<TapeNode> nodes;
+    std::vector<double> adjoints;
+};
+
+/**
+ *  A double that records the operations performed on it onto the tape of
+ *  the current thread.  Numbers built from a double are constants and are
+ *  not recorded; use Number::input for the variables to differentiate by.
+ */
+class Number
+{
+public:
+    Number(double value = 0.0) : v(value), idx(NOT_ON_TAPE) {}
+    Number(double value, size_t index) : v(value), idx(index) {}
+
+    /** Creates an input variable on the tape */
+    static Number input(double value);
+    /** The tape of the current thread */
+    static Tape &tape();
+
+    double value() const { return v; }
+    size_t index() const { return idx; }
+
+    /** Runs the reverse sweep from this number */
+    void propagateAdjoints() const;
+    /** d(output) / d(this) after the output's propagateAdjoints */
+    double adjoint() const;
+
+    Number &operator+=(const Number &other);
+    Number &operator-=(const Number &other);
+    Number &operator*=(const Number &other);
+    Number &operator/=(const Number &other);
+
+private:
+    double v;
+    size_t idx;
+};
+
+/*  Builds the result of an operation, recording it if any argument is on the tape */
+inline Number recordOperation(double value, const Number &a, double partialA)
+{
+    if (a.index() == NOT_ON_TAPE)
+    {
+        return Number(value);
+    }
+    return Number(value, Number::tape().record(a.index(), partialA));
+}
+
+inline Number recordOperation(double value,
+                              const Number &a, double partialA,
+                              const Number &b, double partialB)
+{
+    if (a.index() == NOT_ON_TAPE && b.index() == NOT_ON_TAPE)
+    {
+        return Number(value);
+    }
+    return Number(value, Number::tape().record(a.index(), partialA, b.index(), partialB));
+}
+
+inline Number operator+(const Number &a, const Number &b)
+{
+    return recordOperation(a.value() + b.value(), a, 1.0, b, 1.0);
+}
+
+inline Number operator-(const Number &a, const Number &b)
+{
+    return recordOperation(a.value() - b.value(), a, 1.0, b, -1.0);
+}
+
+inline Number operator*(const Number &a, const Number &b)
+{
+    return recordOperation(a.value() * b.value(), a, b.value(), b, a.value());
+}
+
+inline Number operator/(const Number &a, const Number &b)
+{
+    double inverse = 1.0 / b.value();
+    double result = a.value() * inverse;
+    return recordOperation(result, a, inverse, b, -result * inverse);
+}
+
+inline Number operator-(const Number &a)
+{
+    return recordOperation(-a.value(), a, -1.0);
+}
+
+inline Number operator+(const Number &a)
+{
+    return a;
+}
+
+inline Number exp(const Number &a)
+{
+    double e = std::exp(a.value());
+    return recordOperation(e, a, e);
+}
+
+inline Number log(const Number &a)
+{
+    return recordOperation(std::log(a.value()), a, 1.0 / a.value());
+}
+
+inline Number sqrt(const Number &a)
+{
+    double s = std::sqrt(a.value());
+    return recordOperation(s, a, 0.5 / s);
+}
+
+inline Number pow(const Number &a, double exponent)
+{
+    double p = std::pow(a.value(), exponent);
+    return recordOperation(p, a, exponent * std::pow(a.value(), exponent - 1));
+}
+
+inline Number fabs(const Number &a)
+{
+    return a.value() < 0 ? -a : a;
+}
+
+inline bool operator<(const Number &a, const Number &b) { return a.value() < b.value(); }
+inline bool operator>(const Number &a, const Number &b) { return a.value() > b.value(); }
+inline bool operator<=(const Number &a, const Number &b) { return a.value() <= b.value(); }
+inline bool operator>=(const Number &a, const Number &b) { return a.value() >= b.value(); }
+inline bool operator==(const Number &a, const Number &b) { return a.value() == b.value(); }
+inline bool operator!=(const Number &a, const Number &b) { return a.value() != b.value(); }
+
+inline std::ostream &operator<<(std::ostream &out, const Number &a)
+{
+    return out << a.value();
+}
+
+/**
+ *  Test function
+ */
+void testAad();
+
+/**
+ *  Benchmark function
+ */
+void benchmarkAad();
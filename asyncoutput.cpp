@@ -0,0 +1,359 @@
+#include "asyncoutput.h"
+#include "charts.h"
+#include "matlib.h"
+#include <chrono>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <latch>
+
+AsyncOutput::AsyncOutput(size_t maxQueued, int nThreads)
+    : maxQueued(std::max<size_t>(maxQueued, 1)), submitted(0), finishedBelow(0), stopping(false)
+{
+    for (int i = 0; i < std::max(nThreads, 1); i++)
+    {
+        threads.emplace_back([this]()
+        {
+            run();
+        });
+    }
+}
+
+AsyncOutput::~AsyncOutput()
+{
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobAdded.notify_all();
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void AsyncOutput::run()
+{
+    while (true)
+    {
+        QueuedJob job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobAdded.wait(lock, [this]()
+            {
+                return stopping || !queue.empty();
+            });
+            if (queue.empty())
+            {
+                return;
+            }
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+        jobTaken.notify_one();
+        // exceptions are stored in the future
+        job.task();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finishedAhead.insert(job.sequence);
+            while (!finishedAhead.empty() && *finishedAhead.begin() == finishedBelow)
+            {
+                finishedAhead.erase(finishedAhead.begin());
+                finishedBelow++;
+            }
+        }
+        jobFinished.notify_all();
+    }
+}
+
+std::future<void> AsyncOutput::submit(std::function<void()> job)
+{
+    std::packaged_task<void()> task(std::move(job));
+    std::future<void> result = task.get_future();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobTaken.wait(lock, [this]()
+        {
+            return queue.size() < maxQueued;
+        });
+        queue.push_back(QueuedJob{submitted++, std::move(task)});
+    }
+    jobAdded.notify_one();
+    return result;
+}
+
+void AsyncOutput::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    size_t target = submitted;
+    // jobs submitted later may finish first, so finishing target jobs is not enough
+    jobFinished.wait(lock, [this, target]()
+    {
+        return finishedBelow >= target;
+    });
+}
+
+std::future<void> AsyncOutput::writeCSVChart(std::string file, std::vector<double> x, std::vector<double> y)
+{
+    return submit([file = std::move(file), x = std::move(x), y = std::move(y)]()
+    {
+        ::writeCSVChart(file, x, y);
+    });
+}
+
+std::future<void> AsyncOutput::pieChart(std::string file, std::vector<std::string> labels, std::vector<double> values)
+{
+    return submit([file = std::move(file), labels = std::move(labels), values = std::move(values)]()
+    {
+        ::pieChart(file, labels, values);
+    });
+}
+
+std::future<void> AsyncOutput::plot(std::string file, std::vector<double> xValues, std::vector<double> yValues)
+{
+    return submit([file = std::move(file), xValues = std::move(xValues), yValues = std::move(yValues)]()
+    {
+        ::plot(file, xValues, yValues);
+    });
+}
+
+std::future<void> AsyncOutput::hist(std::string file, std::vector<std::string> labels, std::vector<double> xValues)
+{
+    return submit([file = std::move(file), labels = std::move(labels), xValues = std::move(xValues)]()
+    {
+        ::hist(file, labels, xValues);
+    });
+}
+
+std::future<void> AsyncOutput::hist(std::string file, std::vector<double> values)
+{
+    return submit([file = std::move(file), values = std::move(values)]()
+    {
+        ::hist(file, std::span<const double>(values));
+    });
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+static std::string readWholeFile(const std::string &file)
+{
+    std::ifstream in(file, std::ios::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+// Tests that background charts match the synchronous ones once flushed
+static void testMatchesSynchronousOutput()
+{
+    std::vector<double> x = randn(1000);
+    std::vector<double> y = randuniform(1000);
+    plot("SyncChart.html", x, y);
+    writeCSVChart("SyncChart.csv", x, y);
+    {
+        AsyncOutput output;
+        std::vector<double> movedX = x;
+        std::vector<double> movedY = y;
+        output.writeCSVChart("AsyncChart.csv", x, y);
+        std::future<void> done = output.plot("AsyncChart.html", std::move(movedX), std::move(movedY));
+        ASSERT(movedX.empty());
+        output.flush();
+        ASSERT(done.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+        ASSERT(readWholeFile("AsyncChart.html") == readWholeFile("SyncChart.html"));
+        ASSERT(readWholeFile("AsyncChart.csv") == readWholeFile("SyncChart.csv"));
+    }
+    std::remove("SyncChart.html");
+    std::remove("SyncChart.csv");
+    std::remove("AsyncChart.html");
+    std::remove("AsyncChart.csv");
+}
+
+// Tests ordering, errors and that a full queue makes callers wait
+static void testQueueAndErrors()
+{
+    std::vector<int> order;
+    AsyncOutput output(2);
+    std::future<void> failed = output.submit([]()
+    {
+        throw std::runtime_error("disk full");
+    });
+    for (int i = 0; i < 20; i++)
+    {
+        output.submit([&order, i]()
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            order.push_back(i);
+        });
+    }
+    output.flush();
+    ASSERT(order.size() == 20);
+    ASSERT(std::is_sorted(order.begin(), order.end()));
+    bool threw = false;
+    try
+    {
+        failed.get();
+    }
+    catch (const std::runtime_error &)
+    {
+        threw = true;
+    }
+    ASSERT(threw);
+
+    // with the one queue slot taken behind a running job, the next submit waits
+    AsyncOutput full(1);
+    std::latch started(1);
+    std::latch release(1);
+    full.submit([&]()
+    {
+        started.count_down();
+        release.wait();
+    });
+    started.wait();
+    full.submit([]() {});
+    std::atomic<bool> returned{false};
+    std::thread caller([&]()
+    {
+        full.submit([]() {});
+        returned = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT(!returned);
+    release.count_down();
+    caller.join();
+    ASSERT(returned);
+    full.flush();
+}
+
+// Tests that flush waits for an earlier job still running when a later one has finished
+static void testFlushWaitsForEarlierJobs()
+{
+    AsyncOutput output(4, 2);
+    std::latch release(1);
+    output.submit([&]()
+    {
+        release.wait();
+    });
+    std::atomic<bool> flushed{false};
+    std::thread flusher([&]()
+    {
+        output.flush();
+        flushed = true;
+    });
+    // let the flush start waiting, then finish a job submitted after it
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    output.submit([]() {}).get();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT(!flushed);
+    release.count_down();
+    flusher.join();
+    ASSERT(flushed);
+}
+
+// Tests that the futures of jobs writing where they cannot rethrow the error
+static void testWriteErrors()
+{
+    std::filesystem::path missing = std::filesystem::temp_directory_path() / "asyncoutput_missing";
+    std::filesystem::remove_all(missing);
+    std::string file = (missing / "chart").string();
+    AsyncOutput output;
+    std::vector<std::future<void>> results;
+    results.push_back(output.writeCSVChart(file + ".csv", {1.0, 2.0}, {3.0, 4.0}));
+    results.push_back(output.pieChart(file + ".html", {"a", "b"}, {1.0, 2.0}));
+    results.push_back(output.plot(file + ".html", {1.0, 2.0}, {3.0, 4.0}));
+    results.push_back(output.hist(file + ".html", {"a", "b"}, {1.0, 2.0}));
+    results.push_back(output.hist(file + ".html", std::vector<double>{1.0, 2.0, 3.0}));
+    for (std::future<void> &result : results)
+    {
+        bool threw = false;
+        try
+        {
+            result.get();
+        }
+        catch (const std::runtime_error &)
+        {
+            threw = true;
+        }
+        ASSERT(threw);
+    }
+}
+
+void testAsyncOutput()
+{
+    TEST(testMatchesSynchronousOutput);
+    TEST(testQueueAndErrors);
+    TEST(testFlushWaitsForEarlierJobs);
+    TEST(testWriteErrors);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+/*  The compute part of a benchmark job, a random walk of n steps */
+static void simulateSeries(size_t seed, size_t n, std::vector<double> &x, std::vector<double> &y)
+{
+    std::mt19937_64 generator(seed);
+    std::normal_distribution<double> normal;
+    x.resize(n);
+    y.resize(n);
+    double level = 100.0;
+    for (size_t i = 0; i < n; i++)
+    {
+        level *= std::exp(0.01 * normal(generator));
+        x[i] = (double)i;
+        y[i] = level;
+    }
+}
+
+void benchmarkAsyncOutput()
+{
+    size_t nCharts = 500;
+    size_t points = 20000;
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "asyncoutput_benchmark";
+    std::filesystem::create_directories(directory);
+    auto chartFile = [&](size_t i)
+    {
+        return (directory / ("chart" + std::to_string(i) + ".html")).string();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nCharts; i++)
+    {
+        std::vector<double> x;
+        std::vector<double> y;
+        simulateSeries(i, points, x, y);
+        plot(chartFile(i), x, y);
+    }
+    double synchronousSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double computeSeconds = 0.0;
+    start = std::chrono::steady_clock::now();
+    {
+        AsyncOutput output;
+        for (size_t i = 0; i < nCharts; i++)
+        {
+            std::vector<double> x;
+            std::vector<double> y;
+            auto computeStart = std::chrono::steady_clock::now();
+            simulateSeries(i, points, x, y);
+            computeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - computeStart).count();
+            output.plot(chartFile(i), std::move(x), std::move(y));
+        }
+        output.flush();
+    }
+    double asynchronousSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "async output " << nCharts << " charts of " << points << " points, "
+              << std::thread::hardware_concurrency() << " hardware threads\n"
+              << "  synchronous  " << synchronousSeconds << "s\n"
+              << "  asynchronous " << asynchronousSeconds << "s end to end, compute thread busy computing for "
+              << computeSeconds << "s\n";
+    std::filesystem::remove_all(directory);
+}
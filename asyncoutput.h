@@ -0,0 +1,78 @@
+#pragma once
+
+#include "stdafx.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+/**
+ *  Writes charts and CSV files on background I/O threads so that the
+ *  compute thread does not wait for the file system.  The chart functions
+ *  take their data by value, so callers can move vectors in without a
+ *  copy.  At most maxQueued jobs wait at a time; submitting more blocks
+ *  until one starts, which bounds the memory held by the queue.  Each
+ *  call returns a future that is ready when the file is complete and
+ *  rethrows any error.  flush waits for everything submitted so far and
+ *  the destructor flushes before stopping the threads.  With one thread
+ *  jobs run in the order they were submitted.
+ */
+class AsyncOutput
+{
+public:
+    explicit AsyncOutput(size_t maxQueued = 64, int nThreads = 1);
+    ~AsyncOutput();
+
+    AsyncOutput(const AsyncOutput &) = delete;
+    AsyncOutput &operator=(const AsyncOutput &) = delete;
+
+    std::future<void> writeCSVChart(std::string file, std::vector<double> x, std::vector<double> y);
+    std::future<void> pieChart(std::string file, std::vector<std::string> labels, std::vector<double> values);
+    std::future<void> plot(std::string file, std::vector<double> xValues, std::vector<double> yValues);
+    std::future<void> hist(std::string file, std::vector<std::string> labels, std::vector<double> xValues);
+    std::future<void> hist(std::string file, std::vector<double> values);
+
+    /** Runs any job on an I/O thread, e.g. a report writer */
+    std::future<void> submit(std::function<void()> job);
+
+    /** Blocks until every job submitted before the call has finished */
+    void flush();
+
+private:
+    /*  A job and its position in the order of submission */
+    struct QueuedJob
+    {
+        size_t sequence;
+        std::packaged_task<void()> task;
+    };
+
+    void run();
+
+    std::mutex mutex;
+    std::condition_variable jobAdded;
+    std::condition_variable jobTaken;
+    std::condition_variable jobFinished;
+    std::deque<QueuedJob> queue;
+    size_t maxQueued;
+    size_t submitted;
+    /*  Every job with a lower sequence has finished */
+    size_t finishedBelow;
+    /*  Finished jobs above finishedBelow, waiting for earlier jobs on other threads */
+    std::set<size_t> finishedAhead;
+    bool stopping;
+    std::vector<std::thread> threads;
+};
+
+/**
+ *  Test function
+ */
+void testAsyncOutput();
+
+/**
+ *  Benchmark function
+ */
+void benchmarkAsyncOutput();
@@ -0,0 +1,265 @@
+#include "base64.h"
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define BASE64_SSSE3
+#define BASE64_TARGET_SSSE3
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BASE64_SSSE3
+/*  Compiles the kernel for SSSE3 without requiring it of the whole program */
+#define BASE64_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+
+/*  The standard base64 alphabet */
+static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+size_t base64EncodedSize(size_t bytes)
+{
+    return (bytes + 2) / 3 * 4;
+}
+
+size_t base64EncodeScalar(const void *data, size_t bytes, char *out)
+{
+    const unsigned char *in = (const unsigned char *)data;
+    char *start = out;
+    size_t i = 0;
+    for (; i + 3 <= bytes; i += 3)
+    {
+        uint32_t triple = (uint32_t)in[i] << 16 | (uint32_t)in[i + 1] << 8 | in[i + 2];
+        *out++ = ALPHABET[triple >> 18];
+        *out++ = ALPHABET[(triple >> 12) & 63];
+        *out++ = ALPHABET[(triple >> 6) & 63];
+        *out++ = ALPHABET[triple & 63];
+    }
+    if (i < bytes)
+    {
+        uint32_t triple = (uint32_t)in[i] << 16;
+        if (i + 1 < bytes)
+        {
+            triple |= (uint32_t)in[i + 1] << 8;
+        }
+        *out++ = ALPHABET[triple >> 18];
+        *out++ = ALPHABET[(triple >> 12) & 63];
+        *out++ = i + 1 < bytes ? ALPHABET[(triple >> 6) & 63] : '=';
+        *out++ = '=';
+    }
+    return out - start;
+}
+
+#ifdef BASE64_SSSE3
+
+static bool hasSsse3()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+/*  Encodes whole blocks of 12 bytes while 16 can be loaded, returning the
+    number of bytes consumed, after W. Mula and D. Lemire, "Faster Base64
+    Encoding and Decoding Using AVX2 Instructions" */
+static BASE64_TARGET_SSSE3 size_t encodeBlocksSsse3(const unsigned char *in, size_t bytes, char *out)
+{
+    // each 32 bit lane gets bytes b1 b0 b2 b1 of its three input bytes
+    const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    // offsets from the index to its character, selected by the range of the index
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 'A', 0, 0);
+    size_t i = 0;
+    for (; i + 16 <= bytes; i += 12)
+    {
+        __m128i block = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i)), spread);
+        // move the four 6 bit fields of each lane into the low bits of its bytes
+        __m128i high = _mm_mulhi_epu16(_mm_and_si128(block, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        __m128i low = _mm_mullo_epi16(_mm_and_si128(block, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        __m128i indices = _mm_or_si128(high, low);
+        // 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+        __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+        __m128i chars = _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+        _mm_storeu_si128((__m128i *)(out + i / 3 * 4), chars);
+    }
+    return i;
+}
+
+#endif
+
+size_t base64Encode(const void *data, size_t bytes, char *out)
+{
+#ifdef BASE64_SSSE3
+    static const bool ssse3 = hasSsse3();
+    if (ssse3)
+    {
+        const unsigned char *in = (const unsigned char *)data;
+        size_t done = encodeBlocksSsse3(in, bytes, out);
+        return done / 3 * 4 + base64EncodeScalar(in + done, bytes - done, out + done / 3 * 4);
+    }
+#endif
+    return base64EncodeScalar(data, bytes, out);
+}
+
+std::string base64Encode(const void *data, size_t bytes)
+{
+    std::string text(base64EncodedSize(bytes), '\0');
+    base64Encode(data, bytes, text.data());
+    return text;
+}
+
+/*  The 6 bit value of a base64 character, -1 for characters outside the alphabet */
+static int decodeCharacter(char c)
+{
+    if (c >= 'A' && c <= 'Z')
+    {
+        return c - 'A';
+    }
+    if (c >= 'a' && c <= 'z')
+    {
+        return c - 'a' + 26;
+    }
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0' + 52;
+    }
+    if (c == '+')
+    {
+        return 62;
+    }
+    if (c == '/')
+    {
+        return 63;
+    }
+    return -1;
+}
+
+std::vector<unsigned char> base64Decode(std::string_view text)
+{
+    if (text.size() % 4 != 0)
+    {
+        throw std::invalid_argument("base64 length must be a multiple of 4");
+    }
+    size_t padding = 0;
+    while (padding < 2 && padding < text.size() && text[text.size() - 1 - padding] == '=')
+    {
+        padding++;
+    }
+    std::vector<unsigned char> bytes;
+    bytes.reserve(text.size() / 4 * 3);
+    for (size_t i = 0; i < text.size(); i += 4)
+    {
+        uint32_t quad = 0;
+        for (size_t j = 0; j < 4; j++)
+        {
+            int value = i + j >= text.size() - padding ? 0 : decodeCharacter(text[i + j]);
+            if (value < 0)
+            {
+                throw std::invalid_argument("Invalid base64 character");
+            }
+            quad = quad << 6 | (uint32_t)value;
+        }
+        bytes.push_back((unsigned char)(quad >> 16));
+        bytes.push_back((unsigned char)(quad >> 8));
+        bytes.push_back((unsigned char)quad);
+    }
+    bytes.resize(bytes.size() - padding);
+    return bytes;
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+// Tests the encodings of RFC 4648
+static void testKnownEncodings()
+{
+    const char *inputs[] = {"", "f", "fo", "foo", "foob", "fooba", "foobar"};
+    const char *expected[] = {"", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy"};
+    for (size_t i = 0; i < 7; i++)
+    {
+        ASSERT(base64Encode(inputs[i], std::strlen(inputs[i])) == expected[i]);
+        std::vector<unsigned char> decoded = base64Decode(expected[i]);
+        ASSERT(std::string(decoded.begin(), decoded.end()) == inputs[i]);
+    }
+    bool threw = false;
+    try
+    {
+        base64Decode("Zm9");
+    }
+    catch (const std::invalid_argument &)
+    {
+        threw = true;
+    }
+    ASSERT(threw);
+}
+
+// Tests that the vector encoder agrees with the scalar one for every length and alignment
+static void testMatchesScalar()
+{
+    std::vector<unsigned char> bytes(300);
+    for (size_t i = 0; i < bytes.size(); i++)
+    {
+        // every byte value, including those that map to '+' and '/'
+        bytes[i] = (unsigned char)(i * 151 + 7);
+    }
+    std::vector<char> fast(base64EncodedSize(bytes.size()));
+    std::vector<char> scalar(fast.size());
+    for (size_t start = 0; start < 4; start++)
+    {
+        for (size_t length = 0; start + length <= bytes.size(); length++)
+        {
+            size_t n = base64Encode(bytes.data() + start, length, fast.data());
+            ASSERT(n == base64EncodedSize(length));
+            ASSERT(base64EncodeScalar(bytes.data() + start, length, scalar.data()) == n);
+            ASSERT(std::memcmp(fast.data(), scalar.data(), n) == 0);
+        }
+    }
+    std::vector<unsigned char> decoded = base64Decode(base64Encode(bytes.data(), bytes.size()));
+    ASSERT(decoded == bytes);
+}
+
+void testBase64()
+{
+    TEST(testKnownEncodings);
+    TEST(testMatchesScalar);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+void benchmarkBase64()
+{
+    size_t bytes = 64 << 20;
+    std::vector<unsigned char> data(bytes);
+    for (size_t i = 0; i < bytes; i++)
+    {
+        data[i] = (unsigned char)(i * 2654435761u >> 13);
+    }
+    std::vector<char> out(base64EncodedSize(bytes));
+
+    auto timeEncoder = [&](const char *name, size_t (*encode)(const void *, size_t, char *))
+    {
+        auto start = std::chrono::steady_clock::now();
+        size_t n = encode(data.data(), bytes, out.data());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        doNotOptimize(out[n - 1]);
+        std::cout << "  " << name << ": " << bytes / seconds * 1e-9 << " GB/s in\n";
+    };
+    std::cout << "base64 " << (bytes >> 20) << " MB\n";
+    timeEncoder("scalar", base64EncodeScalar);
+    timeEncoder("simd", base64Encode);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "stdafx.h"
+#include <string>
+#include <string_view>
+
+/** Number of characters in the padded base64 encoding of bytes bytes */
+size_t base64EncodedSize(size_t bytes);
+
+/**
+ * Encodes bytes as standard base64 with '=' padding into out, which must
+ * hold base64EncodedSize(bytes) characters, and returns the number written.
+ * Twelve bytes at a time are spread into sixteen 6-bit indices and mapped
+ * to the alphabet with SSSE3 shuffles when the processor supports them,
+ * which is several times faster than the table lookup of the scalar loop.
+ */
+size_t base64Encode(const void *data, size_t bytes, char *out);
+std::string base64Encode(const void *data, size_t bytes);
+
+/** The portable one byte at a time encoder, for checking and benchmarking */
+size_t base64EncodeScalar(const void *data, size_t bytes, char *out);
+
+/** Decodes padded base64, throws if the length or a character is invalid */
+std::vector<unsigned char> base64Decode(std::string_view text);
+
+/**
+ *  Test function
+ */
+void testBase64();
+
+/**
+ *  Benchmark function
+ */
+void benchmarkBase64();
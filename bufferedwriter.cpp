@@ -0,0 +1,222 @@
+#include "bufferedwriter.h"
+#include "testing.h"
+#include <atomic>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+/*  Longest text to_chars can produce for a double or an integer */
+static const size_t MAX_NUMBER_LENGTH = 32;
+/*  Significant digits that always read back to the same double, higher
+    precisions only add digits of the binary expansion */
+static const int MAX_PRECISION = 17;
+/*  Writers that have finished on a thread leave their buffers for the next */
+static const size_t MAX_SPARE_BUFFERS = 4;
+static thread_local std::vector<std::vector<char>> spareBuffers;
+
+static int clampPrecision(int significantDigits)
+{
+    return std::min(std::max(significantDigits, 0), MAX_PRECISION);
+}
+
+/*  The precision used by newly created writers */
+static std::atomic<int> defaultPrecision{0};
+
+int outputPrecision()
+{
+    return defaultPrecision.load(std::memory_order_relaxed);
+}
+
+void setOutputPrecision(int significantDigits)
+{
+    defaultPrecision.store(clampPrecision(significantDigits), std::memory_order_relaxed);
+}
+
+BufferedWriter::BufferedWriter(std::ostream &out, int precision, size_t capacity)
+    : out(out), capacity(std::max<size_t>(capacity, MAX_NUMBER_LENGTH)), used(0), precision(clampPrecision(precision))
+{
+    // reusing a buffer saves allocating and clearing a megabyte for every small chart
+    if (!spareBuffers.empty())
+    {
+        buffer = std::move(spareBuffers.back());
+        spareBuffers.pop_back();
+    }
+    if (buffer.size() < this->capacity)
+    {
+        buffer.resize(this->capacity);
+    }
+}
+
+BufferedWriter::~BufferedWriter()
+{
+    flush();
+    if (spareBuffers.size() < MAX_SPARE_BUFFERS)
+    {
+        spareBuffers.push_back(std::move(buffer));
+    }
+}
+
+void BufferedWriter::flush()
+{
+    if (used > 0)
+    {
+        out.write(buffer.data(), used);
+        used = 0;
+    }
+}
+
+void BufferedWriter::reserve(size_t size)
+{
+    if (used + size > capacity)
+    {
+        flush();
+    }
+}
+
+void BufferedWriter::write(const char *data, size_t size)
+{
+    if (size > capacity)
+    {
+        // too big to be worth copying
+        flush();
+        out.write(data, size);
+        return;
+    }
+    reserve(size);
+    std::memcpy(buffer.data() + used, data, size);
+    used += size;
+}
+
+BufferedWriter &BufferedWriter::operator<<(double value)
+{
+    reserve(MAX_NUMBER_LENGTH);
+    char *first = buffer.data() + used;
+    char *last = first + MAX_NUMBER_LENGTH;
+    std::to_chars_result result = precision > 0
+                                      ? std::to_chars(first, last, value, std::chars_format::general, precision)
+                                      : std::to_chars(first, last, value);
+    if (result.ec != std::errc())
+    {
+        // cannot happen with the precision clamped, but never write what was not formatted
+        result = std::to_chars(first, last, value);
+    }
+    used = result.ptr - buffer.data();
+    return *this;
+}
+
+BufferedWriter &BufferedWriter::operator<<(long long value)
+{
+    reserve(MAX_NUMBER_LENGTH);
+    char *first = buffer.data() + used;
+    used = std::to_chars(first, first + MAX_NUMBER_LENGTH, value).ptr - buffer.data();
+    return *this;
+}
+
+BufferedWriter &BufferedWriter::operator<<(unsigned long long value)
+{
+    reserve(MAX_NUMBER_LENGTH);
+    char *first = buffer.data() + used;
+    used = std::to_chars(first, first + MAX_NUMBER_LENGTH, value).ptr - buffer.data();
+    return *this;
+}
+
+BufferedWriter &BufferedWriter::operator<<(char c)
+{
+    reserve(1);
+    buffer[used++] = c;
+    return *this;
+}
+
+BufferedWriter &BufferedWriter::operator<<(const char *text)
+{
+    write(text, std::strlen(text));
+    return *this;
+}
+
+BufferedWriter &BufferedWriter::operator<<(const std::string &text)
+{
+    write(text.data(), text.size());
+    return *this;
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+static void testShortestRoundTrip()
+{
+    double values[] = {0.0, 1.0, -2.5, 0.1, 1.0 / 3.0, 1e-300, 6.02214076e23, 123456789.123456789};
+    std::stringstream out;
+    {
+        BufferedWriter writer(out, 0);
+        for (double value : values)
+        {
+            writer << value << '\n';
+        }
+    }
+    std::string line;
+    for (double value : values)
+    {
+        std::getline(out, line);
+        ASSERT(std::strtod(line.c_str(), nullptr) == value);
+    }
+    std::stringstream simple;
+    {
+        BufferedWriter writer(simple, 0);
+        writer << 0.0 << ", " << 1.0 << ", " << 0.5 << ", " << 42 << ", " << std::string("text");
+    }
+    ASSERT(simple.str() == "0, 1, 0.5, 42, text");
+}
+
+static void testPrecision()
+{
+    std::stringstream out;
+    {
+        BufferedWriter writer(out, 3);
+        writer << 3.14159265 << ' ' << 1234567.0;
+    }
+    ASSERT(out.str() == "3.14 1.23e+06");
+}
+
+static void testSmallBufferFlushes()
+{
+    std::stringstream out;
+    std::stringstream expected;
+    {
+        BufferedWriter writer(out, 0, 64);
+        for (int i = 0; i < 1000; i++)
+        {
+            writer << i << ',';
+            expected << i << ',';
+        }
+        writer << std::string(200, 'x');
+        expected << std::string(200, 'x');
+    }
+    ASSERT(out.str() == expected.str());
+}
+
+// Tests that precisions beyond a round trip are clamped rather than overflowing the number
+static void testPrecisionClamped()
+{
+    setOutputPrecision(40);
+    ASSERT(outputPrecision() == MAX_PRECISION);
+    setOutputPrecision(0);
+    std::stringstream out;
+    {
+        BufferedWriter writer(out, 40);
+        writer << 0.1 << ' ' << -1.0 / 3.0e-300;
+    }
+    ASSERT(out.str() == "0.10000000000000001 -3.3333333333333331e+299");
+    ASSERT(out.str().find('\0') == std::string::npos);
+}
+
+void testBufferedWriter()
+{
+    TEST(testShortestRoundTrip);
+    TEST(testPrecision);
+    TEST(testPrecisionClamped);
+    TEST(testSmallBufferFlushes);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "stdafx.h"
+#include <ostream>
+#include <string>
+
+/**
+ *  Number of significant digits used when writing doubles to charts
+ *  and CSV files, 0 means the shortest form that reads back exactly
+ */
+int outputPrecision();
+
+/**
+ *  Sets the number of significant digits used when writing doubles,
+ *  0 for the shortest round-trip form.  Precisions above 17, which
+ *  already reads back exactly, are treated as 17.
+ */
+void setOutputPrecision(int significantDigits);
+
+/**
+ *  Formats text and numbers into a large buffer with std::to_chars and
+ *  writes it to the underlying stream in big chunks.  Doubles are written
+ *  in the shortest form that reads back to exactly the same value unless
+ *  a precision is given, and the output does not depend on the locale.
+ *  The buffer is flushed when it is full and on destruction, and is then
+ *  kept for the next writer on the same thread.
+ */
+class BufferedWriter
+{
+public:
+    explicit BufferedWriter(std::ostream &out,
+                            int precision = outputPrecision(),
+                            size_t capacity = 1 << 20);
+    ~BufferedWriter();
+
+    BufferedWriter(const BufferedWriter &) = delete;
+    BufferedWriter &operator=(const BufferedWriter &) = delete;
+
+    BufferedWriter &operator<<(double value);
+    BufferedWriter &operator<<(long long value);
+    BufferedWriter &operator<<(unsigned long long value);
+    BufferedWriter &operator<<(int value) { return *this << (long long)value; }
+    BufferedWriter &operator<<(unsigned long value) { return *this << (unsigned long long)value; }
+    BufferedWriter &operator<<(char c);
+    BufferedWriter &operator<<(const char *text);
+    BufferedWriter &operator<<(const std::string &text);
+
+    /** Appends raw bytes */
+    void write(const char *data, size_t size);
+
+    /** Writes the buffered output to the stream */
+    void flush();
+
+private:
+    /** Makes room for at least size more bytes */
+    void reserve(size_t size);
+
+    std::ostream &out;
+    std::vector<char> buffer;
+    /** Bytes of the buffer used before flushing, a reused buffer may be larger */
+    size_t capacity;
+    size_t used;
+    int precision;
+};
+
+/**
+ *  Test function
+ */
+void testBufferedWriter();
@@ -1,6 +1,18 @@
 #include "charts.h"
+#include "base64.h"
+#include "bufferedwriter.h"
+#include "columnfile.h"
 #include "matlib.h"
+#include "parallel.h"
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
+#include <limits>
+#include <mutex>
 #include <sstream>
 #include <vector>
 #include <string>
@@ -11,17 +23,46 @@
 void writeCSVChartData(std::ostream &out, const std::vector<double> &x, const std::vector<double> &y)
 {
     assert(x.size() == y.size());
+    BufferedWriter writer(out);
     for (size_t i = 0; i < x.size(); i++)
     {
-        out << x[i] << "," << y[i] << "\n";
+        writer << x[i] << ',' << y[i] << '\n';
+    }
+}
+
+/*  Opens a chart file for writing, throwing if it cannot be created */
+static std::ofstream openChartFile(const std::string &file)
+{
+    std::ofstream out(file);
+    if (!out)
+    {
+        throw std::runtime_error("Cannot write " + file);
+    }
+    return out;
+}
+
+/*  Closes a chart file, throwing if any write to it failed, e.g. on a full disk */
+static void closeChartFile(std::ofstream &out, const std::string &file)
+{
+    out.close();
+    if (!out)
+    {
+        throw std::runtime_error("Failed writing " + file);
     }
 }
 
 // Writes x and y values to a CSV file
 void writeCSVChart(const std::string &filename, const std::vector<double> &x, const std::vector<double> &y)
 {
-    std::ofstream out(filename);
+    std::ofstream out = openChartFile(filename);
     writeCSVChartData(out, x, y);
+    closeChartFile(out, filename);
+}
+
+// Writes x and y values to a binary column file
+void writeColumnChart(const std::string &filename, const std::vector<double> &x, const std::vector<double> &y, size_t blockRows)
+{
+    writeColumnFile(filename, {"x", "y"}, {x, y}, blockRows);
 }
 
 // Writes the top boilerplate for the HTML pie chart
@@ -69,26 +110,28 @@ static void writeFixedPieChartData(std::ostream &out)
 static void writeDataOfPieChart(std::ostream &out, const std::vector<std::string> &labels, const std::vector<double> &values)
 {
     assert(labels.size() == values.size());
-    out << "data.addRows([\n";
+    BufferedWriter writer(out);
+    writer << "data.addRows([\n";
     for (size_t i = 0; i < labels.size(); i++)
     {
-        out << "['" << labels[i] << "', " << values[i] << "]";
+        writer << "['" << labels[i] << "', " << values[i] << ']';
         if (i != labels.size() - 1)
         {
-            out << ",";
+            writer << ',';
         }
-        out << "\n";
+        writer << '\n';
     }
-    out << "]);\n";
+    writer << "]);\n";
 }
 
 // Generates a dynamic pie chart in an HTML file based on labels and values
 void pieChart(const std::string &file, const std::vector<std::string> &labels, const std::vector<double> &values)
 {
-    std::ofstream out(file);
+    std::ofstream out = openChartFile(file);
     writeTopBoilerPlateOfPieChart(out);
     writeDataOfPieChart(out, labels, values);
     writeBottomBoilerPlateOfPieChart(out);
+    closeChartFile(out, file);
 }
 
 // Writes the top boilerplate for the HTML line chart
@@ -134,33 +177,290 @@ static void writeBottomBoilerPlateOfLineChart(std::ostream &out)
     out << "</html>";
 }
 
+/*  The encoding used by plot and hist */
+static std::atomic<ChartEncoding> currentEncoding{ChartEncoding::Text};
+/*  Quantized values are rounded to one of this many steps above their minimum */
+static const double QUANTIZATION_STEPS = 65535.0;
+/*  Bytes encoded to base64 at a time, a multiple of 3 so the pieces join without padding */
+static const size_t BASE64_PIECE = 3 << 14;
+
+ChartEncoding chartEncoding()
+{
+    return currentEncoding.load(std::memory_order_relaxed);
+}
+
+void setChartEncoding(ChartEncoding encoding)
+{
+    currentEncoding.store(encoding, std::memory_order_relaxed);
+}
+
+// Writes bytes as base64 a piece at a time
+static void writeBase64(BufferedWriter &writer, const void *data, size_t bytes)
+{
+    const unsigned char *in = (const unsigned char *)data;
+    std::vector<char> encoded(base64EncodedSize(BASE64_PIECE));
+    for (size_t offset = 0; offset < bytes; offset += BASE64_PIECE)
+    {
+        size_t n = base64Encode(in + offset, std::min(BASE64_PIECE, bytes - offset), encoded.data());
+        writer.write(encoded.data(), n);
+    }
+}
+
+// Writes the values as base64 of their little endian bytes, as typed arrays read them
+template <typename T>
+static void writeLittleEndian(BufferedWriter &writer, std::span<const T> values)
+{
+    if constexpr (std::endian::native == std::endian::little)
+    {
+        writeBase64(writer, values.data(), values.size_bytes());
+    }
+    else
+    {
+        std::vector<unsigned char> bytes(values.size_bytes());
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            const unsigned char *value = (const unsigned char *)&values[i];
+            std::reverse_copy(value, value + sizeof(T), bytes.data() + i * sizeof(T));
+        }
+        writeBase64(writer, bytes.data(), bytes.size());
+    }
+}
+
+// Rounds the values to levels offset + k scale and returns the differences of
+// consecutive levels, zigzag mapped to unsigned and written 7 bits a byte
+static std::vector<unsigned char> deltaQuantize(std::span<const double> values, double &offset, double &scale)
+{
+    offset = 0.0;
+    scale = 1.0;
+    if (values.empty())
+    {
+        return {};
+    }
+    auto [lowest, highest] = std::minmax_element(values.begin(), values.end());
+    offset = *lowest;
+    scale = *highest > *lowest ? (*highest - *lowest) / QUANTIZATION_STEPS : 1.0;
+    std::vector<unsigned char> bytes;
+    bytes.reserve(values.size() * 2);
+    int64_t previous = 0;
+    for (double value : values)
+    {
+        if (!std::isfinite(value))
+        {
+            throw std::invalid_argument("Quantized chart values must be finite");
+        }
+        int64_t level = std::llround((value - offset) / scale);
+        int64_t delta = level - previous;
+        previous = level;
+        uint64_t zigzag = (uint64_t)delta << 1 ^ (uint64_t)(delta >> 63);
+        while (zigzag >= 128)
+        {
+            bytes.push_back((unsigned char)(zigzag | 128));
+            zigzag >>= 7;
+        }
+        bytes.push_back((unsigned char)zigzag);
+    }
+    return bytes;
+}
+
+// Writes the JavaScript that turns an encoded series back into an array
+static void writeSeriesDecoder(BufferedWriter &writer)
+{
+    writer << "    function decodeSeries(encoding, text, offset, scale, n) {\n";
+    writer << "      var binary = atob(text);\n";
+    writer << "      var bytes = new Uint8Array(binary.length);\n";
+    writer << "      for (var i = 0; i < binary.length; i++) bytes[i] = binary.charCodeAt(i);\n";
+    writer << "      if (encoding == 'f64') return new Float64Array(bytes.buffer);\n";
+    writer << "      if (encoding == 'f32') return new Float32Array(bytes.buffer);\n";
+    writer << "      var values = new Float64Array(n);\n";
+    writer << "      var level = 0, position = 0;\n";
+    writer << "      for (var i = 0; i < n; i++) {\n";
+    writer << "        var zigzag = 0, weight = 1, b;\n";
+    writer << "        do { b = bytes[position++]; zigzag += (b & 127) * weight; weight *= 128; } while (b & 128);\n";
+    writer << "        level += zigzag % 2 ? -(zigzag + 1) / 2 : zigzag / 2;\n";
+    writer << "        values[i] = offset + level * scale;\n";
+    writer << "      }\n";
+    writer << "      return values;\n";
+    writer << "    }\n";
+}
+
+// Writes a variable holding the decoded values of a series
+static void writeEncodedSeries(BufferedWriter &writer, const char *name, std::span<const double> values, ChartEncoding encoding)
+{
+    writer << "    var " << name << " = decodeSeries(";
+    if (encoding == ChartEncoding::Float64)
+    {
+        writer << "'f64', '";
+        writeLittleEndian(writer, values);
+        writer << "', 0, 1, ";
+    }
+    else if (encoding == ChartEncoding::Float32)
+    {
+        std::vector<float> floats(values.begin(), values.end());
+        writer << "'f32', '";
+        writeLittleEndian(writer, std::span<const float>(floats));
+        writer << "', 0, 1, ";
+    }
+    else
+    {
+        double offset;
+        double scale;
+        std::vector<unsigned char> deltas = deltaQuantize(values, offset, scale);
+        writer << "'delta', '";
+        writeBase64(writer, deltas.data(), deltas.size());
+        // offset and scale in full, as every value depends on them
+        writer << "', " << offset << ", " << scale << ", ";
+    }
+    writer << (unsigned long long)values.size() << ");\n";
+}
+
+// Writes line chart data as encoded series and the code to add them as rows
+static void writeEncodedDataOfLineChart(std::ostream &out, std::span<const double> xValues, std::span<const double> yValues,
+                                        ChartEncoding encoding)
+{
+    BufferedWriter writer(out, 0);
+    writeSeriesDecoder(writer);
+    writeEncodedSeries(writer, "x", xValues, encoding);
+    writeEncodedSeries(writer, "y", yValues, encoding);
+    writer << "    var rows = new Array(x.length);\n";
+    writer << "    for (var i = 0; i < x.length; i++) rows[i] = [x[i], y[i]];\n";
+    writer << "    data.addRows(rows);\n";
+}
+
 // Writes dynamic line chart data based on provided labels and values
-static void writeDataOfLineChart(std::ostream &out, const std::vector<double> &xValues, const std::vector<double> &yValues)
+static void writeDataOfLineChart(std::ostream &out, std::span<const double> xValues, std::span<const double> yValues,
+                                 ChartEncoding encoding = chartEncoding())
 {
     assert(xValues.size() == yValues.size());
-    out << "    data.addRows([\n";
+    if (encoding != ChartEncoding::Text)
+    {
+        writeEncodedDataOfLineChart(out, xValues, yValues, encoding);
+        return;
+    }
+    BufferedWriter writer(out);
+    writer << "    data.addRows([\n";
     for (size_t i = 0; i < xValues.size(); i++)
     {
-        out << "      [" << xValues[i] << ", " << yValues[i] << "]"; // Corrected: No quotes around xValues[i]
+        writer << "      [" << xValues[i] << ", " << yValues[i] << ']'; // Corrected: No quotes around xValues[i]
         if (i != xValues.size() - 1)
         {
-            out << ",\n";
+            writer << ",\n";
         }
         else
         {
-            out << "\n";
+            writer << '\n';
         }
     }
-    out << "    ]);\n";
+    writer << "    ]);\n";
 }
 
 // Generates a dynamic line chart in an HTML file based on labels and values
 void plot(const std::string &file, const std::vector<double> &xValues, const std::vector<double> &yValues)
 {
-    std::ofstream out(file);
+    plot(file, std::span<const double>(xValues), std::span<const double>(yValues));
+}
+
+// Generates a line chart in an HTML file from columns held elsewhere, e.g. in a ColumnFile
+void plot(const std::string &file, std::span<const double> xValues, std::span<const double> yValues)
+{
+    std::ofstream out = openChartFile(file);
     writeTopBoilerPlateOfLineChart(out);
     writeDataOfLineChart(out, xValues, yValues);
     writeBottomBoilerPlateOfLineChart(out);
+    closeChartFile(out, file);
+}
+
+LineChartWriter::LineChartWriter(const std::string &file, size_t bufferBytes)
+    : out(file), writer(out, outputPrecision(), bufferBytes), nRows(0), closed(false)
+{
+    if (!out)
+    {
+        throw std::runtime_error("Cannot write " + file);
+    }
+    writeTopBoilerPlateOfLineChart(out);
+    writer << "    data.addRows([\n";
+}
+
+LineChartWriter::~LineChartWriter()
+{
+    try
+    {
+        close();
+    }
+    catch (...)
+    {
+        // destructors must not throw, call close to see errors
+    }
+}
+
+void LineChartWriter::append(double x, double y)
+{
+    if (closed)
+    {
+        throw std::invalid_argument("Cannot append to a closed chart");
+    }
+    // the separator goes before each row as the last row is not known in advance
+    if (nRows > 0)
+    {
+        writer << ",\n";
+    }
+    writer << "      [" << x << ", " << y << ']';
+    nRows++;
+}
+
+void LineChartWriter::append(std::span<const double> xValues, std::span<const double> yValues)
+{
+    if (xValues.size() != yValues.size())
+    {
+        throw std::invalid_argument("x and y must have the same size");
+    }
+    for (size_t i = 0; i < xValues.size(); i++)
+    {
+        append(xValues[i], yValues[i]);
+    }
+}
+
+void LineChartWriter::close()
+{
+    if (closed)
+    {
+        return;
+    }
+    closed = true;
+    if (nRows > 0)
+    {
+        writer << '\n';
+    }
+    writer << "    ]);\n";
+    writer.flush();
+    writeBottomBoilerPlateOfLineChart(out);
+    out.close();
+    if (!out)
+    {
+        throw std::runtime_error("Failed writing a line chart");
+    }
+}
+
+// Generates a line chart of a decimated series in an HTML file
+void plot(const std::string &file, const std::vector<double> &xValues, const std::vector<double> &yValues,
+          Decimation decimation, size_t maxPoints)
+{
+    switch (decimation)
+    {
+    case Decimation::LargestTriangleThreeBuckets:
+    {
+        Series reduced = largestTriangleThreeBuckets(xValues, yValues, maxPoints);
+        plot(file, reduced.x, reduced.y);
+        break;
+    }
+    case Decimation::MinMax:
+    {
+        Series reduced = minMaxDecimate(xValues, yValues, maxPoints);
+        plot(file, reduced.x, reduced.y);
+        break;
+    }
+    default:
+        plot(file, xValues, yValues);
+    }
 }
 
 // Writes the top boilerplate for the HTML line chart
@@ -230,37 +530,299 @@ static void writeBottomBoilerPlateOfHistogram(std::ostream &out)
     out << "</html>\n";
 }
 
+// Writes histogram data as text labels and an encoded series of values
+static void writeEncodedDataOfHistogram(std::ostream &out, const std::vector<std::string> &labels, const std::vector<double> &xValues,
+                                        ChartEncoding encoding)
+{
+    BufferedWriter writer(out, 0);
+    writeSeriesDecoder(writer);
+    writer << "    var labels = [";
+    for (size_t i = 0; i < labels.size(); i++)
+    {
+        writer << (i == 0 ? "'" : ", '") << labels[i] << '\'';
+    }
+    writer << "];\n";
+    writeEncodedSeries(writer, "values", xValues, encoding);
+    writer << "    var rows = [['Label', 'Value']];\n";
+    writer << "    for (var i = 0; i < values.length; i++) rows.push([labels[i], values[i]]);\n";
+    writer << "    var data = google.visualization.arrayToDataTable(rows);\n";
+}
+
 // Writes the data for the histogram (correctly using addRows)
-static void writeDataOfHistogram(std::ostream &out, const std::vector<std::string> &labels, const std::vector<double> &xValues)
+static void writeDataOfHistogram(std::ostream &out, const std::vector<std::string> &labels, const std::vector<double> &xValues,
+                                 ChartEncoding encoding = chartEncoding())
 {
     assert(labels.size() == xValues.size());
+    if (encoding != ChartEncoding::Text)
+    {
+        writeEncodedDataOfHistogram(out, labels, xValues, encoding);
+        return;
+    }
 
-    out << "        var data = google.visualization.arrayToDataTable([\n"; // Start the array
+    BufferedWriter writer(out);
+    writer << "        var data = google.visualization.arrayToDataTable([\n"; // Start the array
 
-    out << "['Label', 'Value'],\n"; // Header row (important!)
+    writer << "['Label', 'Value'],\n"; // Header row (important!)
 
     for (size_t i = 0; i < xValues.size(); i++)
     {
-        out << "        ['" << labels[i] << "', " << xValues[i] << "]";
+        writer << "        ['" << labels[i] << "', " << xValues[i] << ']';
         if (i != xValues.size() - 1)
         {
-            out << ",\n";
+            writer << ",\n";
         }
         else
         {
-            out << "\n";
+            writer << '\n';
         }
     }
-    out << "        ]);\n"; // Close the array for arrayToDataTable
+    writer << "        ]);\n"; // Close the array for arrayToDataTable
 }
 
 // Generates a dynamic line chart in an HTML file based on labels and values
 void hist(const std::string &file, const std::vector<std::string> &labels, const std::vector<double> &xValues)
 {
-    std::ofstream out(file);
+    std::ofstream out = openChartFile(file);
     writeTopBoilerPlateOfLineChart(out);
     writeDataOfHistogram(out, labels, xValues);
     writeBottomBoilerPlateOfHistogram(out);
+    closeChartFile(out, file);
+}
+
+/*  Values counted per thread by the binning kernels */
+static const size_t BINNING_CHUNK = 1 << 16;
+/*  Values whose bin index is computed before the counts are updated */
+static const size_t BINNING_BATCH = 256;
+/*  Freedman-Diaconis estimates the quartiles from at most this many values */
+static const size_t QUARTILE_SAMPLE = 1 << 20;
+/*  Upper limit on the number of bins the Freedman-Diaconis rule may choose */
+static const size_t MAX_AUTOMATIC_BINS = 10000;
+
+/*  Merges per thread counts, computed by countChunk(begin, end, counts), into one vector */
+template <typename CountChunk>
+static std::vector<size_t> countInParallel(size_t nValues, size_t nBins, CountChunk countChunk)
+{
+    std::vector<size_t> counts(nBins, 0);
+    std::mutex countsMutex;
+    parallelFor(nValues, [&](size_t begin, size_t end)
+    {
+        std::vector<size_t> local(nBins, 0);
+        countChunk(begin, end, local);
+        std::lock_guard<std::mutex> lock(countsMutex);
+        for (size_t bin = 0; bin < nBins; bin++)
+        {
+            counts[bin] += local[bin];
+        }
+    }, BINNING_CHUNK);
+    return counts;
+}
+
+/*  The least and greatest finite values and how many values are finite */
+struct FiniteRange
+{
+    double lo = std::numeric_limits<double>::infinity();
+    double hi = -std::numeric_limits<double>::infinity();
+    size_t count = 0;
+};
+
+static FiniteRange finiteRange(std::span<const double> values)
+{
+    FiniteRange range;
+    for (double x : values)
+    {
+        if (std::isfinite(x))
+        {
+            range.lo = std::min(range.lo, x);
+            range.hi = std::max(range.hi, x);
+            range.count++;
+        }
+    }
+    return range;
+}
+
+HistogramBins binValues(std::span<const double> values, int nBins)
+{
+    if (nBins < 1)
+    {
+        throw std::invalid_argument("Cannot bin into less than one bin");
+    }
+    FiniteRange range = finiteRange(values);
+    if (range.count == 0)
+    {
+        throw std::invalid_argument("Cannot bin a vector without finite values");
+    }
+    double lo = range.lo;
+    double hi = range.hi;
+    double width = hi > lo ? (hi - lo) / nBins : 1.0;
+    HistogramBins bins;
+    for (int i = 0; i <= nBins; i++)
+    {
+        bins.edges.push_back(lo + i * width);
+    }
+    double scale = 1.0 / width;
+    uint32_t lastBin = (uint32_t)nBins - 1;
+    // non-finite values are counted in an extra bin past the last, which is dropped
+    uint32_t skippedBin = (uint32_t)nBins;
+    bins.counts = countInParallel(values.size(), nBins + 1, [&](size_t begin, size_t end, std::vector<size_t> &counts)
+    {
+        // the index computation has no branches so it vectorizes, the scatter is done separately
+        uint32_t index[BINNING_BATCH];
+        for (size_t first = begin; first < end; first += BINNING_BATCH)
+        {
+            size_t count = std::min(BINNING_BATCH, end - first);
+            const double *x = values.data() + first;
+            for (size_t i = 0; i < count; i++)
+            {
+                // false for NaN and infinities, so they never reach the conversion
+                bool inRange = x[i] >= lo && x[i] <= hi;
+                double position = inRange ? (x[i] - lo) * scale : 0.0;
+                uint32_t bin = (uint32_t)std::min(position, (double)lastBin);
+                index[i] = inRange ? bin : skippedBin;
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                counts[index[i]]++;
+            }
+        }
+    });
+    bins.counts.pop_back();
+    return bins;
+}
+
+HistogramBins binValues(std::span<const double> values, const std::vector<double> &edges)
+{
+    if (edges.size() < 2 || !std::is_sorted(edges.begin(), edges.end()))
+    {
+        throw std::invalid_argument("Bin edges must be at least two increasing values");
+    }
+    size_t nBins = edges.size() - 1;
+    HistogramBins bins;
+    bins.edges = edges;
+    bins.counts = countInParallel(values.size(), nBins, [&](size_t begin, size_t end, std::vector<size_t> &counts)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            double x = values[i];
+            if (!(x >= edges.front() && x <= edges.back()))
+            {
+                continue;
+            }
+            size_t bin = std::upper_bound(edges.begin(), edges.end(), x) - edges.begin() - 1;
+            counts[std::min(bin, nBins - 1)]++;
+        }
+    });
+    return bins;
+}
+
+HistogramBins binValuesFreedmanDiaconis(std::span<const double> values)
+{
+    FiniteRange range = finiteRange(values);
+    if (range.count == 0)
+    {
+        throw std::invalid_argument("Cannot bin a vector without finite values");
+    }
+    // the quartiles of an evenly strided sample are plenty for choosing a bin width
+    size_t stride = std::max<size_t>(1, values.size() / QUARTILE_SAMPLE);
+    std::vector<double> sample;
+    for (size_t i = 0; i < values.size(); i += stride)
+    {
+        if (std::isfinite(values[i]))
+        {
+            sample.push_back(values[i]);
+        }
+    }
+    if (sample.empty())
+    {
+        sample.push_back(range.lo);
+    }
+    std::nth_element(sample.begin(), sample.begin() + sample.size() / 4, sample.end());
+    double lowerQuartile = sample[sample.size() / 4];
+    std::nth_element(sample.begin(), sample.begin() + 3 * sample.size() / 4, sample.end());
+    double upperQuartile = sample[3 * sample.size() / 4];
+
+    double width = 2 * (upperQuartile - lowerQuartile) / std::cbrt((double)range.count);
+    double span = range.hi - range.lo;
+    size_t nBins = width > 0 ? (size_t)std::ceil(span / width) : (size_t)std::ceil(std::sqrt((double)range.count));
+    nBins = std::min(std::max<size_t>(nBins, 1), MAX_AUTOMATIC_BINS);
+    return binValues(values, (int)nBins);
+}
+
+// Writes the top boilerplate for the HTML column chart
+static void writeTopBoilerPlateOfColumnChart(std::ostream &out)
+{
+    out << "<!DOCTYPE html>\n";
+    out << "<html>\n";
+    out << "<head>\n";
+    out << "<title>Histogram</title>\n";
+    out << "<script type='text/javascript' src='https://www.gstatic.com/charts/loader.js'></script>\n";
+    out << "<script type='text/javascript'>\n";
+    out << "  google.charts.load('current', {'packages':['corechart']});\n";
+    out << "  google.charts.setOnLoadCallback(drawChart);\n";
+    out << "  function drawChart() {\n";
+    out << "    var data = new google.visualization.DataTable();\n";
+    out << "    data.addColumn('string', 'Bin');\n";
+    out << "    data.addColumn('number', 'Count');\n";
+}
+
+// Writes the bottom boilerplate for the HTML column chart
+static void writeBottomBoilerPlateOfColumnChart(std::ostream &out)
+{
+    out << "    var options = { 'title' : 'Histogram', 'legend' : {position : 'none'}, 'bar' : {groupWidth : '100%'}, 'width' : 900, 'height' : 500 };\n";
+    out << "    var chart = new google.visualization.ColumnChart(document.getElementById('chart_div'));\n";
+    out << "    chart.draw(data, options);\n";
+    out << "  }\n";
+    out << "</script>\n";
+    out << "</head>\n";
+    out << "<body>\n";
+    out << "  <div id='chart_div' style='width: 900px; height: 500px;'></div>\n";
+    out << "</body>\n";
+    out << "</html>";
+}
+
+// Writes one row per bin, labelled by its range
+static void writeDataOfBinnedHistogram(std::ostream &out, const HistogramBins &bins)
+{
+    assert(bins.edges.size() == bins.counts.size() + 1);
+    BufferedWriter writer(out);
+    writer << "    data.addRows([\n";
+    for (size_t i = 0; i < bins.counts.size(); i++)
+    {
+        writer << "      ['" << bins.edges[i] << " to " << bins.edges[i + 1] << "', " << bins.counts[i] << ']';
+        if (i != bins.counts.size() - 1)
+        {
+            writer << ",\n";
+        }
+        else
+        {
+            writer << '\n';
+        }
+    }
+    writer << "    ]);\n";
+}
+
+// Generates a column chart of binned data in an HTML file
+void hist(const std::string &file, const HistogramBins &bins)
+{
+    std::ofstream out = openChartFile(file);
+    writeTopBoilerPlateOfColumnChart(out);
+    writeDataOfBinnedHistogram(out, bins);
+    writeBottomBoilerPlateOfColumnChart(out);
+    closeChartFile(out, file);
+}
+
+void hist(const std::string &file, std::span<const double> values)
+{
+    hist(file, binValuesFreedmanDiaconis(values));
+}
+
+void hist(const std::string &file, std::span<const double> values, int nBins)
+{
+    hist(file, binValues(values, nBins));
+}
+
+void hist(const std::string &file, std::span<const double> values, const std::vector<double> &edges)
+{
+    hist(file, binValues(values, edges));
 }
 
 ///////////////////////////////////////////////
@@ -336,10 +898,259 @@ static void testFixedHistogramData()
     writeBottomBoilerPlateOfHistogram(out);
 }
 
+// Tests the equal width, user edge and Freedman-Diaconis binning
+static void testBinValues()
+{
+    std::vector<double> values = {0.0, 0.5, 1.0, 1.5, 2.0, 2.5, 3.0, 3.5, 4.0};
+    HistogramBins bins = binValues(values, 4);
+    ASSERT(bins.edges.size() == 5);
+    ASSERT(bins.counts == std::vector<size_t>({2, 2, 2, 3}));
+
+    HistogramBins edged = binValues(values, std::vector<double>{1.0, 2.0, 10.0});
+    ASSERT(edged.counts == std::vector<size_t>({2, 5}));
+
+    // enough values to be split across threads
+    std::vector<double> normals = randn(200000);
+    HistogramBins automatic = binValuesFreedmanDiaconis(normals);
+    size_t total = 0;
+    for (size_t count : automatic.counts)
+    {
+        total += count;
+    }
+    ASSERT(total == normals.size());
+    ASSERT(automatic.counts.size() > 50 && automatic.counts.size() < 500);
+}
+
+static void testBinValuesSkipsNonFinite()
+{
+    double inf = std::numeric_limits<double>::infinity();
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    std::vector<double> values = {nan, 0.0, inf, 1.0, -inf, 2.0, 3.0, nan, 4.0};
+    HistogramBins bins = binValues(values, 4);
+    ASSERT(bins.edges.front() == 0.0 && bins.edges.back() == 4.0);
+    ASSERT(bins.counts == std::vector<size_t>({1, 1, 1, 2}));
+
+    HistogramBins automatic = binValuesFreedmanDiaconis(values);
+    size_t total = 0;
+    for (size_t count : automatic.counts)
+    {
+        total += count;
+    }
+    ASSERT(total == 5);
+
+    bool thrown = false;
+    try
+    {
+        binValues(std::vector<double>{nan, inf}, 4);
+    }
+    catch (const std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    ASSERT(thrown);
+}
+
+// Tests the binned histogram data writing function
+static void testBinnedHistogramData()
+{
+    std::stringstream out;
+    HistogramBins bins{{0.0, 0.5, 1.0}, {3, 7}};
+    writeDataOfBinnedHistogram(out, bins);
+    std::stringstream expected;
+    expected << "    data.addRows([\n";
+    expected << "      ['0 to 0.5', 3],\n";
+    expected << "      ['0.5 to 1', 7]\n";
+    expected << "    ]);\n";
+    ASSERT(out.str() == expected.str());
+}
+
+// Tests that CSV data reads back to exactly the values written
+static void testCSVRoundTrip()
+{
+    std::vector<double> x = randn(1000);
+    std::vector<double> y = randuniform(1000);
+    std::stringstream out;
+    writeCSVChartData(out, x, y);
+    std::string line;
+    for (size_t i = 0; i < x.size(); i++)
+    {
+        std::getline(out, line);
+        char *end = nullptr;
+        ASSERT(std::strtod(line.c_str(), &end) == x[i]);
+        ASSERT(*end == ',');
+        ASSERT(std::strtod(end + 1, nullptr) == y[i]);
+    }
+
+    std::stringstream rounded;
+    setOutputPrecision(3);
+    writeCSVChartData(rounded, {3.14159}, {2.71828});
+    setOutputPrecision(0);
+    ASSERT(rounded.str() == "3.14,2.72\n");
+}
+
+static std::string readWholeFile(const std::string &file)
+{
+    std::ifstream in(file, std::ios::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+// Tests that streaming a chart in pieces writes the same file as plot
+static void testLineChartWriter()
+{
+    std::vector<double> x = randn(5000);
+    std::vector<double> y = randuniform(5000);
+    plot("BatchChart.html", x, y);
+    {
+        // a tiny buffer so the rows are flushed many times
+        LineChartWriter chart("StreamedChart.html", 64);
+        chart.append(x[0], y[0]);
+        chart.append(std::span<const double>(x).subspan(1, 2999), std::span<const double>(y).subspan(1, 2999));
+        for (size_t i = 3000; i < x.size(); i++)
+        {
+            chart.append(x[i], y[i]);
+        }
+        ASSERT(chart.rows() == 5000);
+    }
+    ASSERT(readWholeFile("StreamedChart.html") == readWholeFile("BatchChart.html"));
+
+    plot("BatchChart.html", std::vector<double>(), std::vector<double>());
+    LineChartWriter empty("StreamedChart.html");
+    empty.close();
+    ASSERT(readWholeFile("StreamedChart.html") == readWholeFile("BatchChart.html"));
+    std::remove("BatchChart.html");
+    std::remove("StreamedChart.html");
+}
+
+// Decodes the series written as "var name = decodeSeries(...)" as the JavaScript decoder does
+static std::vector<double> decodeSeriesOf(const std::string &html, const std::string &name)
+{
+    size_t start = html.find("var " + name + " = decodeSeries('");
+    if (start == std::string::npos)
+    {
+        return {};
+    }
+    start = html.find('\'', start) + 1;
+    size_t end = html.find('\'', start);
+    std::string encoding = html.substr(start, end - start);
+    start = html.find('\'', end + 1) + 1;
+    end = html.find('\'', start);
+    std::vector<unsigned char> bytes = base64Decode(std::string_view(html).substr(start, end - start));
+    char *next = nullptr;
+    double offset = std::strtod(html.c_str() + end + 2, &next);
+    double scale = std::strtod(next + 1, &next);
+    size_t n = std::strtoull(next + 1, nullptr, 10);
+
+    std::vector<double> values(n);
+    if (encoding == "f64")
+    {
+        ASSERT(bytes.size() == n * sizeof(double));
+        std::memcpy(values.data(), bytes.data(), std::min(bytes.size(), n * sizeof(double)));
+    }
+    else if (encoding == "f32")
+    {
+        ASSERT(bytes.size() == n * sizeof(float));
+        std::vector<float> floats(n);
+        std::memcpy(floats.data(), bytes.data(), std::min(bytes.size(), n * sizeof(float)));
+        values.assign(floats.begin(), floats.end());
+    }
+    else
+    {
+        int64_t level = 0;
+        size_t position = 0;
+        for (size_t i = 0; i < n && position < bytes.size(); i++)
+        {
+            uint64_t zigzag = 0;
+            int shift = 0;
+            unsigned char b;
+            do
+            {
+                b = bytes[position++];
+                zigzag |= (uint64_t)(b & 127) << shift;
+                shift += 7;
+            } while ((b & 128) && position < bytes.size());
+            level += (zigzag & 1) ? -(int64_t)(zigzag >> 1) - 1 : (int64_t)(zigzag >> 1);
+            values[i] = offset + level * scale;
+        }
+    }
+    return values;
+}
+
+// Tests that each encoding of a chart decodes to the values within its error
+static void testEncodedChartData()
+{
+    std::vector<double> x(1001);
+    for (size_t i = 0; i < x.size(); i++)
+    {
+        x[i] = i * 0.01;
+    }
+    std::vector<double> y = randn(x.size());
+    auto [lowest, highest] = std::minmax_element(y.begin(), y.end());
+    double halfStep = (*highest - *lowest) / 131070.0 * (1 + 1e-9);
+
+    ChartEncoding encodings[] = {ChartEncoding::Float64, ChartEncoding::Float32, ChartEncoding::DeltaQuantized};
+    for (ChartEncoding encoding : encodings)
+    {
+        std::stringstream out;
+        writeDataOfLineChart(out, x, y, encoding);
+        std::string html = out.str();
+        ASSERT(html.find("data.addRows(rows);") != std::string::npos);
+        std::vector<double> decodedX = decodeSeriesOf(html, "x");
+        std::vector<double> decodedY = decodeSeriesOf(html, "y");
+        ASSERT(decodedX.size() == x.size() && decodedY.size() == y.size());
+        for (size_t i = 0; i < decodedY.size(); i++)
+        {
+            if (encoding == ChartEncoding::Float64)
+            {
+                ASSERT(decodedX[i] == x[i] && decodedY[i] == y[i]);
+            }
+            else if (encoding == ChartEncoding::Float32)
+            {
+                ASSERT(decodedX[i] == (float)x[i] && decodedY[i] == (float)y[i]);
+            }
+            else
+            {
+                ASSERT(std::abs(decodedX[i] - x[i]) <= 10.0 / 131070.0 * (1 + 1e-9));
+                ASSERT(std::abs(decodedY[i] - y[i]) <= halfStep);
+            }
+        }
+    }
+
+    std::stringstream histogram;
+    writeDataOfHistogram(histogram, {"a", "b"}, {1.5, -2.0}, ChartEncoding::Float64);
+    ASSERT(histogram.str().find("var labels = ['a', 'b'];") != std::string::npos);
+    ASSERT(decodeSeriesOf(histogram.str(), "values") == std::vector<double>({1.5, -2.0}));
+
+    std::stringstream constant;
+    writeDataOfHistogram(constant, {"a", "b", "c"}, {3.0, 3.0, 3.0}, ChartEncoding::DeltaQuantized);
+    ASSERT(decodeSeriesOf(constant.str(), "values") == std::vector<double>({3.0, 3.0, 3.0}));
+
+    bool threw = false;
+    try
+    {
+        std::stringstream infinite;
+        writeDataOfHistogram(infinite, {"a", "b"}, {1.0, INFINITY}, ChartEncoding::DeltaQuantized);
+    }
+    catch (const std::invalid_argument &)
+    {
+        threw = true;
+    }
+    ASSERT(threw);
+
+    // plot follows the global setting
+    setChartEncoding(ChartEncoding::Float32);
+    plot("EncodedChart.html", x, y);
+    setChartEncoding(ChartEncoding::Text);
+    ASSERT(decodeSeriesOf(readWholeFile("EncodedChart.html"), "y").size() == y.size());
+    std::remove("EncodedChart.html");
+}
+
 // Test function to verify all functionalities
 void testCharts()
 {
     // Test CSV chart data
+    testCSVRoundTrip();
     std::vector<double> x = {1, 2, 3, 4};
     std::vector<double> y = {10, 20, 30, 40};
     writeCSVChart("chart.csv", x, y);
@@ -373,4 +1184,292 @@ void testCharts()
         std::cout << histogramLabels[i] << ": " << histogramValues[i] << std::endl;
     }
     hist("DynamicHistogram.html", histogramLabels, histogramValues);
+
+    // Test binned histogram
+    testBinValues();
+    testBinValuesSkipsNonFinite();
+    testBinnedHistogramData();
+    hist("BinnedHistogram.html", randuniform(10000));
+
+    // Test decimated line chart
+    std::vector<double> longX;
+    std::vector<double> longY;
+    for (int i = 0; i < 100000; i++)
+    {
+        longX.push_back(i);
+        longY.push_back(std::sin(i * 1e-3));
+    }
+    plot("DecimatedChart.html", longX, longY, Decimation::LargestTriangleThreeBuckets, 1000);
+
+    // Test streamed line chart
+    testLineChartWriter();
+
+    // Test binary encoded charts
+    testEncodedChartData();
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+// Stream buffer that discards its output, counting the bytes written
+class CountingBuffer : public std::streambuf
+{
+public:
+    size_t bytes = 0;
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        bytes++;
+        return c;
+    }
+    std::streamsize xsputn(const char *, std::streamsize n) override
+    {
+        bytes += n;
+        return n;
+    }
+};
+
+// Normally distributed benchmark data without the memory of a uniform vector
+static std::vector<double> benchmarkSamples(size_t n)
+{
+    std::vector<double> values(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        // a low discrepancy sequence pushed through norminv
+        double u = std::fmod(0.5 + i * 0.6180339887498949, 1.0);
+        values[i] = norminv(std::min(std::max(u, 1e-12), 1 - 1e-12));
+    }
+    return values;
+}
+
+static void benchmarkHistogramBinning()
+{
+    // bytes per raw row measured at 1M values and extrapolated to larger sizes
+    double rawBytesPerValue = 0.0;
+    size_t sizes[] = {1000000, 10000000, 100000000};
+    for (size_t n : sizes)
+    {
+        std::vector<double> values = benchmarkSamples(n);
+        if (rawBytesPerValue == 0.0)
+        {
+            std::vector<std::string> labels(n, "x");
+            CountingBuffer raw;
+            std::ostream rawOut(&raw);
+            writeDataOfHistogram(rawOut, labels, values);
+            rawBytesPerValue = (double)raw.bytes / n;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        HistogramBins fixed = binValues(values, 100);
+        double fixedSeconds = secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        HistogramBins automatic = binValuesFreedmanDiaconis(values);
+        double automaticSeconds = secondsSince(start);
+
+        CountingBuffer binned;
+        std::ostream binnedOut(&binned);
+        writeTopBoilerPlateOfColumnChart(binnedOut);
+        writeDataOfBinnedHistogram(binnedOut, automatic);
+        writeBottomBoilerPlateOfColumnChart(binnedOut);
+
+        std::cout << "hist n=" << n
+                  << " fixed width " << n / fixedSeconds * 1e-6 << " M values/s"
+                  << ", freedman-diaconis (" << automatic.counts.size() << " bins) " << n / automaticSeconds * 1e-6 << " M values/s"
+                  << ", output " << binned.bytes << " bytes vs ~" << (size_t)(rawBytesPerValue * n) << " bytes raw\n";
+    }
+}
+
+// The CSV writer as it was before BufferedWriter, for comparison
+static void streamCSVChartData(std::ostream &out, const std::vector<double> &x, const std::vector<double> &y)
+{
+    for (size_t i = 0; i < x.size(); i++)
+    {
+        out << x[i] << "," << y[i] << "\n";
+    }
+}
+
+// The line chart writer as it was before BufferedWriter, for comparison
+static void streamDataOfLineChart(std::ostream &out, const std::vector<double> &xValues, const std::vector<double> &yValues)
+{
+    out << "    data.addRows([\n";
+    for (size_t i = 0; i < xValues.size(); i++)
+    {
+        out << "      [" << xValues[i] << ", " << yValues[i] << "]";
+        out << (i != xValues.size() - 1 ? ",\n" : "\n");
+    }
+    out << "    ]);\n";
+}
+
+static void reportWriter(const std::string &name, size_t rows, size_t bytes, double seconds)
+{
+    std::cout << "  " << name << ": " << bytes / seconds * 1e-6 << " MB/s, "
+              << rows / seconds * 1e-6 << " M rows/s (" << bytes << " bytes)\n";
+}
+
+// Formatting throughput of the writers into a sink that discards the output
+static void benchmarkWriters()
+{
+    size_t rows = 10000000;
+    std::vector<double> x(rows);
+    std::vector<double> y = benchmarkSamples(rows);
+    for (size_t i = 0; i < rows; i++)
+    {
+        x[i] = i * 1e-3;
+    }
+    std::cout << "writers rows=" << rows << "\n";
+
+    auto timeWriter = [&](const std::string &name, auto write)
+    {
+        CountingBuffer sink;
+        std::ostream out(&sink);
+        auto start = std::chrono::steady_clock::now();
+        write(out);
+        reportWriter(name, rows, sink.bytes, secondsSince(start));
+    };
+
+    timeWriter("csv ostream (6 digits)", [&](std::ostream &out)
+    {
+        streamCSVChartData(out, x, y);
+    });
+    timeWriter("csv ostream (17 digits)", [&](std::ostream &out)
+    {
+        out << std::setprecision(17);
+        streamCSVChartData(out, x, y);
+    });
+    timeWriter("csv to_chars (shortest)", [&](std::ostream &out)
+    {
+        writeCSVChartData(out, x, y);
+    });
+    timeWriter("line chart ostream (6 digits)", [&](std::ostream &out)
+    {
+        streamDataOfLineChart(out, x, y);
+    });
+    timeWriter("line chart to_chars (shortest)", [&](std::ostream &out)
+    {
+        writeDataOfLineChart(out, x, y);
+    });
+}
+
+// Size, generation time and script left for the browser to parse of each chart encoding
+static void benchmarkChartEncodings()
+{
+    size_t rows = 1000000;
+    std::vector<double> x(rows);
+    std::vector<double> y = benchmarkSamples(rows);
+    double level = 100.0;
+    for (size_t i = 0; i < rows; i++)
+    {
+        // a random walk, like a simulated path
+        x[i] = i * 1e-3;
+        level += 0.01 * y[i];
+        y[i] = level;
+    }
+    auto [lowest, highest] = std::minmax_element(y.begin(), y.end());
+    std::cout << "chart encodings rows=" << rows << "\n";
+
+    const char *names[] = {"text", "float64", "float32", "delta quantized"};
+    ChartEncoding encodings[] = {ChartEncoding::Text, ChartEncoding::Float64, ChartEncoding::Float32, ChartEncoding::DeltaQuantized};
+    for (size_t k = 0; k < 4; k++)
+    {
+        CountingBuffer sink;
+        std::ostream out(&sink);
+        auto start = std::chrono::steady_clock::now();
+        writeDataOfLineChart(out, x, y, encodings[k]);
+        double seconds = secondsSince(start);
+
+        std::ostringstream html;
+        writeDataOfLineChart(html, x, y, encodings[k]);
+        std::string text = html.str();
+        // the parse cost proxy, bytes of code outside string literals that
+        // the browser tokenizes rather than scans in one pass
+        size_t scriptBytes = 0;
+        bool inString = false;
+        for (char c : text)
+        {
+            if (c == '\'')
+            {
+                inString = !inString;
+            }
+            else if (!inString)
+            {
+                scriptBytes++;
+            }
+        }
+        double maxError = 0.0;
+        if (encodings[k] != ChartEncoding::Text)
+        {
+            std::vector<double> decoded = decodeSeriesOf(text, "y");
+            for (size_t i = 0; i < rows; i++)
+            {
+                maxError = std::max(maxError, std::abs(decoded[i] - y[i]));
+            }
+        }
+        std::cout << "  " << names[k] << ": " << sink.bytes << " bytes, " << seconds * 1e3 << " ms, "
+                  << scriptBytes << " bytes of script, max error " << maxError / (*highest - *lowest) << " of range\n";
+    }
+}
+
+void benchmarkCharts()
+{
+    benchmarkWriters();
+    benchmarkHistogramBinning();
+    benchmarkChartEncodings();
+}
+
+/*  Data written by the microbenchmarks */
+static std::vector<double> benchmarkX;
+static std::vector<double> benchmarkY;
+/*  Bytes written by one call of the writer being benchmarked */
+static size_t benchmarkBytes = 0;
+
+static void benchmarkWriteCSVChartData(size_t iterations)
+{
+    CountingBuffer sink;
+    std::ostream out(&sink);
+    for (size_t i = 0; i < iterations; i++)
+    {
+        writeCSVChartData(out, benchmarkX, benchmarkY);
+    }
+    benchmarkBytes = sink.bytes / iterations;
+}
+
+static void benchmarkWriteDataOfLineChart(size_t iterations)
+{
+    CountingBuffer sink;
+    std::ostream out(&sink);
+    for (size_t i = 0; i < iterations; i++)
+    {
+        writeDataOfLineChart(out, benchmarkX, benchmarkY);
+    }
+    benchmarkBytes = sink.bytes / iterations;
+}
+
+static void benchmarkBinValues(size_t iterations)
+{
+    for (size_t i = 0; i < iterations; i++)
+    {
+        doNotOptimize(binValues(benchmarkY, 100));
+    }
+}
+
+void microbenchmarkCharts()
+{
+    size_t rows = 10000;
+    benchmarkX.resize(rows);
+    benchmarkY = benchmarkSamples(rows);
+    for (size_t i = 0; i < rows; i++)
+    {
+        benchmarkX[i] = i * 1e-3;
+    }
+    // one call measures the bytes per iteration for the throughput
+    benchmarkWriteCSVChartData(1);
+    BENCHMARK_THROUGHPUT(benchmarkWriteCSVChartData, rows, benchmarkBytes);
+    benchmarkWriteDataOfLineChart(1);
+    BENCHMARK_THROUGHPUT(benchmarkWriteDataOfLineChart, rows, benchmarkBytes);
+    BENCHMARK_THROUGHPUT(benchmarkBinValues, rows, rows * sizeof(double));
 }
@@ -0,0 +1,422 @@
+#include "columnfile.h"
+#include "charts.h"
+#include "matlib.h"
+#include "parallel.h"
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+/*  Columns and summaries start on multiples of this many bytes */
+static const size_t COLUMN_ALIGNMENT = 64;
+/*  Identifies a column file and its layout version */
+static const char MAGIC[8] = {'M', 'Y', 'L', 'I', 'B', 'C', 'O', 'L'};
+static const uint32_t VERSION = 1;
+/*  Minimum number of blocks summarised by one thread */
+static const size_t MIN_BLOCKS_PER_THREAD = 16;
+
+/*  The fixed part of the header, followed by one ColumnEntry per column and then the names */
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t alignment;
+    uint64_t rows;
+    uint64_t blockRows;
+    uint32_t columns;
+    uint32_t reserved;
+};
+
+struct ColumnEntry
+{
+    uint32_t type;
+    uint32_t nameLength;
+    uint64_t dataOffset;
+    uint64_t summaryOffset;
+};
+
+static_assert(sizeof(FileHeader) == 40 && sizeof(ColumnEntry) == 24 && sizeof(BlockSummary) == 24,
+              "the file layout must not contain padding");
+
+static size_t alignUp(size_t offset)
+{
+    return (offset + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+}
+
+static void checkLittleEndian()
+{
+    if (std::endian::native != std::endian::little)
+    {
+        throw std::invalid_argument("Column files are only supported on little endian machines");
+    }
+}
+
+static std::vector<BlockSummary> summariseBlocks(std::span<const double> values, size_t blockRows)
+{
+    size_t nBlocks = (values.size() + blockRows - 1) / blockRows;
+    std::vector<BlockSummary> summaries(nBlocks);
+    parallelFor(nBlocks, [&](size_t begin, size_t end)
+    {
+        for (size_t block = begin; block < end; block++)
+        {
+            std::span<const double> rows = values.subspan(block * blockRows, std::min(blockRows, values.size() - block * blockRows));
+            BlockSummary summary{rows[0], rows[0], 0.0};
+            for (double x : rows)
+            {
+                summary.min = std::min(summary.min, x);
+                summary.max = std::max(summary.max, x);
+                summary.sum += x;
+            }
+            summaries[block] = summary;
+        }
+    }, MIN_BLOCKS_PER_THREAD);
+    return summaries;
+}
+
+void writeColumnFile(const std::string &filename,
+                     const std::vector<std::string> &names,
+                     const std::vector<std::span<const double>> &columns,
+                     size_t blockRows)
+{
+    checkLittleEndian();
+    if (names.size() != columns.size())
+    {
+        throw std::invalid_argument("Every column needs a name");
+    }
+    size_t rows = columns.empty() ? 0 : columns[0].size();
+    for (const std::span<const double> &column : columns)
+    {
+        if (column.size() != rows)
+        {
+            throw std::invalid_argument("Columns must have the same number of rows");
+        }
+    }
+    size_t nBlocks = blockRows > 0 ? (rows + blockRows - 1) / blockRows : 0;
+
+    // lay out the file before writing anything
+    size_t headerSize = sizeof(FileHeader) + columns.size() * sizeof(ColumnEntry);
+    for (const std::string &name : names)
+    {
+        headerSize += name.size();
+    }
+    std::vector<ColumnEntry> entries(columns.size());
+    size_t offset = alignUp(headerSize);
+    for (ColumnEntry &entry : entries)
+    {
+        entry.dataOffset = offset;
+        offset = alignUp(offset + rows * sizeof(double));
+    }
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        entries[i].type = (uint32_t)ColumnType::Float64;
+        entries[i].nameLength = (uint32_t)names[i].size();
+        entries[i].summaryOffset = blockRows > 0 ? offset : 0;
+        offset = blockRows > 0 ? alignUp(offset + nBlocks * sizeof(BlockSummary)) : offset;
+    }
+
+    FileHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.alignment = COLUMN_ALIGNMENT;
+    header.rows = rows;
+    header.blockRows = blockRows;
+    header.columns = (uint32_t)columns.size();
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out)
+    {
+        throw std::runtime_error("Cannot write " + filename);
+    }
+    static const char padding[COLUMN_ALIGNMENT] = {};
+    size_t written = 0;
+    auto write = [&](const void *bytes, size_t size)
+    {
+        out.write((const char *)bytes, size);
+        written += size;
+    };
+    auto pad = [&]()
+    {
+        write(padding, alignUp(written) - written);
+    };
+
+    write(&header, sizeof(header));
+    write(entries.data(), entries.size() * sizeof(ColumnEntry));
+    for (const std::string &name : names)
+    {
+        write(name.data(), name.size());
+    }
+    pad();
+    for (const std::span<const double> &column : columns)
+    {
+        write(column.data(), column.size_bytes());
+        pad();
+    }
+    if (blockRows > 0)
+    {
+        for (const std::span<const double> &column : columns)
+        {
+            std::vector<BlockSummary> summaries = summariseBlocks(column, blockRows);
+            write(summaries.data(), summaries.size() * sizeof(BlockSummary));
+            pad();
+        }
+    }
+    if (!out)
+    {
+        throw std::runtime_error("Failed writing " + filename);
+    }
+}
+
+ColumnFile::ColumnFile(const std::string &filename)
+    : file(filename), nRows(0), nBlockRows(0)
+{
+    checkLittleEndian();
+    const char *bytes = file.data();
+    size_t size = file.size();
+    auto invalid = [&](const std::string &reason)
+    {
+        return std::invalid_argument(filename + " is not a valid column file: " + reason);
+    };
+    // true when [offset, offset + count * itemSize) lies inside the file
+    auto inside = [&](uint64_t offset, uint64_t count, size_t itemSize)
+    {
+        return offset <= size && count <= (size - offset) / itemSize;
+    };
+
+    FileHeader header;
+    if (size < sizeof(header))
+    {
+        throw invalid("too short");
+    }
+    std::memcpy(&header, bytes, sizeof(header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+    {
+        throw invalid("wrong magic number");
+    }
+    if (header.version != VERSION)
+    {
+        throw invalid("unsupported version " + std::to_string(header.version));
+    }
+    if (!inside(sizeof(header), header.columns, sizeof(ColumnEntry)))
+    {
+        throw invalid("truncated header");
+    }
+    nRows = header.rows;
+    nBlockRows = header.blockRows;
+    size_t nBlocks = nBlockRows > 0 ? (nRows + nBlockRows - 1) / nBlockRows : 0;
+
+    size_t nameOffset = sizeof(header) + header.columns * sizeof(ColumnEntry);
+    for (uint32_t i = 0; i < header.columns; i++)
+    {
+        ColumnEntry entry;
+        std::memcpy(&entry, bytes + sizeof(header) + i * sizeof(ColumnEntry), sizeof(entry));
+        if (!inside(nameOffset, entry.nameLength, 1))
+        {
+            throw invalid("truncated column names");
+        }
+        names.emplace_back(bytes + nameOffset, entry.nameLength);
+        nameOffset += entry.nameLength;
+        types.push_back((ColumnType)entry.type);
+
+        if (entry.dataOffset % alignof(double) != 0 || !inside(entry.dataOffset, nRows, sizeof(double)))
+        {
+            throw invalid("column " + names.back() + " is outside the file");
+        }
+        data.push_back((const double *)(bytes + entry.dataOffset));
+
+        if (nBlockRows > 0 && (entry.summaryOffset % alignof(double) != 0 ||
+                               !inside(entry.summaryOffset, nBlocks, sizeof(BlockSummary))))
+        {
+            throw invalid("block summaries of " + names.back() + " are outside the file");
+        }
+        summaries.push_back(nBlockRows > 0 ? (const BlockSummary *)(bytes + entry.summaryOffset) : nullptr);
+    }
+}
+
+std::span<const double> ColumnFile::column(size_t column) const
+{
+    if (column >= names.size())
+    {
+        throw std::invalid_argument("Column index out of range");
+    }
+    if (types[column] != ColumnType::Float64)
+    {
+        throw std::invalid_argument("Column " + names[column] + " does not hold doubles");
+    }
+    return std::span<const double>(data[column], nRows);
+}
+
+std::span<const double> ColumnFile::column(const std::string &name) const
+{
+    return column(indexOf(name));
+}
+
+std::span<const BlockSummary> ColumnFile::blockSummaries(size_t column) const
+{
+    if (column >= names.size())
+    {
+        throw std::invalid_argument("Column index out of range");
+    }
+    size_t nBlocks = nBlockRows > 0 ? (nRows + nBlockRows - 1) / nBlockRows : 0;
+    return std::span<const BlockSummary>(summaries[column], nBlocks);
+}
+
+size_t ColumnFile::indexOf(const std::string &name) const
+{
+    auto found = std::find(names.begin(), names.end(), name);
+    if (found == names.end())
+    {
+        throw std::invalid_argument("No column named " + name);
+    }
+    return found - names.begin();
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+static void testRoundTrip()
+{
+    std::vector<double> x(1000);
+    for (size_t i = 0; i < x.size(); i++)
+    {
+        x[i] = i * 0.1;
+    }
+    std::vector<double> y = randn(1000);
+    std::vector<double> z = randuniform(1000);
+    writeColumnFile("ColumnFileTest.col", {"x", "y", "a longer name"}, {x, y, z}, 128);
+    {
+        ColumnFile file("ColumnFileTest.col");
+        ASSERT(file.rows() == 1000);
+        ASSERT(file.columns() == 3);
+        ASSERT(file.name(2) == "a longer name");
+        ASSERT(file.type(1) == ColumnType::Float64);
+        std::span<const double> readY = file.column("y");
+        ASSERT(std::equal(readY.begin(), readY.end(), y.begin(), y.end()));
+        ASSERT((size_t)file.column(0).data() % COLUMN_ALIGNMENT == 0);
+        ASSERT(mean(file.column(2)) == mean(z));
+        ASSERT(prctile(file.column(1), 90) == prctile(y, 90));
+
+        // the block summaries agree with the data
+        std::span<const BlockSummary> blocks = file.blockSummaries(1);
+        ASSERT(file.blockRows() == 128);
+        ASSERT(blocks.size() == 8);
+        double total = 0.0;
+        double lowest = blocks[0].min;
+        for (const BlockSummary &block : blocks)
+        {
+            total += block.sum;
+            lowest = std::min(lowest, block.min);
+        }
+        ASSERT_APPROX_EQUAL(total / 1000, mean(y), 1e-12);
+        ASSERT(lowest == min(y));
+    }
+    std::remove("ColumnFileTest.col");
+}
+
+static void testWithoutSummaries()
+{
+    std::vector<double> x = {1.0, 2.0, 3.0};
+    std::vector<double> y = {4.0, 5.0, 6.0};
+    writeColumnChart("ColumnChartTest.col", x, y);
+    {
+        ColumnFile file("ColumnChartTest.col");
+        ASSERT(file.blockRows() == 0);
+        ASSERT(file.blockSummaries(0).empty());
+        ASSERT(max(file.column("y")) == 6.0);
+    }
+    std::remove("ColumnChartTest.col");
+}
+
+static void testRejectsOtherFiles()
+{
+    std::vector<double> x = {1, 2};
+    writeCSVChart("NotAColumnFile.csv", x, x);
+    bool threw = false;
+    try
+    {
+        ColumnFile file("NotAColumnFile.csv");
+    }
+    catch (const std::invalid_argument &)
+    {
+        threw = true;
+    }
+    ASSERT(threw);
+    std::remove("NotAColumnFile.csv");
+}
+
+void testColumnFile()
+{
+    TEST(testRoundTrip);
+    TEST(testWithoutSummaries);
+    TEST(testRejectsOtherFiles);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+// Reads a two column CSV the way it is done without a reader, with getline and strtod
+static void readCSVWithGetline(const std::string &filename, std::vector<double> &x, std::vector<double> &y)
+{
+    std::ifstream in(filename);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        char *end = nullptr;
+        x.push_back(std::strtod(line.c_str(), &end));
+        y.push_back(std::strtod(end + 1, nullptr));
+    }
+}
+
+void benchmarkColumnFile()
+{
+    size_t rows = 10000000;
+    std::vector<double> x(rows);
+    std::vector<double> y(rows);
+    for (size_t i = 0; i < rows; i++)
+    {
+        x[i] = i * 1e-3;
+        y[i] = std::sin(i * 1e-3) + 1e-4 * (double)(i % 997);
+    }
+    double gigabytes = 2.0 * rows * sizeof(double) * 1e-9;
+    std::filesystem::path directory = std::filesystem::temp_directory_path();
+    std::string csvFile = (directory / "benchmark.csv").string();
+    std::string columnFile = (directory / "benchmark.col").string();
+
+    auto start = std::chrono::steady_clock::now();
+    writeCSVChart(csvFile, x, y);
+    double csvWriteSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    writeColumnChart(columnFile, x, y, 4096);
+    double columnWriteSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<double> csvX;
+    std::vector<double> csvY;
+    readCSVWithGetline(csvFile, csvX, csvY);
+    double csvChecksum = mean(csvX) + mean(csvY);
+    double csvReadSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    double columnChecksum = 0.0;
+    {
+        ColumnFile file(columnFile);
+        columnChecksum = mean(file.column("x")) + mean(file.column("y"));
+    }
+    double columnReadSeconds = secondsSince(start);
+
+    std::cout << "column file rows=" << rows << " (" << gigabytes << " GB of doubles)\n"
+              << "  csv    " << std::filesystem::file_size(csvFile) << " bytes, write " << gigabytes / csvWriteSeconds << " GB/s"
+              << ", getline read and means " << gigabytes / csvReadSeconds << " GB/s\n"
+              << "  column " << std::filesystem::file_size(columnFile) << " bytes, write " << gigabytes / columnWriteSeconds << " GB/s"
+              << ", mapped read and means " << gigabytes / columnReadSeconds << " GB/s"
+              << " (checksums " << csvChecksum << ", " << columnChecksum << ")\n";
+    std::filesystem::remove(csvFile);
+    std::filesystem::remove(columnFile);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "stdafx.h"
+#include "mappedfile.h"
+#include <cstdint>
+#include <span>
+#include <string>
+
+/**
+ *  The type of the values in a column
+ */
+enum class ColumnType : uint32_t
+{
+    Float64 = 1
+};
+
+/**
+ *  Minimum, maximum and sum of one block of rows of a column
+ */
+struct BlockSummary
+{
+    double min;
+    double max;
+    double sum;
+};
+
+/**
+ * Writes named columns of equal length to a binary column file.  The file
+ * starts with a header holding the column names, types, row count and
+ * the offset of each column, followed by each column as raw little endian
+ * doubles starting on a 64 byte boundary.  When blockRows is not 0 a
+ * footer with the BlockSummary of every blockRows rows of each column is
+ * appended, so range queries can skip blocks without reading them.
+ */
+void writeColumnFile(const std::string &filename,
+                     const std::vector<std::string> &names,
+                     const std::vector<std::span<const double>> &columns,
+                     size_t blockRows = 0);
+
+/**
+ *  Reads a file written by writeColumnFile by memory mapping it.  The
+ *  columns are spans over the mapping, so opening a file does not read
+ *  the data and the spans stay valid for the lifetime of the ColumnFile.
+ */
+class ColumnFile
+{
+public:
+    explicit ColumnFile(const std::string &filename);
+
+    size_t rows() const { return nRows; }
+    size_t columns() const { return names.size(); }
+    const std::string &name(size_t column) const { return names[column]; }
+    ColumnType type(size_t column) const { return types[column]; }
+
+    /** The values of a column, throws if there is no such column */
+    std::span<const double> column(size_t column) const;
+    std::span<const double> column(const std::string &name) const;
+
+    /** Rows per block summary, 0 if the file has no summaries */
+    size_t blockRows() const { return nBlockRows; }
+    std::span<const BlockSummary> blockSummaries(size_t column) const;
+
+private:
+    size_t indexOf(const std::string &name) const;
+
+    MappedFile file;
+    size_t nRows;
+    size_t nBlockRows;
+    std::vector<std::string> names;
+    std::vector<ColumnType> types;
+    std::vector<const double *> data;
+    std::vector<const BlockSummary *> summaries;
+};
+
+/**
+ *  Test function
+ */
+void testColumnFile();
+
+/**
+ *  Benchmark function
+ */
+void benchmarkColumnFile();
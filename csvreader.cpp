@@ -0,0 +1,366 @@
+#include "csvreader.h"
+#include "charts.h"
+#include "mappedfile.h"
+#include "matlib.h"
+#include "parallel.h"
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+
+/*  Files are split into chunks of at least this many bytes */
+static const size_t MIN_CHUNK_BYTES = 1 << 20;
+/*  Chunks per thread, so that chunks of uneven cost still balance */
+static const size_t CHUNKS_PER_THREAD = 4;
+
+/*  The start of the line after the one containing p */
+static const char *nextLine(const char *p, const char *end)
+{
+    const char *newline = (const char *)std::memchr(p, '\n', end - p);
+    return newline != nullptr ? newline + 1 : end;
+}
+
+/*  The end of the text of a line that runs up to next, without the line ending */
+static const char *lineEnd(const char *begin, const char *next)
+{
+    const char *end = next;
+    if (end > begin && end[-1] == '\n')
+    {
+        end--;
+    }
+    if (end > begin && end[-1] == '\r')
+    {
+        end--;
+    }
+    return end;
+}
+
+static const char *skipSpaces(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+    return p;
+}
+
+static bool isBlank(const char *begin, const char *end)
+{
+    return skipSpaces(begin, end) == end;
+}
+
+static std::vector<std::string> splitNames(const char *p, const char *end, char delimiter)
+{
+    std::vector<std::string> names;
+    while (true)
+    {
+        const char *field = skipSpaces(p, end);
+        const char *fieldEnd = std::find(field, end, delimiter);
+        const char *trimmed = fieldEnd;
+        while (trimmed > field && (trimmed[-1] == ' ' || trimmed[-1] == '\t'))
+        {
+            trimmed--;
+        }
+        names.emplace_back(field, trimmed);
+        if (fieldEnd == end)
+        {
+            return names;
+        }
+        p = fieldEnd + 1;
+    }
+}
+
+/*  Parses one line into the given row of the columns, returning why it is malformed or an empty string */
+static std::string parseLine(const char *p, const char *end, char delimiter,
+                             std::vector<std::vector<double>> &columns, size_t row)
+{
+    size_t nColumns = columns.size();
+    for (size_t c = 0; c < nColumns; c++)
+    {
+        p = skipSpaces(p, end);
+        if (p < end && *p == '+')
+        {
+            p++;
+        }
+        double value;
+        std::from_chars_result result = std::from_chars(p, end, value);
+        if (result.ec != std::errc())
+        {
+            return "field " + std::to_string(c + 1) + " is not a number";
+        }
+        columns[c][row] = value;
+        p = skipSpaces(result.ptr, end);
+        if (c + 1 < nColumns)
+        {
+            if (p == end || *p != delimiter)
+            {
+                return "expected " + std::to_string(nColumns) + " fields but found " + std::to_string(c + 1);
+            }
+            p++;
+        }
+    }
+    if (p != end)
+    {
+        return "unexpected text after field " + std::to_string(nColumns);
+    }
+    return std::string();
+}
+
+const std::vector<double> &CsvTable::column(const std::string &name) const
+{
+    auto found = std::find(names.begin(), names.end(), name);
+    if (found == names.end())
+    {
+        throw std::invalid_argument("No column named " + name);
+    }
+    return columns[found - names.begin()];
+}
+
+CsvTable readCSV(const std::string &filename, const CsvOptions &options)
+{
+    MappedFile file(filename);
+    const char *begin = file.data();
+    const char *end = begin + file.size();
+    CsvTable table;
+
+    // the first line that is not blank gives the number of columns
+    const char *first = begin;
+    size_t firstLine = 0;
+    while (first < end && isBlank(first, lineEnd(first, nextLine(first, end))))
+    {
+        first = nextLine(first, end);
+        firstLine++;
+    }
+    if (first == end)
+    {
+        return table;
+    }
+    const char *start = first;
+    size_t startLine = firstLine;
+    std::vector<std::string> names = splitNames(first, lineEnd(first, nextLine(first, end)), options.delimiter);
+    if (options.header)
+    {
+        table.names = names;
+        start = nextLine(first, end);
+        startLine++;
+    }
+    size_t nColumns = names.size();
+
+    // chunk boundaries are moved forward to the start of a line
+    size_t length = end - start;
+    size_t nChunks = std::min(std::max<size_t>(length / MIN_CHUNK_BYTES, 1), (size_t)numThreads() * CHUNKS_PER_THREAD);
+    std::vector<const char *> bounds(nChunks + 1, end);
+    bounds[0] = start;
+    for (size_t i = 1; i < nChunks; i++)
+    {
+        const char *p = start + i * (length / nChunks);
+        bounds[i] = std::max(nextLine(p - 1, end), bounds[i - 1]);
+    }
+
+    // count the lines and rows of each chunk so every chunk knows where its rows go
+    std::vector<size_t> chunkLines(nChunks + 1, 0);
+    std::vector<size_t> chunkRows(nChunks + 1, 0);
+    parallelFor(nChunks, [&](size_t chunkBegin, size_t chunkEnd)
+    {
+        for (size_t chunk = chunkBegin; chunk < chunkEnd; chunk++)
+        {
+            for (const char *p = bounds[chunk]; p < bounds[chunk + 1];)
+            {
+                const char *next = nextLine(p, bounds[chunk + 1]);
+                chunkRows[chunk + 1] += isBlank(p, lineEnd(p, next)) ? 0 : 1;
+                chunkLines[chunk + 1]++;
+                p = next;
+            }
+        }
+    });
+    for (size_t chunk = 0; chunk < nChunks; chunk++)
+    {
+        chunkLines[chunk + 1] += chunkLines[chunk];
+        chunkRows[chunk + 1] += chunkRows[chunk];
+    }
+    table.columns.assign(nColumns, std::vector<double>(chunkRows[nChunks]));
+
+    std::vector<std::vector<CsvError>> chunkErrors(nChunks);
+    std::vector<size_t> chunkMalformed(nChunks, 0);
+    double notANumber = std::numeric_limits<double>::quiet_NaN();
+    parallelFor(nChunks, [&](size_t chunkBegin, size_t chunkEnd)
+    {
+        for (size_t chunk = chunkBegin; chunk < chunkEnd; chunk++)
+        {
+            size_t row = chunkRows[chunk];
+            size_t line = startLine + chunkLines[chunk] + 1;
+            for (const char *p = bounds[chunk]; p < bounds[chunk + 1]; line++)
+            {
+                const char *next = nextLine(p, bounds[chunk + 1]);
+                const char *text = lineEnd(p, next);
+                if (!isBlank(p, text))
+                {
+                    std::string problem = parseLine(p, text, options.delimiter, table.columns, row);
+                    if (!problem.empty())
+                    {
+                        for (std::vector<double> &column : table.columns)
+                        {
+                            column[row] = notANumber;
+                        }
+                        if (chunkErrors[chunk].size() < options.maxErrors)
+                        {
+                            chunkErrors[chunk].push_back(CsvError{line, problem});
+                        }
+                        chunkMalformed[chunk]++;
+                    }
+                    row++;
+                }
+                p = next;
+            }
+        }
+    });
+
+    for (size_t chunk = 0; chunk < nChunks; chunk++)
+    {
+        table.malformedLines += chunkMalformed[chunk];
+        for (const CsvError &error : chunkErrors[chunk])
+        {
+            if (table.errors.size() < options.maxErrors)
+            {
+                table.errors.push_back(error);
+            }
+        }
+    }
+    if (options.strict && table.malformedLines > 0)
+    {
+        if (table.errors.empty())
+        {
+            throw std::invalid_argument(filename + " has " + std::to_string(table.malformedLines) + " malformed lines");
+        }
+        const CsvError &error = table.errors.front();
+        throw std::invalid_argument(filename + " line " + std::to_string(error.line) + ": " + error.message);
+    }
+    return table;
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+static void writeText(const std::string &filename, const std::string &text)
+{
+    std::ofstream out(filename, std::ios::binary);
+    out << text;
+}
+
+// Values written by writeCSVChart read back exactly, across several chunks
+static void testReadsWhatWasWritten()
+{
+    std::vector<double> x = randn(200000);
+    std::vector<double> y = randuniform(200000);
+    writeCSVChart("CsvReaderTest.csv", x, y);
+    CsvTable table = readCSV("CsvReaderTest.csv");
+    ASSERT(table.columns.size() == 2);
+    ASSERT(table.rows() == x.size());
+    ASSERT(table.columns[0] == x);
+    ASSERT(table.columns[1] == y);
+    ASSERT(table.errors.empty());
+    ASSERT(mean(table.columns[1]) == mean(y));
+    std::remove("CsvReaderTest.csv");
+}
+
+static void testHeaderAndMalformedLines()
+{
+    writeText("CsvReaderTest.csv",
+              "x, y\r\n"
+              "1, 2\r\n"
+              "\r\n"
+              "3,abc\n"
+              "5,6,7\n"
+              "+8 ,9");
+    CsvOptions options;
+    options.header = true;
+    CsvTable table = readCSV("CsvReaderTest.csv", options);
+    ASSERT(table.names == std::vector<std::string>({"x", "y"}));
+    ASSERT(table.rows() == 4);
+    ASSERT(table.column("x")[0] == 1 && table.column("y")[0] == 2);
+    ASSERT(std::isnan(table.column("x")[1]) && std::isnan(table.column("y")[2]));
+    ASSERT(table.column("x")[3] == 8 && table.column("y")[3] == 9);
+    ASSERT(table.malformedLines == 2);
+    ASSERT(table.errors.size() == 2);
+    ASSERT(table.errors[0].line == 4 && table.errors[1].line == 5);
+
+    options.strict = true;
+    bool threw = false;
+    try
+    {
+        readCSV("CsvReaderTest.csv", options);
+    }
+    catch (const std::invalid_argument &)
+    {
+        threw = true;
+    }
+    ASSERT(threw);
+    std::remove("CsvReaderTest.csv");
+}
+
+static void testEmptyFile()
+{
+    writeText("CsvReaderTest.csv", "\n\n");
+    CsvTable table = readCSV("CsvReaderTest.csv");
+    ASSERT(table.rows() == 0);
+    std::remove("CsvReaderTest.csv");
+}
+
+void testCsvReader()
+{
+    TEST(testReadsWhatWasWritten);
+    TEST(testHeaderAndMalformedLines);
+    TEST(testEmptyFile);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+void benchmarkCsvReader()
+{
+    size_t rows = 10000000;
+    std::vector<double> x(rows);
+    std::vector<double> y(rows);
+    for (size_t i = 0; i < rows; i++)
+    {
+        x[i] = i * 1e-3;
+        y[i] = std::sin(i * 1e-3) + 1e-4 * (double)(i % 997);
+    }
+    std::string filename = (std::filesystem::temp_directory_path() / "benchmark.csv").string();
+    writeCSVChart(filename, x, y);
+    double gigabytes = std::filesystem::file_size(filename) * 1e-9;
+
+    // what the reader replaces
+    auto start = std::chrono::steady_clock::now();
+    std::vector<double> lineX;
+    std::vector<double> lineY;
+    {
+        std::ifstream in(filename);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            size_t comma = line.find(',');
+            lineX.push_back(std::stod(line.substr(0, comma)));
+            lineY.push_back(std::stod(line.substr(comma + 1)));
+        }
+    }
+    double getlineSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    CsvTable table = readCSV(filename);
+    double readSeconds = secondsSince(start);
+
+    std::cout << "csv reader rows=" << rows << " (" << gigabytes << " GB), " << numThreads() << " threads\n"
+              << "  getline/stod " << rows / getlineSeconds * 1e-6 << " M rows/s, " << gigabytes / getlineSeconds << " GB/s\n"
+              << "  readCSV      " << rows / readSeconds * 1e-6 << " M rows/s, " << gigabytes / readSeconds << " GB/s"
+              << (table.columns[1] == lineY ? "" : " (MISMATCH)") << "\n";
+    std::filesystem::remove(filename);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "stdafx.h"
+#include <string>
+
+/**
+ *  How readCSV interprets a file
+ */
+struct CsvOptions
+{
+    /*  Character between the fields of a line */
+    char delimiter = ',';
+    /*  Whether the first line holds the column names */
+    bool header = false;
+    /*  Throw on the first malformed line instead of recording it */
+    bool strict = false;
+    /*  Malformed lines recorded beyond this many are only counted */
+    size_t maxErrors = 100;
+};
+
+/**
+ *  A line that could not be parsed, line numbers start at 1 and
+ *  include the header and blank lines
+ */
+struct CsvError
+{
+    size_t line;
+    std::string message;
+};
+
+/**
+ *  The columns read from a CSV file.  Malformed lines still occupy a row,
+ *  filled with NaN, so row i of every column comes from the same line.
+ */
+struct CsvTable
+{
+    std::vector<std::string> names;
+    std::vector<std::vector<double>> columns;
+    std::vector<CsvError> errors;
+    size_t malformedLines = 0;
+
+    size_t rows() const { return columns.empty() ? 0 : columns[0].size(); }
+
+    /** The column with the given header name, throws if there is none */
+    const std::vector<double> &column(const std::string &name) const;
+};
+
+/**
+ * Reads a CSV file of numbers into one vector per column.  The file is
+ * memory mapped and split into newline aligned chunks which are parsed in
+ * parallel with std::from_chars, after a first pass that counts the lines
+ * of each chunk so the columns can be allocated once and every chunk
+ * writes its own rows.  The number of columns is taken from the first
+ * line.  Blank lines are skipped and CRLF line endings are accepted.
+ */
+CsvTable readCSV(const std::string &filename, const CsvOptions &options = CsvOptions());
+
+/**
+ *  Test function
+ */
+void testCsvReader();
+
+/**
+ *  Benchmark function
+ */
+void benchmarkCsvReader();
@@ -0,0 +1,601 @@
+#include "curve.h"
+#include "matlib.h"
+#include <string_view>
+
+/*  The shapes of the monotone convex forward on a segment, in Hagan and West's numbering */
+static const int SECTOR_QUADRATIC = 1;
+static const int SECTOR_FLAT_THEN_CURVED = 2;
+static const int SECTOR_CURVED_THEN_FLAT = 3;
+static const int SECTOR_BASIN = 4;
+
+/*  Number of maturity sets whose discount factors are remembered */
+static const size_t MAX_CACHED_SETS = 16;
+
+Curve::Curve(const std::vector<double> &times,
+             const std::vector<double> &zeroRates,
+             CurveInterpolation interpolation)
+    : method(interpolation), times(times), zeroRates(zeroRates)
+{
+    if (times.empty() || times.size() != zeroRates.size())
+    {
+        throw std::invalid_argument("A curve needs one zero rate for each of at least one pillar");
+    }
+    for (size_t i = 0; i < times.size(); i++)
+    {
+        if (!(times[i] > (i == 0 ? 0.0 : times[i - 1])))
+        {
+            throw std::invalid_argument("Pillar times must be positive and increasing");
+        }
+    }
+    build();
+}
+
+Curve::Curve(const Curve &other)
+    : method(other.method), times(other.times), zeroRates(other.zeroRates),
+      segments(other.segments), finalForward(other.finalForward)
+{
+}
+
+Curve &Curve::operator=(const Curve &other)
+{
+    if (this != &other)
+    {
+        method = other.method;
+        times = other.times;
+        zeroRates = other.zeroRates;
+        segments = other.segments;
+        finalForward = other.finalForward;
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        cache.clear();
+    }
+    return *this;
+}
+
+void Curve::build()
+{
+    size_t n = times.size();
+    segments.assign(n, Segment());
+    double start = 0.0;
+    double integral = 0.0;
+    for (size_t i = 0; i < n; i++)
+    {
+        Segment &s = segments[i];
+        s.start = start;
+        s.width = times[i] - start;
+        s.integral = integral;
+        s.discreteForward = (zeroRates[i] * times[i] - integral) / s.width;
+        start = times[i];
+        integral = zeroRates[i] * times[i];
+    }
+
+    // instantaneous forwards at the pillars, interpolating the discrete forwards either side
+    std::vector<double> f(n + 1, segments[0].discreteForward);
+    for (size_t i = 1; i < n; i++)
+    {
+        const Segment &left = segments[i - 1];
+        const Segment &right = segments[i];
+        f[i] = (left.width * right.discreteForward + right.width * left.discreteForward) / (left.width + right.width);
+    }
+    if (n > 1)
+    {
+        f[0] = segments[0].discreteForward - 0.5 * (f[1] - segments[0].discreteForward);
+        f[n] = segments[n - 1].discreteForward - 0.5 * (f[n - 1] - segments[n - 1].discreteForward);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        Segment &s = segments[i];
+        double g0 = f[i] - s.discreteForward;
+        double g1 = f[i + 1] - s.discreteForward;
+        s.g0 = g0;
+        s.g1 = g1;
+        s.eta = 0.0;
+        s.a = 0.0;
+        if ((g0 == 0.0 && g1 == 0.0) ||
+            (g0 < 0.0 && -0.5 * g0 <= g1 && g1 <= -2.0 * g0) ||
+            (g0 > 0.0 && -0.5 * g0 >= g1 && g1 >= -2.0 * g0))
+        {
+            s.sector = SECTOR_QUADRATIC;
+        }
+        else if ((g0 < 0.0 && g1 > -2.0 * g0) || (g0 > 0.0 && g1 < -2.0 * g0))
+        {
+            s.sector = SECTOR_FLAT_THEN_CURVED;
+            s.eta = (g1 + 2.0 * g0) / (g1 - g0);
+        }
+        else if ((g0 > 0.0 && g1 < 0.0) || (g0 < 0.0 && g1 > 0.0))
+        {
+            s.sector = SECTOR_CURVED_THEN_FLAT;
+            s.eta = 3.0 * g1 / (g1 - g0);
+        }
+        else
+        {
+            s.sector = SECTOR_BASIN;
+            s.eta = g1 / (g1 + g0);
+            s.a = -g0 * g1 / (g0 + g1);
+        }
+    }
+    finalForward = method == CurveInterpolation::LogLinear ? segments[n - 1].discreteForward : f[n];
+}
+
+size_t Curve::findSegment(double t) const
+{
+    if (!(t >= 0.0))
+    {
+        throw std::invalid_argument("Curve times cannot be negative");
+    }
+    return std::upper_bound(times.begin(), times.end(), t) - times.begin();
+}
+
+void Curve::evaluate(size_t segment, double t, double &integral, double &forward) const
+{
+    if (segment == segments.size())
+    {
+        integral = zeroRates.back() * times.back() + finalForward * (t - times.back());
+        forward = finalForward;
+        return;
+    }
+    const Segment &s = segments[segment];
+    if (method == CurveInterpolation::LogLinear)
+    {
+        integral = s.integral + s.discreteForward * (t - s.start);
+        forward = s.discreteForward;
+        return;
+    }
+    // g is the forward less the discrete forward and G its integral, in units of the segment width
+    double x = (t - s.start) / s.width;
+    double g;
+    double G;
+    switch (s.sector)
+    {
+    case SECTOR_QUADRATIC:
+        g = s.g0 * (1.0 - 4.0 * x + 3.0 * x * x) + s.g1 * (-2.0 * x + 3.0 * x * x);
+        G = s.g0 * (x - 2.0 * x * x + x * x * x) + s.g1 * (-x * x + x * x * x);
+        break;
+    case SECTOR_FLAT_THEN_CURVED:
+        if (x <= s.eta)
+        {
+            g = s.g0;
+            G = s.g0 * x;
+        }
+        else
+        {
+            double d = (x - s.eta) / (1.0 - s.eta);
+            g = s.g0 + (s.g1 - s.g0) * d * d;
+            G = s.g0 * x + (s.g1 - s.g0) * (x - s.eta) * d * d / 3.0;
+        }
+        break;
+    case SECTOR_CURVED_THEN_FLAT:
+        if (x < s.eta)
+        {
+            double d = (s.eta - x) / s.eta;
+            g = s.g1 + (s.g0 - s.g1) * d * d;
+            G = s.g1 * x + (s.g0 - s.g1) * (s.eta - (s.eta - x) * d * d) / 3.0;
+        }
+        else
+        {
+            g = s.g1;
+            G = s.g1 * x + (s.g0 - s.g1) * s.eta / 3.0;
+        }
+        break;
+    default:
+        // eta is 0 or 1 when g0 or g1 is 0, leaving a single branch
+        if (x <= s.eta && s.eta > 0.0)
+        {
+            double d = (s.eta - x) / s.eta;
+            g = s.a + (s.g0 - s.a) * d * d;
+            G = s.a * x + (s.g0 - s.a) * (s.eta - (s.eta - x) * d * d) / 3.0;
+        }
+        else
+        {
+            double d = (x - s.eta) / (1.0 - s.eta);
+            g = s.a + (s.g1 - s.a) * d * d;
+            G = s.a * x + (s.g0 - s.a) * s.eta / 3.0 + (s.g1 - s.a) * (x - s.eta) * d * d / 3.0;
+        }
+    }
+    integral = s.integral + s.width * (s.discreteForward * x + G);
+    forward = s.discreteForward + g;
+}
+
+double Curve::discountFactor(double t) const
+{
+    double integral;
+    double forward;
+    evaluate(findSegment(t), t, integral, forward);
+    return std::exp(-integral);
+}
+
+double Curve::zeroRate(double t) const
+{
+    double integral;
+    double forward;
+    evaluate(findSegment(t), t, integral, forward);
+    return t > 0.0 ? integral / t : forward;
+}
+
+double Curve::forwardRate(double t) const
+{
+    double integral;
+    double forward;
+    evaluate(findSegment(t), t, integral, forward);
+    return forward;
+}
+
+/*
+ *  Calls f(i, segment) for each of the increasing times, advancing through
+ *  the segments as the times pass their ends
+ */
+template <typename F>
+static void mergeWithPillars(const std::vector<double> &pillars, std::span<const double> times, F f)
+{
+    if (!times.empty() && !(times[0] >= 0.0))
+    {
+        throw std::invalid_argument("Curve times cannot be negative");
+    }
+    size_t segment = 0;
+    for (size_t i = 0; i < times.size(); i++)
+    {
+        if (i > 0 && !(times[i] >= times[i - 1]))
+        {
+            throw std::invalid_argument("Batch curve times must be sorted");
+        }
+        while (segment < pillars.size() && times[i] >= pillars[segment])
+        {
+            segment++;
+        }
+        f(i, segment);
+    }
+}
+
+void Curve::discountFactors(std::span<const double> t, std::span<double> result) const
+{
+    if (t.size() != result.size())
+    {
+        throw std::invalid_argument("Times and results differ in size");
+    }
+    mergeWithPillars(times, t, [&](size_t i, size_t segment)
+    {
+        double integral;
+        double forward;
+        evaluate(segment, t[i], integral, forward);
+        result[i] = std::exp(-integral);
+    });
+}
+
+void Curve::forwardRates(std::span<const double> t, std::span<double> result) const
+{
+    if (t.size() != result.size())
+    {
+        throw std::invalid_argument("Times and results differ in size");
+    }
+    mergeWithPillars(times, t, [&](size_t i, size_t segment)
+    {
+        double integral;
+        evaluate(segment, t[i], integral, result[i]);
+    });
+}
+
+static size_t hashTimes(const std::vector<double> &times)
+{
+    return std::hash<std::string_view>()(std::string_view((const char *)times.data(), times.size() * sizeof(double)));
+}
+
+std::shared_ptr<const std::vector<double>> Curve::cachedDiscountFactors(const std::vector<double> &t) const
+{
+    size_t hash = hashTimes(t);
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        for (const CacheEntry &entry : cache)
+        {
+            if (entry.hash == hash && entry.times == t)
+            {
+                return entry.values;
+            }
+        }
+    }
+    auto values = std::make_shared<std::vector<double>>(t.size());
+    discountFactors(t, *values);
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (cache.size() >= MAX_CACHED_SETS)
+    {
+        cache.erase(cache.begin());
+    }
+    cache.push_back(CacheEntry{hash, t, values});
+    return values;
+}
+
+void Curve::bump(double shift)
+{
+    for (double &rate : zeroRates)
+    {
+        rate += shift;
+    }
+    build();
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cache.clear();
+}
+
+void Curve::bumpPillar(size_t pillar, double shift)
+{
+    if (pillar >= zeroRates.size())
+    {
+        throw std::invalid_argument("No such pillar");
+    }
+    zeroRates[pillar] += shift;
+    build();
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cache.clear();
+}
+
+/*  Black-Scholes with the discount factors to maturity of the rate and of the dividend yield */
+static double blackScholesPrice(bool call,
+                                double strike,
+                                double maturity,
+                                double spot,
+                                double volatility,
+                                double rateDiscount,
+                                double dividendDiscount)
+{
+    double forward = spot * dividendDiscount / rateDiscount;
+    double volSqrtT = volatility * std::sqrt(maturity);
+    double d1 = (std::log(forward / strike) + 0.5 * volSqrtT * volSqrtT) / volSqrtT;
+    double d2 = d1 - volSqrtT;
+    if (call)
+    {
+        return spot * dividendDiscount * normcdf(d1) - strike * rateDiscount * normcdf(d2);
+    }
+    return strike * rateDiscount * normcdf(-d2) - spot * dividendDiscount * normcdf(-d1);
+}
+
+double blackScholesCallPrice(double strike,
+                             double maturity,
+                             double spot,
+                             double volatility,
+                             const Curve &rates,
+                             const Curve &dividends)
+{
+    return blackScholesPrice(true, strike, maturity, spot, volatility,
+                             rates.discountFactor(maturity), dividends.discountFactor(maturity));
+}
+
+double blackScholesPutPrice(double strike,
+                            double maturity,
+                            double spot,
+                            double volatility,
+                            const Curve &rates,
+                            const Curve &dividends)
+{
+    return blackScholesPrice(false, strike, maturity, spot, volatility,
+                             rates.discountFactor(maturity), dividends.discountFactor(maturity));
+}
+
+std::vector<double> blackScholesCallPrices(const std::vector<double> &strikes,
+                                           const std::vector<double> &maturities,
+                                           double spot,
+                                           const std::vector<double> &volatilities,
+                                           const Curve &rates,
+                                           const Curve &dividends)
+{
+    if (strikes.size() != maturities.size() || volatilities.size() != maturities.size())
+    {
+        throw std::invalid_argument("Strikes, maturities and volatilities differ in size");
+    }
+    std::shared_ptr<const std::vector<double>> rateDiscounts = rates.cachedDiscountFactors(maturities);
+    std::shared_ptr<const std::vector<double>> dividendDiscounts = dividends.cachedDiscountFactors(maturities);
+    std::vector<double> prices(maturities.size());
+    for (size_t i = 0; i < prices.size(); i++)
+    {
+        prices[i] = blackScholesPrice(true, strikes[i], maturities[i], spot, volatilities[i],
+                                      (*rateDiscounts)[i], (*dividendDiscounts)[i]);
+    }
+    return prices;
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+/*  A humped curve that exercises every monotone convex sector */
+static Curve humpedCurve(CurveInterpolation interpolation)
+{
+    return Curve({0.25, 0.5, 1.0, 2.0, 3.0, 5.0, 7.0, 10.0, 20.0, 30.0},
+                 {0.030, 0.032, 0.035, 0.041, 0.0435, 0.040, 0.039, 0.041, 0.044, 0.043},
+                 interpolation);
+}
+
+static std::vector<double> testMaturities()
+{
+    std::vector<double> maturities;
+    for (int i = 0; i <= 400; i++)
+    {
+        maturities.push_back(0.1 * i);
+    }
+    return maturities;
+}
+
+// Tests that a flat curve reproduces the flat rate pricers
+static void testFlatCurve()
+{
+    for (CurveInterpolation interpolation : {CurveInterpolation::LogLinear, CurveInterpolation::MonotoneConvex})
+    {
+        Curve rates({1.0, 5.0}, {0.05, 0.05}, interpolation);
+        Curve dividends({1.0}, {0.0}, interpolation);
+        for (double t : {0.0, 0.3, 1.0, 4.0, 12.0})
+        {
+            ASSERT_APPROX_EQUAL(rates.discountFactor(t), std::exp(-0.05 * t), 1e-14);
+            ASSERT_APPROX_EQUAL(rates.forwardRate(t), 0.05, 1e-14);
+        }
+        ASSERT_APPROX_EQUAL(blackScholesCallPrice(95.0, 2.0, 100.0, 0.25, rates, dividends),
+                            blackScholesCallPrice(95.0, 2.0, 100.0, 0.25, 0.05), 1e-12);
+        ASSERT_APPROX_EQUAL(blackScholesPutPrice(95.0, 2.0, 100.0, 0.25, rates, dividends),
+                            blackScholesPutPrice(95.0, 2.0, 100.0, 0.25, 0.05), 1e-12);
+    }
+}
+
+// Tests that both interpolations reprice the pillars and that the forwards integrate to the discount factors
+static void testInterpolation()
+{
+    for (CurveInterpolation interpolation : {CurveInterpolation::LogLinear, CurveInterpolation::MonotoneConvex})
+    {
+        Curve curve = humpedCurve(interpolation);
+        for (size_t i = 0; i < curve.pillarTimes().size(); i++)
+        {
+            double t = curve.pillarTimes()[i];
+            ASSERT_APPROX_EQUAL(curve.zeroRate(t), curve.pillarZeroRates()[i], 1e-14);
+        }
+        double h = 1e-5;
+        for (double t : testMaturities())
+        {
+            if (t > h)
+            {
+                double derivative = -(std::log(curve.discountFactor(t + h)) - std::log(curve.discountFactor(t - h))) / (2 * h);
+                // log-linear forwards jump at the pillars
+                bool atPillar = std::binary_search(curve.pillarTimes().begin(), curve.pillarTimes().end(), t);
+                if (interpolation == CurveInterpolation::MonotoneConvex || !atPillar)
+                {
+                    ASSERT_APPROX_EQUAL(derivative, curve.forwardRate(t), 1e-6);
+                }
+            }
+        }
+    }
+    // monotone convex forwards are continuous across the pillars
+    Curve curve = humpedCurve(CurveInterpolation::MonotoneConvex);
+    for (double t : curve.pillarTimes())
+    {
+        ASSERT_APPROX_EQUAL(curve.forwardRate(t - 1e-9), curve.forwardRate(t + 1e-9), 1e-7);
+    }
+}
+
+// Tests that batch evaluation matches the point lookups and that the cache follows bumps
+static void testBatchAndCache()
+{
+    Curve curve = humpedCurve(CurveInterpolation::MonotoneConvex);
+    std::vector<double> maturities = testMaturities();
+    std::vector<double> discounts(maturities.size());
+    std::vector<double> forwards(maturities.size());
+    curve.discountFactors(maturities, discounts);
+    curve.forwardRates(maturities, forwards);
+    for (size_t i = 0; i < maturities.size(); i++)
+    {
+        ASSERT(discounts[i] == curve.discountFactor(maturities[i]));
+        ASSERT(forwards[i] == curve.forwardRate(maturities[i]));
+    }
+
+    std::vector<double> unsorted{1.0, 0.5};
+    std::vector<double> result(2);
+    bool threw = false;
+    try
+    {
+        curve.discountFactors(unsorted, result);
+    }
+    catch (const std::invalid_argument &)
+    {
+        threw = true;
+    }
+    ASSERT(threw);
+
+    std::shared_ptr<const std::vector<double>> cached = curve.cachedDiscountFactors(maturities);
+    ASSERT(*cached == discounts);
+    ASSERT(curve.cachedDiscountFactors(maturities) == cached);
+    Curve copy = curve;
+    curve.bump(0.0001);
+    std::shared_ptr<const std::vector<double>> bumped = curve.cachedDiscountFactors(maturities);
+    ASSERT(bumped != cached);
+    ASSERT(*cached == discounts);
+    for (size_t i = 0; i < maturities.size(); i++)
+    {
+        ASSERT_APPROX_EQUAL((*bumped)[i], discounts[i] * std::exp(-0.0001 * maturities[i]), 1e-14);
+    }
+    ASSERT(*copy.cachedDiscountFactors(maturities) == discounts);
+
+    std::vector<double> strikes(maturities.size(), 100.0);
+    std::vector<double> volatilities(maturities.size(), 0.2);
+    Curve dividends({1.0, 10.0}, {0.01, 0.02}, CurveInterpolation::MonotoneConvex);
+    std::vector<double> prices = blackScholesCallPrices(strikes, maturities, 100.0, volatilities, curve, dividends);
+    for (size_t i = 1; i < maturities.size(); i++)
+    {
+        ASSERT_APPROX_EQUAL(prices[i], blackScholesCallPrice(100.0, maturities[i], 100.0, 0.2, curve, dividends), 1e-12);
+    }
+}
+
+void testCurve()
+{
+    TEST(testFlatCurve);
+    TEST(testInterpolation);
+    TEST(testBatchAndCache);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+/*  The curve and the maturities evaluated by the benchmarks */
+static std::unique_ptr<Curve> benchmarkCurveInstance;
+static std::vector<double> benchmarkMaturities;
+
+static void benchmarkPointLookups(size_t iterations)
+{
+    std::vector<double> discounts(benchmarkMaturities.size());
+    for (size_t i = 0; i < iterations; i++)
+    {
+        for (size_t j = 0; j < benchmarkMaturities.size(); j++)
+        {
+            discounts[j] = benchmarkCurveInstance->discountFactor(benchmarkMaturities[j]);
+        }
+        doNotOptimize(discounts.data());
+        clobberMemory();
+    }
+}
+
+static void benchmarkBatchEvaluation(size_t iterations)
+{
+    std::vector<double> discounts(benchmarkMaturities.size());
+    for (size_t i = 0; i < iterations; i++)
+    {
+        benchmarkCurveInstance->discountFactors(benchmarkMaturities, discounts);
+        doNotOptimize(discounts.data());
+        clobberMemory();
+    }
+}
+
+static void benchmarkCachedEvaluation(size_t iterations)
+{
+    for (size_t i = 0; i < iterations; i++)
+    {
+        doNotOptimize(benchmarkCurveInstance->cachedDiscountFactors(benchmarkMaturities));
+    }
+}
+
+void benchmarkCurve()
+{
+    // a 30 year curve with quarterly pillars, and an option chain of 5000 sorted maturities
+    std::vector<double> pillars;
+    std::vector<double> rates;
+    for (int i = 1; i <= 120; i++)
+    {
+        pillars.push_back(0.25 * i);
+        rates.push_back(0.03 + 0.01 * std::sin(0.1 * i));
+    }
+    std::vector<double> uniforms = randuniform(5000);
+    benchmarkMaturities.clear();
+    for (double u : uniforms)
+    {
+        benchmarkMaturities.push_back(30.0 * u);
+    }
+    std::sort(benchmarkMaturities.begin(), benchmarkMaturities.end());
+    size_t n = benchmarkMaturities.size();
+
+    for (CurveInterpolation interpolation : {CurveInterpolation::LogLinear, CurveInterpolation::MonotoneConvex})
+    {
+        std::cout << (interpolation == CurveInterpolation::LogLinear ? "log-linear" : "monotone convex")
+                  << " curve, " << pillars.size() << " pillars, " << n << " maturities\n";
+        benchmarkCurveInstance = std::make_unique<Curve>(pillars, rates, interpolation);
+        BENCHMARK_THROUGHPUT(benchmarkPointLookups, n, 0);
+        BENCHMARK_THROUGHPUT(benchmarkBatchEvaluation, n, 0);
+        BENCHMARK_THROUGHPUT(benchmarkCachedEvaluation, n, 0);
+    }
+    benchmarkCurveInstance.reset();
+}
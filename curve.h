@@ -0,0 +1,146 @@
+#pragma once
+
+#include "stdafx.h"
+#include <memory>
+#include <mutex>
+#include <span>
+
+/**
+ *  How a curve interpolates between its pillars
+ */
+enum class CurveInterpolation
+{
+    /** Log discount factors linear in time, i.e. piecewise flat forwards */
+    LogLinear,
+    /** Hagan and West's monotone convex method, continuous forwards that keep the shape of the data */
+    MonotoneConvex
+};
+
+/**
+ *  A term structure of continuously compounded zero rates, used for
+ *  discount curves and dividend yield curves.  The curve starts at time
+ *  zero with a discount factor of one, reprices every pillar exactly and
+ *  continues beyond the last pillar at its final forward rate.
+ *
+ *  Batch evaluation takes maturities in increasing order and walks them
+ *  and the pillars together, so the cost is one pass with no binary
+ *  search per maturity.  cachedDiscountFactors also remembers the values
+ *  for the maturity sets it has seen until the curve is bumped, as pricing
+ *  the same option chain tick after tick asks for the same maturities.
+ */
+class Curve
+{
+public:
+    Curve(const std::vector<double> &times,
+          const std::vector<double> &zeroRates,
+          CurveInterpolation interpolation = CurveInterpolation::LogLinear);
+    Curve(const Curve &other);
+    Curve &operator=(const Curve &other);
+
+    /** The discount factor to time t, looking up the pillar by binary search */
+    double discountFactor(double t) const;
+    /** The continuously compounded zero rate to time t */
+    double zeroRate(double t) const;
+    /** The instantaneous forward rate at time t */
+    double forwardRate(double t) const;
+
+    /** The discount factors at increasing maturities, throws if they are not sorted */
+    void discountFactors(std::span<const double> times, std::span<double> result) const;
+    /** The instantaneous forward rates at increasing maturities, throws if they are not sorted */
+    void forwardRates(std::span<const double> times, std::span<double> result) const;
+
+    /**
+     *  As discountFactors, returning the values computed for an identical
+     *  maturity set if there are any.  The values remain valid after the
+     *  curve is bumped, later calls return new ones.
+     */
+    std::shared_ptr<const std::vector<double>> cachedDiscountFactors(const std::vector<double> &times) const;
+
+    /** Shifts every zero rate by the same amount */
+    void bump(double shift);
+    /** Shifts the zero rate of one pillar */
+    void bumpPillar(size_t pillar, double shift);
+
+    const std::vector<double> &pillarTimes() const { return times; }
+    const std::vector<double> &pillarZeroRates() const { return zeroRates; }
+    CurveInterpolation interpolation() const { return method; }
+
+private:
+    /*  The interpolation between two pillars, precomputed when the curve is built */
+    struct Segment
+    {
+        double start;
+        double width;
+        /*  Integral of the forward rate up to the start, i.e. -log of the discount factor */
+        double integral;
+        double discreteForward;
+        /*  Monotone convex shape of the forward, see Hagan and West */
+        int sector;
+        double g0;
+        double g1;
+        double eta;
+        double a;
+    };
+
+    /*  A maturity set whose discount factors have been computed */
+    struct CacheEntry
+    {
+        size_t hash;
+        std::vector<double> times;
+        std::shared_ptr<const std::vector<double>> values;
+    };
+
+    void build();
+    size_t findSegment(double t) const;
+    void evaluate(size_t segment, double t, double &integral, double &forward) const;
+
+    CurveInterpolation method;
+    std::vector<double> times;
+    std::vector<double> zeroRates;
+    std::vector<Segment> segments;
+    double finalForward;
+    mutable std::mutex cacheMutex;
+    mutable std::vector<CacheEntry> cache;
+};
+
+/**
+ * Computes the price of a European call with discounting and dividend
+ * yields taken from curves
+ */
+double blackScholesCallPrice(double strike,
+                             double maturity,
+                             double spot,
+                             double volatility,
+                             const Curve &rates,
+                             const Curve &dividends);
+/**
+ * Computes the price of a European put with discounting and dividend
+ * yields taken from curves
+ */
+double blackScholesPutPrice(double strike,
+                            double maturity,
+                            double spot,
+                            double volatility,
+                            const Curve &rates,
+                            const Curve &dividends);
+
+/**
+ * Prices a chain of European calls sorted by maturity, reading the
+ * discount factors of both curves from their caches
+ */
+std::vector<double> blackScholesCallPrices(const std::vector<double> &strikes,
+                                           const std::vector<double> &maturities,
+                                           double spot,
+                                           const std::vector<double> &volatilities,
+                                           const Curve &rates,
+                                           const Curve &dividends);
+
+/**
+ *  Test function
+ */
+void testCurve();
+
+/**
+ *  Benchmark function
+ */
+void benchmarkCurve();
@@ -0,0 +1,294 @@
+#include "downsample.h"
+#include "matlib.h"
+#include "parallel.h"
+#include <chrono>
+
+/*  Minimum number of buckets handled by one thread */
+static const size_t MIN_BUCKETS_PER_THREAD = 64;
+/*  Buckets selected in sequence by Largest-Triangle-Three-Buckets.  The
+    first bucket of a group anchors on the average of the bucket before it,
+    so the groups are fixed rather than one per thread for the result not
+    to depend on the number of threads. */
+static const size_t LTTB_GROUP_BUCKETS = 64;
+/*  Marks a bucket without a point */
+static const size_t NO_POINT = (size_t)-1;
+
+static void checkSeries(const std::vector<double> &x, const std::vector<double> &y)
+{
+    if (x.size() != y.size())
+    {
+        throw std::invalid_argument("x and y must have the same size");
+    }
+}
+
+Series largestTriangleThreeBuckets(const std::vector<double> &x,
+                                   const std::vector<double> &y,
+                                   size_t maxPoints)
+{
+    checkSeries(x, y);
+    if (maxPoints < 3)
+    {
+        throw std::invalid_argument("Largest-Triangle-Three-Buckets needs at least 3 points");
+    }
+    size_t n = x.size();
+    if (n <= maxPoints)
+    {
+        return Series{x, y};
+    }
+
+    // the interior points are split into maxPoints - 2 buckets
+    size_t nBuckets = maxPoints - 2;
+    auto bucketStart = [&](size_t bucket)
+    {
+        return 1 + (size_t)((double)bucket * (n - 2) / nBuckets);
+    };
+    auto bucketAverage = [&](size_t bucket, double &averageX, double &averageY)
+    {
+        size_t first = bucketStart(bucket);
+        size_t last = bucketStart(bucket + 1);
+        double sumX = 0.0;
+        double sumY = 0.0;
+        for (size_t j = first; j < last; j++)
+        {
+            sumX += x[j];
+            sumY += y[j];
+        }
+        averageX = sumX / (last - first);
+        averageY = sumY / (last - first);
+    };
+
+    // each group is selected in one pass, the averages computed as they are needed
+    std::vector<size_t> selected(nBuckets);
+    size_t nGroups = (nBuckets + LTTB_GROUP_BUCKETS - 1) / LTTB_GROUP_BUCKETS;
+    parallelFor(nGroups, [&](size_t beginGroup, size_t endGroup)
+    {
+        for (size_t group = beginGroup; group < endGroup; group++)
+        {
+            size_t begin = group * LTTB_GROUP_BUCKETS;
+            size_t end = std::min(begin + LTTB_GROUP_BUCKETS, nBuckets);
+            double anchorX = x[0];
+            double anchorY = y[0];
+            if (begin > 0)
+            {
+                bucketAverage(begin - 1, anchorX, anchorY);
+            }
+            for (size_t bucket = begin; bucket < end; bucket++)
+            {
+                double nextX = x[n - 1];
+                double nextY = y[n - 1];
+                if (bucket + 1 < nBuckets)
+                {
+                    bucketAverage(bucket + 1, nextX, nextY);
+                }
+                size_t first = bucketStart(bucket);
+                size_t last = bucketStart(bucket + 1);
+                size_t best = first;
+                double bestArea = -1.0;
+                for (size_t j = first; j < last; j++)
+                {
+                    // twice the triangle area, the factor does not change the maximum
+                    double area = std::fabs((anchorX - nextX) * (y[j] - anchorY) - (anchorX - x[j]) * (nextY - anchorY));
+                    if (area > bestArea)
+                    {
+                        bestArea = area;
+                        best = j;
+                    }
+                }
+                selected[bucket] = best;
+                anchorX = x[best];
+                anchorY = y[best];
+            }
+        }
+    });
+
+    Series result;
+    result.x.reserve(maxPoints);
+    result.y.reserve(maxPoints);
+    result.x.push_back(x[0]);
+    result.y.push_back(y[0]);
+    for (size_t index : selected)
+    {
+        result.x.push_back(x[index]);
+        result.y.push_back(y[index]);
+    }
+    result.x.push_back(x[n - 1]);
+    result.y.push_back(y[n - 1]);
+    return result;
+}
+
+Series minMaxDecimate(const std::vector<double> &x,
+                      const std::vector<double> &y,
+                      size_t maxPoints)
+{
+    checkSeries(x, y);
+    if (maxPoints < 4)
+    {
+        throw std::invalid_argument("Min-max decimation needs at least 4 points");
+    }
+    size_t n = x.size();
+    if (n <= maxPoints)
+    {
+        return Series{x, y};
+    }
+
+    // the first and last points are kept, leaving two points per bucket
+    size_t nBuckets = (maxPoints - 2) / 2;
+    double lo = x[0];
+    double width = (x[n - 1] - lo) / nBuckets;
+    auto bucketStart = [&](size_t bucket)
+    {
+        if (bucket == 0)
+        {
+            return (size_t)0;
+        }
+        if (bucket >= nBuckets || !(width > 0))
+        {
+            return n;
+        }
+        return (size_t)(std::lower_bound(x.begin(), x.end(), lo + bucket * width) - x.begin());
+    };
+
+    std::vector<size_t> firstIndex(nBuckets, NO_POINT);
+    std::vector<size_t> secondIndex(nBuckets, NO_POINT);
+    parallelFor(nBuckets, [&](size_t begin, size_t end)
+    {
+        size_t first = bucketStart(begin);
+        for (size_t bucket = begin; bucket < end; bucket++)
+        {
+            size_t last = bucketStart(bucket + 1);
+            if (first < last)
+            {
+                size_t lowest = first;
+                size_t highest = first;
+                for (size_t j = first + 1; j < last; j++)
+                {
+                    lowest = y[j] < y[lowest] ? j : lowest;
+                    highest = y[j] > y[highest] ? j : highest;
+                }
+                firstIndex[bucket] = std::min(lowest, highest);
+                secondIndex[bucket] = lowest == highest ? NO_POINT : std::max(lowest, highest);
+            }
+            first = last;
+        }
+    }, MIN_BUCKETS_PER_THREAD);
+
+    Series result;
+    result.x.reserve(maxPoints);
+    result.y.reserve(maxPoints);
+    size_t previous = NO_POINT;
+    auto keep = [&](size_t index)
+    {
+        if (index != NO_POINT && index != previous)
+        {
+            result.x.push_back(x[index]);
+            result.y.push_back(y[index]);
+            previous = index;
+        }
+    };
+    keep(0);
+    for (size_t bucket = 0; bucket < nBuckets; bucket++)
+    {
+        keep(firstIndex[bucket]);
+        keep(secondIndex[bucket]);
+    }
+    keep(n - 1);
+    return result;
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+/*  A slow sine wave with one spike */
+static Series spikySeries(size_t n, size_t spikeAt)
+{
+    Series s;
+    for (size_t i = 0; i < n; i++)
+    {
+        s.x.push_back((double)i);
+        s.y.push_back(i == spikeAt ? 100.0 : std::sin(i * 0.01));
+    }
+    return s;
+}
+
+static bool contains(const std::vector<double> &values, double value)
+{
+    return std::find(values.begin(), values.end(), value) != values.end();
+}
+
+static void testLargestTriangleThreeBuckets()
+{
+    Series small = spikySeries(10, 3);
+    Series unchanged = largestTriangleThreeBuckets(small.x, small.y, 20);
+    ASSERT(unchanged.x == small.x && unchanged.y == small.y);
+
+    Series s = spikySeries(100000, 31337);
+    Series reduced = largestTriangleThreeBuckets(s.x, s.y, 500);
+    ASSERT(reduced.x.size() == 500);
+    ASSERT(reduced.x.front() == 0 && reduced.x.back() == 99999);
+    ASSERT(std::is_sorted(reduced.x.begin(), reduced.x.end()));
+    ASSERT(contains(reduced.y, 100.0));
+
+    int threads = numThreads();
+    for (int n : {1, 3, 8})
+    {
+        setNumThreads(n);
+        Series again = largestTriangleThreeBuckets(s.x, s.y, 500);
+        ASSERT(again.x == reduced.x && again.y == reduced.y);
+    }
+    setNumThreads(threads);
+}
+
+static void testMinMaxDecimate()
+{
+    Series s = spikySeries(100000, 77777);
+    Series reduced = minMaxDecimate(s.x, s.y, 400);
+    ASSERT(reduced.x.size() <= 400);
+    ASSERT(reduced.x.size() > 300);
+    ASSERT(reduced.x.front() == 0 && reduced.x.back() == 99999);
+    ASSERT(std::is_sorted(reduced.x.begin(), reduced.x.end()));
+    ASSERT(contains(reduced.y, 100.0));
+    // the global minimum and maximum of the sine are kept
+    ASSERT_APPROX_EQUAL(min(reduced.y), min(s.y), 1e-15);
+}
+
+void testDownsample()
+{
+    TEST(testLargestTriangleThreeBuckets);
+    TEST(testMinMaxDecimate);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+void benchmarkDownsample()
+{
+    size_t n = 20000000;
+    size_t budget = 2000;
+    Series s;
+    s.x.resize(n);
+    s.y.resize(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        s.x[i] = (double)i;
+        s.y[i] = std::sin(i * 1e-5) + 0.1 * std::sin(i * 0.37);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Series lttb = largestTriangleThreeBuckets(s.x, s.y, budget);
+    double lttbSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    Series minMax = minMaxDecimate(s.x, s.y, budget);
+    double minMaxSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "downsample n=" << n << " lttb to " << lttb.x.size() << " points (ratio " << (double)n / lttb.x.size()
+              << ") in " << lttbSeconds * 1e3 << "ms, " << n / lttbSeconds * 1e-6 << " M points/s\n";
+    std::cout << "downsample n=" << n << " min-max to " << minMax.x.size() << " points (ratio " << (double)n / minMax.x.size()
+              << ") in " << minMaxSeconds * 1e3 << "ms, " << n / minMaxSeconds * 1e-6 << " M points/s\n";
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "stdafx.h"
+
+/**
+ *  An x-y series of equal length vectors
+ */
+struct Series
+{
+    std::vector<double> x;
+    std::vector<double> y;
+};
+
+/**
+ * Reduces a series to at most maxPoints points with the
+ * Largest-Triangle-Three-Buckets algorithm, which keeps in each bucket the
+ * point forming the largest triangle with the point kept in the previous
+ * bucket and the average of the next bucket.  Buckets are processed in
+ * parallel in fixed groups of 64; the first bucket of each group anchors on
+ * the average of the bucket before it instead of its selected point, so
+ * the result does not depend on the number of threads.
+ * The first and last points are always kept and x must be sorted.
+ */
+Series largestTriangleThreeBuckets(const std::vector<double> &x,
+                                   const std::vector<double> &y,
+                                   size_t maxPoints);
+
+/**
+ * Reduces a series to at most maxPoints points by splitting the x range
+ * into maxPoints / 2 equal width buckets, one per pixel, and keeping the
+ * minimum and maximum of each bucket in their original order.  Every
+ * extreme is preserved, so spikes survive.  x must be sorted.
+ */
+Series minMaxDecimate(const std::vector<double> &x,
+                      const std::vector<double> &y,
+                      size_t maxPoints);
+
+/**
+ *  Test function
+ */
+void testDownsample();
+
+/**
+ *  Benchmark function
+ */
+void benchmarkDownsample();
@@ -1,9 +1,19 @@
 #include <iostream>
 #include <cmath>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <string>
 #include "geometry.h"
 #include "matlib.h"
+#include "parallel.h"
 #include "testing.h"
 
+/*  Queries answered by one task of the batch queries */
+static const size_t QUERY_BLOCK = 1024;
+/*  The grid is coarsened until it has at most this many cells per circle */
+static const double MAX_CELLS_PER_CIRCLE = 4.0;
+
 double getArea(double radius)
 {
     // Print the radius value if debugging is enabled
@@ -34,6 +44,259 @@ double getCircumference(double radius)
     return circumference;
 }
 
+void validateRadii(std::span<const double> radii)
+{
+    // an or reduction vectorizes, the position is only searched for once it has failed;
+    // a min reduction would not do, as std::min ignores a NaN after the first radius
+    bool bad = false;
+    for (double radius : radii)
+    {
+        bad |= !(radius >= 0);
+    }
+    if (bad)
+    {
+        size_t index = std::find_if(radii.begin(), radii.end(), [](double radius)
+        {
+            return !(radius >= 0);
+        }) - radii.begin();
+        throw std::invalid_argument("Radius cannot be negative or NaN, radius " + std::to_string(index) + " is " + std::to_string(radii[index]));
+    }
+}
+
+std::vector<double> getAreas(std::span<const double> radii)
+{
+    validateRadii(radii);
+    std::vector<double> areas(radii.size());
+    for (size_t i = 0; i < radii.size(); i++)
+    {
+        areas[i] = PI * (radii[i] * radii[i]);
+    }
+    return areas;
+}
+
+std::vector<double> getCircumferences(std::span<const double> radii)
+{
+    validateRadii(radii);
+    std::vector<double> circumferences(radii.size());
+    for (size_t i = 0; i < radii.size(); i++)
+    {
+        circumferences[i] = 2 * PI * radii[i];
+    }
+    return circumferences;
+}
+
+CircleGrid::CircleGrid(const Circles &circles, double cellSize)
+    : circles(circles), originX(0.0), originY(0.0), cellSize(cellSize), nx(1), ny(1)
+{
+    size_t n = circles.size();
+    if (circles.y.size() != n || circles.radius.size() != n)
+    {
+        throw std::invalid_argument("Circles must have as many radii as centres");
+    }
+    validateRadii(circles.radius);
+    // the cell of a circle is found by converting its bounds to integers
+    bool finite = true;
+    for (size_t i = 0; i < n; i++)
+    {
+        finite &= std::isfinite(circles.x[i]) & std::isfinite(circles.y[i]) & std::isfinite(circles.radius[i]);
+    }
+    if (!finite)
+    {
+        throw std::invalid_argument("Circle centres and radii must be finite");
+    }
+    if (n == 0)
+    {
+        this->cellSize = 1.0;
+        cellStart.assign(2, 0);
+        return;
+    }
+
+    double maxX = circles.x[0] + circles.radius[0];
+    double maxY = circles.y[0] + circles.radius[0];
+    originX = circles.x[0] - circles.radius[0];
+    originY = circles.y[0] - circles.radius[0];
+    double sumRadius = 0.0;
+    for (size_t i = 0; i < n; i++)
+    {
+        originX = std::min(originX, circles.x[i] - circles.radius[i]);
+        originY = std::min(originY, circles.y[i] - circles.radius[i]);
+        maxX = std::max(maxX, circles.x[i] + circles.radius[i]);
+        maxY = std::max(maxY, circles.y[i] + circles.radius[i]);
+        sumRadius += circles.radius[i];
+    }
+    double width = maxX - originX;
+    double height = maxY - originY;
+    if (!(this->cellSize > 0))
+    {
+        this->cellSize = 2 * sumRadius / n;
+    }
+    if (!(this->cellSize > 0))
+    {
+        this->cellSize = std::max(std::max(width, height) / std::sqrt((double)n), 1.0);
+    }
+    while ((width / this->cellSize + 1) * (height / this->cellSize + 1) > MAX_CELLS_PER_CIRCLE * n + 16)
+    {
+        this->cellSize *= 2;
+    }
+    nx = (size_t)(width / this->cellSize) + 1;
+    ny = (size_t)(height / this->cellSize) + 1;
+
+    // count the circles of each cell, then fill them in, so each cell's list is contiguous
+    cellStart.assign(nx * ny + 1, 0);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        std::vector<size_t> next(cellStart.begin(), cellStart.end() - 1);
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t x0 = cellX(circles.x[i] - circles.radius[i]);
+            size_t x1 = cellX(circles.x[i] + circles.radius[i]);
+            size_t y0 = cellY(circles.y[i] - circles.radius[i]);
+            size_t y1 = cellY(circles.y[i] + circles.radius[i]);
+            for (size_t cy = y0; cy <= y1; cy++)
+            {
+                for (size_t cx = x0; cx <= x1; cx++)
+                {
+                    if (pass == 0)
+                    {
+                        cellStart[cy * nx + cx + 1]++;
+                    }
+                    else
+                    {
+                        cellCircles[next[cy * nx + cx]++] = i;
+                    }
+                }
+            }
+        }
+        if (pass == 0)
+        {
+            for (size_t cell = 0; cell < nx * ny; cell++)
+            {
+                cellStart[cell + 1] += cellStart[cell];
+            }
+            cellCircles.resize(cellStart.back());
+        }
+    }
+}
+
+size_t CircleGrid::cellX(double x) const
+{
+    double position = std::floor((x - originX) / cellSize);
+    return (size_t)std::min(std::max(position, 0.0), (double)(nx - 1));
+}
+
+size_t CircleGrid::cellY(double y) const
+{
+    double position = std::floor((y - originY) / cellSize);
+    return (size_t)std::min(std::max(position, 0.0), (double)(ny - 1));
+}
+
+void CircleGrid::containing(double x, double y, std::vector<size_t> &result) const
+{
+    double positionX = (x - originX) / cellSize;
+    double positionY = (y - originY) / cellSize;
+    if (!(positionX >= 0 && positionX < nx && positionY >= 0 && positionY < ny))
+    {
+        return;
+    }
+    size_t cell = (size_t)positionY * nx + (size_t)positionX;
+    for (size_t k = cellStart[cell]; k < cellStart[cell + 1]; k++)
+    {
+        size_t i = cellCircles[k];
+        if (pointInCircle(x, y, circles.x[i], circles.y[i], circles.radius[i]))
+        {
+            result.push_back(i);
+        }
+    }
+}
+
+void CircleGrid::intersecting(double x, double y, double radius, std::vector<size_t> &result) const
+{
+    if (radius < 0)
+    {
+        throw std::invalid_argument("Radius cannot be negative");
+    }
+    if (circles.size() == 0 || !(x + radius >= originX && y + radius >= originY &&
+                                 x - radius <= originX + nx * cellSize && y - radius <= originY + ny * cellSize))
+    {
+        return;
+    }
+    size_t x0 = cellX(x - radius);
+    size_t x1 = cellX(x + radius);
+    size_t y0 = cellY(y - radius);
+    size_t y1 = cellY(y + radius);
+    for (size_t cy = y0; cy <= y1; cy++)
+    {
+        for (size_t cx = x0; cx <= x1; cx++)
+        {
+            size_t cell = cy * nx + cx;
+            for (size_t k = cellStart[cell]; k < cellStart[cell + 1]; k++)
+            {
+                size_t i = cellCircles[k];
+                // a circle in several of the cells is only reported from the first one they share
+                size_t firstX = std::max(x0, cellX(circles.x[i] - circles.radius[i]));
+                size_t firstY = std::max(y0, cellY(circles.y[i] - circles.radius[i]));
+                if (firstX == cx && firstY == cy &&
+                    circlesOverlap(x, y, radius, circles.x[i], circles.y[i], circles.radius[i]))
+                {
+                    result.push_back(i);
+                }
+            }
+        }
+    }
+}
+
+/*  Runs query(q, indices) for every query in parallel blocks and joins the answers in order */
+template <typename Query>
+static QueryResults runQueries(size_t nQueries, Query query)
+{
+    size_t nBlocks = (nQueries + QUERY_BLOCK - 1) / QUERY_BLOCK;
+    std::vector<std::vector<size_t>> blockCounts(nBlocks);
+    std::vector<std::vector<size_t>> blockIndices(nBlocks);
+    parallelFor(nBlocks, [&](size_t begin, size_t end)
+    {
+        for (size_t block = begin; block < end; block++)
+        {
+            size_t last = std::min(nQueries, (block + 1) * QUERY_BLOCK);
+            for (size_t q = block * QUERY_BLOCK; q < last; q++)
+            {
+                size_t before = blockIndices[block].size();
+                query(q, blockIndices[block]);
+                blockCounts[block].push_back(blockIndices[block].size() - before);
+            }
+        }
+    });
+
+    QueryResults results;
+    results.offsets.reserve(nQueries + 1);
+    results.offsets.push_back(0);
+    for (size_t block = 0; block < nBlocks; block++)
+    {
+        for (size_t count : blockCounts[block])
+        {
+            results.offsets.push_back(results.offsets.back() + count);
+        }
+        results.indices.insert(results.indices.end(), blockIndices[block].begin(), blockIndices[block].end());
+    }
+    return results;
+}
+
+QueryResults CircleGrid::containing(const Points &points) const
+{
+    return runQueries(points.size(), [&](size_t q, std::vector<size_t> &indices)
+    {
+        containing(points.x[q], points.y[q], indices);
+    });
+}
+
+QueryResults CircleGrid::intersecting(const Circles &queries) const
+{
+    validateRadii(queries.radius);
+    return runQueries(queries.size(), [&](size_t q, std::vector<size_t> &indices)
+    {
+        intersecting(queries.x[q], queries.y[q], queries.radius[q], indices);
+    });
+}
+
 ///////////////////////////////////////////////
 //
 //   TESTS
@@ -86,8 +349,268 @@ static void testCircumference()
     ASSERT_APPROX_EQUAL(getCircumference(PI), 19.7392088021787, 1e-7);
 }
 
+static void testBatchKernels()
+{
+    std::vector<double> radii = {0.0, 1.0, 2.5, PI, 1e6};
+    std::vector<double> areas = getAreas(radii);
+    std::vector<double> circumferences = getCircumferences(radii);
+    for (size_t i = 0; i < radii.size(); i++)
+    {
+        ASSERT(areas[i] == getArea(radii[i]));
+        ASSERT(circumferences[i] == getCircumference(radii[i]));
+    }
+    for (double bad : {-1.0, std::numeric_limits<double>::quiet_NaN()})
+    {
+        radii[3] = bad;
+        bool threw = false;
+        try
+        {
+            getAreas(radii);
+        }
+        catch (const std::invalid_argument &)
+        {
+            threw = true;
+        }
+        ASSERT(threw);
+    }
+}
+
+static void testPrimitives()
+{
+    ASSERT_APPROX_EQUAL(distance(0, 0, 3, 4), 5.0, 1e-15);
+    ASSERT(pointInCircle(1, 1, 0, 0, 2));
+    ASSERT(pointInCircle(2, 0, 0, 0, 2));
+    ASSERT(!pointInCircle(2, 2, 0, 0, 2));
+    ASSERT(circlesOverlap(0, 0, 1, 3, 0, 2));
+    ASSERT(!circlesOverlap(0, 0, 1, 3.1, 0, 2));
+}
+
+/*  Random circles and points in a square of the given side */
+static Circles randomCircles(size_t n, double side, double maxRadius)
+{
+    Circles circles;
+    std::vector<double> u = randuniform((int)(3 * n));
+    for (size_t i = 0; i < n; i++)
+    {
+        circles.x.push_back(side * u[3 * i]);
+        circles.y.push_back(side * u[3 * i + 1]);
+        circles.radius.push_back(maxRadius * u[3 * i + 2]);
+    }
+    return circles;
+}
+
+static void bruteForceContaining(const Circles &circles, double x, double y, std::vector<size_t> &result)
+{
+    for (size_t i = 0; i < circles.size(); i++)
+    {
+        if (pointInCircle(x, y, circles.x[i], circles.y[i], circles.radius[i]))
+        {
+            result.push_back(i);
+        }
+    }
+}
+
+static void bruteForceIntersecting(const Circles &circles, double x, double y, double radius, std::vector<size_t> &result)
+{
+    for (size_t i = 0; i < circles.size(); i++)
+    {
+        if (circlesOverlap(x, y, radius, circles.x[i], circles.y[i], circles.radius[i]))
+        {
+            result.push_back(i);
+        }
+    }
+}
+
+static std::vector<size_t> sorted(std::span<const size_t> indices)
+{
+    std::vector<size_t> copy(indices.begin(), indices.end());
+    std::sort(copy.begin(), copy.end());
+    return copy;
+}
+
+static void testCircleGrid()
+{
+    Circles circles = randomCircles(2000, 100.0, 5.0);
+    // one circle much larger than the cells
+    circles.x.push_back(50.0);
+    circles.y.push_back(50.0);
+    circles.radius.push_back(30.0);
+    CircleGrid grid(circles);
+    ASSERT(grid.cellsX() > 1 && grid.cellsY() > 1);
+
+    Circles queries = randomCircles(3000, 120.0, 8.0);
+    Points points{queries.x, queries.y};
+    for (double &x : points.x)
+    {
+        x -= 10.0;
+    }
+    QueryResults containing = grid.containing(points);
+    QueryResults intersecting = grid.intersecting(queries);
+    ASSERT(containing.size() == points.size());
+    ASSERT(intersecting.size() == queries.size());
+    for (size_t q = 0; q < points.size(); q++)
+    {
+        std::vector<size_t> expected;
+        bruteForceContaining(circles, points.x[q], points.y[q], expected);
+        ASSERT(sorted(containing[q]) == expected);
+        expected.clear();
+        bruteForceIntersecting(circles, queries.x[q], queries.y[q], queries.radius[q], expected);
+        ASSERT(sorted(intersecting[q]) == expected);
+    }
+
+    for (int field = 0; field < 3; field++)
+    {
+        Circles bad = randomCircles(10, 100.0, 5.0);
+        double nan = std::numeric_limits<double>::quiet_NaN();
+        double inf = std::numeric_limits<double>::infinity();
+        (field == 0 ? bad.x[4] : field == 1 ? bad.y[4] : bad.radius[4]) = field == 2 ? nan : inf;
+        bool threw = false;
+        try
+        {
+            CircleGrid rejected(bad);
+        }
+        catch (const std::invalid_argument &)
+        {
+            threw = true;
+        }
+        ASSERT(threw);
+    }
+
+    CircleGrid empty{Circles()};
+    std::vector<size_t> none;
+    empty.containing(1.0, 1.0, none);
+    empty.intersecting(1.0, 1.0, 1.0, none);
+    ASSERT(none.empty());
+}
+
 void testGeometry()
 {
     TEST(testArea);
     TEST(testCircumference);
-}
\ No newline at end of file
+    TEST(testBatchKernels);
+    TEST(testPrimitives);
+    TEST(testCircleGrid);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+void benchmarkGeometry()
+{
+    size_t n = 10000000;
+    std::vector<double> radii = randuniform((int)n);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<double> scalarAreas(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        scalarAreas[i] = getArea(radii[i]);
+    }
+    double scalarSeconds = secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    std::vector<double> areas = getAreas(radii);
+    double batchSeconds = secondsSince(start);
+    std::cout << "geometry areas n=" << n << " scalar " << n / scalarSeconds * 1e-6 << " M/s, batch "
+              << n / batchSeconds * 1e-6 << " M/s" << (areas == scalarAreas ? "" : " (MISMATCH)") << "\n";
+
+    size_t nCircles = 100000;
+    size_t nQueries = 100000;
+    size_t nBruteForce = 1000;
+    Circles circles = randomCircles(nCircles, 1000.0, 3.0);
+    Circles queries = randomCircles(nQueries, 1000.0, 3.0);
+    Points points{queries.x, queries.y};
+
+    start = std::chrono::steady_clock::now();
+    CircleGrid grid(circles);
+    double buildSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    QueryResults containing = grid.containing(points);
+    double containingSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    QueryResults intersecting = grid.intersecting(queries);
+    double intersectingSeconds = secondsSince(start);
+
+    std::vector<size_t> bruteContaining;
+    start = std::chrono::steady_clock::now();
+    for (size_t q = 0; q < nBruteForce; q++)
+    {
+        bruteForceContaining(circles, points.x[q], points.y[q], bruteContaining);
+    }
+    double bruteContainingSeconds = secondsSince(start);
+
+    std::vector<size_t> bruteIntersecting;
+    start = std::chrono::steady_clock::now();
+    for (size_t q = 0; q < nBruteForce; q++)
+    {
+        bruteForceIntersecting(circles, queries.x[q], queries.y[q], queries.radius[q], bruteIntersecting);
+    }
+    double bruteIntersectingSeconds = secondsSince(start);
+
+    std::cout << "geometry grid " << nCircles << " circles, " << grid.cellsX() << "x" << grid.cellsY()
+              << " cells built in " << buildSeconds * 1e3 << "ms\n"
+              << "  containing   grid " << nQueries / containingSeconds << " queries/s ("
+              << containing.indices.size() << " hits), brute force " << nBruteForce / bruteContainingSeconds << " queries/s\n"
+              << "  intersecting grid " << nQueries / intersectingSeconds << " queries/s ("
+              << intersecting.indices.size() << " hits), brute force " << nBruteForce / bruteIntersectingSeconds << " queries/s\n";
+}
+/*  Inputs cycled through by the microbenchmarks */
+static Circles benchmarkCircles;
+static std::unique_ptr<CircleGrid> benchmarkGrid;
+static const size_t BENCHMARK_INPUT_MASK = 1023;
+
+static void benchmarkGetArea(size_t iterations)
+{
+    for (size_t i = 0; i < iterations; i++)
+    {
+        doNotOptimize(getArea(benchmarkCircles.radius[i & BENCHMARK_INPUT_MASK]));
+    }
+}
+
+static void benchmarkGetAreas(size_t iterations)
+{
+    std::span<const double> radii(benchmarkCircles.radius.data(), BENCHMARK_INPUT_MASK + 1);
+    for (size_t i = 0; i < iterations; i++)
+    {
+        doNotOptimize(getAreas(radii));
+    }
+}
+
+static void benchmarkGridContaining(size_t iterations)
+{
+    std::vector<size_t> found;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        found.clear();
+        // swapping the coordinates gives query points unrelated to the centres
+        size_t q = i & BENCHMARK_INPUT_MASK;
+        benchmarkGrid->containing(benchmarkCircles.y[q], benchmarkCircles.x[q], found);
+        doNotOptimize(found.data());
+    }
+}
+
+static void benchmarkGridIntersecting(size_t iterations)
+{
+    std::vector<size_t> found;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        found.clear();
+        size_t q = i & BENCHMARK_INPUT_MASK;
+        benchmarkGrid->intersecting(benchmarkCircles.y[q], benchmarkCircles.x[q], benchmarkCircles.radius[q], found);
+        doNotOptimize(found.data());
+    }
+}
+
+void microbenchmarkGeometry()
+{
+    benchmarkCircles = randomCircles(100000, 1000.0, 3.0);
+    benchmarkGrid = std::make_unique<CircleGrid>(benchmarkCircles);
+    BENCHMARK_THROUGHPUT(benchmarkGetArea, 1, 0);
+    BENCHMARK_THROUGHPUT(benchmarkGetAreas, BENCHMARK_INPUT_MASK + 1, 0);
+    BENCHMARK_THROUGHPUT(benchmarkGridContaining, 1, 0);
+    BENCHMARK_THROUGHPUT(benchmarkGridIntersecting, 1, 0);
+    benchmarkGrid.reset();
+}
@@ -1,11 +1,135 @@
 #pragma once
 
 #include "matlib.h"
+#include <span>
 
 /** Computes the area of a circle with radius r */
-double area(double radius);
+double getArea(double radius);
 /** Computes the circumference of a circle with radius r */
-double circumference(double radius);
+double getCircumference(double radius);
+
+/**
+ *  Points stored as separate x and y arrays, so batch kernels read
+ *  contiguous doubles
+ */
+struct Points
+{
+    std::vector<double> x;
+    std::vector<double> y;
+
+    size_t size() const { return x.size(); }
+};
+
+/**
+ *  Circles stored as separate centre and radius arrays
+ */
+struct Circles
+{
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> radius;
+
+    size_t size() const { return x.size(); }
+};
+
+/**
+ * Throws if any radius is negative or NaN.  The check is a single branch free
+ * pass over the radii, so the batch kernels themselves do not branch.
+ */
+void validateRadii(std::span<const double> radii);
+
+/** Computes the area of every circle, throws if a radius is negative */
+std::vector<double> getAreas(std::span<const double> radii);
+/** Computes the circumference of every circle, throws if a radius is negative */
+std::vector<double> getCircumferences(std::span<const double> radii);
+
+/** The distance between two points */
+inline double distance(double x1, double y1, double x2, double y2)
+{
+    double dx = x2 - x1;
+    double dy = y2 - y1;
+    return std::sqrt(dx * dx + dy * dy);
+}
+
+/** Whether a point lies inside or on a circle */
+inline bool pointInCircle(double x, double y, double centreX, double centreY, double radius)
+{
+    double dx = x - centreX;
+    double dy = y - centreY;
+    return dx * dx + dy * dy <= radius * radius;
+}
+
+/** Whether two circles overlap or touch */
+inline bool circlesOverlap(double x1, double y1, double radius1, double x2, double y2, double radius2)
+{
+    double dx = x2 - x1;
+    double dy = y2 - y1;
+    double reach = radius1 + radius2;
+    return dx * dx + dy * dy <= reach * reach;
+}
+
+/**
+ *  The answers to a batch of queries, the circles matching query i are
+ *  indices[offsets[i]] to indices[offsets[i + 1] - 1]
+ */
+struct QueryResults
+{
+    std::vector<size_t> offsets;
+    std::vector<size_t> indices;
+
+    size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    std::span<const size_t> operator[](size_t query) const
+    {
+        return std::span<const size_t>(indices.data() + offsets[query], offsets[query + 1] - offsets[query]);
+    }
+};
+
+/**
+ *  A uniform grid over a set of circles.  Each cell lists the circles
+ *  whose bounding box touches it, so a point query only tests the circles
+ *  of one cell and a circle query those of the cells its bounding box
+ *  covers.  The cell size defaults to the mean diameter, enlarged if that
+ *  would make the grid much bigger than the number of circles.  The
+ *  circles are copied, so the grid does not depend on the caller's data.
+ *  The centres and radii must be finite.
+ */
+class CircleGrid
+{
+public:
+    explicit CircleGrid(const Circles &circles, double cellSize = 0.0);
+
+    /** Appends the indices of the circles containing the point */
+    void containing(double x, double y, std::vector<size_t> &result) const;
+    /** Appends the indices of the circles overlapping the given circle */
+    void intersecting(double x, double y, double radius, std::vector<size_t> &result) const;
+
+    /** The circles containing each point, queries run in parallel */
+    QueryResults containing(const Points &points) const;
+    /** The circles overlapping each query circle, queries run in parallel */
+    QueryResults intersecting(const Circles &queries) const;
+
+    size_t cellsX() const { return nx; }
+    size_t cellsY() const { return ny; }
+
+private:
+    size_t cellX(double x) const;
+    size_t cellY(double y) const;
+
+    Circles circles;
+    double originX;
+    double originY;
+    double cellSize;
+    size_t nx;
+    size_t ny;
+    std::vector<size_t> cellStart;
+    std::vector<size_t> cellCircles;
+};
 
 /** Test function */
-void testGeometry();
\ No newline at end of file
+void testGeometry();
+
+/** Benchmark function */
+void benchmarkGeometry();
+
+/** Microbenchmarks of the hot paths, see BENCHMARK in testing.h */
+void microbenchmarkGeometry();
@@ -0,0 +1,408 @@
+#include "kde.h"
+#include "charts.h"
+#include "matlib.h"
+#include "parallel.h"
+#include <chrono>
+#include <complex>
+#include <limits>
+#include <mutex>
+
+/*  The grid extends this many bandwidths beyond the data */
+static const double GRID_PADDING = 4.0;
+/*  The kernel is truncated this many bandwidths from its centre, where it is below 1e-8 of its peak */
+static const double KERNEL_SUPPORT = 6.0;
+/*  Values binned per thread */
+static const size_t BINNING_CHUNK = 1 << 16;
+/*  The quartiles for Silverman's rule are estimated from at most this many values */
+static const size_t QUARTILE_SAMPLE = 1 << 20;
+
+typedef std::complex<double> Complex;
+
+/*  Throws unless every value is finite, a NaN or infinity would make the grid and bin indices meaningless */
+static void checkFinite(std::span<const double> values)
+{
+    bool finite = true;
+    for (double value : values)
+    {
+        finite &= std::isfinite(value);
+    }
+    if (!finite)
+    {
+        throw std::invalid_argument("A density needs finite values");
+    }
+}
+
+double kernelBandwidth(std::span<const double> values, Bandwidth rule)
+{
+    if (values.size() < 2)
+    {
+        throw std::invalid_argument("A bandwidth needs at least two values");
+    }
+    checkFinite(values);
+    double spread = standardDeviation(values);
+    if (rule == Bandwidth::Silverman)
+    {
+        // the quartiles of an evenly strided sample are plenty for a rule of thumb
+        size_t stride = std::max<size_t>(1, values.size() / QUARTILE_SAMPLE);
+        std::vector<double> sample;
+        for (size_t i = 0; i < values.size(); i += stride)
+        {
+            sample.push_back(values[i]);
+        }
+        double iqr = prctile(sample, 75) - prctile(sample, 25);
+        if (iqr > 0.0)
+        {
+            spread = std::min(spread, iqr / 1.34);
+        }
+    }
+    double factor = rule == Bandwidth::Silverman ? 0.9 : 1.06;
+    double bandwidth = factor * spread * std::pow((double)values.size(), -0.2);
+    if (!(bandwidth > 0.0))
+    {
+        throw std::invalid_argument("Cannot choose a bandwidth for values that are all equal");
+    }
+    return bandwidth;
+}
+
+/*
+ *  In place iterative radix-2 FFT, the size a power of two.  The inverse
+ *  is unscaled.
+ */
+static void fft(std::vector<Complex> &data, bool inverse)
+{
+    size_t n = data.size();
+    // bit reversal permutation
+    for (size_t i = 1, j = 0; i < n; i++)
+    {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+        {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j)
+        {
+            std::swap(data[i], data[j]);
+        }
+    }
+    // the roots of unity, computed directly so that their error does not accumulate
+    std::vector<Complex> roots(n / 2);
+    double sign = inverse ? 1.0 : -1.0;
+    for (size_t k = 0; k < n / 2; k++)
+    {
+        roots[k] = std::polar(1.0, sign * 2.0 * PI * k / n);
+    }
+    for (size_t length = 2; length <= n; length <<= 1)
+    {
+        size_t half = length / 2;
+        size_t step = n / length;
+        for (size_t start = 0; start < n; start += length)
+        {
+            for (size_t k = 0; k < half; k++)
+            {
+                Complex odd = data[start + k + half] * roots[k * step];
+                data[start + k + half] = data[start + k] - odd;
+                data[start + k] += odd;
+            }
+        }
+    }
+}
+
+/*  Shares each value between its two nearest grid points in proportion to their closeness */
+static std::vector<double> linearBinning(std::span<const double> values, double lo, double spacing, size_t gridPoints)
+{
+    std::vector<double> weights(gridPoints, 0.0);
+    std::mutex weightsMutex;
+    double scale = 1.0 / spacing;
+    parallelFor(values.size(), [&](size_t begin, size_t end)
+    {
+        std::vector<double> local(gridPoints, 0.0);
+        for (size_t i = begin; i < end; i++)
+        {
+            double position = (values[i] - lo) * scale;
+            size_t j = std::min((size_t)position, gridPoints - 2);
+            double fraction = position - j;
+            local[j] += 1.0 - fraction;
+            local[j + 1] += fraction;
+        }
+        std::lock_guard<std::mutex> lock(weightsMutex);
+        for (size_t j = 0; j < gridPoints; j++)
+        {
+            weights[j] += local[j];
+        }
+    }, BINNING_CHUNK);
+    return weights;
+}
+
+DensityEstimate kernelDensity(std::span<const double> values, Bandwidth rule, size_t gridPoints)
+{
+    return kernelDensity(values, kernelBandwidth(values, rule), gridPoints);
+}
+
+DensityEstimate kernelDensity(std::span<const double> values, double bandwidth, size_t gridPoints)
+{
+    if (values.empty() || !(bandwidth > 0.0) || gridPoints < 2)
+    {
+        throw std::invalid_argument("A density needs values, a positive bandwidth and at least two grid points");
+    }
+    checkFinite(values);
+    DensityEstimate estimate;
+    estimate.bandwidth = bandwidth;
+    double lo = min(values) - GRID_PADDING * bandwidth;
+    double hi = max(values) + GRID_PADDING * bandwidth;
+    double spacing = (hi - lo) / (gridPoints - 1);
+    estimate.x.resize(gridPoints);
+    for (size_t j = 0; j < gridPoints; j++)
+    {
+        estimate.x[j] = lo + j * spacing;
+    }
+    std::vector<double> weights = linearBinning(values, lo, spacing, gridPoints);
+
+    // zero padding to at least gridPoints + kernelPoints stops the circular convolution wrapping around
+    size_t kernelPoints = std::min(gridPoints - 1, (size_t)std::ceil(KERNEL_SUPPORT * bandwidth / spacing));
+    size_t size = 1;
+    while (size < gridPoints + kernelPoints)
+    {
+        size <<= 1;
+    }
+    std::vector<Complex> binned(size);
+    std::vector<Complex> kernel(size);
+    for (size_t j = 0; j < gridPoints; j++)
+    {
+        binned[j] = weights[j];
+    }
+    double normalisation = 1.0 / (values.size() * bandwidth * ROOT_2_PI);
+    for (size_t l = 0; l <= kernelPoints; l++)
+    {
+        double u = l * spacing / bandwidth;
+        double k = normalisation * std::exp(-0.5 * u * u);
+        kernel[l] = k;
+        if (l > 0)
+        {
+            kernel[size - l] = k;
+        }
+    }
+    fft(binned, false);
+    fft(kernel, false);
+    for (size_t i = 0; i < size; i++)
+    {
+        binned[i] *= kernel[i];
+    }
+    fft(binned, true);
+    estimate.density.resize(gridPoints);
+    for (size_t j = 0; j < gridPoints; j++)
+    {
+        // rounding can leave tiny negative values far out in the tails
+        estimate.density[j] = std::max(binned[j].real() / size, 0.0);
+    }
+    return estimate;
+}
+
+std::vector<double> kernelDensityAt(std::span<const double> values, double bandwidth, const std::vector<double> &points)
+{
+    if (values.empty() || !(bandwidth > 0.0))
+    {
+        throw std::invalid_argument("A density needs values and a positive bandwidth");
+    }
+    checkFinite(values);
+    std::vector<double> density(points.size());
+    double normalisation = 1.0 / (values.size() * bandwidth * ROOT_2_PI);
+    double scale = 1.0 / bandwidth;
+    parallelFor(points.size(), [&](size_t begin, size_t end)
+    {
+        for (size_t j = begin; j < end; j++)
+        {
+            double sum = 0.0;
+            for (double value : values)
+            {
+                double u = (points[j] - value) * scale;
+                sum += std::exp(-0.5 * u * u);
+            }
+            density[j] = normalisation * sum;
+        }
+    });
+    return density;
+}
+
+void densityPlot(const std::string &file, std::span<const double> values, Bandwidth rule)
+{
+    densityPlot(file, kernelDensity(values, rule));
+}
+
+void densityPlot(const std::string &file, const DensityEstimate &estimate)
+{
+    plot(file, estimate.x, estimate.density);
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+static double normalDensity(double x)
+{
+    return std::exp(-0.5 * x * x) / ROOT_2_PI;
+}
+
+// Tests the rules of thumb on data with a known spread
+static void testBandwidth()
+{
+    std::vector<double> values;
+    for (int i = 0; i < 1000; i++)
+    {
+        values.push_back(i % 2 == 0 ? -1.0 : 1.0);
+    }
+    // the standard deviation of +-1 is just over 1 and the IQR is 2, so both rules use the deviation
+    double deviation = standardDeviation(values);
+    ASSERT_APPROX_EQUAL(kernelBandwidth(values, Bandwidth::Scott), 1.06 * deviation * std::pow(1000.0, -0.2), 1e-12);
+    ASSERT_APPROX_EQUAL(kernelBandwidth(values, Bandwidth::Silverman), 0.9 * deviation * std::pow(1000.0, -0.2), 1e-12);
+    // outliers inflate the deviation but not the IQR, which Silverman's rule then uses
+    values.push_back(1000.0);
+    values.push_back(-1000.0);
+    double iqr = prctile(values, 75) - prctile(values, 25);
+    ASSERT_APPROX_EQUAL(kernelBandwidth(values, Bandwidth::Silverman), 0.9 * iqr / 1.34 * std::pow(1002.0, -0.2), 1e-12);
+    bool threw = false;
+    try
+    {
+        kernelBandwidth(std::vector<double>(10, 3.0));
+    }
+    catch (const std::invalid_argument &)
+    {
+        threw = true;
+    }
+    ASSERT(threw);
+}
+
+// Tests the binned estimate against exact evaluation and the true density
+static void testAgainstDirectEvaluation()
+{
+    std::vector<double> values = randn(20000);
+    DensityEstimate estimate = kernelDensity(values);
+    ASSERT(estimate.x.size() == 1024);
+    std::vector<double> exact = kernelDensityAt(values, estimate.bandwidth, estimate.x);
+    double spacing = estimate.x[1] - estimate.x[0];
+    double integral = 0.0;
+    for (size_t j = 0; j < estimate.x.size(); j++)
+    {
+        ASSERT_APPROX_EQUAL(estimate.density[j], exact[j], 1e-4);
+        integral += estimate.density[j] * spacing;
+        if (std::fabs(estimate.x[j]) < 2.0)
+        {
+            ASSERT_APPROX_EQUAL(estimate.density[j], normalDensity(estimate.x[j]), 0.03);
+        }
+    }
+    ASSERT_APPROX_EQUAL(integral, 1.0, 1e-3);
+}
+
+// Tests that non-finite values are rejected rather than binned
+static void testNonFiniteValues()
+{
+    for (double bad : {std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::infinity()})
+    {
+        std::vector<double> values = randn(1000);
+        values[500] = bad;
+        int threw = 0;
+        try
+        {
+            kernelDensity(values);
+        }
+        catch (const std::invalid_argument &)
+        {
+            threw++;
+        }
+        try
+        {
+            kernelDensity(values, 0.1);
+        }
+        catch (const std::invalid_argument &)
+        {
+            threw++;
+        }
+        try
+        {
+            kernelDensityAt(values, 0.1, {0.0});
+        }
+        catch (const std::invalid_argument &)
+        {
+            threw++;
+        }
+        ASSERT(threw == 3);
+    }
+}
+
+// Tests a shifted and scaled sample and the plot output
+static void testDensityPlot()
+{
+    std::vector<double> values = randn(50000);
+    for (double &value : values)
+    {
+        value = 5.0 + 2.0 * value;
+    }
+    DensityEstimate estimate = kernelDensity(values, Bandwidth::Scott, 512);
+    size_t peak = std::max_element(estimate.density.begin(), estimate.density.end()) - estimate.density.begin();
+    ASSERT_APPROX_EQUAL(estimate.x[peak], 5.0, 0.3);
+    ASSERT_APPROX_EQUAL(estimate.density[peak], normalDensity(0.0) / 2.0, 0.02);
+
+    densityPlot("DensityChart.html", values);
+    std::ifstream in("DensityChart.html");
+    std::stringstream contents;
+    contents << in.rdbuf();
+    ASSERT(contents.str().find("data.addRows") != std::string::npos);
+    in.close();
+    std::remove("DensityChart.html");
+}
+
+void testKde()
+{
+    TEST(testBandwidth);
+    TEST(testAgainstDirectEvaluation);
+    TEST(testNonFiniteValues);
+    TEST(testDensityPlot);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+/*  The largest difference between two densities */
+static double maxDifference(const std::vector<double> &a, const std::vector<double> &b)
+{
+    double difference = 0.0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        difference = std::max(difference, std::fabs(a[i] - b[i]));
+    }
+    return difference;
+}
+
+void benchmarkKde()
+{
+    size_t gridPoints = 512;
+    for (int n : {200000, 10000000})
+    {
+        std::vector<double> values = randn(n);
+        auto start = std::chrono::steady_clock::now();
+        DensityEstimate estimate = kernelDensity(values, Bandwidth::Silverman, gridPoints);
+        double fftSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<double> truth(gridPoints);
+        for (size_t j = 0; j < gridPoints; j++)
+        {
+            truth[j] = normalDensity(estimate.x[j]);
+        }
+        std::cout << "kde of " << n << " normals on " << gridPoints << " points, bandwidth " << estimate.bandwidth << "\n"
+                  << "  binned FFT " << fftSeconds << "s, max error against the normal density "
+                  << maxDifference(estimate.density, truth) << "\n";
+        if (n <= 200000)
+        {
+            start = std::chrono::steady_clock::now();
+            std::vector<double> exact = kernelDensityAt(values, estimate.bandwidth, estimate.x);
+            double directSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "  direct     " << directSeconds << "s, max difference from the binned estimate "
+                      << maxDifference(estimate.density, exact) << "\n";
+        }
+    }
+}
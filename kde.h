@@ -0,0 +1,76 @@
+#pragma once
+
+#include "stdafx.h"
+#include <span>
+#include <string>
+
+/**
+ *  Rules of thumb for the bandwidth of a Gaussian kernel
+ */
+enum class Bandwidth
+{
+    /** 0.9 min(sd, IQR / 1.34) n^(-1/5), robust to heavy tails and bimodality */
+    Silverman,
+    /** 1.06 sd n^(-1/5), optimal for normal data */
+    Scott
+};
+
+/** The bandwidth chosen by a rule of thumb, throws if the values are all equal or not all finite */
+double kernelBandwidth(std::span<const double> values, Bandwidth rule = Bandwidth::Silverman);
+
+/**
+ *  A density evaluated on an equally spaced grid
+ */
+struct DensityEstimate
+{
+    std::vector<double> x;
+    std::vector<double> density;
+    double bandwidth;
+};
+
+/**
+ * Estimates the density of the values with a Gaussian kernel on a grid of
+ * gridPoints points spanning their range plus four bandwidths either side.
+ * The values are linearly binned onto the grid in one parallel pass and
+ * the binned counts convolved with the kernel by FFT, so the cost is
+ * O(n + m log m) for n values and m grid points instead of O(n m).  The
+ * binning error is O(spacing^2), far below the sampling error of the
+ * estimate once the grid spacing is a fraction of the bandwidth.  Throws
+ * std::invalid_argument unless every value is finite.
+ */
+DensityEstimate kernelDensity(std::span<const double> values,
+                              Bandwidth rule = Bandwidth::Silverman,
+                              size_t gridPoints = 1024);
+/** As kernelDensity, with a given bandwidth */
+DensityEstimate kernelDensity(std::span<const double> values,
+                              double bandwidth,
+                              size_t gridPoints = 1024);
+
+/**
+ * Evaluates the Gaussian kernel density estimate exactly at each point,
+ * summing over every value, for checking the binned estimate
+ */
+std::vector<double> kernelDensityAt(std::span<const double> values,
+                                    double bandwidth,
+                                    const std::vector<double> &points);
+
+/**
+ * Plots the estimated density of the values as a line chart
+ */
+void densityPlot(const std::string &file,
+                 std::span<const double> values,
+                 Bandwidth rule = Bandwidth::Silverman);
+/**
+ * Plots an estimated density as a line chart
+ */
+void densityPlot(const std::string &file, const DensityEstimate &estimate);
+
+/**
+ *  Test function
+ */
+void testKde();
+
+/**
+ *  Benchmark function
+ */
+void benchmarkKde();
@@ -0,0 +1,423 @@
+#include "lsm.h"
+#include "matlib.h"
+#include "parallel.h"
+#include <chrono>
+#include <mutex>
+
+/*  Minimum number of paths handled by one thread */
+static const size_t MIN_PATHS_PER_THREAD = 4096;
+
+/*  Appends the exponents of every monomial of total degree <= degree to exponents */
+static void addMonomials(size_t asset, size_t nAssets, int degree,
+                         std::vector<int> &current,
+                         std::vector<std::vector<int>> &exponents)
+{
+    if (asset == nAssets)
+    {
+        exponents.push_back(current);
+        return;
+    }
+    for (int power = 0; power <= degree; power++)
+    {
+        current[asset] = power;
+        addMonomials(asset + 1, nAssets, degree - power, current, exponents);
+    }
+    current[asset] = 0;
+}
+
+/*  Evaluates every basis monomial at x, using powers as scratch space */
+static void evaluateBasis(const std::vector<std::vector<int>> &exponents,
+                          const double *x, size_t nAssets, int degree,
+                          std::vector<double> &powers, double *out)
+{
+    for (size_t i = 0; i < nAssets; i++)
+    {
+        double *p = &powers[i * (degree + 1)];
+        p[0] = 1.0;
+        for (int d = 1; d <= degree; d++)
+        {
+            p[d] = p[d - 1] * x[i];
+        }
+    }
+    for (size_t m = 0; m < exponents.size(); m++)
+    {
+        double product = 1.0;
+        for (size_t i = 0; i < nAssets; i++)
+        {
+            product *= powers[i * (degree + 1) + exponents[m][i]];
+        }
+        out[m] = product;
+    }
+}
+
+/*  Fills w with sqrt(variance) * z, or w = w * scale + sqrt(variance) * z, a block of paths at a time */
+static void addNormals(std::vector<double> &w, double scale, double variance, size_t blockValues)
+{
+    double sd = std::sqrt(variance);
+    for (size_t first = 0; first < w.size(); first += blockValues)
+    {
+        size_t count = std::min(blockValues, w.size() - first);
+        std::vector<double> z = randn((int)count);
+        for (size_t i = 0; i < count; i++)
+        {
+            w[first + i] = w[first + i] * scale + sd * z[i];
+        }
+    }
+}
+
+LsmResult longstaffSchwartzPrice(const LsmParameters &parameters,
+                                 const ExercisePayoff &payoff)
+{
+    size_t nAssets = parameters.spots.size();
+    if (nAssets == 0 || parameters.volatilities.size() != nAssets)
+    {
+        throw std::invalid_argument("Spots and volatilities must be non-empty and of equal size");
+    }
+    if (parameters.paths < 2 || parameters.exerciseDates < 1 || parameters.maturity <= 0 || parameters.blockSize < 1)
+    {
+        throw std::invalid_argument("Invalid simulation settings");
+    }
+    Matrix factor = parameters.correlation.rows() == 0 ? Matrix::identity(nAssets)
+                                                       : cholesky(parameters.correlation);
+    if (factor.rows() != nAssets)
+    {
+        throw std::invalid_argument("Correlation matrix does not match the number of assets");
+    }
+
+    int degree = parameters.basisDegree;
+    std::vector<std::vector<int>> exponents;
+    std::vector<int> current(nAssets, 0);
+    addMonomials(0, nAssets, degree, current, exponents);
+    size_t m = exponents.size();
+
+    size_t nPaths = parameters.paths;
+    int nDates = parameters.exerciseDates;
+    double dt = parameters.maturity / nDates;
+    double discount = std::exp(-parameters.rate * dt);
+    size_t blockValues = (size_t)parameters.blockSize * nAssets;
+
+    // the only per path state: the driving Brownian motions at the current
+    // date, the value of the cash flows discounted to it and the exercise value
+    std::vector<double> w(nPaths * nAssets, 0.0);
+    std::vector<double> value(nPaths);
+    std::vector<double> exerciseValue(nPaths);
+
+    // asset prices of path p at time t
+    auto prices = [&](size_t p, double t, double *out)
+    {
+        const double *wp = &w[p * nAssets];
+        for (size_t i = 0; i < nAssets; i++)
+        {
+            const double *li = factor.row(i);
+            double correlated = 0.0;
+            for (size_t j = 0; j <= i; j++)
+            {
+                correlated += li[j] * wp[j];
+            }
+            double vol = parameters.volatilities[i];
+            out[i] = parameters.spots[i] * std::exp((parameters.rate - 0.5 * vol * vol) * t + vol * correlated);
+        }
+    };
+
+    // exercise at maturity
+    addNormals(w, 0.0, parameters.maturity, blockValues);
+    parallelFor(nPaths, [&](size_t begin, size_t end)
+    {
+        std::vector<double> s(nAssets);
+        for (size_t p = begin; p < end; p++)
+        {
+            prices(p, parameters.maturity, s.data());
+            value[p] = payoff(s.data(), nAssets);
+        }
+    }, MIN_PATHS_PER_THREAD);
+
+    std::mutex regressionMutex;
+    for (int k = nDates - 1; k >= 1; k--)
+    {
+        double t = k * dt;
+        double tNext = t + dt;
+        // Brownian bridge from tNext back to t
+        addNormals(w, t / tNext, dt * t / tNext, blockValues);
+
+        Matrix normalMatrix(m, m);
+        std::vector<double> rhs(m, 0.0);
+        parallelFor(nPaths, [&](size_t begin, size_t end)
+        {
+            std::vector<double> s(nAssets);
+            std::vector<double> powers(nAssets * (degree + 1));
+            std::vector<double> basis(m);
+            Matrix localMatrix(m, m);
+            std::vector<double> localRhs(m, 0.0);
+            for (size_t p = begin; p < end; p++)
+            {
+                value[p] *= discount;
+                prices(p, t, s.data());
+                exerciseValue[p] = payoff(s.data(), nAssets);
+                if (exerciseValue[p] <= 0.0)
+                {
+                    continue;
+                }
+                for (size_t i = 0; i < nAssets; i++)
+                {
+                    s[i] /= parameters.spots[i];
+                }
+                evaluateBasis(exponents, s.data(), nAssets, degree, powers, basis.data());
+                for (size_t i = 0; i < m; i++)
+                {
+                    double *row = localMatrix.row(i);
+                    for (size_t j = 0; j <= i; j++)
+                    {
+                        row[j] += basis[i] * basis[j];
+                    }
+                    localRhs[i] += basis[i] * value[p];
+                }
+            }
+            std::lock_guard<std::mutex> lock(regressionMutex);
+            for (size_t i = 0; i < m; i++)
+            {
+                for (size_t j = 0; j <= i; j++)
+                {
+                    normalMatrix(i, j) += localMatrix(i, j);
+                }
+                rhs[i] += localRhs[i];
+            }
+        }, MIN_PATHS_PER_THREAD);
+
+        if (normalMatrix(0, 0) < (double)m)
+        {
+            // too few paths in the money to regress on
+            continue;
+        }
+        // symmetrise and add a tiny ridge so rank deficient bases stay solvable
+        double trace = 0.0;
+        for (size_t i = 0; i < m; i++)
+        {
+            trace += normalMatrix(i, i);
+            for (size_t j = 0; j < i; j++)
+            {
+                normalMatrix(j, i) = normalMatrix(i, j);
+            }
+        }
+        for (size_t i = 0; i < m; i++)
+        {
+            normalMatrix(i, i) += 1e-12 * trace / m;
+        }
+        std::vector<double> beta = choleskySolve(cholesky(normalMatrix), rhs);
+
+        parallelFor(nPaths, [&](size_t begin, size_t end)
+        {
+            std::vector<double> s(nAssets);
+            std::vector<double> powers(nAssets * (degree + 1));
+            std::vector<double> basis(m);
+            for (size_t p = begin; p < end; p++)
+            {
+                if (exerciseValue[p] <= 0.0)
+                {
+                    continue;
+                }
+                prices(p, t, s.data());
+                for (size_t i = 0; i < nAssets; i++)
+                {
+                    s[i] /= parameters.spots[i];
+                }
+                evaluateBasis(exponents, s.data(), nAssets, degree, powers, basis.data());
+                double continuation = 0.0;
+                for (size_t i = 0; i < m; i++)
+                {
+                    continuation += beta[i] * basis[i];
+                }
+                if (exerciseValue[p] > continuation)
+                {
+                    value[p] = exerciseValue[p];
+                }
+            }
+        }, MIN_PATHS_PER_THREAD);
+    }
+
+    for (double &v : value)
+    {
+        v *= discount;
+    }
+    LsmResult result;
+    result.price = mean(value);
+    result.standardError = standardDeviation(value) / std::sqrt((double)nPaths);
+    if (parameters.exerciseAtStart)
+    {
+        result.price = std::max(result.price, payoff(parameters.spots.data(), nAssets));
+    }
+    return result;
+}
+
+ExercisePayoff basketPutPayoff(double strike, const std::vector<double> &weights)
+{
+    return [strike, weights](const double *prices, size_t nAssets)
+    {
+        double basket = 0.0;
+        for (size_t i = 0; i < nAssets; i++)
+        {
+            basket += weights[i] * prices[i];
+        }
+        return std::max(strike - basket, 0.0);
+    };
+}
+
+ExercisePayoff maxCallPayoff(double strike)
+{
+    return [strike](const double *prices, size_t nAssets)
+    {
+        double best = prices[0];
+        for (size_t i = 1; i < nAssets; i++)
+        {
+            best = std::max(best, prices[i]);
+        }
+        return std::max(best - strike, 0.0);
+    };
+}
+
+double binomialAmericanPutPrice(const double &strike,
+                                const double &maturity,
+                                const double &spot,
+                                const double &volatility,
+                                const double &rate,
+                                int steps)
+{
+    double dt = maturity / steps;
+    double up = std::exp(volatility * std::sqrt(dt));
+    double down = 1 / up;
+    double discount = std::exp(-rate * dt);
+    double probabilityUp = (1 / discount - down) / (up - down);
+    std::vector<double> values(steps + 1);
+    for (int i = 0; i <= steps; i++)
+    {
+        values[i] = std::max(strike - spot * std::pow(up, i) * std::pow(down, steps - i), 0.0);
+    }
+    for (int step = steps - 1; step >= 0; step--)
+    {
+        for (int i = 0; i <= step; i++)
+        {
+            double continuation = discount * (probabilityUp * values[i + 1] + (1 - probabilityUp) * values[i]);
+            double exercise = strike - spot * std::pow(up, i) * std::pow(down, step - i);
+            values[i] = std::max(continuation, exercise);
+        }
+    }
+    return values[0];
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+static LsmParameters singleAssetParameters()
+{
+    LsmParameters parameters;
+    parameters.spots = {36.0};
+    parameters.volatilities = {0.2};
+    parameters.rate = 0.06;
+    parameters.maturity = 1.0;
+    parameters.exerciseDates = 50;
+    parameters.paths = 20000;
+    parameters.basisDegree = 3;
+    return parameters;
+}
+
+static void testBinomialAmericanPut()
+{
+    // Longstaff and Schwartz (2001) quote a finite difference value of 4.487 for this put
+    double price = binomialAmericanPutPrice(40, 1, 36, 0.2, 0.06, 2000);
+    ASSERT_APPROX_EQUAL(price, 4.487, 0.005);
+    // an American put is worth at least the European one
+    ASSERT(price > blackScholesPutPrice(40, 1, 36, 0.2, 0.06));
+}
+
+static void testLsmAmericanPut()
+{
+    LsmParameters parameters = singleAssetParameters();
+    LsmResult result = longstaffSchwartzPrice(parameters, basketPutPayoff(40, {1.0}));
+    double reference = binomialAmericanPutPrice(40, 1, 36, 0.2, 0.06, 2000);
+    ASSERT(result.standardError > 0 && result.standardError < 0.05);
+    ASSERT_APPROX_EQUAL(result.price, reference, 4 * result.standardError + 0.03);
+}
+
+static void testLsmEuropeanLimit()
+{
+    // a single exercise date at maturity is a European option
+    LsmParameters parameters = singleAssetParameters();
+    parameters.exerciseDates = 1;
+    parameters.exerciseAtStart = false;
+    LsmResult result = longstaffSchwartzPrice(parameters, basketPutPayoff(40, {1.0}));
+    double europeanPrice = blackScholesPutPrice(40, 1, 36, 0.2, 0.06);
+    ASSERT_APPROX_EQUAL(result.price, europeanPrice, 4 * result.standardError);
+}
+
+static void testLsmMultiAsset()
+{
+    LsmParameters parameters;
+    parameters.spots = {100.0, 100.0};
+    parameters.volatilities = {0.2, 0.2};
+    parameters.correlation = Matrix(2, 2, 0.3);
+    parameters.correlation(0, 0) = 1.0;
+    parameters.correlation(1, 1) = 1.0;
+    parameters.rate = 0.05;
+    parameters.maturity = 1.0;
+    parameters.exerciseDates = 10;
+    parameters.paths = 20000;
+    LsmResult bermudan = longstaffSchwartzPrice(parameters, basketPutPayoff(100, {0.5, 0.5}));
+    parameters.exerciseDates = 1;
+    parameters.exerciseAtStart = false;
+    LsmResult european = longstaffSchwartzPrice(parameters, basketPutPayoff(100, {0.5, 0.5}));
+    // early exercise of a put with positive rates has positive value
+    ASSERT(bermudan.price > european.price);
+    ASSERT(european.price > 0);
+}
+
+void testLsm()
+{
+    TEST(testBinomialAmericanPut);
+    TEST(testLsmAmericanPut);
+    TEST(testLsmEuropeanLimit);
+    TEST(testLsmMultiAsset);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+void benchmarkLsm()
+{
+    size_t assetCounts[] = {1, 2, 5};
+    for (size_t nAssets : assetCounts)
+    {
+        LsmParameters parameters;
+        parameters.spots.assign(nAssets, 100.0);
+        parameters.volatilities.assign(nAssets, 0.2);
+        parameters.correlation = Matrix(nAssets, nAssets, 0.5);
+        for (size_t i = 0; i < nAssets; i++)
+        {
+            parameters.correlation(i, i) = 1.0;
+        }
+        parameters.rate = 0.05;
+        parameters.exerciseDates = 50;
+        parameters.paths = 100000;
+        std::vector<double> weights(nAssets, 1.0 / nAssets);
+
+        auto start = std::chrono::steady_clock::now();
+        LsmResult result = longstaffSchwartzPrice(parameters, basketPutPayoff(100, weights));
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "lsm assets=" << nAssets
+                  << " price " << result.price << " +/- " << result.standardError
+                  << " " << parameters.paths * (double)parameters.exerciseDates / seconds << " path-dates/s"
+                  << " (" << seconds << "s)\n";
+    }
+
+    // accuracy against the lattice for the classic single asset put
+    double reference = binomialAmericanPutPrice(40, 1, 36, 0.2, 0.06, 2000);
+    LsmParameters parameters = singleAssetParameters();
+    parameters.paths = 100000;
+    LsmResult result = longstaffSchwartzPrice(parameters, basketPutPayoff(40, {1.0}));
+    std::cout << "lsm american put " << result.price << " +/- " << result.standardError
+              << " lattice " << reference << "\n";
+}
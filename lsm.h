@@ -0,0 +1,82 @@
+#pragma once
+
+#include "matrix.h"
+#include <functional>
+
+/**
+ *  Payoff of exercising at a given date, given the asset prices at that date
+ */
+typedef std::function<double(const double *prices, size_t nAssets)> ExercisePayoff;
+
+/**
+ *  Market and simulation settings for a Longstaff-Schwartz valuation of an
+ *  option on correlated geometric Brownian motions
+ */
+struct LsmParameters
+{
+    std::vector<double> spots;
+    std::vector<double> volatilities;
+    /** Correlation between the assets, leave empty for independent assets */
+    Matrix correlation;
+    double rate = 0.0;
+    double maturity = 1.0;
+    /** Number of equally spaced exercise dates, the last one at maturity */
+    int exerciseDates = 50;
+    int paths = 100000;
+    /** Number of paths whose normals are generated at a time */
+    int blockSize = 8192;
+    /** Regression basis is every monomial in the normalised prices up to this total degree */
+    int basisDegree = 2;
+    /** Whether the option may also be exercised immediately */
+    bool exerciseAtStart = true;
+};
+
+/**
+ *  A Monte Carlo price and its standard error
+ */
+struct LsmResult
+{
+    double price;
+    double standardError;
+};
+
+/**
+ * Prices an American/Bermudan option with the Longstaff-Schwartz least
+ * squares Monte Carlo method.  Paths are generated backwards in time with
+ * a Brownian bridge, so only the current state and the discounted cash
+ * flow of each path are stored rather than the whole path.  The
+ * continuation value regressions are accumulated in parallel across paths
+ * and solved through the normal equations.
+ */
+LsmResult longstaffSchwartzPrice(const LsmParameters &parameters,
+                                 const ExercisePayoff &payoff);
+
+/**
+ * Payoff of a put on a weighted basket, max(strike - sum w_i S_i, 0)
+ */
+ExercisePayoff basketPutPayoff(double strike, const std::vector<double> &weights);
+
+/**
+ * Payoff of a call on the maximum of the assets, max(max_i S_i - strike, 0)
+ */
+ExercisePayoff maxCallPayoff(double strike);
+
+/**
+ * Prices an American put on a Cox-Ross-Rubinstein binomial tree
+ */
+double binomialAmericanPutPrice(const double &strike,
+                                const double &maturity,
+                                const double &spot,
+                                const double &volatility,
+                                const double &rate,
+                                int steps);
+
+/**
+ *  Test function
+ */
+void testLsm();
+
+/**
+ *  Benchmark function
+ */
+void benchmarkLsm();
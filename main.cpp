@@ -1,15 +1,120 @@
 #include "matlib.h"
 #include "geometry.h"
 #include "charts.h"
+#include "parallel.h"
+#include "matrix.h"
+#include "lsm.h"
+#include "aad.h"
+#include "variancereduction.h"
+#include "svi.h"
+#include "downsample.h"
+#include "bufferedwriter.h"
+#include "columnfile.h"
+#include "csvreader.h"
+#include "asyncoutput.h"
+#include "trace.h"
+#include "curve.h"
+#include "pipeline.h"
+#include "kde.h"
+#include "base64.h"
+#include "rolling.h"
+#include <string>
 
 using namespace std;
 
-int main()
+/*  Runs the benchmarks instead of the tests, e.g. "a.exe bench" */
+static void runBenchmarks()
 {
+    benchmarkGeometry();
+    benchmarkMatrix();
+    benchmarkLsm();
+    benchmarkAad();
+    benchmarkVarianceReduction();
+    benchmarkSvi();
+    benchmarkCharts();
+    benchmarkDownsample();
+    benchmarkColumnFile();
+    benchmarkCsvReader();
+    benchmarkAsyncOutput();
+    benchmarkTrace();
+    benchmarkCurve();
+    benchmarkPipeline();
+    benchmarkKde();
+    benchmarkBase64();
+    benchmarkRolling();
+}
+
+/*  Runs the microbenchmark suites, e.g. "a.exe suite --json run.json --baseline base.json --threshold 0.1",
+    returning the number of benchmarks slower than the baseline by more than the threshold */
+static int runSuites(int argc, char **argv)
+{
+    std::string jsonFile;
+    std::string baselineFile;
+    double threshold = 0.1;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        std::string option = argv[i];
+        if (option == "--json")
+        {
+            jsonFile = argv[i + 1];
+        }
+        else if (option == "--baseline")
+        {
+            baselineFile = argv[i + 1];
+        }
+        else if (option == "--threshold")
+        {
+            threshold = std::stod(argv[i + 1]);
+        }
+    }
+    microbenchmarkMatlib();
+    microbenchmarkGeometry();
+    microbenchmarkCharts();
+    if (!jsonFile.empty())
+    {
+        writeBenchmarkJson(jsonFile);
+    }
+    if (baselineFile.empty())
+    {
+        return 0;
+    }
+    std::cout << "Compared with " << baselineFile << ":\n";
+    return compareWithBaseline(readBenchmarkJson(baselineFile), threshold);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && std::string(argv[1]) == "bench")
+    {
+        runBenchmarks();
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "suite")
+    {
+        return runSuites(argc, argv) > 0 ? 1 : 0;
+    }
     setDebugEnabled(true);
     testMatlib();
     testGeometry();
     testCharts();
+    testParallel();
+    testMatrix();
+    testLsm();
+    testAad();
+    testVarianceReduction();
+    testSvi();
+    testDownsample();
+    testBufferedWriter();
+    testColumnFile();
+    testCsvReader();
+    testAsyncOutput();
+    testBenchmarkHarness();
+    testTrace();
+    testCurve();
+    testPipeline();
+    testKde();
+    testBase64();
+    testRolling();
     // testUsageExamples();
     std::vector<double> xValues{60, 70, 80, 90, 100, 110, 120, 130, 140};
     std::vector<double> yValues{};
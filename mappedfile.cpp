@@ -0,0 +1,100 @@
+#include "mappedfile.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string &filename)
+    : begin(nullptr), length(0)
+{
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        throw std::runtime_error("Cannot open " + filename);
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize))
+    {
+        CloseHandle(file);
+        throw std::runtime_error("Cannot read the size of " + filename);
+    }
+    length = (size_t)fileSize.QuadPart;
+    if (length > 0)
+    {
+        // the view keeps the mapping and the file open after the handles are closed
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr)
+        {
+            begin = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+    if (length > 0 && begin == nullptr)
+    {
+        throw std::runtime_error("Cannot map " + filename);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (begin != nullptr)
+    {
+        UnmapViewOfFile(begin);
+    }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &filename)
+    : begin(nullptr), length(0)
+{
+    int descriptor = open(filename.c_str(), O_RDONLY);
+    if (descriptor < 0)
+    {
+        throw std::runtime_error("Cannot open " + filename);
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0)
+    {
+        close(descriptor);
+        throw std::runtime_error("Cannot read the size of " + filename);
+    }
+    length = (size_t)status.st_size;
+    if (length > 0)
+    {
+        // the mapping keeps the file open after the descriptor is closed
+        void *address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (address != MAP_FAILED)
+        {
+            begin = (const char *)address;
+            posix_madvise(address, length, POSIX_MADV_SEQUENTIAL);
+        }
+    }
+    close(descriptor);
+    if (length > 0 && begin == nullptr)
+    {
+        throw std::runtime_error("Cannot map " + filename);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (begin != nullptr)
+    {
+        munmap((void *)begin, length);
+    }
+}
+
+#endif
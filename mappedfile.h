@@ -0,0 +1,26 @@
+#pragma once
+
+#include "stdafx.h"
+#include <string>
+
+/**
+ *  A read only memory mapping of a whole file.  The operating system pages
+ *  the file in on demand, so the contents can be read in place without
+ *  copying them into the process first.  An empty file maps to no data.
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return begin; }
+    size_t size() const { return length; }
+
+private:
+    const char *begin;
+    size_t length;
+};
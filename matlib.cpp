@@ -1,149 +1,74 @@
 #include "matlib.h"
 
-const double ROOT_2_PI = sqrt(2.0 * PI);
-
-static inline double hornerFunction(double x, double a0, double a1)
-{
-  return a0 + x * a1;
-}
-
-static inline double hornerFunction(double x, double a0, double a1, double a2)
-{
-  return a0 + x * hornerFunction(x, a1, a2);
-}
-
-static inline double hornerFunction(double x, double a0, double a1, double a2, double a3)
-{
-  return a0 + x * hornerFunction(x, a1, a2, a3);
-}
-
-static inline double hornerFunction(double x, double a0, double a1, double a2, double a3, double a4)
-{
-  return a0 + x * hornerFunction(x, a1, a2, a3, a4);
-}
-
-static inline double hornerFunction(double x, double a0, double a1, double a2, double a3, double a4,
-                                    double a5)
+/**
+ *  The implementations are the generic templates in matlib.h, which make
+ *  the use of horner's method obvious and can also be used with AAD.
+ */
+double normcdf(double x)
 {
-  return a0 + x * hornerFunction(x, a1, a2, a3, a4, a5);
+  return normcdf<double>(x);
 }
 
-static inline double hornerFunction(double x, double a0, double a1, double a2, double a3, double a4,
-                                    double a5, double a6)
+double norminv(double x)
 {
-  return a0 + x * hornerFunction(x, a1, a2, a3, a4, a5, a6);
+  return norminv<double>(x);
 }
 
-static inline double hornerFunction(double x, double a0, double a1, double a2, double a3, double a4,
-                                    double a5, double a6, double a7)
+double blackScholesCallPrice(const double &strike,
+                             const double &maturity,
+                             const double &spot,
+                             const double &volatility,
+                             const double &rate)
 {
-  return a0 + x * hornerFunction(x, a1, a2, a3, a4, a5, a6, a7);
+  return blackScholesCallPrice<double>(strike, maturity, spot, volatility, rate);
 }
 
-static inline double hornerFunction(double x, double a0, double a1, double a2, double a3, double a4,
-                                    double a5, double a6, double a7, double a8)
+double blackScholesPutPrice(const double &strike,
+                            const double &maturity,
+                            const double &spot,
+                            const double &volatility,
+                            const double &rate)
 {
-  return a0 + x * hornerFunction(x, a1, a2, a3, a4, a5, a6, a7, a8);
+  return blackScholesPutPrice<double>(strike, maturity, spot, volatility, rate);
 }
 
-/**
- *  Arguably this is a little easier to read than the original normcdf
- *  function as it makes the use of horner's method obvious.
- */
-double normcdf(double x)
-{
-  DEBUG_PRINT("normcdf(" << x << ")");
-  if (x < 0)
-  {
-    return 1 - normcdf(-x);
-  }
-  double k = 1 / (1 + 0.2316419 * x);
-  double poly = hornerFunction(k,
-                               0.0, 0.319381530, -0.356563782,
-                               1.781477937, -1.821255978, 1.330274429);
-  double approx = 1.0 - 1.0 / ROOT_2_PI * exp(-0.5 * x * x) * poly;
-  return approx;
-}
-
-/*  Constants required for Moro's algorithm */
-static const double a0 = 2.50662823884;
-static const double a1 = -18.61500062529;
-static const double a2 = 41.39119773534;
-static const double a3 = -25.44106049637;
-static const double b1 = -8.47351093090;
-static const double b2 = 23.08336743743;
-static const double b3 = -21.06224101826;
-static const double b4 = 3.13082909833;
-static const double c0 = 0.3374754822726147;
-static const double c1 = 0.9761690190917186;
-static const double c2 = 0.1607979714918209;
-static const double c3 = 0.0276438810333863;
-static const double c4 = 0.0038405729373609;
-static const double c5 = 0.0003951896511919;
-static const double c6 = 0.0000321767881768;
-static const double c7 = 0.0000002888167364;
-static const double c8 = 0.0000003960315187;
-
-double norminv(double x)
+double blackScholesImpliedVolatility(const double &callPrice,
+                                     const double &strike,
+                                     const double &maturity,
+                                     const double &spot,
+                                     const double &rate)
 {
-  // We use Moro's algorithm
-  DEBUG_PRINT("norminv(" << x << ")");
-  double y = x - 0.5;
-  if (y < 0.42 && y > -0.42)
+  double discountedStrike = strike * std::exp(-rate * maturity);
+  if (callPrice <= std::max(spot - discountedStrike, 0.0) || callPrice >= spot)
   {
-    double r = y * y;
-    DEBUG_PRINT("Case 1, r=" << r);
-    return y * hornerFunction(r, a0, a1, a2, a3) / hornerFunction(r, 1.0, b1, b2, b3, b4);
+    throw std::invalid_argument("Call price violates the no-arbitrage bounds");
   }
-  else
+  double low = 1e-6;
+  double high = 10.0;
+  double volatility = 0.2;
+  for (int iteration = 0; iteration < 100; iteration++)
   {
-    double r;
-    if (y < 0.0)
+    double difference = blackScholesCallPrice(strike, maturity, spot, volatility, rate) - callPrice;
+    if (std::fabs(difference) < 1e-12 * spot)
     {
-      r = x;
+      break;
     }
-    else
+    // the price is increasing in volatility, so keep a bracket for bisection
+    if (difference > 0)
     {
-      r = 1.0 - x;
-    }
-    DEBUG_PRINT("Case 2, r=" << r);
-    double s = log(-log(r));
-    double t = hornerFunction(s, c0, c1, c2, c3, c4, c5, c6, c7, c8);
-    if (x > 0.5)
-    {
-      return t;
+      high = volatility;
     }
     else
     {
-      return -t;
+      low = volatility;
     }
+    double sqrtT = std::sqrt(maturity);
+    double d1 = (std::log(spot / strike) + (rate + 0.5 * volatility * volatility) * maturity) / (volatility * sqrtT);
+    double vega = spot * std::exp(-0.5 * d1 * d1) / ROOT_2_PI * sqrtT;
+    double next = volatility - difference / vega;
+    volatility = (vega > 0 && next > low && next < high) ? next : 0.5 * (low + high);
   }
-}
-
-double blackScholesCallPrice(const double &strike,
-                             const double &maturity,
-                             const double &spot,
-                             const double &volatility,
-                             const double &rate)
-{
-  double d1 = (1 / (volatility * std::sqrt(maturity))) * (std::log(spot / strike) + (rate + pow(volatility, 2.0) / 2) * std::sqrt(maturity));
-  double d2 = (1 / (volatility * std::sqrt(maturity))) * (std::log(spot / strike) + (rate - pow(volatility, 2.0) / 2) * std::sqrt(maturity));
-  double parity = normcdf(d1) * spot - normcdf(d2) * strike * std::exp(-rate * maturity);
-  DEBUG_PRINT("Put-Call Parity = " << parity << "\n");
-  return parity;
-}
-
-double blackScholesPutPrice(const double &strike,
-                            const double &maturity,
-                            const double &spot,
-                            const double &volatility,
-                            const double &rate)
-{
-  double d1 = (1 / (volatility * std::sqrt(maturity))) * (std::log(spot / strike) + (rate + pow(volatility, 2.0) / 2) * std::sqrt(maturity));
-  double d2 = (1 / (volatility * std::sqrt(maturity))) * (std::log(spot / strike) + (rate - pow(volatility, 2.0) / 2) * std::sqrt(maturity));
-  double parity = normcdf(-d2) * strike * std::exp(-rate * maturity) - normcdf(-d1) * spot;
-  DEBUG_PRINT("Put-Call Parity = " << parity << "\n");
-  return parity;
+  return volatility;
 }
 
 std::vector<double> solveQuadratic(const double &a,
@@ -169,30 +94,61 @@ std::vector<double> solveQuadratic(const double &a,
   }
 }
 
+/**
+ *  The statistics work on spans so that they can read memory mapped
+ *  columns without copying, the vector versions forward to them.
+ */
 double mean(const std::vector<double> &numbers)
+{
+  return mean(std::span<const double>(numbers));
+}
+
+double standardDeviation(const std::vector<double> &numbers, bool sample)
+{
+  return standardDeviation(std::span<const double>(numbers), sample);
+}
+
+double min(const std::vector<double> &numbers)
+{
+  return min(std::span<const double>(numbers));
+}
+
+double max(const std::vector<double> &numbers)
+{
+  return max(std::span<const double>(numbers));
+}
+
+double prctile(const std::vector<double> &v, double p)
+{
+  return prctile(std::span<const double>(v), p);
+}
+
+/*  The statistics are shared by double and float inputs, sums are always accumulated in double */
+template <typename T>
+static double meanOf(std::span<const T> numbers)
 {
   if (numbers.empty())
   {
     throw std::invalid_argument("Vector is empty");
   }
   double sum = 0;
-  for (const double &number : numbers)
+  for (const T &number : numbers)
   {
     sum += number;
   }
   return sum / numbers.size();
 }
 
-double standardDeviation(const std::vector<double> &numbers, bool sample)
+template <typename T>
+static double standardDeviationOf(std::span<const T> numbers, bool sample)
 {
   if (numbers.empty())
   {
     throw std::invalid_argument("Vector is empty");
   }
-  double sampleMean = mean(numbers);
-  double sampleSize = numbers.size();
+  double sampleMean = meanOf(numbers);
   double sumSquaredDiffs = 0;
-  for (const double &number : numbers)
+  for (const T &number : numbers)
   {
     sumSquaredDiffs += pow(number - sampleMean, 2);
   }
@@ -200,10 +156,11 @@ double standardDeviation(const std::vector<double> &numbers, bool sample)
   return std::sqrt(sumSquaredDiffs / denominator);
 }
 
-double min(const std::vector<double> &numbers)
+template <typename T>
+static T minOf(std::span<const T> numbers)
 {
-  double min = numbers[0];
-  for (const double &number : numbers)
+  T min = numbers[0];
+  for (const T &number : numbers)
   {
     if (number < min)
     {
@@ -213,10 +170,11 @@ double min(const std::vector<double> &numbers)
   return min;
 }
 
-double max(const std::vector<double> &numbers)
+template <typename T>
+static T maxOf(std::span<const T> numbers)
 {
-  double max = numbers[0];
-  for (const double &number : numbers)
+  T max = numbers[0];
+  for (const T &number : numbers)
   {
     if (number > max)
     {
@@ -226,55 +184,15 @@ double max(const std::vector<double> &numbers)
   return max;
 }
 
-std::vector<double> randuniform(int n)
-{
-  std::vector<double> numbers{};
-  for (unsigned int i{0}; i < n; ++i)
-  {
-    numbers.push_back((double)rand() / RAND_MAX);
-  }
-  return numbers;
-}
-
-std::vector<double> randn(int n)
-{
-  std::vector<double> randomUniformNumbers{randuniform(n)};
-  std::vector<double> randomNormalNumbers{};
-  for (const double &randomUniformNumber : randomUniformNumbers)
-  {
-    randomNormalNumbers.push_back(norminv(randomUniformNumber));
-  }
-  return randomNormalNumbers;
-}
-
-std::vector<double> boxMullerNormal(int n)
-{
-  std::vector<double> randomNormalNumbers;
-  while (randomNormalNumbers.size() < n)
-  {
-    std::vector<double> randomUniformNumbers = randuniform(2);
-    double u1 = randomUniformNumbers[0];
-    double u2 = randomUniformNumbers[1];
-    double r = std::sqrt(-2 * std::log(u1));
-    double theta = 2 * PI * u2;
-
-    randomNormalNumbers.push_back(r * std::cos(theta));
-    if (randomNormalNumbers.size() < n)
-    {
-      randomNormalNumbers.push_back(r * std::sin(theta));
-    }
-  }
-  return randomNormalNumbers;
-}
-
-double prctile(const std::vector<double> &v, double p)
+template <typename T>
+static T prctileOf(std::span<const T> v, double p)
 {
   if (v.empty() || p < 0.0 || p > 100.0)
   {
     throw std::invalid_argument("Invalid input: vector is empty or percentile is out of range.");
   }
 
-  std::vector<double> copy = v;
+  std::vector<T> copy(v.begin(), v.end());
   std::sort(copy.begin(), copy.end());
 
   double index = (copy.size() + 1) * (p / 100.0);
@@ -284,9 +202,78 @@ double prctile(const std::vector<double> &v, double p)
 
   if (upper >= copy.size())
   {
-    return copy[lower];
+    // high percentiles of small samples index past the end
+    return copy[std::min(lower, copy.size() - 1)];
   }
-  return copy[lower] + fraction * (copy[upper] - copy[lower]);
+  return (T)(copy[lower] + fraction * (copy[upper] - copy[lower]));
+}
+
+double mean(std::span<const double> numbers)
+{
+  return meanOf(numbers);
+}
+
+double mean(std::span<const float> numbers)
+{
+  return meanOf(numbers);
+}
+
+double standardDeviation(std::span<const double> numbers, bool sample)
+{
+  return standardDeviationOf(numbers, sample);
+}
+
+double standardDeviation(std::span<const float> numbers, bool sample)
+{
+  return standardDeviationOf(numbers, sample);
+}
+
+double min(std::span<const double> numbers)
+{
+  return minOf(numbers);
+}
+
+float min(std::span<const float> numbers)
+{
+  return minOf(numbers);
+}
+
+double max(std::span<const double> numbers)
+{
+  return maxOf(numbers);
+}
+
+float max(std::span<const float> numbers)
+{
+  return maxOf(numbers);
+}
+
+double prctile(std::span<const double> v, double p)
+{
+  return prctileOf(v, p);
+}
+
+float prctile(std::span<const float> v, double p)
+{
+  return prctileOf(v, p);
+}
+
+/**
+ *  The random generators are the generic templates in matlib.h
+ */
+std::vector<double> randuniform(int n)
+{
+  return randuniform<double>(n);
+}
+
+std::vector<double> randn(int n)
+{
+  return randn<double>(n);
+}
+
+std::vector<double> boxMullerNormal(int n)
+{
+  return boxMullerNormal<double>(n);
 }
 
 ///////////////////////////////////////////////
@@ -347,6 +334,23 @@ static void testBlackScholes()
   ASSERT_APPROX_EQUAL(callMinusPut, spotMinusPVStrike, 1e-7);
 }
 
+static void testBlackScholesKnownValue()
+{
+  // Hull's textbook example: S=42, K=40, r=10%, vol=20%, T=0.5
+  ASSERT_APPROX_EQUAL(blackScholesCallPrice(40, 0.5, 42, 0.2, 0.1), 4.76, 0.01);
+  ASSERT_APPROX_EQUAL(blackScholesPutPrice(40, 0.5, 42, 0.2, 0.1), 0.81, 0.01);
+}
+
+static void testImpliedVolatility()
+{
+  double strikes[] = {60, 90, 100, 110, 150};
+  for (double strike : strikes)
+  {
+    double price = blackScholesCallPrice(strike, 0.75, 100.0, 0.27, 0.03);
+    ASSERT_APPROX_EQUAL(blackScholesImpliedVolatility(price, strike, 0.75, 100.0, 0.03), 0.27, 1e-8);
+  }
+}
+
 static void testSolveQuadratic()
 {
   std::vector<double> roots;
@@ -429,11 +433,77 @@ static void testPrctile()
   ASSERT_APPROX_EQUAL(prctile(numbers, 75), 76.5, 1e-2);
 }
 
+// Tests the single precision versions against the double ones, within the documented errors
+static void testFloatNormal()
+{
+  for (int i = 0; i <= 1000; i++)
+  {
+    float x = -6.0f + 0.012f * i;
+    ASSERT_APPROX_EQUAL(normcdf(x), normcdf((double)x), 3e-7);
+  }
+  for (int i = 1; i < 1000; i++)
+  {
+    float u = 0.001f * i;
+    ASSERT_APPROX_EQUAL(norminv(u), norminv((double)u), 3e-6);
+  }
+  // float overloads are chosen for float arguments
+  ASSERT((std::is_same_v<decltype(normcdf(0.5f)), float>));
+  ASSERT((std::is_same_v<decltype(norminv(0.5f)), float>));
+}
+
+static void testFloatBlackScholes()
+{
+  for (float strike = 60.0f; strike <= 150.0f; strike += 5.0f)
+  {
+    double call = blackScholesCallPrice((double)strike, 2.0, 100.0, 0.3, 0.05);
+    double put = blackScholesPutPrice((double)strike, 2.0, 100.0, 0.3, 0.05);
+    ASSERT_APPROX_EQUAL(blackScholesCallPrice(strike, 2.0f, 100.0f, 0.3f, 0.05f), call, 4e-5);
+    ASSERT_APPROX_EQUAL(blackScholesPutPrice(strike, 2.0f, 100.0f, 0.3f, 0.05f), put, 4e-5);
+  }
+}
+
+// Tests that float statistics accumulate in double
+static void testMixedPrecisionStatistics()
+{
+  std::vector<float> numbers(10000000, 0.1f);
+  numbers[17] = -1.0f;
+  numbers[42] = 2.0f;
+  double expectedMean = (0.1f * (numbers.size() - 2.0) - 1.0 + 2.0) / numbers.size();
+  ASSERT_APPROX_EQUAL(mean(numbers), expectedMean, 1e-12);
+  ASSERT(standardDeviation(numbers) > 0.0);
+  ASSERT(min(numbers) == -1.0f);
+  ASSERT(max(numbers) == 2.0f);
+  ASSERT(prctile(numbers, 50) == 0.1f);
+
+  std::vector<double> doubles = randn(1000);
+  std::vector<float> floats(doubles.begin(), doubles.end());
+  ASSERT_APPROX_EQUAL(standardDeviation(floats), standardDeviation(doubles), 1e-6);
+}
+
+static void testFloatRandom()
+{
+  std::vector<float> uniforms = randuniform<float>(100000);
+  ASSERT(min(uniforms) >= 0.0f && max(uniforms) < 1.0f);
+  std::vector<float> normals = randn<float>(100000);
+  ASSERT(std::isfinite(min(normals)) && std::isfinite(max(normals)));
+  ASSERT_APPROX_EQUAL(mean(normals), 0, 2e-2);
+  ASSERT_APPROX_EQUAL(standardDeviation(normals), 1, 2e-2);
+  std::vector<float> boxMuller = boxMullerNormal<float>(10001);
+  ASSERT(boxMuller.size() == 10001);
+  ASSERT_APPROX_EQUAL(standardDeviation(boxMuller), 1, 5e-2);
+}
+
 void testMatlib()
 {
   TEST(testNormInv);
   TEST(testNormCdf);
   TEST(testBlackScholes);
+  TEST(testBlackScholesKnownValue);
+  TEST(testImpliedVolatility);
+  TEST(testFloatNormal);
+  TEST(testFloatBlackScholes);
+  TEST(testMixedPrecisionStatistics);
+  TEST(testFloatRandom);
   TEST(testSolveQuadratic);
   TEST(testMean);
   TEST(testStandardDeviation);
@@ -444,3 +514,185 @@ void testMatlib()
   TEST(testBoxMullerNormal);
   TEST(testPrctile);
 }
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+/*  Inputs cycled through by the benchmarks, a power of two long */
+static std::vector<double> benchmarkInputs;
+static const size_t BENCHMARK_INPUT_MASK = 1023;
+
+static void benchmarkNormcdf(size_t iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    doNotOptimize(normcdf(benchmarkInputs[i & BENCHMARK_INPUT_MASK]));
+  }
+}
+
+static void benchmarkNorminv(size_t iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    doNotOptimize(norminv(normcdf(benchmarkInputs[i & BENCHMARK_INPUT_MASK])));
+  }
+}
+
+static void benchmarkBlackScholesCallPrice(size_t iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    double spot = 100.0 + benchmarkInputs[i & BENCHMARK_INPUT_MASK];
+    doNotOptimize(blackScholesCallPrice(100.0, 1.0, spot, 0.2, 0.05));
+  }
+}
+
+static void benchmarkMean(size_t iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    doNotOptimize(mean(benchmarkInputs));
+  }
+}
+
+static void benchmarkPrctile(size_t iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    doNotOptimize(prctile(benchmarkInputs, 95));
+  }
+}
+
+static void benchmarkRandn(size_t iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    doNotOptimize(randn(1000));
+  }
+}
+
+/*
+ *  Single against double precision, evaluating whole arrays so that the
+ *  compiler is free to vectorise
+ */
+static std::vector<float> benchmarkFloatInputs;
+
+template <typename T>
+static void normcdfArray(const std::vector<T> &inputs, size_t iterations)
+{
+  std::vector<T> outputs(inputs.size());
+  for (size_t i = 0; i < iterations; i++)
+  {
+    for (size_t j = 0; j < inputs.size(); j++)
+    {
+      outputs[j] = normcdf(inputs[j]);
+    }
+    doNotOptimize(outputs.data());
+    clobberMemory();
+  }
+}
+
+template <typename T>
+static void norminvArray(const std::vector<T> &inputs, size_t iterations)
+{
+  std::vector<T> uniforms(inputs.size());
+  for (size_t j = 0; j < inputs.size(); j++)
+  {
+    uniforms[j] = normcdf(inputs[j]);
+  }
+  std::vector<T> outputs(inputs.size());
+  for (size_t i = 0; i < iterations; i++)
+  {
+    for (size_t j = 0; j < inputs.size(); j++)
+    {
+      outputs[j] = norminv(uniforms[j]);
+    }
+    doNotOptimize(outputs.data());
+    clobberMemory();
+  }
+}
+
+template <typename T>
+static void blackScholesArray(const std::vector<T> &inputs, size_t iterations)
+{
+  std::vector<T> outputs(inputs.size());
+  for (size_t i = 0; i < iterations; i++)
+  {
+    for (size_t j = 0; j < inputs.size(); j++)
+    {
+      outputs[j] = blackScholesCallPrice<T>(T(100.0), T(1.0), T(100.0) + inputs[j], T(0.2), T(0.05));
+    }
+    doNotOptimize(outputs.data());
+    clobberMemory();
+  }
+}
+
+static void benchmarkNormcdfDouble(size_t iterations)
+{
+  normcdfArray(benchmarkInputs, iterations);
+}
+
+static void benchmarkNormcdfFloat(size_t iterations)
+{
+  normcdfArray(benchmarkFloatInputs, iterations);
+}
+
+static void benchmarkNorminvDouble(size_t iterations)
+{
+  norminvArray(benchmarkInputs, iterations);
+}
+
+static void benchmarkNorminvFloat(size_t iterations)
+{
+  norminvArray(benchmarkFloatInputs, iterations);
+}
+
+static void benchmarkBlackScholesDouble(size_t iterations)
+{
+  blackScholesArray(benchmarkInputs, iterations);
+}
+
+static void benchmarkBlackScholesFloat(size_t iterations)
+{
+  blackScholesArray(benchmarkFloatInputs, iterations);
+}
+
+static void benchmarkMeanFloat(size_t iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    doNotOptimize(mean(benchmarkFloatInputs));
+  }
+}
+
+static void benchmarkRandnFloat(size_t iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    doNotOptimize(randn<float>(1000));
+  }
+}
+
+void microbenchmarkMatlib()
+{
+  benchmarkInputs = randn((int)BENCHMARK_INPUT_MASK + 1);
+  size_t n = benchmarkInputs.size();
+  benchmarkFloatInputs.assign(benchmarkInputs.begin(), benchmarkInputs.end());
+  BENCHMARK_THROUGHPUT(benchmarkNormcdf, 1, 0);
+  BENCHMARK_THROUGHPUT(benchmarkNorminv, 1, 0);
+  BENCHMARK_THROUGHPUT(benchmarkBlackScholesCallPrice, 1, 0);
+  BENCHMARK_THROUGHPUT(benchmarkMean, n, n * sizeof(double));
+  BENCHMARK_THROUGHPUT(benchmarkPrctile, n, n * sizeof(double));
+  BENCHMARK_THROUGHPUT(benchmarkRandn, 1000, 0);
+  BENCHMARK_THROUGHPUT(benchmarkRandnFloat, 1000, 0);
+  BENCHMARK_THROUGHPUT(benchmarkMeanFloat, n, n * sizeof(float));
+  BENCHMARK_THROUGHPUT(benchmarkNormcdfDouble, n, n * sizeof(double));
+  BENCHMARK_THROUGHPUT(benchmarkNormcdfFloat, n, n * sizeof(float));
+  BENCHMARK_THROUGHPUT(benchmarkNorminvDouble, n, n * sizeof(double));
+  BENCHMARK_THROUGHPUT(benchmarkNorminvFloat, n, n * sizeof(float));
+  BENCHMARK_THROUGHPUT(benchmarkBlackScholesDouble, n, n * sizeof(double));
+  BENCHMARK_THROUGHPUT(benchmarkBlackScholesFloat, n, n * sizeof(float));
+}
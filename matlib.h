@@ -1,8 +1,12 @@
 #pragma once
 
 #include "stdafx.h"
+#include "trace.h"
+#include <span>
+#include <type_traits>
 
 const double PI = 3.14159265358979;
+const double ROOT_2_PI = 2.50662827463100050242;
 
 /**
  *  Computes the cumulative
@@ -32,6 +36,16 @@ double blackScholesPutPrice(const double &strike,
                             const double &spot,
                             const double &volatility,
                             const double &rate);
+/**
+ * Computes the Black-Scholes volatility that reproduces a European call
+ * price, using Newton's method safeguarded by bisection
+ */
+double blackScholesImpliedVolatility(const double &callPrice,
+                                     const double &strike,
+                                     const double &maturity,
+                                     const double &spot,
+                                     const double &rate);
+
 /**
  * Computes the roots of a quadratic polynomial
  */
@@ -43,21 +57,31 @@ std::vector<double> solveQuadratic(const double &a,
  * Computes the mean of a vector of doubles
  */
 double mean(const std::vector<double> &numbers);
+double mean(std::span<const double> numbers);
+/** Single precision inputs are summed in double, the result has double accuracy */
+double mean(std::span<const float> numbers);
 
 /**
  * Computes the standard deviation of a vector of doubles.  Default is sample standard deviation
  */
 double standardDeviation(const std::vector<double> &numbers, bool sample = true);
+double standardDeviation(std::span<const double> numbers, bool sample = true);
+/** Single precision inputs are accumulated in double, the result has double accuracy */
+double standardDeviation(std::span<const float> numbers, bool sample = true);
 
 /**
  * Take a vector of doubles and return the min
  */
 double min(const std::vector<double> &numbers);
+double min(std::span<const double> numbers);
+float min(std::span<const float> numbers);
 
 /**
  * Take a vector of doubles and return the max
  */
 double max(const std::vector<double> &numbers);
+double max(std::span<const double> numbers);
+float max(std::span<const float> numbers);
 
 /**
  * returns a vector of uniformly distributed random numbers in the range (0,1)
@@ -78,8 +102,277 @@ std::vector<double> boxMullerNormal(int n);
  * Takes as input a vector of doubles v and a percentile p and outputs the p-th percentile
  */
 double prctile(const std::vector<double> &v, double p);
+double prctile(std::span<const double> v, double p);
+float prctile(std::span<const float> v, double p);
 
 /**
  *  Test function
  */
-void testMatlib();
\ No newline at end of file
+void testMatlib();
+
+/**
+ *  Microbenchmarks of the hot paths, see BENCHMARK in testing.h
+ */
+void microbenchmarkMatlib();
+
+///////////////////////////////////////////////
+//
+//   GENERIC IMPLEMENTATIONS
+//
+///////////////////////////////////////////////
+
+/*
+ *  The functions below are templates on the number type so that they can
+ *  be evaluated with an AAD Number (see aad.h) as well as with double.
+ *  Calls with plain doubles resolve to the non-template overloads above.
+ *  Mathematical functions are called unqualified so that overloads for
+ *  the number type are found by argument dependent lookup.
+ *
+ *  Called with float they compute entirely in single precision, which
+ *  halves the memory traffic of arrays of inputs and is accurate enough
+ *  for scenario generation.  Scalar speed is much the same, the float
+ *  Black-Scholes prices are about a third faster.  The largest
+ *  differences from the double versions, measured on dense grids, are
+ *
+ *      normcdf                  2.4e-7 absolute
+ *      norminv                  2.3e-6 absolute, 1.6e-6 relative for |x| > 1
+ *      Black-Scholes prices     4e-7 of the spot, for maturities up to
+ *                               5 years and volatilities up to 60%
+ *
+ *  on top of the approximation errors of 7.5e-8 for normcdf and 3e-9 for
+ *  norminv.  The float statistics accumulate in double so their error is
+ *  that of double, whereas summing ten million copies of 0.1f in float
+ *  is out by 9%.
+ */
+
+/*
+ *  The type of the constants used with a number type.  Constants are
+ *  float when computing in float, so that the arithmetic stays in single
+ *  precision, and double for double and AAD numbers.
+ */
+template <typename T>
+struct ScalarTypeOf
+{
+    typedef double type;
+};
+
+template <>
+struct ScalarTypeOf<float>
+{
+    typedef float type;
+};
+
+template <typename T>
+using ScalarType = typename ScalarTypeOf<T>::type;
+
+/*  Evaluates a0 + x * (a1 + x * (a2 + ...)) by Horner's method */
+template <typename T>
+inline T hornerFunction(const T &, ScalarType<T> a0)
+{
+    return T(a0);
+}
+
+template <typename T, typename... Coefficients>
+inline T hornerFunction(const T &x, ScalarType<T> a0, ScalarType<T> a1, Coefficients... rest)
+{
+    return a0 + x * hornerFunction(x, a1, ScalarType<T>(rest)...);
+}
+
+/*  Allows any non-integral number type */
+template <typename T>
+using EnableIfNumber = std::enable_if_t<!std::is_integral_v<T>, int>;
+
+/*
+ *  The coefficients of the Abramowitz and Stegun approximation 26.2.17 to
+ *  normcdf, whose absolute error of 7.5e-8 is below the resolution of
+ *  float near 1, so the float set is the same coefficients rounded.
+ */
+template <typename S>
+struct NormcdfCoefficients
+{
+    static constexpr S p = S(0.2316419);
+    static constexpr S b1 = S(0.319381530);
+    static constexpr S b2 = S(-0.356563782);
+    static constexpr S b3 = S(1.781477937);
+    static constexpr S b4 = S(-1.821255978);
+    static constexpr S b5 = S(1.330274429);
+};
+
+template <typename T, EnableIfNumber<T> = 0>
+T normcdf(const T &x)
+{
+    using std::exp;
+    typedef ScalarType<T> S;
+    typedef NormcdfCoefficients<S> C;
+    TRACE_POINT("normcdf");
+    if (x < 0)
+    {
+        return S(1.0) - normcdf<T>(-x);
+    }
+    T k = S(1.0) / (S(1.0) + C::p * x);
+    T poly = hornerFunction(k, S(0.0), C::b1, C::b2, C::b3, C::b4, C::b5);
+    return S(1.0) - S(1.0 / ROOT_2_PI) * exp(S(-0.5) * x * x) * poly;
+}
+
+/*  Constants required for Moro's algorithm, rounded to the scalar type */
+template <typename S>
+struct MoroCoefficients
+{
+    static constexpr S a0 = S(2.50662823884);
+    static constexpr S a1 = S(-18.61500062529);
+    static constexpr S a2 = S(41.39119773534);
+    static constexpr S a3 = S(-25.44106049637);
+    static constexpr S b1 = S(-8.47351093090);
+    static constexpr S b2 = S(23.08336743743);
+    static constexpr S b3 = S(-21.06224101826);
+    static constexpr S b4 = S(3.13082909833);
+    static constexpr S c0 = S(0.3374754822726147);
+    static constexpr S c1 = S(0.9761690190917186);
+    static constexpr S c2 = S(0.1607979714918209);
+    static constexpr S c3 = S(0.0276438810333863);
+    static constexpr S c4 = S(0.0038405729373609);
+    static constexpr S c5 = S(0.0003951896511919);
+    static constexpr S c6 = S(0.0000321767881768);
+    static constexpr S c7 = S(0.0000002888167364);
+    static constexpr S c8 = S(0.0000003960315187);
+};
+
+template <typename T, EnableIfNumber<T> = 0>
+T norminv(const T &x)
+{
+    // We use Moro's algorithm
+    using std::log;
+    typedef ScalarType<T> S;
+    typedef MoroCoefficients<S> C;
+    T y = x - S(0.5);
+    if (y < S(0.42) && y > S(-0.42))
+    {
+        T r = y * y;
+        TRACE_POINT("norminv central");
+        return y * hornerFunction(r, C::a0, C::a1, C::a2, C::a3) / hornerFunction(r, S(1.0), C::b1, C::b2, C::b3, C::b4);
+    }
+    T r = y < S(0.0) ? x : S(1.0) - x;
+    TRACE_POINT("norminv tail");
+    T s = log(-log(r));
+    T t = hornerFunction(s, C::c0, C::c1, C::c2, C::c3, C::c4, C::c5, C::c6, C::c7, C::c8);
+    return x > S(0.5) ? t : -t;
+}
+
+template <typename T, EnableIfNumber<T> = 0>
+T blackScholesCallPrice(const T &strike,
+                        const T &maturity,
+                        const T &spot,
+                        const T &volatility,
+                        const T &rate)
+{
+    using std::exp;
+    using std::log;
+    using std::sqrt;
+    typedef ScalarType<T> S;
+    T volSqrtT = volatility * sqrt(maturity);
+    T d1 = (log(spot / strike) + (rate + S(0.5) * volatility * volatility) * maturity) / volSqrtT;
+    T d2 = d1 - volSqrtT;
+    T price = normcdf<T>(d1) * spot - normcdf<T>(d2) * strike * exp(-rate * maturity);
+    DEBUG_PRINT("Call price = " << price << "\n");
+    return price;
+}
+
+template <typename T, EnableIfNumber<T> = 0>
+T blackScholesPutPrice(const T &strike,
+                       const T &maturity,
+                       const T &spot,
+                       const T &volatility,
+                       const T &rate)
+{
+    using std::exp;
+    using std::log;
+    using std::sqrt;
+    typedef ScalarType<T> S;
+    T volSqrtT = volatility * sqrt(maturity);
+    T d1 = (log(spot / strike) + (rate + S(0.5) * volatility * volatility) * maturity) / volSqrtT;
+    T d2 = d1 - volSqrtT;
+    T price = normcdf<T>(-d2) * strike * exp(-rate * maturity) - normcdf<T>(-d1) * spot;
+    DEBUG_PRINT("Put price = " << price << "\n");
+    return price;
+}
+
+/**
+ * Generates uniform random numbers of type T, e.g. randuniform<float>(n).
+ * They are rounded from double and kept below 1 so that norminv is finite.
+ */
+template <typename T, EnableIfNumber<T> = 0>
+std::vector<T> randuniform(int n)
+{
+    const T belowOne = std::nextafter(T(1.0), T(0.0));
+    std::vector<T> numbers(std::max(n, 0));
+    for (T &number : numbers)
+    {
+        number = std::min((T)((double)rand() / RAND_MAX), belowOne);
+    }
+    return numbers;
+}
+
+/** Generates normal random numbers of type T by inverting uniforms of type T */
+template <typename T, EnableIfNumber<T> = 0>
+std::vector<T> randn(int n)
+{
+    std::vector<T> numbers = randuniform<T>(n);
+    for (T &number : numbers)
+    {
+        number = norminv<T>(number);
+    }
+    return numbers;
+}
+
+/** Generates normal random numbers of type T with the Box-Muller algorithm */
+template <typename T, EnableIfNumber<T> = 0>
+std::vector<T> boxMullerNormal(int n)
+{
+    using std::cos;
+    using std::log;
+    using std::sin;
+    using std::sqrt;
+    typedef ScalarType<T> S;
+    std::vector<T> numbers = randuniform<T>(n + n % 2);
+    for (size_t i = 0; i + 1 < numbers.size(); i += 2)
+    {
+        T r = sqrt(S(-2.0) * log(numbers[i]));
+        T theta = S(2.0 * PI) * numbers[i + 1];
+        numbers[i] = r * cos(theta);
+        numbers[i + 1] = r * sin(theta);
+    }
+    numbers.resize(std::max(n, 0));
+    return numbers;
+}
+
+/**
+ * Prices a European call by simulating the terminal spot of a geometric
+ * Brownian motion from the given standard normal draws
+ */
+template <typename T, EnableIfNumber<T> = 0>
+T monteCarloCallPrice(const T &strike,
+                      const T &maturity,
+                      const T &spot,
+                      const T &volatility,
+                      const T &rate,
+                      const std::vector<double> &normals)
+{
+    using std::exp;
+    using std::sqrt;
+    if (normals.empty())
+    {
+        throw std::invalid_argument("Vector is empty");
+    }
+    T drift = spot * exp((rate - 0.5 * volatility * volatility) * maturity);
+    T diffusion = volatility * sqrt(maturity);
+    T sum = 0.0;
+    for (const double &z : normals)
+    {
+        T payoff = drift * exp(diffusion * z) - strike;
+        if (payoff > 0.0)
+        {
+            sum += payoff;
+        }
+    }
+    return exp(-rate * maturity) * sum / (double)normals.size();
+}
\ No newline at end of file
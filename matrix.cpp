@@ -0,0 +1,473 @@
+#include "matrix.h"
+#include "matlib.h"
+#include "parallel.h"
+#include <chrono>
+
+/*  Tile sizes of the blocked multiply, chosen so a tile of b stays in L2 */
+static const size_t BLOCK_ROWS = 64;
+static const size_t BLOCK_INNER = 256;
+static const size_t BLOCK_COLS = 512;
+/*  Products smaller than this many multiply-adds are not worth threading */
+static const double PARALLEL_FLOP_THRESHOLD = 1e6;
+/*  Number of draws transformed at a time by correlatedNormals */
+static const size_t DRAW_BLOCK = 1024;
+
+Matrix::Matrix() : nRows(0), nCols(0)
+{
+}
+
+Matrix::Matrix(size_t rows, size_t cols, double value)
+    : nRows(rows), nCols(cols), values(rows * cols, value)
+{
+}
+
+Matrix Matrix::identity(size_t n)
+{
+    Matrix m(n, n);
+    for (size_t i = 0; i < n; i++)
+    {
+        m(i, i) = 1.0;
+    }
+    return m;
+}
+
+void multiply(const Matrix &a, const Matrix &b, Matrix &c)
+{
+    if (a.cols() != b.rows())
+    {
+        throw std::invalid_argument("Matrix dimensions do not agree");
+    }
+    size_t n = a.rows();
+    size_t inner = a.cols();
+    size_t m = b.cols();
+    c = Matrix(n, m);
+
+    size_t nRowBlocks = (n + BLOCK_ROWS - 1) / BLOCK_ROWS;
+    double flops = (double)n * inner * m;
+    size_t minChunk = flops < PARALLEL_FLOP_THRESHOLD ? nRowBlocks : 1;
+    parallelFor(nRowBlocks, [&](size_t firstBlock, size_t lastBlock)
+    {
+        for (size_t rowBlock = firstBlock; rowBlock < lastBlock; rowBlock++)
+        {
+            size_t i0 = rowBlock * BLOCK_ROWS;
+            size_t i1 = std::min(n, i0 + BLOCK_ROWS);
+            for (size_t k0 = 0; k0 < inner; k0 += BLOCK_INNER)
+            {
+                size_t k1 = std::min(inner, k0 + BLOCK_INNER);
+                for (size_t j0 = 0; j0 < m; j0 += BLOCK_COLS)
+                {
+                    size_t j1 = std::min(m, j0 + BLOCK_COLS);
+                    for (size_t i = i0; i < i1; i++)
+                    {
+                        double *ci = c.row(i);
+                        const double *ai = a.row(i);
+                        for (size_t k = k0; k < k1; k++)
+                        {
+                            double aik = ai[k];
+                            const double *bk = b.row(k);
+                            // contiguous in j so the compiler can vectorize it
+                            for (size_t j = j0; j < j1; j++)
+                            {
+                                ci[j] += aik * bk[j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }, minChunk);
+}
+
+Matrix operator*(const Matrix &a, const Matrix &b)
+{
+    Matrix c;
+    multiply(a, b, c);
+    return c;
+}
+
+std::vector<double> operator*(const Matrix &a, const std::vector<double> &x)
+{
+    if (a.cols() != x.size())
+    {
+        throw std::invalid_argument("Matrix dimensions do not agree");
+    }
+    std::vector<double> result(a.rows());
+    size_t minChunk = (double)a.rows() * a.cols() < PARALLEL_FLOP_THRESHOLD ? a.rows() : BLOCK_ROWS;
+    parallelFor(a.rows(), [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            const double *ai = a.row(i);
+            double sum = 0.0;
+            for (size_t j = 0; j < a.cols(); j++)
+            {
+                sum += ai[j] * x[j];
+            }
+            result[i] = sum;
+        }
+    }, minChunk);
+    return result;
+}
+
+Matrix transpose(const Matrix &a)
+{
+    Matrix t(a.cols(), a.rows());
+    // transpose tile by tile so neither side is walked with a large stride
+    const size_t tile = 32;
+    for (size_t i0 = 0; i0 < a.rows(); i0 += tile)
+    {
+        for (size_t j0 = 0; j0 < a.cols(); j0 += tile)
+        {
+            size_t i1 = std::min(a.rows(), i0 + tile);
+            size_t j1 = std::min(a.cols(), j0 + tile);
+            for (size_t i = i0; i < i1; i++)
+            {
+                for (size_t j = j0; j < j1; j++)
+                {
+                    t(j, i) = a(i, j);
+                }
+            }
+        }
+    }
+    return t;
+}
+
+/*  Cholesky-Banachiewicz factorisation of a + shift * I, returns false on a non positive pivot */
+static bool tryCholesky(const Matrix &a, double shift, Matrix &l)
+{
+    size_t n = a.rows();
+    l = Matrix(n, n);
+    for (size_t i = 0; i < n; i++)
+    {
+        const double *li = l.row(i);
+        for (size_t j = 0; j <= i; j++)
+        {
+            const double *lj = l.row(j);
+            double sum = a(i, j);
+            for (size_t k = 0; k < j; k++)
+            {
+                sum -= li[k] * lj[k];
+            }
+            if (i == j)
+            {
+                sum += shift;
+                if (!(sum > 0.0))
+                {
+                    return false;
+                }
+                l(i, i) = std::sqrt(sum);
+            }
+            else
+            {
+                l(i, j) = sum / l(j, j);
+            }
+        }
+    }
+    return true;
+}
+
+Matrix cholesky(const Matrix &a, bool repair)
+{
+    if (a.rows() != a.cols())
+    {
+        throw std::invalid_argument("Cholesky requires a square matrix");
+    }
+    size_t n = a.rows();
+    Matrix l;
+    if (tryCholesky(a, 0.0, l))
+    {
+        return l;
+    }
+    if (!repair)
+    {
+        throw std::invalid_argument("Matrix is not positive definite");
+    }
+
+    double maxDiagonal = 0.0;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (a(i, i) < 0.0)
+        {
+            throw std::invalid_argument("Matrix has a negative diagonal element");
+        }
+        maxDiagonal = std::max(maxDiagonal, a(i, i));
+    }
+    // grow the shift geometrically until the factorisation succeeds
+    for (double shift = 1e-12 * std::max(maxDiagonal, 1e-300); shift <= n * maxDiagonal; shift *= 10)
+    {
+        if (tryCholesky(a, shift, l))
+        {
+            DEBUG_PRINT("cholesky repaired with shift " << shift);
+            for (size_t i = 0; i < n; i++)
+            {
+                double scale = std::sqrt(a(i, i) / (a(i, i) + shift));
+                double *li = l.row(i);
+                for (size_t j = 0; j <= i; j++)
+                {
+                    li[j] *= scale;
+                }
+            }
+            return l;
+        }
+    }
+    throw std::invalid_argument("Matrix could not be repaired to positive definite");
+}
+
+std::vector<double> choleskySolve(const Matrix &choleskyFactor, const std::vector<double> &b)
+{
+    size_t n = choleskyFactor.rows();
+    if (b.size() != n)
+    {
+        throw std::invalid_argument("Matrix dimensions do not agree");
+    }
+    const Matrix &l = choleskyFactor;
+    std::vector<double> x(b);
+    // solve L * y = b
+    for (size_t i = 0; i < n; i++)
+    {
+        const double *li = l.row(i);
+        for (size_t k = 0; k < i; k++)
+        {
+            x[i] -= li[k] * x[k];
+        }
+        x[i] /= li[i];
+    }
+    // solve L^T * x = y
+    for (size_t i = n; i-- > 0;)
+    {
+        for (size_t k = i + 1; k < n; k++)
+        {
+            x[i] -= l(k, i) * x[k];
+        }
+        x[i] /= l(i, i);
+    }
+    return x;
+}
+
+Matrix applyCholesky(const Matrix &choleskyFactor, const Matrix &z)
+{
+    return z * transpose(choleskyFactor);
+}
+
+Matrix correlatedNormals(const Matrix &choleskyFactor, int nDraws)
+{
+    size_t n = choleskyFactor.rows();
+    Matrix result(nDraws, n);
+    Matrix factorTransposed = transpose(choleskyFactor);
+    Matrix block;
+    for (size_t first = 0; first < (size_t)nDraws; first += DRAW_BLOCK)
+    {
+        size_t count = std::min(DRAW_BLOCK, (size_t)nDraws - first);
+        std::vector<double> normals = randn((int)(count * n));
+        Matrix z(count, n);
+        std::copy(normals.begin(), normals.end(), z.data());
+        multiply(z, factorTransposed, block);
+        std::copy(block.data(), block.data() + count * n, result.row(first));
+    }
+    return result;
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+static Matrix sampleMatrix(size_t rows, size_t cols)
+{
+    Matrix m(rows, cols);
+    for (size_t i = 0; i < rows; i++)
+    {
+        for (size_t j = 0; j < cols; j++)
+        {
+            m(i, j) = std::sin(1.0 + i * cols + j);
+        }
+    }
+    return m;
+}
+
+static void testMultiply()
+{
+    Matrix a(2, 3);
+    Matrix b(3, 2);
+    for (size_t i = 0; i < 6; i++)
+    {
+        a.data()[i] = i + 1.0;
+        b.data()[i] = i + 7.0;
+    }
+    Matrix c = a * b;
+    ASSERT(c.rows() == 2 && c.cols() == 2);
+    ASSERT_APPROX_EQUAL(c(0, 0), 58, 1e-12);
+    ASSERT_APPROX_EQUAL(c(0, 1), 64, 1e-12);
+    ASSERT_APPROX_EQUAL(c(1, 0), 139, 1e-12);
+    ASSERT_APPROX_EQUAL(c(1, 1), 154, 1e-12);
+
+    // compare the blocked kernel against the textbook triple loop
+    Matrix x = sampleMatrix(150, 300);
+    Matrix y = sampleMatrix(300, 70);
+    Matrix z = x * y;
+    for (size_t i = 0; i < x.rows(); i++)
+    {
+        for (size_t j = 0; j < y.cols(); j++)
+        {
+            double expected = 0.0;
+            for (size_t k = 0; k < x.cols(); k++)
+            {
+                expected += x(i, k) * y(k, j);
+            }
+            ASSERT_APPROX_EQUAL(z(i, j), expected, 1e-10);
+        }
+    }
+}
+
+static void testMatrixVector()
+{
+    Matrix a = sampleMatrix(5, 4);
+    std::vector<double> x{1, -2, 3, 0.5};
+    std::vector<double> y = a * x;
+    ASSERT(y.size() == 5);
+    for (size_t i = 0; i < 5; i++)
+    {
+        double expected = a(i, 0) - 2 * a(i, 1) + 3 * a(i, 2) + 0.5 * a(i, 3);
+        ASSERT_APPROX_EQUAL(y[i], expected, 1e-12);
+    }
+}
+
+static void testCholesky()
+{
+    Matrix a(3, 3);
+    double values[] = {4, 12, -16, 12, 37, -43, -16, -43, 98};
+    std::copy(values, values + 9, a.data());
+    Matrix l = cholesky(a, false);
+    ASSERT_APPROX_EQUAL(l(0, 0), 2, 1e-12);
+    ASSERT_APPROX_EQUAL(l(1, 0), 6, 1e-12);
+    ASSERT_APPROX_EQUAL(l(1, 1), 1, 1e-12);
+    ASSERT_APPROX_EQUAL(l(2, 0), -8, 1e-12);
+    ASSERT_APPROX_EQUAL(l(2, 1), 5, 1e-12);
+    ASSERT_APPROX_EQUAL(l(2, 2), 3, 1e-12);
+    ASSERT(l(0, 1) == 0 && l(0, 2) == 0 && l(1, 2) == 0);
+}
+
+static void testCholeskySolve()
+{
+    Matrix a(3, 3);
+    double values[] = {4, 12, -16, 12, 37, -43, -16, -43, 98};
+    std::copy(values, values + 9, a.data());
+    std::vector<double> x{1, -1, 2};
+    std::vector<double> solution = choleskySolve(cholesky(a), a * x);
+    for (size_t i = 0; i < 3; i++)
+    {
+        ASSERT_APPROX_EQUAL(solution[i], x[i], 1e-9);
+    }
+}
+
+static void testCholeskyRepair()
+{
+    // perfectly correlated assets give a singular correlation matrix
+    Matrix a(3, 3, 1.0);
+    bool thrown = false;
+    try
+    {
+        cholesky(a, false);
+    }
+    catch (const std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    ASSERT(thrown);
+
+    Matrix l = cholesky(a);
+    Matrix product = l * transpose(l);
+    for (size_t i = 0; i < 3; i++)
+    {
+        for (size_t j = 0; j < 3; j++)
+        {
+            ASSERT_APPROX_EQUAL(product(i, j), a(i, j), 1e-6);
+        }
+    }
+}
+
+static void testCorrelatedNormals()
+{
+    Matrix correlation(2, 2, 0.8);
+    correlation(0, 0) = 1.0;
+    correlation(1, 1) = 1.0;
+    Matrix draws = correlatedNormals(cholesky(correlation), 20000);
+    ASSERT(draws.rows() == 20000 && draws.cols() == 2);
+    std::vector<double> x(draws.rows());
+    std::vector<double> y(draws.rows());
+    for (size_t i = 0; i < draws.rows(); i++)
+    {
+        x[i] = draws(i, 0);
+        y[i] = draws(i, 1);
+    }
+    double mx = mean(x);
+    double my = mean(y);
+    double covariance = 0.0;
+    for (size_t i = 0; i < x.size(); i++)
+    {
+        covariance += (x[i] - mx) * (y[i] - my);
+    }
+    covariance /= x.size() - 1;
+    double rho = covariance / (standardDeviation(x) * standardDeviation(y));
+    ASSERT_APPROX_EQUAL(rho, 0.8, 0.02);
+}
+
+void testMatrix()
+{
+    TEST(testMultiply);
+    TEST(testMatrixVector);
+    TEST(testCholesky);
+    TEST(testCholeskySolve);
+    TEST(testCholeskyRepair);
+    TEST(testCorrelatedNormals);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+/*  A correlation matrix with exponentially decaying correlation between assets */
+static Matrix benchmarkCorrelation(size_t n)
+{
+    Matrix c(n, n);
+    for (size_t i = 0; i < n; i++)
+    {
+        for (size_t j = 0; j < n; j++)
+        {
+            c(i, j) = std::exp(-0.01 * std::fabs((double)i - (double)j));
+        }
+    }
+    return c;
+}
+
+void benchmarkMatrix()
+{
+    size_t sizes[] = {100, 250, 500, 1000, 2000};
+    for (size_t n : sizes)
+    {
+        Matrix correlation = benchmarkCorrelation(n);
+
+        auto start = std::chrono::steady_clock::now();
+        Matrix product = correlation * correlation;
+        double multiplySeconds = secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        Matrix l = cholesky(correlation);
+        double choleskySeconds = secondsSince(start);
+
+        std::cout << "matrix n=" << n
+                  << " multiply " << 2.0 * n * n * n / multiplySeconds * 1e-9 << " GFLOP/s"
+                  << " cholesky " << n * n * n / 3.0 / choleskySeconds * 1e-9 << " GFLOP/s\n";
+
+        int nDraws = (int)std::max<size_t>(1000, 20000000 / (n * n));
+        start = std::chrono::steady_clock::now();
+        Matrix draws = correlatedNormals(l, nDraws);
+        double drawSeconds = secondsSince(start);
+        std::cout << "matrix n=" << n << " correlated draws "
+                  << nDraws / drawSeconds << " vectors/s, "
+                  << nDraws * n / drawSeconds << " normals/s\n";
+    }
+}
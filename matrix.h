@@ -0,0 +1,130 @@
+#pragma once
+
+#include "stdafx.h"
+#include <cstddef>
+#include <new>
+
+/**
+ *  Allocator returning memory aligned to a cache line so that rows
+ *  of a Matrix start on a SIMD friendly boundary
+ */
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T *p, size_t)
+    {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+/**
+ *  A dense, contiguous, row-major matrix of doubles
+ */
+class Matrix
+{
+public:
+    Matrix();
+    Matrix(size_t rows, size_t cols, double value = 0.0);
+
+    /** Returns the n by n identity matrix */
+    static Matrix identity(size_t n);
+
+    size_t rows() const { return nRows; }
+    size_t cols() const { return nCols; }
+
+    double &operator()(size_t i, size_t j) { return values[i * nCols + j]; }
+    double operator()(size_t i, size_t j) const { return values[i * nCols + j]; }
+
+    /** Pointer to the first element of row i */
+    double *row(size_t i) { return values.data() + i * nCols; }
+    const double *row(size_t i) const { return values.data() + i * nCols; }
+
+    double *data() { return values.data(); }
+    const double *data() const { return values.data(); }
+
+private:
+    size_t nRows;
+    size_t nCols;
+    std::vector<double, AlignedAllocator<double>> values;
+};
+
+/**
+ * Computes c = a * b using a cache-blocked kernel, parallel over row blocks of c
+ */
+void multiply(const Matrix &a, const Matrix &b, Matrix &c);
+
+/**
+ * Computes the matrix product a * b
+ */
+Matrix operator*(const Matrix &a, const Matrix &b);
+
+/**
+ * Computes the matrix-vector product a * x
+ */
+std::vector<double> operator*(const Matrix &a, const std::vector<double> &x);
+
+/**
+ * Returns the transpose of a
+ */
+Matrix transpose(const Matrix &a);
+
+/**
+ * Computes the lower triangular Cholesky factor L with a = L * L^T.
+ * If a is only positive semi-definite (or slightly indefinite through
+ * rounding or estimation noise) and repair is true, the smallest diagonal
+ * shift that makes it positive definite is added and the rows of L are
+ * rescaled so L * L^T keeps the diagonal of a. Otherwise a non positive
+ * definite input throws std::invalid_argument.
+ */
+Matrix cholesky(const Matrix &a, bool repair = true);
+
+/**
+ * Solves L * L^T * x = b by forward and back substitution given the
+ * Cholesky factor L
+ */
+std::vector<double> choleskySolve(const Matrix &choleskyFactor, const std::vector<double> &b);
+
+/**
+ * Applies the Cholesky factor to a block of independent normals stored one
+ * draw per row, i.e. returns z * L^T so each row has covariance L * L^T
+ */
+Matrix applyCholesky(const Matrix &choleskyFactor, const Matrix &z);
+
+/**
+ * Returns nDraws correlated normal vectors, one per row, with covariance
+ * L * L^T.  The underlying normals come from randn and are transformed
+ * in blocks.
+ */
+Matrix correlatedNormals(const Matrix &choleskyFactor, int nDraws);
+
+/**
+ *  Test function
+ */
+void testMatrix();
+
+/**
+ *  Benchmark function
+ */
+void benchmarkMatrix();
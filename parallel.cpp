@@ -0,0 +1,131 @@
+#include "parallel.h"
+#include "testing.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*  Zero means use the hardware concurrency */
+static std::atomic<int> requestedThreads{0};
+
+int numThreads()
+{
+    int n = requestedThreads.load(std::memory_order_relaxed);
+    if (n > 0)
+    {
+        return n;
+    }
+    unsigned int hardware = std::thread::hardware_concurrency();
+    return hardware == 0 ? 1 : (int)hardware;
+}
+
+void setNumThreads(int n)
+{
+    requestedThreads.store(n < 0 ? 0 : n, std::memory_order_relaxed);
+}
+
+void parallelFor(size_t n, const std::function<void(size_t, size_t)> &f, size_t minChunk)
+{
+    if (n == 0)
+    {
+        return;
+    }
+    minChunk = std::max<size_t>(minChunk, 1);
+    size_t nChunks = std::min<size_t>((size_t)numThreads(), (n + minChunk - 1) / minChunk);
+    if (nChunks <= 1)
+    {
+        f(0, n);
+        return;
+    }
+
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto runChunk = [&](size_t chunk)
+    {
+        size_t begin = n * chunk / nChunks;
+        size_t end = n * (chunk + 1) / nChunks;
+        try
+        {
+            f(begin, end);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(nChunks - 1);
+    for (size_t chunk = 1; chunk < nChunks; chunk++)
+    {
+        threads.emplace_back(runChunk, chunk);
+    }
+    // the calling thread does the first chunk itself
+    runChunk(0);
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+static void testParallelForCoversRange()
+{
+    std::vector<int> visits(1000, 0);
+    parallelFor(visits.size(), [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            visits[i]++;
+        }
+    });
+    for (int v : visits)
+    {
+        ASSERT(v == 1);
+    }
+}
+
+static void testParallelForRethrows()
+{
+    // several threads even on a single core machine, so a chunk other than the first runs
+    int threads = numThreads();
+    setNumThreads(4);
+    bool thrown = false;
+    try
+    {
+        parallelFor(100, [](size_t begin, size_t)
+        {
+            if (begin > 0)
+            {
+                throw std::runtime_error("chunk failed");
+            }
+        });
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    setNumThreads(threads);
+    ASSERT(thrown);
+}
+
+void testParallel()
+{
+    TEST(testParallelForCoversRange);
+    TEST(testParallelForRethrows);
+}
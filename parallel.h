@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+/** Number of threads used by the parallel algorithms (defaults to the hardware concurrency) */
+int numThreads();
+/** Sets the number of threads used by the parallel algorithms, 1 disables threading */
+void setNumThreads(int n);
+
+/**
+ * Splits the range [0, n) into contiguous chunks of at least minChunk
+ * elements and calls f(begin, end) for each chunk on its own thread.
+ * The first exception thrown by a chunk is rethrown on the calling thread.
+ */
+void parallelFor(size_t n,
+                 const std::function<void(size_t, size_t)> &f,
+                 size_t minChunk = 1);
+
+/**
+ *  Test function
+ */
+void testParallel();
@@ -0,0 +1,468 @@
+#include "pipeline.h"
+#include "matlib.h"
+#include <chrono>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/*  Default chunk, 32KB of doubles, which stays in the L1 or L2 cache */
+static const size_t DEFAULT_CHUNK = 4096;
+/*  Magnitudes below this share the zero bucket of a sketch */
+static const double SKETCH_MIN_MAGNITUDE = 1e-12;
+
+void StreamMoments::add(std::span<const double> values)
+{
+    if (values.empty())
+    {
+        return;
+    }
+    // two passes over the chunk, which is in cache, then merge it in
+    StreamMoments chunk;
+    double sum = 0.0;
+    for (double x : values)
+    {
+        sum += x;
+        chunk.min = std::min(chunk.min, x);
+        chunk.max = std::max(chunk.max, x);
+    }
+    chunk.count = values.size();
+    chunk.mean = sum / chunk.count;
+    double m2 = 0.0;
+    for (double x : values)
+    {
+        m2 += (x - chunk.mean) * (x - chunk.mean);
+    }
+    chunk.m2 = m2;
+    merge(chunk);
+}
+
+void StreamMoments::merge(const StreamMoments &other)
+{
+    if (other.count == 0)
+    {
+        return;
+    }
+    if (count == 0)
+    {
+        *this = other;
+        return;
+    }
+    double total = (double)(count + other.count);
+    double delta = other.mean - mean;
+    mean += delta * (other.count / total);
+    m2 += other.m2 + delta * delta * (count * (other.count / total));
+    count += other.count;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+}
+
+double StreamMoments::variance(bool sample) const
+{
+    if (count == 0 || (sample && count == 1))
+    {
+        throw std::invalid_argument("Too few values for a variance");
+    }
+    return m2 / (sample ? count - 1 : count);
+}
+
+double StreamMoments::standardDeviation(bool sample) const
+{
+    return std::sqrt(variance(sample));
+}
+
+QuantileSketch::QuantileSketch(double relativeAccuracy)
+    : relativeAccuracy(relativeAccuracy), zeros(0), total(0)
+{
+    if (!(relativeAccuracy > 0.0 && relativeAccuracy < 1.0))
+    {
+        throw std::invalid_argument("Relative accuracy must be between 0 and 1");
+    }
+    gamma = (1.0 + relativeAccuracy) / (1.0 - relativeAccuracy);
+    logGamma = std::log(gamma);
+}
+
+void QuantileSketch::Buckets::add(int index, size_t count)
+{
+    if (counts.empty())
+    {
+        offset = index;
+        counts.assign(1, 0);
+    }
+    else if (index < offset)
+    {
+        counts.insert(counts.begin(), offset - index, 0);
+        offset = index;
+    }
+    else if (index - offset >= (int)counts.size())
+    {
+        counts.resize(index - offset + 1, 0);
+    }
+    counts[index - offset] += count;
+}
+
+/*  Bucket i holds the magnitudes in (gamma^(i-1), gamma^i] */
+int QuantileSketch::bucketIndex(double magnitude) const
+{
+    return (int)std::ceil(std::log(magnitude) / logGamma);
+}
+
+/*  The value within relativeAccuracy of the whole of bucket i */
+double QuantileSketch::bucketValue(int index) const
+{
+    return 2.0 * std::exp(index * logGamma) / (gamma + 1.0);
+}
+
+void QuantileSketch::add(double x)
+{
+    if (x > SKETCH_MIN_MAGNITUDE)
+    {
+        positive.add(bucketIndex(x), 1);
+    }
+    else if (x < -SKETCH_MIN_MAGNITUDE)
+    {
+        negative.add(bucketIndex(-x), 1);
+    }
+    else
+    {
+        zeros++;
+    }
+    total++;
+}
+
+void QuantileSketch::add(std::span<const double> values)
+{
+    for (double x : values)
+    {
+        add(x);
+    }
+}
+
+void QuantileSketch::merge(const QuantileSketch &other)
+{
+    if (other.relativeAccuracy != relativeAccuracy)
+    {
+        throw std::invalid_argument("Sketches have different accuracies");
+    }
+    for (size_t i = 0; i < other.positive.counts.size(); i++)
+    {
+        if (other.positive.counts[i] > 0)
+        {
+            positive.add(other.positive.offset + (int)i, other.positive.counts[i]);
+        }
+    }
+    for (size_t i = 0; i < other.negative.counts.size(); i++)
+    {
+        if (other.negative.counts[i] > 0)
+        {
+            negative.add(other.negative.offset + (int)i, other.negative.counts[i]);
+        }
+    }
+    zeros += other.zeros;
+    total += other.total;
+}
+
+double QuantileSketch::quantile(double q) const
+{
+    if (total == 0 || q < 0.0 || q > 1.0)
+    {
+        throw std::invalid_argument("Invalid input: sketch is empty or quantile is out of range.");
+    }
+    double rank = q * (total - 1);
+    double seen = 0.0;
+    // from the most negative value upwards
+    for (size_t i = negative.counts.size(); i-- > 0;)
+    {
+        seen += negative.counts[i];
+        if (seen > rank)
+        {
+            return -bucketValue(negative.offset + (int)i);
+        }
+    }
+    seen += zeros;
+    if (seen > rank)
+    {
+        return 0.0;
+    }
+    for (size_t i = 0; i < positive.counts.size(); i++)
+    {
+        seen += positive.counts[i];
+        if (seen > rank)
+        {
+            return bucketValue(positive.offset + (int)i);
+        }
+    }
+    return bucketValue(positive.offset + (int)positive.counts.size() - 1);
+}
+
+/*  The splitmix64 finaliser, a bijection that scrambles every bit */
+static inline uint64_t mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+Pipeline::Pipeline(size_t n, uint64_t seed)
+    : n(n), seed(mix(seed)), chunk(DEFAULT_CHUNK), runParallel(false)
+{
+}
+
+Pipeline &Pipeline::norminv()
+{
+    stages.push_back([](std::span<double> values)
+    {
+        for (double &x : values)
+        {
+            x = ::norminv<double>(x);
+        }
+    });
+    return *this;
+}
+
+Pipeline &Pipeline::boxMuller()
+{
+    // chunks always have an even length, so pairs never straddle two chunks
+    stages.push_back([](std::span<double> values)
+    {
+        for (size_t i = 0; i + 1 < values.size(); i += 2)
+        {
+            double r = std::sqrt(-2.0 * std::log(values[i]));
+            double theta = 2.0 * PI * values[i + 1];
+            values[i] = r * std::cos(theta);
+            values[i + 1] = r * std::sin(theta);
+        }
+    });
+    return *this;
+}
+
+Pipeline &Pipeline::chunkSize(size_t elements)
+{
+    chunk = std::max<size_t>(elements + (elements & 1), 2);
+    return *this;
+}
+
+Pipeline &Pipeline::parallel(bool enabled)
+{
+    runParallel = enabled;
+    return *this;
+}
+
+size_t Pipeline::evaluateChunk(size_t i, std::vector<double> &buffer) const
+{
+    size_t begin = i * chunk;
+    size_t length = std::min(chunk, n - begin);
+    // an odd final chunk draws one extra uniform to complete the last pair
+    size_t padded = length + (length & 1);
+    buffer.resize(padded);
+    for (size_t j = 0; j < padded; j++)
+    {
+        uint64_t bits = mix(seed + (begin + j + 1) * 0x9E3779B97F4A7C15ULL);
+        buffer[j] = ((double)(bits >> 11) + 0.5) * 0x1.0p-53;
+    }
+    std::span<double> values(buffer.data(), padded);
+    for (const std::function<void(std::span<double>)> &stage : stages)
+    {
+        stage(values);
+    }
+    return length;
+}
+
+StreamMoments Pipeline::moments() const
+{
+    return reduce(StreamMoments(), [](StreamMoments &state, std::span<const double> values)
+    {
+        state.add(values);
+    }, [](StreamMoments &state, const StreamMoments &other)
+    {
+        state.merge(other);
+    });
+}
+
+QuantileSketch Pipeline::sketch(double relativeAccuracy) const
+{
+    return reduce(QuantileSketch(relativeAccuracy), [](QuantileSketch &state, std::span<const double> values)
+    {
+        state.add(values);
+    }, [](QuantileSketch &state, const QuantileSketch &other)
+    {
+        state.merge(other);
+    });
+}
+
+std::vector<double> Pipeline::collect() const
+{
+    std::vector<double> result;
+    result.reserve(n);
+    std::vector<double> buffer;
+    for (size_t i = 0; i * chunk < n; i++)
+    {
+        size_t length = evaluateChunk(i, buffer);
+        result.insert(result.end(), buffer.begin(), buffer.begin() + length);
+    }
+    return result;
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+// Tests that the draws do not depend on the chunking or threads
+static void testUniformSource()
+{
+    std::vector<double> draws = Pipeline(10001, 7).collect();
+    ASSERT(draws.size() == 10001);
+    ASSERT(Pipeline(10001, 7).chunkSize(100).collect() == draws);
+    ASSERT(Pipeline(10001, 7).chunkSize(3).parallel().collect() == draws);
+    ASSERT(Pipeline(10001, 8).collect() != draws);
+    ASSERT(min(draws) > 0.0 && max(draws) < 1.0);
+
+    StreamMoments moments = Pipeline(1000000, 7).moments();
+    ASSERT(moments.count == 1000000);
+    ASSERT_APPROX_EQUAL(moments.mean, 0.5, 2e-3);
+    ASSERT_APPROX_EQUAL(moments.variance(), 1.0 / 12.0, 1e-3);
+    ASSERT(Pipeline(0, 7).moments().count == 0);
+}
+
+// Tests the streamed moments against the vector statistics of the same draws
+static void testNormalMoments()
+{
+    for (int boxMuller = 0; boxMuller < 2; boxMuller++)
+    {
+        Pipeline normals(100001, 11);
+        if (boxMuller)
+        {
+            normals.boxMuller();
+        }
+        else
+        {
+            normals.norminv();
+        }
+        std::vector<double> values = normals.collect();
+        for (bool parallel : {false, true})
+        {
+            StreamMoments moments = normals.parallel(parallel).chunkSize(1000).moments();
+            ASSERT(moments.count == values.size());
+            ASSERT_APPROX_EQUAL(moments.mean, mean(values), 1e-12);
+            ASSERT_APPROX_EQUAL(moments.standardDeviation(), standardDeviation(values), 1e-12);
+            ASSERT(moments.min == min(values));
+            ASSERT(moments.max == max(values));
+            ASSERT_APPROX_EQUAL(moments.mean, 0.0, 1e-2);
+            ASSERT_APPROX_EQUAL(moments.standardDeviation(), 1.0, 1e-2);
+        }
+    }
+}
+
+// Tests the sketch percentiles against prctile and that merged sketches match
+static void testQuantileSketch()
+{
+    Pipeline normals = Pipeline(200000, 3).norminv();
+    std::vector<double> values = normals.collect();
+    QuantileSketch sketch = normals.sketch(0.01);
+    ASSERT(sketch.count() == values.size());
+    for (double p : {1.0, 5.0, 25.0, 75.0, 95.0, 99.0})
+    {
+        double exact = prctile(values, p);
+        ASSERT(std::fabs(sketch.prctile(p) - exact) <= 0.02 * std::fabs(exact));
+    }
+
+    QuantileSketch left(0.01);
+    QuantileSketch right(0.01);
+    left.add(std::span<const double>(values.data(), values.size() / 2));
+    right.add(std::span<const double>(values.data() + values.size() / 2, values.size() - values.size() / 2));
+    left.merge(right);
+    for (double q : {0.0, 0.1, 0.5, 0.9, 1.0})
+    {
+        ASSERT(left.quantile(q) == sketch.quantile(q));
+    }
+}
+
+// Tests a Monte Carlo price computed without materialising the paths
+static void testPayoffPipeline()
+{
+    double strike = 105.0;
+    double maturity = 1.0;
+    double spot = 100.0;
+    double volatility = 0.2;
+    double rate = 0.03;
+    double drift = spot * std::exp((rate - 0.5 * volatility * volatility) * maturity);
+    double diffusion = volatility * std::sqrt(maturity);
+    double discount = std::exp(-rate * maturity);
+    StreamMoments payoffs = Pipeline(1000000, 5).norminv().transform([=](double z)
+    {
+        return discount * std::max(drift * std::exp(diffusion * z) - strike, 0.0);
+    }).parallel().moments();
+    double standardError = payoffs.standardDeviation() / std::sqrt((double)payoffs.count);
+    double exact = blackScholesCallPrice(strike, maturity, spot, volatility, rate);
+    ASSERT(std::fabs(payoffs.mean - exact) < 4 * standardError);
+}
+
+void testPipeline()
+{
+    TEST(testUniformSource);
+    TEST(testNormalMoments);
+    TEST(testQuantileSketch);
+    TEST(testPayoffPipeline);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+/*  The largest resident set size of the process so far, in megabytes */
+static double peakResidentMegabytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize / 1048576.0;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1048576.0;
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+void benchmarkPipeline()
+{
+    int n = 20000000;
+    std::cout << "mean and standard deviation of " << n << " normals, " << numThreads() << " threads\n";
+
+    // the streaming runs go first, as the peak resident size never falls
+    double peak = peakResidentMegabytes();
+    auto start = std::chrono::steady_clock::now();
+    StreamMoments moments = Pipeline(n, 1).norminv().moments();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  pipeline           " << n / seconds * 1e-6 << " M/s, peak grew "
+              << peakResidentMegabytes() - peak << " MB, mean " << moments.mean << "\n";
+
+    peak = peakResidentMegabytes();
+    start = std::chrono::steady_clock::now();
+    moments = Pipeline(n, 1).norminv().parallel().moments();
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  parallel pipeline  " << n / seconds * 1e-6 << " M/s, peak grew "
+              << peakResidentMegabytes() - peak << " MB, mean " << moments.mean << "\n";
+
+    peak = peakResidentMegabytes();
+    start = std::chrono::steady_clock::now();
+    std::vector<double> normals = randn(n);
+    double sampleMean = mean(normals);
+    double sampleDeviation = standardDeviation(normals);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    doNotOptimize(sampleDeviation);
+    std::cout << "  randn and vectors  " << n / seconds * 1e-6 << " M/s, peak grew "
+              << peakResidentMegabytes() - peak << " MB, mean " << sampleMean << "\n";
+}
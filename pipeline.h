@@ -0,0 +1,204 @@
+#pragma once
+
+#include "stdafx.h"
+#include "parallel.h"
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <span>
+
+/**
+ *  Count, mean, variance, min and max of a stream, accumulated a chunk at
+ *  a time and merged across chunks with Chan's formula
+ */
+struct StreamMoments
+{
+    size_t count = 0;
+    double mean = 0.0;
+    /** Sum of squared deviations from the mean */
+    double m2 = 0.0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    void add(std::span<const double> values);
+    void merge(const StreamMoments &other);
+
+    /** Default is the sample variance, as for standardDeviation */
+    double variance(bool sample = true) const;
+    double standardDeviation(bool sample = true) const;
+};
+
+/**
+ *  A fixed memory estimate of the distribution of a stream.  Values are
+ *  counted in buckets whose bounds grow geometrically, so every quantile
+ *  is returned to within the given relative accuracy whatever the number
+ *  of values, and sketches of different chunks merge exactly.  Values
+ *  closer to zero than 1e-12 share a single bucket.
+ */
+class QuantileSketch
+{
+public:
+    explicit QuantileSketch(double relativeAccuracy = 0.01);
+
+    void add(double x);
+    void add(std::span<const double> values);
+    /** Adds the counts of a sketch with the same accuracy */
+    void merge(const QuantileSketch &other);
+
+    /** The q-quantile for q in [0, 1] */
+    double quantile(double q) const;
+    /** The p-th percentile for p in [0, 100], as prctile */
+    double prctile(double p) const { return quantile(p / 100.0); }
+
+    size_t count() const { return total; }
+
+private:
+    /*  Counts of consecutive bucket indices starting at offset */
+    struct Buckets
+    {
+        int offset = 0;
+        std::vector<size_t> counts;
+
+        void add(int index, size_t count);
+    };
+
+    int bucketIndex(double magnitude) const;
+    double bucketValue(int index) const;
+
+    double relativeAccuracy;
+    double gamma;
+    double logGamma;
+    Buckets positive;
+    Buckets negative;
+    size_t zeros;
+    size_t total;
+};
+
+/**
+ *  A lazy stream of random numbers, from uniform draws through a chain of
+ *  transforms to a reduction, that never holds more than a chunk of it in
+ *  memory.  mean(randn(n)) becomes
+ *
+ *      Pipeline(n, seed).norminv().moments().mean
+ *
+ *  which uses O(chunk) memory instead of two vectors of n doubles.  Each
+ *  chunk is small enough to stay in cache while every stage runs over it
+ *  in a tight loop the compiler can vectorise.
+ *
+ *  The uniforms come from a counter based generator, so each draw depends
+ *  only on the seed and its position in the stream and the draws are the
+ *  same whatever the chunk size or number of threads.  With parallel()
+ *  ranges of chunks are reduced on separate threads and merged in order,
+ *  so a reduction is reproducible for a given number of threads.
+ */
+class Pipeline
+{
+public:
+    /** A stream of n uniforms in (0, 1) */
+    explicit Pipeline(size_t n, uint64_t seed = 0);
+
+    /** Maps the uniforms to standard normals by inverting normcdf */
+    Pipeline &norminv();
+    /** Maps consecutive pairs of uniforms to pairs of standard normals */
+    Pipeline &boxMuller();
+    /** Applies f to each element, e.g. a payoff of a normal draw */
+    template <typename F>
+    Pipeline &transform(F f);
+
+    /** Number of elements processed at a time, rounded up to an even number */
+    Pipeline &chunkSize(size_t elements);
+    /** Whether chunks are processed on several threads, see numThreads */
+    Pipeline &parallel(bool enabled = true);
+
+    size_t size() const { return n; }
+
+    StreamMoments moments() const;
+    QuantileSketch sketch(double relativeAccuracy = 0.01) const;
+
+    /**
+     *  Runs any reduction, accumulate(State &, std::span<const double>)
+     *  folding in each chunk and merge(State &, const State &) combining
+     *  the states of consecutive ranges of chunks
+     */
+    template <typename State, typename Accumulate, typename Merge>
+    State reduce(State initial, Accumulate accumulate, Merge merge) const;
+
+    /** The whole stream as a vector */
+    std::vector<double> collect() const;
+
+private:
+    /*  Fills buffer with chunk i of the stream and returns its length */
+    size_t evaluateChunk(size_t i, std::vector<double> &buffer) const;
+
+    size_t n;
+    uint64_t seed;
+    size_t chunk;
+    bool runParallel;
+    std::vector<std::function<void(std::span<double>)>> stages;
+};
+
+template <typename F>
+Pipeline &Pipeline::transform(F f)
+{
+    stages.push_back([f](std::span<double> values)
+    {
+        for (double &x : values)
+        {
+            x = f(x);
+        }
+    });
+    return *this;
+}
+
+template <typename State, typename Accumulate, typename Merge>
+State Pipeline::reduce(State initial, Accumulate accumulate, Merge merge) const
+{
+    size_t nChunks = (n + chunk - 1) / chunk;
+    std::vector<std::pair<size_t, State>> partials;
+    std::mutex partialsMutex;
+    auto reduceRange = [&](size_t begin, size_t end)
+    {
+        std::vector<double> buffer;
+        State state = initial;
+        for (size_t i = begin; i < end; i++)
+        {
+            size_t length = evaluateChunk(i, buffer);
+            accumulate(state, std::span<const double>(buffer.data(), length));
+        }
+        std::lock_guard<std::mutex> lock(partialsMutex);
+        partials.emplace_back(begin, std::move(state));
+    };
+    if (runParallel)
+    {
+        parallelFor(nChunks, reduceRange);
+    }
+    else
+    {
+        reduceRange(0, nChunks);
+    }
+    if (partials.empty())
+    {
+        return initial;
+    }
+    std::sort(partials.begin(), partials.end(), [](const auto &a, const auto &b)
+    {
+        return a.first < b.first;
+    });
+    State result = std::move(partials[0].second);
+    for (size_t i = 1; i < partials.size(); i++)
+    {
+        merge(result, partials[i].second);
+    }
+    return result;
+}
+
+/**
+ *  Test function
+ */
+void testPipeline();
+
+/**
+ *  Benchmark function
+ */
+void benchmarkPipeline();
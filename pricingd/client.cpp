@@ -0,0 +1,344 @@
+#include "matlib.h"
+#include "protocol.h"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <thread>
+
+/*
+ *  Load generator for the pricing daemon.  For 1, 2, 4, ... clients, each
+ *  on its own connection with one request outstanding, it sends batches of
+ *  random options for a few seconds and reports the throughput and the
+ *  latency percentiles of the requests.  It then times one large batch
+ *  sent inline and in shared memory, and checks the prices it received
+ *  against blackScholesCallPrice and blackScholesPutPrice.
+ *
+ *      loadgen [socket] [--seconds s] [--batch options] [--max-clients n] [--large options]
+ */
+
+/*  A connection to the daemon, with a shared memory segment for large
+    batches that is unlinked as soon as it is created, so only this process
+    and the server it passes the descriptor to can map it */
+class PricingClient
+{
+public:
+    explicit PricingClient(const std::string &path)
+        : socket(::socket(AF_UNIX, SOCK_STREAM, 0)), nextId(0), segmentDescriptor(-1), segment(MAP_FAILED),
+          segmentCount(0)
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        if (socket < 0 || connect(socket, (sockaddr *)&address, sizeof(address)) != 0)
+        {
+            std::string error = std::strerror(errno);
+            if (socket >= 0)
+            {
+                close(socket);
+            }
+            throw std::runtime_error("Cannot connect to " + path + ": " + error);
+        }
+    }
+
+    ~PricingClient()
+    {
+        close(socket);
+        if (segment != MAP_FAILED)
+        {
+            munmap(segment, sharedSegmentSize(segmentCount));
+        }
+        if (segmentDescriptor >= 0)
+        {
+            close(segmentDescriptor);
+        }
+    }
+
+    PricingClient(const PricingClient &) = delete;
+    PricingClient &operator=(const PricingClient &) = delete;
+
+    /*  Prices the options with the options and prices on the socket */
+    std::vector<double> price(const std::vector<PricingOption> &options)
+    {
+        PricingRequest request = header(options.size(), 0);
+        std::vector<char> message(sizeof(request) + options.size() * sizeof(PricingOption));
+        std::memcpy(message.data(), &request, sizeof(request));
+        std::memcpy(message.data() + sizeof(request), options.data(), options.size() * sizeof(PricingOption));
+        if (!writeFully(socket, message.data(), message.size()))
+        {
+            throw std::runtime_error("Cannot send a request");
+        }
+        readResponse(request.id);
+        std::vector<double> prices(options.size());
+        if (!readFully(socket, prices.data(), prices.size() * sizeof(double)))
+        {
+            throw std::runtime_error("Connection closed while reading prices");
+        }
+        return prices;
+    }
+
+    /*  Space for count options in shared memory, to be filled before priceShared */
+    PricingOption *sharedOptions(size_t count)
+    {
+        if (count > segmentCount)
+        {
+            if (segment != MAP_FAILED)
+            {
+                munmap(segment, sharedSegmentSize(segmentCount));
+                segment = MAP_FAILED;
+            }
+            if (segmentDescriptor < 0)
+            {
+                static std::atomic<int> segments{0};
+                std::string name = "/pricing-" + std::to_string(getpid()) + "-" + std::to_string(segments++);
+                segmentDescriptor = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+                if (segmentDescriptor >= 0)
+                {
+                    shm_unlink(name.c_str());
+                }
+            }
+            if (segmentDescriptor >= 0 && ftruncate(segmentDescriptor, (off_t)sharedSegmentSize(count)) == 0)
+            {
+                segment = mmap(nullptr, sharedSegmentSize(count), PROT_READ | PROT_WRITE, MAP_SHARED,
+                               segmentDescriptor, 0);
+            }
+            if (segment == MAP_FAILED)
+            {
+                throw std::runtime_error(std::string("Cannot create shared memory: ") + std::strerror(errno));
+            }
+            segmentCount = count;
+        }
+        return (PricingOption *)segment;
+    }
+
+    /*  Prices the first count shared options in place, returning their prices */
+    const double *priceShared(size_t count)
+    {
+        PricingRequest request = header(count, PRICING_SHARED_MEMORY);
+        if (!writeWithDescriptor(socket, &request, sizeof(request), segmentDescriptor))
+        {
+            throw std::runtime_error("Cannot send a request");
+        }
+        readResponse(request.id);
+        return (const double *)((PricingOption *)segment + count);
+    }
+
+private:
+    PricingRequest header(size_t count, uint32_t flags)
+    {
+        PricingRequest request{};
+        request.magic = PRICING_MAGIC;
+        request.flags = flags;
+        request.id = nextId++;
+        request.count = (uint32_t)count;
+        return request;
+    }
+
+    void readResponse(uint64_t id)
+    {
+        PricingResponse response;
+        if (!readFully(socket, &response, sizeof(response)))
+        {
+            throw std::runtime_error("Connection closed while waiting for a response");
+        }
+        if (response.magic != PRICING_MAGIC || response.id != id || response.status != PricingStatus::Ok)
+        {
+            throw std::runtime_error("Request " + std::to_string(id) + " failed with status " +
+                                     std::to_string((uint32_t)response.status));
+        }
+    }
+
+    int socket;
+    uint64_t nextId;
+    int segmentDescriptor;
+    void *segment;
+    size_t segmentCount;
+};
+
+/*  Random options around the money, half calls and half puts */
+static std::vector<PricingOption> randomOptions(size_t n, std::mt19937 &generator)
+{
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<PricingOption> options(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        options[i] = {80.0 + 40.0 * uniform(generator), 0.1 + 2.0 * uniform(generator), 100.0,
+                      0.1 + 0.4 * uniform(generator), 0.05 * uniform(generator),
+                      i % 2 == 0 ? OptionType::Call : OptionType::Put, 0};
+    }
+    return options;
+}
+
+/*  Largest difference between the prices and those computed here */
+static double maxPricingError(const PricingOption *options, const double *prices, size_t n)
+{
+    double error = 0.0;
+    for (size_t i = 0; i < n; i++)
+    {
+        const PricingOption &o = options[i];
+        double expected = o.type == OptionType::Call
+                              ? blackScholesCallPrice(o.strike, o.maturity, o.spot, o.volatility, o.rate)
+                              : blackScholesPutPrice(o.strike, o.maturity, o.spot, o.volatility, o.rate);
+        error = std::max(error, std::abs(prices[i] - expected));
+    }
+    return error;
+}
+
+/*  Runs nClients closed loop clients for the given time and prints a line of results */
+static void runLoad(const std::string &path, int nClients, size_t batch, double seconds, double &maxError)
+{
+    std::vector<std::vector<double>> latencies(nClients);
+    std::vector<double> errors(nClients, 0.0);
+    std::vector<std::exception_ptr> failures(nClients);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::duration<double>(seconds);
+    for (int c = 0; c < nClients; c++)
+    {
+        threads.emplace_back([&, c]
+        {
+            // an exception escaping the thread would terminate, so it is passed to the caller
+            try
+            {
+                PricingClient client(path);
+                std::mt19937 generator(c);
+                std::vector<PricingOption> options = randomOptions(batch, generator);
+                // the first response is checked, the rest only timed
+                std::vector<double> prices = client.price(options);
+                errors[c] = maxPricingError(options.data(), prices.data(), batch);
+                while (std::chrono::steady_clock::now() < deadline)
+                {
+                    auto sent = std::chrono::steady_clock::now();
+                    doNotOptimize(client.price(options));
+                    latencies[c].push_back(secondsSince(sent) * 1e6);
+                }
+            }
+            catch (...)
+            {
+                failures[c] = std::current_exception();
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    for (const std::exception_ptr &failure : failures)
+    {
+        if (failure)
+        {
+            std::rethrow_exception(failure);
+        }
+    }
+    double elapsed = secondsSince(start);
+
+    std::vector<double> all;
+    for (int c = 0; c < nClients; c++)
+    {
+        all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+        maxError = std::max(maxError, errors[c]);
+    }
+    if (all.empty())
+    {
+        std::cout << "  clients=" << nClients << ": no requests completed\n";
+        return;
+    }
+    std::cout << "  clients=" << nClients
+              << " " << all.size() / elapsed * 1e-3 << " k requests/s"
+              << ", " << all.size() * batch / elapsed * 1e-6 << " M options/s"
+              << ", latency p50 " << prctile(all, 50) << " us"
+              << ", p99 " << prctile(all, 99) << " us"
+              << ", p999 " << prctile(all, 99.9) << " us\n";
+}
+
+/*  Times one large batch sent on the socket and in shared memory */
+static void runLargeBatch(const std::string &path, size_t n, double &maxError)
+{
+    PricingClient client(path);
+    std::mt19937 generator(12345);
+    std::vector<PricingOption> options = randomOptions(n, generator);
+    PricingOption *shared = client.sharedOptions(n);
+    std::copy(options.begin(), options.end(), shared);
+
+    // the first of each is a warm up, e.g. for the server's first mapping of the pages
+    double inlineSeconds = 0.0;
+    double sharedSeconds = 0.0;
+    for (int repeat = 0; repeat < 2; repeat++)
+    {
+        if (n <= MAX_INLINE_OPTIONS)
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<double> prices = client.price(options);
+            inlineSeconds = secondsSince(start);
+            maxError = std::max(maxError, maxPricingError(options.data(), prices.data(), n));
+        }
+        auto start = std::chrono::steady_clock::now();
+        const double *prices = client.priceShared(n);
+        sharedSeconds = secondsSince(start);
+        maxError = std::max(maxError, maxPricingError(shared, prices, n));
+    }
+    std::cout << "  batch of " << n << " options: ";
+    if (n <= MAX_INLINE_OPTIONS)
+    {
+        std::cout << "inline " << inlineSeconds * 1e3 << " ms, ";
+    }
+    std::cout << "shared memory " << sharedSeconds * 1e3 << " ms\n";
+}
+
+int main(int argc, char **argv)
+{
+    std::string path = DEFAULT_PRICING_SOCKET;
+    double seconds = 2.0;
+    size_t batch = 16;
+    int maxClients = 64;
+    size_t large = MAX_INLINE_OPTIONS;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option == "--seconds" && i + 1 < argc)
+        {
+            seconds = std::stod(argv[++i]);
+        }
+        else if (option == "--batch" && i + 1 < argc)
+        {
+            batch = std::stoul(argv[++i]);
+        }
+        else if (option == "--max-clients" && i + 1 < argc)
+        {
+            maxClients = std::stoi(argv[++i]);
+        }
+        else if (option == "--large" && i + 1 < argc)
+        {
+            large = std::stoul(argv[++i]);
+        }
+        else
+        {
+            path = option;
+        }
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+    setDebugEnabled(false);
+
+    try
+    {
+        double maxError = 0.0;
+        std::cout << "pricingd load, " << batch << " options a request, " << seconds << " s per step\n";
+        for (int nClients = 1; nClients <= maxClients; nClients *= 2)
+        {
+            runLoad(path, nClients, batch, seconds, maxError);
+        }
+        runLargeBatch(path, large, maxError);
+        std::cout << "  max price difference " << maxError << "\n";
+        return maxError < 1e-12 ? 0 : 1;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
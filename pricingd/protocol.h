@@ -0,0 +1,233 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+/*  Where send has no such flag the programs ignore SIGPIPE instead */
+#define MSG_NOSIGNAL 0
+#endif
+
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
+/*
+ *  Wire format of the pricing daemon.  Client and server always run on the
+ *  same host, so messages are plain structs in native byte order sent over
+ *  a Unix domain stream socket.  Each request is answered by one response
+ *  with the same id, and a client may send further requests before the
+ *  responses arrive.
+ *
+ *  Small batches follow their header on the socket and so do their prices.
+ *  For large batches the client writes the options to a POSIX shared
+ *  memory segment laid out as count options followed by count prices and
+ *  passes its descriptor with the header as SCM_RIGHTS ancillary data, the
+ *  server prices them in place and the response is just a header, so
+ *  neither side copies the data.  The segment is unlinked as soon as it is
+ *  created and never named on the wire, so the server only ever maps
+ *  memory the client itself could open.
+ *
+ *  Build from the root of the repository with
+ *
+ *      g++ -std=c++20 -O2 -pthread -I. pricingd/server.cpp matlib.cpp testing.cpp trace.cpp -o pricingd/pricingd
+ *      g++ -std=c++20 -O2 -pthread -I. pricingd/client.cpp matlib.cpp testing.cpp trace.cpp -o pricingd/loadgen
+ *
+ *  adding -lrt for shm_open on older glibc.
+ */
+
+/** Socket used when none is given on the command line */
+inline constexpr const char *DEFAULT_PRICING_SOCKET = "/tmp/pricingd.sock";
+/** First field of every message */
+inline constexpr uint32_t PRICING_MAGIC = 0x44435250;
+/** Batches of at least this many options are best sent in shared memory */
+inline constexpr uint32_t SHARED_MEMORY_THRESHOLD = 4096;
+/** Largest batch the server accepts on the socket */
+inline constexpr uint32_t MAX_INLINE_OPTIONS = 1 << 16;
+
+enum class OptionType : uint32_t
+{
+    Call,
+    Put
+};
+
+/** One European option, as the arguments of blackScholesCallPrice */
+struct PricingOption
+{
+    double strike;
+    double maturity;
+    double spot;
+    double volatility;
+    double rate;
+    OptionType type;
+    uint32_t reserved;
+};
+
+/** Request flag, the options are in the shared memory segment whose descriptor comes with the header */
+inline constexpr uint32_t PRICING_SHARED_MEMORY = 1;
+
+/** Followed by count options unless they are in shared memory */
+struct PricingRequest
+{
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t id;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+enum class PricingStatus : uint32_t
+{
+    Ok,
+    /** The header was malformed or the batch too large, the connection is closed */
+    BadRequest,
+    /** No shared memory segment came with the request or it is too small */
+    SegmentError,
+    /** The server is shutting down */
+    Unavailable
+};
+
+/** Followed by count prices for an inline request that succeeded */
+struct PricingResponse
+{
+    uint32_t magic;
+    PricingStatus status;
+    uint64_t id;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+/** Size of a shared memory segment holding count options and their prices */
+inline size_t sharedSegmentSize(size_t count)
+{
+    return count * (sizeof(PricingOption) + sizeof(double));
+}
+
+/** Reads exactly size bytes, false if the connection closes or fails first */
+inline bool readFully(int socket, void *data, size_t size)
+{
+    char *next = (char *)data;
+    while (size > 0)
+    {
+        ssize_t n = ::recv(socket, next, size, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        next += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+/** Writes exactly size bytes, false if the connection fails first */
+inline bool writeFully(int socket, const void *data, size_t size)
+{
+    const char *next = (const char *)data;
+    while (size > 0)
+    {
+        // a closed peer is reported as an error rather than SIGPIPE
+        ssize_t n = ::send(socket, next, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        next += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+/** As writeFully, passing a descriptor with the first byte */
+inline bool writeWithDescriptor(int socket, const void *data, size_t size, int descriptor)
+{
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    iovec vector{(void *)data, size};
+    msghdr message{};
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(header), &descriptor, sizeof(int));
+    ssize_t n;
+    do
+    {
+        n = ::sendmsg(socket, &message, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0)
+    {
+        return false;
+    }
+    return writeFully(socket, (const char *)data + n, size - (size_t)n);
+}
+
+/** As readFully, also returning a descriptor passed with the bytes or -1 if there was none */
+inline bool readWithDescriptor(int socket, void *data, size_t size, int &descriptor)
+{
+    descriptor = -1;
+    char *next = (char *)data;
+    while (size > 0)
+    {
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        iovec vector{next, size};
+        msghdr message{};
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        ssize_t n = ::recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        for (cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+        {
+            if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+            {
+                // only one descriptor is expected, any others are closed
+                size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (size_t i = 0; i < count; i++)
+                {
+                    int received;
+                    std::memcpy(&received, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+                    if (descriptor < 0)
+                    {
+                        descriptor = received;
+                    }
+                    else
+                    {
+                        close(received);
+                    }
+                }
+            }
+        }
+        next += n;
+        size -= (size_t)n;
+    }
+    if (size > 0 && descriptor >= 0)
+    {
+        close(descriptor);
+        descriptor = -1;
+    }
+    return size == 0;
+}
@@ -0,0 +1,589 @@
+#include "matlib.h"
+#include "protocol.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+
+/*
+ *  A pricing daemon.  Every process on a host can price options through one
+ *  warm server instead of each paying its own start up and running on a
+ *  single thread.  A thread per connection reads requests and queues them,
+ *  and a batcher thread waits a few microseconds after the first request
+ *  arrives so that requests from other connections join it, then prices
+ *  the whole batch on a pool of threads and queues each connection its
+ *  prices, which a writer thread per connection sends.  Under load a batch
+ *  is formed every window whatever the number of clients, so the pool's
+ *  threads are woken once per window rather than once per request.  A
+ *  client that stops reading only stalls its own connection: its reader
+ *  stops taking requests once MAX_QUEUED_REQUESTS are unanswered, and it is
+ *  dropped if a response cannot be sent within SEND_TIMEOUT_SECONDS.
+ *
+ *      pricingd [socket] [--window microseconds] [--threads n] [--max-batch options]
+ */
+
+/*  Batches smaller than this are priced on the batcher thread alone */
+static const size_t MIN_PARALLEL_OPTIONS = 2048;
+/*  Requests a client may have waiting to be priced or sent back before its
+    connection is no longer read */
+static const size_t MAX_QUEUED_REQUESTS = 64;
+/*  A client that does not take a response within this time is dropped */
+static const int SEND_TIMEOUT_SECONDS = 5;
+
+/*  Threads that live as long as the server and run parallelFor style tasks,
+    as starting threads for every batch would cost more than pricing it */
+class WorkerPool
+{
+public:
+    explicit WorkerPool(int nThreads)
+    {
+        for (int i = 1; i < nThreads; i++)
+        {
+            threads.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start.notify_all();
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    /*  Calls f(begin, end) on contiguous chunks of [0, n) of at least
+        minChunk elements, the calling thread doing the first */
+    void run(size_t n, const std::function<void(size_t, size_t)> &f, size_t minChunk)
+    {
+        size_t chunks = std::min(threads.size() + 1, (n + minChunk - 1) / minChunk);
+        if (chunks <= 1)
+        {
+            f(0, n);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = &f;
+            taskSize = n;
+            nChunks = chunks;
+            remaining = chunks - 1;
+            generation++;
+        }
+        start.notify_all();
+        f(0, n / chunks);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return remaining == 0; });
+    }
+
+private:
+    void work(size_t chunk)
+    {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            start.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+            {
+                return;
+            }
+            seen = generation;
+            if (chunk >= nChunks)
+            {
+                continue;
+            }
+            const std::function<void(size_t, size_t)> &f = *task;
+            size_t begin = taskSize * chunk / nChunks;
+            size_t end = taskSize * (chunk + 1) / nChunks;
+            lock.unlock();
+            f(begin, end);
+            lock.lock();
+            if (--remaining == 0)
+            {
+                done.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    const std::function<void(size_t, size_t)> *task = nullptr;
+    size_t taskSize = 0;
+    size_t nChunks = 0;
+    size_t remaining = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
+
+/*  A client connection.  Its reader admits each request before queueing
+    it, the response to every admitted request is queued here by the
+    batcher or the reader, and the connection's writer thread sends them,
+    so nothing else ever blocks on the client's socket. */
+class Connection
+{
+public:
+    explicit Connection(int socket) : socket(socket) {}
+    ~Connection() { close(socket); }
+
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+
+    /*  Waits until fewer than MAX_QUEUED_REQUESTS are unanswered and admits
+        one more, false once the connection has failed */
+    bool admit()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return failed || queued < MAX_QUEUED_REQUESTS; });
+        if (failed)
+        {
+            return false;
+        }
+        queued++;
+        return true;
+    }
+
+    /*  Queues the response to an admitted request, dropped if the connection has failed */
+    void send(std::vector<char> message)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (failed)
+            {
+                queued--;
+                return;
+            }
+            responses.push_back(std::move(message));
+        }
+        changed.notify_all();
+    }
+
+    /*  Called by the reader once it stops, the writer then sends the remaining responses */
+    void finishReading()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            reading = false;
+        }
+        changed.notify_all();
+    }
+
+    /*  The writer loop, returns once the reader has stopped and every admitted
+        request has been answered, or as soon as a write fails or times out */
+    void write()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            changed.wait(lock, [this] { return !responses.empty() || (!reading && queued == 0); });
+            if (responses.empty())
+            {
+                return;
+            }
+            std::vector<char> message = std::move(responses.front());
+            responses.pop_front();
+            lock.unlock();
+            bool written = writeFully(socket, message.data(), message.size());
+            lock.lock();
+            queued--;
+            if (!written)
+            {
+                failed = true;
+                queued -= responses.size();
+                responses.clear();
+                // wakes the reader if it is waiting for the next request
+                shutdown(socket, SHUT_RDWR);
+                changed.notify_all();
+                return;
+            }
+            changed.notify_all();
+        }
+    }
+
+    const int socket;
+
+private:
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<char>> responses;
+    /*  Admitted requests whose responses have not been written */
+    size_t queued = 0;
+    bool reading = true;
+    bool failed = false;
+};
+
+/*  A client's shared memory segment, mapped for the duration of one request
+    from the descriptor the client passed, which is closed once mapped */
+class SharedSegment
+{
+public:
+    SharedSegment(int descriptor, size_t size)
+        : address(MAP_FAILED), length(size)
+    {
+        struct stat status;
+        if (fstat(descriptor, &status) == 0 && S_ISREG(status.st_mode) && (size_t)status.st_size >= size && size > 0)
+        {
+            address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+        }
+        close(descriptor);
+        if (address == MAP_FAILED)
+        {
+            throw std::runtime_error("Cannot map shared memory");
+        }
+    }
+
+    ~SharedSegment()
+    {
+        munmap(address, length);
+    }
+
+    SharedSegment(const SharedSegment &) = delete;
+    SharedSegment &operator=(const SharedSegment &) = delete;
+
+    void *data() const { return address; }
+
+private:
+    void *address;
+    size_t length;
+};
+
+/*  A request waiting to be priced, its options and prices either owned
+    here or in the client's shared memory */
+struct PendingRequest
+{
+    std::shared_ptr<Connection> connection;
+    uint64_t id = 0;
+    size_t count = 0;
+    const PricingOption *options = nullptr;
+    double *prices = nullptr;
+    std::vector<PricingOption> inlineOptions;
+    std::vector<double> inlinePrices;
+    std::unique_ptr<SharedSegment> segment;
+    std::chrono::steady_clock::time_point arrival;
+};
+
+static double price(const PricingOption &option)
+{
+    if (option.type == OptionType::Put)
+    {
+        return blackScholesPutPrice(option.strike, option.maturity, option.spot, option.volatility, option.rate);
+    }
+    return blackScholesCallPrice(option.strike, option.maturity, option.spot, option.volatility, option.rate);
+}
+
+/*  Sends the header and, for an inline request, the prices */
+static void respond(const PendingRequest &request, PricingStatus status)
+{
+    PricingResponse response{PRICING_MAGIC, status, request.id, (uint32_t)request.count, 0};
+    if (status != PricingStatus::Ok || request.segment)
+    {
+        response.count = status == PricingStatus::Ok ? response.count : 0;
+        std::vector<char> message(sizeof(response));
+        std::memcpy(message.data(), &response, sizeof(response));
+        request.connection->send(std::move(message));
+        return;
+    }
+    // one write, so the client wakes once per response
+    std::vector<char> message(sizeof(response) + request.count * sizeof(double));
+    std::memcpy(message.data(), &response, sizeof(response));
+    std::memcpy(message.data() + sizeof(response), request.prices, request.count * sizeof(double));
+    request.connection->send(std::move(message));
+}
+
+/*  Collects the requests arriving within a window into one batch */
+class Coalescer
+{
+public:
+    Coalescer(std::chrono::microseconds window, size_t maxBatch, WorkerPool &pool)
+        : window(window), maxBatch(maxBatch), pool(pool)
+    {
+    }
+
+    void submit(PendingRequest request)
+    {
+        bool accepted;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            accepted = !stopping;
+            if (accepted)
+            {
+                queuedOptions += request.count;
+                queue.push_back(std::move(request));
+            }
+        }
+        if (!accepted)
+        {
+            // every admitted request is answered, even while stopping
+            respond(request, PricingStatus::Unavailable);
+            return;
+        }
+        ready.notify_one();
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_one();
+    }
+
+    /*  The batcher loop, returns once stopped and the queue is empty */
+    void run()
+    {
+        std::vector<PendingRequest> batch;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            ready.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty())
+            {
+                return;
+            }
+            // later requests join the first until the window closes or the batch is full
+            ready.wait_until(lock, queue.front().arrival + window, [this]
+            {
+                return stopping || queuedOptions >= maxBatch;
+            });
+            batch.swap(queue);
+            queuedOptions = 0;
+            lock.unlock();
+            priceBatch(batch);
+            batch.clear();
+            lock.lock();
+        }
+    }
+
+private:
+    void priceBatch(std::vector<PendingRequest> &batch)
+    {
+        // offsets[r] is the index of the first option of request r in the batch
+        std::vector<size_t> offsets(batch.size() + 1, 0);
+        for (size_t r = 0; r < batch.size(); r++)
+        {
+            offsets[r + 1] = offsets[r] + batch[r].count;
+        }
+        pool.run(offsets.back(), [&](size_t begin, size_t end)
+        {
+            size_t r = std::upper_bound(offsets.begin(), offsets.end(), begin) - offsets.begin() - 1;
+            for (size_t k = begin; k < end; k++)
+            {
+                while (k >= offsets[r + 1])
+                {
+                    r++;
+                }
+                batch[r].prices[k - offsets[r]] = price(batch[r].options[k - offsets[r]]);
+            }
+        }, MIN_PARALLEL_OPTIONS);
+        for (PendingRequest &request : batch)
+        {
+            respond(request, PricingStatus::Ok);
+        }
+    }
+
+    std::chrono::microseconds window;
+    size_t maxBatch;
+    WorkerPool &pool;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::vector<PendingRequest> queue;
+    size_t queuedOptions = 0;
+    bool stopping = false;
+};
+
+/*  Reads requests from one client until it disconnects or fails */
+static void readRequests(const std::shared_ptr<Connection> &connection, Coalescer &coalescer)
+{
+    PricingRequest header;
+    int descriptor;
+    while (readWithDescriptor(connection->socket, &header, sizeof(header), descriptor))
+    {
+        bool shared = header.flags & PRICING_SHARED_MEMORY;
+        if (descriptor >= 0 && !shared)
+        {
+            close(descriptor);
+            descriptor = -1;
+        }
+        if (!connection->admit())
+        {
+            if (descriptor >= 0)
+            {
+                close(descriptor);
+            }
+            return;
+        }
+        PendingRequest request;
+        request.connection = connection;
+        request.id = header.id;
+        request.count = header.count;
+        request.arrival = std::chrono::steady_clock::now();
+        if (header.magic != PRICING_MAGIC || (!shared && header.count > MAX_INLINE_OPTIONS))
+        {
+            // the rest of the stream cannot be trusted
+            if (descriptor >= 0)
+            {
+                close(descriptor);
+            }
+            respond(request, PricingStatus::BadRequest);
+            return;
+        }
+        if (shared)
+        {
+            try
+            {
+                if (descriptor < 0)
+                {
+                    throw std::runtime_error("No shared memory descriptor");
+                }
+                request.segment = std::make_unique<SharedSegment>(descriptor, sharedSegmentSize(header.count));
+            }
+            catch (const std::runtime_error &)
+            {
+                respond(request, PricingStatus::SegmentError);
+                continue;
+            }
+            request.options = (const PricingOption *)request.segment->data();
+            request.prices = (double *)(request.options + header.count);
+        }
+        else
+        {
+            request.inlineOptions.resize(header.count);
+            if (!readFully(connection->socket, request.inlineOptions.data(), header.count * sizeof(PricingOption)))
+            {
+                // the admitted request is answered, although no one will read it
+                respond(request, PricingStatus::BadRequest);
+                return;
+            }
+            request.inlinePrices.resize(header.count);
+            request.options = request.inlineOptions.data();
+            request.prices = request.inlinePrices.data();
+        }
+        // moving the vectors keeps their buffers, so the pointers stay valid
+        coalescer.submit(std::move(request));
+    }
+}
+
+/*  Serves one client on this thread and a writer thread until it disconnects */
+static void serveConnection(std::shared_ptr<Connection> connection, Coalescer &coalescer)
+{
+    std::thread writer([&connection] { connection->write(); });
+    readRequests(connection, coalescer);
+    connection->finishReading();
+    writer.join();
+}
+
+/*  The listening socket, shut down by SIGINT or SIGTERM to stop accepting */
+static int listener = -1;
+
+static void stopListening(int)
+{
+    shutdown(listener, SHUT_RDWR);
+}
+
+int main(int argc, char **argv)
+{
+    std::string path = DEFAULT_PRICING_SOCKET;
+    long windowMicroseconds = 20;
+    int nThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+    size_t maxBatch = 1 << 16;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option == "--window" && i + 1 < argc)
+        {
+            windowMicroseconds = std::stol(argv[++i]);
+        }
+        else if (option == "--threads" && i + 1 < argc)
+        {
+            nThreads = std::max(1, std::stoi(argv[++i]));
+        }
+        else if (option == "--max-batch" && i + 1 < argc)
+        {
+            maxBatch = std::stoul(argv[++i]);
+        }
+        else
+        {
+            path = option;
+        }
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Socket path too long: " << path << "\n";
+        return 1;
+    }
+    std::strcpy(address.sun_path, path.c_str());
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 128) != 0)
+    {
+        std::cerr << "Cannot listen on " << path << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, stopListening);
+    std::signal(SIGTERM, stopListening);
+
+    setDebugEnabled(false);
+    WorkerPool pool(nThreads);
+    // warm up the pricing code and the pool before the first client
+    std::vector<double> warmUp(1 << 16);
+    pool.run(warmUp.size(), [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            warmUp[i] = blackScholesCallPrice(100.0, 1.0, 80.0 + i * 1e-3, 0.2, 0.01);
+        }
+    }, MIN_PARALLEL_OPTIONS);
+
+    Coalescer coalescer(std::chrono::microseconds(windowMicroseconds), maxBatch, pool);
+    std::thread batcher([&] { coalescer.run(); });
+    std::cout << "pricingd listening on " << path << " with " << nThreads << " threads and a "
+              << windowMicroseconds << " us window\n";
+
+    while (true)
+    {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            break;
+        }
+        // a client that does not take its responses is dropped rather than
+        // holding its writer thread forever
+        timeval timeout{SEND_TIMEOUT_SECONDS, 0};
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        // connection threads only touch the coalescer, which outlives them
+        // until the process exits
+        std::thread(serveConnection, std::make_shared<Connection>(client), std::ref(coalescer)).detach();
+    }
+
+    coalescer.stop();
+    batcher.join();
+    close(listener);
+    unlink(path.c_str());
+    // exit without destroying the coalescer, which connection threads may still use
+    std::exit(0);
+}
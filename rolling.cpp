@@ -0,0 +1,581 @@
+#include "rolling.h"
+#include "matlib.h"
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+
+/*  Adds increment to sum, carrying the rounding error in compensation */
+static inline void addCompensated(double &sum, double &compensation, double increment)
+{
+    double y = increment - compensation;
+    double t = sum + y;
+    compensation = (t - sum) - y;
+    sum = t;
+}
+
+RollingWindows::MonotonicDeque::MonotonicDeque(size_t capacity)
+    : ticks(capacity), values(capacity), head(0), length(0)
+{
+}
+
+template <typename Better>
+void RollingWindows::MonotonicDeque::push(uint64_t tick, double value, Better better)
+{
+    size_t capacity = values.size();
+    while (length > 0)
+    {
+        size_t back = head + length - 1;
+        if (back >= capacity)
+        {
+            back -= capacity;
+        }
+        if (better(values[back], value))
+        {
+            break;
+        }
+        length--;
+    }
+    size_t slot = head + length;
+    if (slot >= capacity)
+    {
+        slot -= capacity;
+    }
+    ticks[slot] = tick;
+    values[slot] = value;
+    length++;
+}
+
+void RollingWindows::MonotonicDeque::expire(uint64_t tick)
+{
+    if (length > 0 && ticks[head] <= tick)
+    {
+        head = head + 1 == values.size() ? 0 : head + 1;
+        length--;
+    }
+}
+
+RollingWindows::OrderStatisticTree::OrderStatisticTree(size_t capacity)
+    : root(0), seed(2463534242u)
+{
+    nodes.reserve(capacity + 1);
+    nodes.push_back(Node{0.0, 0, 0, 0, 0});
+}
+
+void RollingWindows::OrderStatisticTree::update(int32_t node)
+{
+    nodes[node].size = 1 + nodes[nodes[node].left].size + nodes[nodes[node].right].size;
+}
+
+void RollingWindows::OrderStatisticTree::split(int32_t tree, double value, bool inclusive, int32_t &low, int32_t &high)
+{
+    if (tree == 0)
+    {
+        low = 0;
+        high = 0;
+        return;
+    }
+    Node &node = nodes[tree];
+    if (inclusive ? node.value <= value : node.value < value)
+    {
+        split(node.right, value, inclusive, node.right, high);
+        low = tree;
+    }
+    else
+    {
+        split(node.left, value, inclusive, low, node.left);
+        high = tree;
+    }
+    update(tree);
+}
+
+int32_t RollingWindows::OrderStatisticTree::merge(int32_t low, int32_t high)
+{
+    if (low == 0 || high == 0)
+    {
+        return low + high;
+    }
+    if (nodes[low].priority > nodes[high].priority)
+    {
+        int32_t right = merge(nodes[low].right, high);
+        nodes[low].right = right;
+        update(low);
+        return low;
+    }
+    int32_t left = merge(low, nodes[high].left);
+    nodes[high].left = left;
+    update(high);
+    return high;
+}
+
+int32_t RollingWindows::OrderStatisticTree::insertInto(int32_t tree, int32_t node)
+{
+    if (tree == 0)
+    {
+        return node;
+    }
+    Node &parent = nodes[tree];
+    if (nodes[node].priority > parent.priority)
+    {
+        // the new node takes this place, splitting the subtree between its children
+        split(tree, nodes[node].value, false, nodes[node].left, nodes[node].right);
+        update(node);
+        return node;
+    }
+    if (nodes[node].value < parent.value)
+    {
+        parent.left = insertInto(parent.left, node);
+    }
+    else
+    {
+        parent.right = insertInto(parent.right, node);
+    }
+    parent.size++;
+    return tree;
+}
+
+int32_t RollingWindows::OrderStatisticTree::eraseFrom(int32_t tree, double value)
+{
+    assert(tree != 0);
+    Node &node = nodes[tree];
+    if (value == node.value)
+    {
+        freeNodes.push_back(tree);
+        return merge(node.left, node.right);
+    }
+    if (value < node.value)
+    {
+        node.left = eraseFrom(node.left, value);
+    }
+    else
+    {
+        node.right = eraseFrom(node.right, value);
+    }
+    node.size--;
+    return tree;
+}
+
+void RollingWindows::OrderStatisticTree::insert(double value)
+{
+    // xorshift priorities keep the treap balanced in expectation
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    int32_t node;
+    if (freeNodes.empty())
+    {
+        node = (int32_t)nodes.size();
+        nodes.push_back(Node{value, seed, 1, 0, 0});
+    }
+    else
+    {
+        node = freeNodes.back();
+        freeNodes.pop_back();
+        nodes[node] = Node{value, seed, 1, 0, 0};
+    }
+    root = insertInto(root, node);
+}
+
+void RollingWindows::OrderStatisticTree::erase(double value)
+{
+    root = eraseFrom(root, value);
+}
+
+double RollingWindows::OrderStatisticTree::kth(size_t k) const
+{
+    int32_t node = root;
+    while (true)
+    {
+        size_t leftSize = nodes[nodes[node].left].size;
+        if (k < leftSize)
+        {
+            node = nodes[node].left;
+        }
+        else if (k == leftSize)
+        {
+            return nodes[node].value;
+        }
+        else
+        {
+            k -= leftSize + 1;
+            node = nodes[node].right;
+        }
+    }
+}
+
+RollingWindows::RollingWindows(size_t nSeries, size_t window, bool percentiles)
+    : nSeries(nSeries), capacity(window), count(0), next(0), tick(0)
+{
+    if (nSeries == 0 || window == 0)
+    {
+        throw std::invalid_argument("RollingWindows needs at least one series and a window of at least one value");
+    }
+    values.resize(nSeries * window);
+    meanValues.resize(nSeries, 0.0);
+    meanCompensation.resize(nSeries, 0.0);
+    m2.resize(nSeries, 0.0);
+    m2Compensation.resize(nSeries, 0.0);
+    minima.assign(nSeries, MonotonicDeque(window));
+    maxima.assign(nSeries, MonotonicDeque(window));
+    if (percentiles)
+    {
+        trees.assign(nSeries, OrderStatisticTree(window));
+    }
+}
+
+void RollingWindows::push(std::span<const double> ticks)
+{
+    if (ticks.size() != nSeries)
+    {
+        throw std::invalid_argument("push needs one value for each series");
+    }
+    for (double x : ticks)
+    {
+        if (!std::isfinite(x))
+        {
+            throw std::invalid_argument("Rolling statistics need finite values");
+        }
+    }
+
+    double *slot = values.data() + next * nSeries;
+    double *mean = meanValues.data();
+    double *meanError = meanCompensation.data();
+    double *sumSquares = m2.data();
+    double *sumSquaresError = m2Compensation.data();
+    if (count < capacity)
+    {
+        // Welford's update while the window fills
+        double n = (double)(count + 1);
+        for (size_t s = 0; s < nSeries; s++)
+        {
+            double x = ticks[s];
+            double delta = x - mean[s];
+            addCompensated(mean[s], meanError[s], delta / n);
+            addCompensated(sumSquares[s], sumSquaresError[s], delta * (x - mean[s]));
+        }
+        count++;
+    }
+    else
+    {
+        // the new value replaces the oldest, which is in the slot about to be overwritten
+        double n = (double)capacity;
+        for (size_t s = 0; s < nSeries; s++)
+        {
+            double x = ticks[s];
+            double old = slot[s];
+            double oldMean = mean[s];
+            double delta = x - old;
+            addCompensated(mean[s], meanError[s], delta / n);
+            addCompensated(sumSquares[s], sumSquaresError[s], delta * (x - mean[s] + old - oldMean));
+        }
+        for (size_t s = 0; s < trees.size(); s++)
+        {
+            trees[s].erase(slot[s]);
+        }
+        for (size_t s = 0; s < nSeries; s++)
+        {
+            minima[s].expire(tick - capacity);
+            maxima[s].expire(tick - capacity);
+        }
+    }
+
+    for (size_t s = 0; s < nSeries; s++)
+    {
+        double x = ticks[s];
+        slot[s] = x;
+        minima[s].push(tick, x, [](double a, double b) { return a < b; });
+        maxima[s].push(tick, x, [](double a, double b) { return a > b; });
+    }
+    for (size_t s = 0; s < trees.size(); s++)
+    {
+        trees[s].insert(ticks[s]);
+    }
+    next = next + 1 == capacity ? 0 : next + 1;
+    tick++;
+}
+
+double RollingWindows::mean(size_t series) const
+{
+    assert(series < nSeries);
+    return count == 0 ? std::numeric_limits<double>::quiet_NaN() : meanValues[series];
+}
+
+double RollingWindows::variance(size_t series, bool sample) const
+{
+    assert(series < nSeries);
+    if (count == 0)
+    {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    // the compensated sum can still round to just below zero for a constant series
+    return std::max(m2[series], 0.0) / (sample ? count - 1.0 : (double)count);
+}
+
+double RollingWindows::standardDeviation(size_t series, bool sample) const
+{
+    return std::sqrt(variance(series, sample));
+}
+
+double RollingWindows::min(size_t series) const
+{
+    assert(series < nSeries);
+    return count == 0 ? std::numeric_limits<double>::quiet_NaN() : minima[series].front();
+}
+
+double RollingWindows::max(size_t series) const
+{
+    assert(series < nSeries);
+    return count == 0 ? std::numeric_limits<double>::quiet_NaN() : maxima[series].front();
+}
+
+double RollingWindows::prctile(size_t series, double p) const
+{
+    assert(series < nSeries);
+    if (trees.empty())
+    {
+        throw std::invalid_argument("Percentiles were not enabled for these windows");
+    }
+    if (count == 0 || p < 0.0 || p > 100.0)
+    {
+        throw std::invalid_argument("Invalid input: window is empty or percentile is out of range.");
+    }
+    // the same interpolation as prctile
+    const OrderStatisticTree &tree = trees[series];
+    double index = (count + 1) * (p / 100.0);
+    size_t lower = (size_t)index;
+    size_t upper = lower + 1;
+    double fraction = index - lower;
+    if (upper >= count)
+    {
+        return tree.kth(std::min(lower, count - 1));
+    }
+    double low = tree.kth(lower);
+    return low + fraction * (tree.kth(upper) - low);
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+static bool closeTo(double a, double b, double tolerance)
+{
+    return std::abs(a - b) <= tolerance * std::max(1.0, std::abs(b));
+}
+
+// Tests every statistic after every update against the functions of the whole window
+static void testAgainstWholeWindow()
+{
+    size_t window = 50;
+    std::vector<double> x = randn(1000);
+    // repeated values exercise the ties in the deques and the treap
+    for (size_t i = 0; i < x.size(); i += 7)
+    {
+        x[i] = std::round(x[i]);
+    }
+    RollingWindow rolling(window);
+    ASSERT(std::isnan(rolling.mean()));
+    for (size_t i = 0; i < x.size(); i++)
+    {
+        rolling.push(x[i]);
+        size_t begin = i + 1 > window ? i + 1 - window : 0;
+        std::vector<double> last(x.begin() + begin, x.begin() + i + 1);
+        ASSERT(rolling.size() == last.size());
+        ASSERT(closeTo(rolling.mean(), mean(last), 1e-13));
+        if (last.size() > 1)
+        {
+            ASSERT(closeTo(rolling.standardDeviation(), standardDeviation(last), 1e-12));
+            ASSERT(closeTo(rolling.standardDeviation(false), standardDeviation(last, false), 1e-12));
+        }
+        ASSERT(rolling.min() == min(last));
+        ASSERT(rolling.max() == max(last));
+        double percentiles[] = {0.0, 5.0, 50.0, 95.0, 100.0};
+        for (double p : percentiles)
+        {
+            ASSERT(rolling.prctile(p) == prctile(last, p));
+        }
+    }
+}
+
+// Tests that the compensated updates do not drift over many windows
+static void testNoDrift()
+{
+    size_t window = 100;
+    std::vector<double> x = randn(1000000);
+    RollingWindow rolling(window, false);
+    for (double &value : x)
+    {
+        // a large offset makes every update cancel most of its digits
+        value = 1e6 + value;
+        rolling.push(value);
+    }
+    std::vector<double> last(x.end() - window, x.end());
+    ASSERT(closeTo(rolling.mean(), mean(last), 1e-15));
+    ASSERT(closeTo(rolling.variance(), std::pow(standardDeviation(last), 2), 1e-8));
+}
+
+// Tests that many series in one RollingWindows match separate windows
+static void testManySeries()
+{
+    size_t nSeries = 7;
+    size_t window = 13;
+    RollingWindows windows(nSeries, window, true);
+    std::vector<RollingWindow> separate(nSeries, RollingWindow(window));
+    std::vector<double> ticks(nSeries);
+    for (int t = 0; t < 200; t++)
+    {
+        std::vector<double> draws = randn((int)nSeries);
+        for (size_t s = 0; s < nSeries; s++)
+        {
+            // series on different scales
+            ticks[s] = draws[s] * (s + 1) + 10.0 * s;
+            separate[s].push(ticks[s]);
+        }
+        windows.push(ticks);
+        for (size_t s = 0; s < nSeries; s++)
+        {
+            ASSERT(windows.means()[s] == windows.mean(s));
+            ASSERT(closeTo(windows.mean(s), separate[s].mean(), 1e-14));
+            ASSERT(closeTo(windows.variance(s, false), separate[s].variance(false), 1e-12));
+            ASSERT(windows.min(s) == separate[s].min());
+            ASSERT(windows.max(s) == separate[s].max());
+            ASSERT(windows.prctile(s, 25.0) == separate[s].prctile(25.0));
+        }
+    }
+
+    auto throws = [](auto f)
+    {
+        try
+        {
+            f();
+        }
+        catch (const std::invalid_argument &)
+        {
+            return true;
+        }
+        return false;
+    };
+    ASSERT(throws([&] { windows.push(std::vector<double>(nSeries - 1)); }));
+    ASSERT(throws([&] { windows.push(std::vector<double>(nSeries, NAN)); }));
+    ASSERT(throws([&] { windows.prctile(0, 101.0); }));
+    ASSERT(throws([] { RollingWindow(10, false).prctile(50.0); }));
+    ASSERT(throws([] { RollingWindows(1, 0); }));
+}
+
+void testRolling()
+{
+    TEST(testAgainstWholeWindow);
+    TEST(testNoDrift);
+    TEST(testManySeries);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+/*  A random walk of n ticks */
+static std::vector<double> randomWalk(size_t n)
+{
+    std::vector<double> steps = randn((int)n);
+    double level = 100.0;
+    for (double &x : steps)
+    {
+        level += 0.01 * x;
+        x = level;
+    }
+    return steps;
+}
+
+// Latency of one update of a single series, against recomputing the window
+static void benchmarkWindowSizes()
+{
+    size_t updates = 1000000;
+    size_t windows[] = {100, 1000, 10000, 100000, 1000000};
+    std::cout << "rolling single series, " << updates << " updates with percentiles\n";
+    for (size_t window : windows)
+    {
+        std::vector<double> x = randomWalk(window + 2 * updates);
+        RollingWindow rolling(window);
+        for (size_t i = 0; i < window; i++)
+        {
+            rolling.push(x[i]);
+        }
+
+        // mean latency of back to back updates, then each update timed on its own
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = window; i < window + updates; i++)
+        {
+            rolling.push(x[i]);
+            doNotOptimize(rolling.mean());
+        }
+        double seconds = secondsSince(start);
+        std::vector<double> latencies(updates);
+        for (size_t i = 0; i < updates; i++)
+        {
+            auto before = std::chrono::steady_clock::now();
+            rolling.push(x[window + updates + i]);
+            doNotOptimize(rolling.prctile(99.0));
+            latencies[i] = secondsSince(before) * 1e9;
+        }
+
+        // recomputing the same statistics from the window's values
+        std::vector<double> last(x.end() - window, x.end());
+        size_t recomputes = std::max<size_t>(1, 1000000 / window);
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < recomputes; i++)
+        {
+            doNotOptimize(mean(last) + standardDeviation(last) + min(last) + max(last) + prctile(last, 99.0));
+        }
+        double recomputeSeconds = secondsSince(start) / recomputes;
+
+        std::cout << "  window " << window << ": " << seconds / updates * 1e9 << " ns/update"
+                  << ", with prctile p50 " << prctile(latencies, 50.0) << " ns"
+                  << ", p99 " << prctile(latencies, 99.0) << " ns"
+                  << ", p999 " << prctile(latencies, 99.9) << " ns"
+                  << ", recomputing " << recomputeSeconds * 1e9 << " ns\n";
+    }
+}
+
+// Updates of many series in one RollingWindows against a RollingWindow each
+static void benchmarkManySeries()
+{
+    size_t nSeries = 1000;
+    size_t window = 1000;
+    size_t ticks = 10000;
+    std::vector<double> walk = randomWalk(nSeries * ticks);
+    std::cout << "rolling " << nSeries << " series, window " << window << ", no percentiles\n";
+
+    RollingWindows windows(nSeries, window);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < ticks; t++)
+    {
+        windows.push(std::span<const double>(walk).subspan(t * nSeries, nSeries));
+    }
+    double soaSeconds = secondsSince(start);
+    doNotOptimize(windows.mean(0));
+
+    std::vector<RollingWindow> separate(nSeries, RollingWindow(window, false));
+    start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < ticks; t++)
+    {
+        for (size_t s = 0; s < nSeries; s++)
+        {
+            separate[s].push(walk[t * nSeries + s]);
+        }
+    }
+    double separateSeconds = secondsSince(start);
+    doNotOptimize(separate[0].mean());
+
+    std::cout << "  structure of arrays " << soaSeconds / ticks * 1e6 << " us/tick ("
+              << soaSeconds / (ticks * nSeries) * 1e9 << " ns/series)"
+              << ", separate windows " << separateSeconds / ticks * 1e6 << " us/tick ("
+              << separateSeconds / (ticks * nSeries) * 1e9 << " ns/series)\n";
+}
+
+void benchmarkRolling()
+{
+    benchmarkWindowSizes();
+    benchmarkManySeries();
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "stdafx.h"
+#include <cstdint>
+#include <span>
+
+/**
+ *  mean, standardDeviation, min, max and prctile over the last window
+ *  values of many series, updated as each tick arrives instead of being
+ *  recomputed from the whole window.
+ *
+ *  The series are held in structure of arrays layout, the values of one
+ *  tick contiguous across series, so a tick updates the means and
+ *  variances of every series in one loop the compiler can vectorise.
+ *  Each update is O(1) for the mean and variance, amortised O(1) for the
+ *  min and max and O(log window) for percentiles:
+ *
+ *  - the mean and the sum of squared deviations are updated with the
+ *    value entering and the value leaving the window, each sum carrying
+ *    a Kahan compensation so that rounding does not build up over
+ *    millions of updates
+ *  - the min and max are the fronts of monotonic deques of the values
+ *    that could still become the min or max before they leave
+ *  - percentiles, when enabled, come from an order statistic treap of
+ *    the window, the same as prctile of the window's values
+ *
+ *  The values must be finite.  Statistics of an empty window are NaN and
+ *  prctile of one throws, as prctile does.
+ */
+class RollingWindows
+{
+public:
+    RollingWindows(size_t nSeries, size_t window, bool percentiles = false);
+
+    /** Appends one value to every series, dropping the oldest once the window is full */
+    void push(std::span<const double> ticks);
+
+    size_t series() const { return nSeries; }
+    size_t window() const { return capacity; }
+    /** Number of values currently in each window */
+    size_t size() const { return count; }
+
+    double mean(size_t series) const;
+    /** Default is the sample variance, as for standardDeviation */
+    double variance(size_t series, bool sample = true) const;
+    double standardDeviation(size_t series, bool sample = true) const;
+    double min(size_t series) const;
+    double max(size_t series) const;
+    /** The p-th percentile of the window in O(log window), needs percentiles enabled */
+    double prctile(size_t series, double p) const;
+
+    /** The means of all series, contiguous */
+    std::span<const double> means() const { return meanValues; }
+
+private:
+    /*  Ticks of the window whose values could still become its extreme,
+        oldest first, in a ring of capacity entries */
+    class MonotonicDeque
+    {
+    public:
+        explicit MonotonicDeque(size_t capacity);
+        /*  Drops values dominated by the new one, better(a, b) true if a replaces b */
+        template <typename Better>
+        void push(uint64_t tick, double value, Better better);
+        /*  Drops the front if it was pushed at or before tick */
+        void expire(uint64_t tick);
+        double front() const { return values[head]; }
+
+    private:
+        std::vector<uint64_t> ticks;
+        std::vector<double> values;
+        size_t head;
+        size_t length;
+    };
+
+    /*  A treap of values with subtree sizes, for the k-th smallest value.
+        Each node's left subtree holds smaller values and its right subtree
+        values at least as large. */
+    class OrderStatisticTree
+    {
+    public:
+        explicit OrderStatisticTree(size_t capacity);
+        void insert(double value);
+        /*  Removes one copy of a value in the tree */
+        void erase(double value);
+        /*  The k-th smallest value, from 0 */
+        double kth(size_t k) const;
+
+    private:
+        struct Node
+        {
+            double value;
+            uint32_t priority;
+            uint32_t size;
+            int32_t left;
+            int32_t right;
+        };
+
+        /*  Splits a tree into the values below value, or at most value if inclusive, and the rest */
+        void split(int32_t tree, double value, bool inclusive, int32_t &low, int32_t &high);
+        int32_t merge(int32_t low, int32_t high);
+        /*  Inserts a node where its priority puts it on the path of its value,
+            returning the new root of the subtree */
+        int32_t insertInto(int32_t tree, int32_t node);
+        /*  Removes one node holding the value, returning the new root of the subtree */
+        int32_t eraseFrom(int32_t tree, double value);
+        void update(int32_t node);
+
+        /*  Node 0 is the empty tree */
+        std::vector<Node> nodes;
+        std::vector<int32_t> freeNodes;
+        int32_t root;
+        uint32_t seed;
+    };
+
+    size_t nSeries;
+    size_t capacity;
+    size_t count;
+    /*  Ring slot the next tick is written to */
+    size_t next;
+    uint64_t tick;
+    /*  values[slot * nSeries + series] */
+    std::vector<double> values;
+    std::vector<double> meanValues;
+    std::vector<double> meanCompensation;
+    std::vector<double> m2;
+    std::vector<double> m2Compensation;
+    std::vector<MonotonicDeque> minima;
+    std::vector<MonotonicDeque> maxima;
+    std::vector<OrderStatisticTree> trees;
+};
+
+/**
+ *  Rolling statistics of a single series, see RollingWindows
+ */
+class RollingWindow
+{
+public:
+    explicit RollingWindow(size_t window, bool percentiles = true)
+        : windows(1, window, percentiles) {}
+
+    void push(double x) { windows.push(std::span<const double>(&x, 1)); }
+
+    size_t window() const { return windows.window(); }
+    size_t size() const { return windows.size(); }
+
+    double mean() const { return windows.mean(0); }
+    double variance(bool sample = true) const { return windows.variance(0, sample); }
+    double standardDeviation(bool sample = true) const { return windows.standardDeviation(0, sample); }
+    double min() const { return windows.min(0); }
+    double max() const { return windows.max(0); }
+    double prctile(double p) const { return windows.prctile(0, p); }
+
+private:
+    RollingWindows windows;
+};
+
+/**
+ *  Test function
+ */
+void testRolling();
+
+/**
+ *  Benchmark function
+ */
+void benchmarkRolling();
@@ -0,0 +1,475 @@
+#include "svi.h"
+#include "matlib.h"
+#include "matrix.h"
+#include "parallel.h"
+#include <chrono>
+#include <limits>
+
+/*  Number of SVI parameters */
+static const size_t N_PARAMETERS = 5;
+/*  Largest damping before the fit is considered stationary */
+static const double MAX_DAMPING = 1e12;
+
+double sviTotalVariance(const SviParameters &p, double k)
+{
+    double d = k - p.m;
+    return p.a + p.b * (p.rho * d + std::sqrt(d * d + p.sigma * p.sigma));
+}
+
+double sviImpliedVolatility(const SviParameters &parameters, double k, double t)
+{
+    return std::sqrt(std::max(sviTotalVariance(parameters, k), 0.0) / t);
+}
+
+/*  Projects the parameters onto the region free of static arbitrage within the slice */
+static SviParameters project(SviParameters p)
+{
+    p.b = std::max(p.b, 0.0);
+    p.rho = std::min(std::max(p.rho, -0.999), 0.999);
+    p.sigma = std::max(p.sigma, 1e-4);
+    // Lee's moment formula bounds the slope of the wings by 2
+    if (p.b * (1 + std::fabs(p.rho)) > 2.0)
+    {
+        p.b = 2.0 / (1 + std::fabs(p.rho));
+    }
+    // the minimum of w is a + b sigma sqrt(1 - rho^2), which must be non negative
+    p.a = std::max(p.a, -p.b * p.sigma * std::sqrt(1 - p.rho * p.rho));
+    return p;
+}
+
+static std::vector<double> toVector(const SviParameters &p)
+{
+    return {p.a, p.b, p.rho, p.m, p.sigma};
+}
+
+static SviParameters fromVector(const std::vector<double> &x)
+{
+    SviParameters p;
+    p.a = x[0];
+    p.b = x[1];
+    p.rho = x[2];
+    p.m = x[3];
+    p.sigma = x[4];
+    return p;
+}
+
+/*  Half the sum of squared total variance residuals */
+static double cost(const SviParameters &p, const std::vector<double> &k, const std::vector<double> &w)
+{
+    double sum = 0.0;
+    for (size_t j = 0; j < k.size(); j++)
+    {
+        double r = sviTotalVariance(p, k[j]) - w[j];
+        sum += r * r;
+    }
+    return 0.5 * sum;
+}
+
+/*  Gatheral's g(k), whose negativity signals butterfly arbitrage */
+static double density(const SviParameters &p, double k)
+{
+    double d = k - p.m;
+    double s = std::sqrt(d * d + p.sigma * p.sigma);
+    double w = sviTotalVariance(p, k);
+    double w1 = p.b * (p.rho + d / s);
+    double w2 = p.b * p.sigma * p.sigma / (s * s * s);
+    double term = 1 - k * w1 / (2 * w);
+    return term * term - 0.25 * w1 * w1 * (1 / w + 0.25) + 0.5 * w2;
+}
+
+/*  Levenberg-Marquardt fit of one slice to the total variances w at log-moneyness k */
+static void fitSlice(const std::vector<double> &k,
+                     const std::vector<double> &w,
+                     const SviSettings &settings,
+                     SviFit &fit)
+{
+    SviParameters p = project(fit.parameters);
+    double currentCost = cost(p, k, w);
+    double damping = settings.initialDamping;
+    fit.converged = false;
+    fit.iterations = 0;
+
+    Matrix jtj(N_PARAMETERS, N_PARAMETERS);
+    std::vector<double> gradient(N_PARAMETERS);
+    double jacobian[N_PARAMETERS];
+    while (fit.iterations < settings.maxIterations && !fit.converged)
+    {
+        fit.iterations++;
+        jtj = Matrix(N_PARAMETERS, N_PARAMETERS);
+        std::fill(gradient.begin(), gradient.end(), 0.0);
+        for (size_t j = 0; j < k.size(); j++)
+        {
+            double d = k[j] - p.m;
+            double s = std::sqrt(d * d + p.sigma * p.sigma);
+            double r = p.a + p.b * (p.rho * d + s) - w[j];
+            jacobian[0] = 1.0;
+            jacobian[1] = p.rho * d + s;
+            jacobian[2] = p.b * d;
+            jacobian[3] = -p.b * (p.rho + d / s);
+            jacobian[4] = p.b * p.sigma / s;
+            for (size_t a = 0; a < N_PARAMETERS; a++)
+            {
+                gradient[a] += jacobian[a] * r;
+                for (size_t b = 0; b <= a; b++)
+                {
+                    jtj(a, b) += jacobian[a] * jacobian[b];
+                }
+            }
+        }
+        for (size_t a = 0; a < N_PARAMETERS; a++)
+        {
+            for (size_t b = 0; b < a; b++)
+            {
+                jtj(b, a) = jtj(a, b);
+            }
+        }
+
+        // increase the damping until a step reduces the cost
+        while (true)
+        {
+            Matrix damped = jtj;
+            for (size_t a = 0; a < N_PARAMETERS; a++)
+            {
+                damped(a, a) += damping * jtj(a, a) + 1e-15;
+            }
+            std::vector<double> step = choleskySolve(cholesky(damped), gradient);
+            std::vector<double> x = toVector(p);
+            for (size_t a = 0; a < N_PARAMETERS; a++)
+            {
+                x[a] -= step[a];
+            }
+            SviParameters candidate = project(fromVector(x));
+            double candidateCost = cost(candidate, k, w);
+            if (candidateCost < currentCost)
+            {
+                bool smallImprovement = currentCost - candidateCost <= settings.tolerance * (currentCost + settings.tolerance);
+                p = candidate;
+                currentCost = candidateCost;
+                damping = std::max(damping * 0.1, 1e-15);
+                fit.converged = smallImprovement;
+                break;
+            }
+            damping *= 10;
+            if (damping > MAX_DAMPING)
+            {
+                // no descent direction left, we are at a (constrained) minimum
+                fit.converged = true;
+                break;
+            }
+        }
+    }
+    fit.parameters = p;
+}
+
+/*  Fills the implied volatility residuals and their summary statistics */
+static void computeResiduals(const std::vector<double> &k, const std::vector<double> &w, SviFit &fit)
+{
+    fit.residuals.resize(k.size());
+    double sumSquares = 0.0;
+    fit.maxAbsResidual = 0.0;
+    for (size_t j = 0; j < k.size(); j++)
+    {
+        double r = sviImpliedVolatility(fit.parameters, k[j], fit.maturity) - std::sqrt(w[j] / fit.maturity);
+        fit.residuals[j] = r;
+        sumSquares += r * r;
+        fit.maxAbsResidual = std::max(fit.maxAbsResidual, std::fabs(r));
+    }
+    fit.rmse = k.empty() ? 0.0 : std::sqrt(sumSquares / k.size());
+}
+
+SviCalibrator::SviCalibrator(const SviSettings &settings) : settings(settings)
+{
+}
+
+void SviCalibrator::reset()
+{
+    previousFits.clear();
+}
+
+std::vector<SviFit> SviCalibrator::calibrate(const SviSurfaceQuotes &quotes)
+{
+    size_t nSlices = quotes.slices.size();
+    std::vector<SviFit> fits(nSlices);
+    std::vector<std::vector<double>> logMoneyness(nSlices);
+    std::vector<std::vector<double>> totalVariance(nSlices);
+
+    parallelFor(nSlices, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            const SviSliceQuotes &slice = quotes.slices[i];
+            if (slice.strikes.size() != slice.callPrices.size() || slice.maturity <= 0)
+            {
+                throw std::invalid_argument("Invalid SVI slice quotes");
+            }
+            double forward = quotes.spot * std::exp(quotes.rate * slice.maturity);
+            std::vector<double> &k = logMoneyness[i];
+            std::vector<double> &w = totalVariance[i];
+            SviFit &fit = fits[i];
+            for (size_t j = 0; j < slice.strikes.size(); j++)
+            {
+                double vol;
+                try
+                {
+                    vol = blackScholesImpliedVolatility(slice.callPrices[j], slice.strikes[j], slice.maturity, quotes.spot, quotes.rate);
+                }
+                catch (const std::invalid_argument &)
+                {
+                    // one stale quote should not cost the whole surface
+                    vol = std::numeric_limits<double>::quiet_NaN();
+                }
+                if (!std::isfinite(vol))
+                {
+                    fit.rejectedQuotes.push_back(j);
+                    continue;
+                }
+                k.push_back(std::log(slice.strikes[j] / forward));
+                w.push_back(vol * vol * slice.maturity);
+            }
+
+            fit.maturity = slice.maturity;
+            fit.warmStarted = false;
+            for (const SviFit &previous : previousFits)
+            {
+                if (previous.maturity == slice.maturity)
+                {
+                    fit.parameters = previous.parameters;
+                    fit.warmStarted = true;
+                    break;
+                }
+            }
+            if (!fit.warmStarted)
+            {
+                double minVariance = w.empty() ? 0.0 : *std::min_element(w.begin(), w.end());
+                fit.parameters.a = 0.5 * minVariance;
+                fit.parameters.b = 0.1;
+                fit.parameters.rho = -0.3;
+                fit.parameters.m = 0.0;
+                fit.parameters.sigma = 0.1;
+            }
+            fit.fitted = k.size() >= N_PARAMETERS;
+            if (fit.fitted)
+            {
+                fitSlice(k, w, settings, fit);
+            }
+            else
+            {
+                fit.iterations = 0;
+                fit.converged = false;
+            }
+        }
+    }, 1);
+
+    // remove calendar arbitrage in order of maturity, then compute the diagnostics
+    std::vector<size_t> order(nSlices);
+    for (size_t i = 0; i < nSlices; i++)
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t x, size_t y)
+    {
+        return fits[x].maturity < fits[y].maturity;
+    });
+    const SviFit *shorter = nullptr;
+    for (size_t position = 0; position < nSlices; position++)
+    {
+        SviFit &fit = fits[order[position]];
+        fit.calendarAdjustment = 0.0;
+        fit.minDensity = std::numeric_limits<double>::infinity();
+        for (int j = 0; j < settings.checkPoints && fit.fitted; j++)
+        {
+            double k = -settings.checkRange + 2 * settings.checkRange * j / std::max(settings.checkPoints - 1, 1);
+            if (shorter)
+            {
+                double violation = sviTotalVariance(shorter->parameters, k) - sviTotalVariance(fit.parameters, k);
+                fit.calendarAdjustment = std::max(fit.calendarAdjustment, violation);
+            }
+        }
+        fit.parameters.a += fit.calendarAdjustment;
+        for (int j = 0; j < settings.checkPoints; j++)
+        {
+            double k = -settings.checkRange + 2 * settings.checkRange * j / std::max(settings.checkPoints - 1, 1);
+            fit.minDensity = std::min(fit.minDensity, density(fit.parameters, k));
+        }
+        computeResiduals(logMoneyness[order[position]], totalVariance[order[position]], fit);
+        if (fit.fitted)
+        {
+            shorter = &fit;
+        }
+        DEBUG_PRINT("SVI slice T=" << fit.maturity << " rmse " << fit.rmse << " iterations " << fit.iterations);
+    }
+
+    previousFits = fits;
+    return fits;
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+/*  Call quotes generated from an SVI slice */
+static SviSliceQuotes syntheticSlice(const SviParameters &p, double maturity, double spot, double rate, int nStrikes)
+{
+    SviSliceQuotes slice;
+    slice.maturity = maturity;
+    double forward = spot * std::exp(rate * maturity);
+    for (int j = 0; j < nStrikes; j++)
+    {
+        double strike = spot * (0.6 + 0.8 * j / (nStrikes - 1));
+        double vol = sviImpliedVolatility(p, std::log(strike / forward), maturity);
+        slice.strikes.push_back(strike);
+        slice.callPrices.push_back(blackScholesCallPrice(strike, maturity, spot, vol, rate));
+    }
+    return slice;
+}
+
+static SviParameters sampleParameters(double maturity)
+{
+    SviParameters p;
+    p.a = 0.02 * maturity;
+    p.b = 0.1 * std::sqrt(maturity);
+    p.rho = -0.4;
+    p.m = 0.05;
+    p.sigma = 0.2;
+    return p;
+}
+
+static void testSviRecoversParameters()
+{
+    SviSurfaceQuotes quotes{100.0, 0.02, {syntheticSlice(sampleParameters(1.0), 1.0, 100.0, 0.02, 40)}};
+    SviCalibrator calibrator;
+    std::vector<SviFit> fits = calibrator.calibrate(quotes);
+    ASSERT(fits.size() == 1);
+    ASSERT(fits[0].converged);
+    ASSERT(!fits[0].warmStarted);
+    ASSERT(fits[0].rmse < 1e-5);
+    ASSERT_APPROX_EQUAL(fits[0].parameters.rho, -0.4, 1e-3);
+    ASSERT_APPROX_EQUAL(fits[0].parameters.m, 0.05, 1e-3);
+    ASSERT(fits[0].minDensity > 0);
+}
+
+static void testSviWarmStart()
+{
+    SviSurfaceQuotes quotes{100.0, 0.02, {syntheticSlice(sampleParameters(0.5), 0.5, 100.0, 0.02, 40)}};
+    SviCalibrator calibrator;
+    int coldIterations = calibrator.calibrate(quotes)[0].iterations;
+    // move the market a little and recalibrate
+    SviParameters moved = sampleParameters(0.5);
+    moved.a *= 1.01;
+    quotes.slices[0] = syntheticSlice(moved, 0.5, 100.0, 0.02, 40);
+    SviFit warm = calibrator.calibrate(quotes)[0];
+    ASSERT(warm.warmStarted);
+    ASSERT(warm.iterations < coldIterations);
+    ASSERT(warm.rmse < 1e-5);
+}
+
+static void testSviCalendarArbitrage()
+{
+    // the longer slice has less total variance, which is calendar arbitrage
+    SviParameters shortParameters = sampleParameters(1.0);
+    SviParameters longParameters = sampleParameters(1.0);
+    longParameters.a -= 0.005;
+    SviSurfaceQuotes quotes{100.0, 0.0, {syntheticSlice(longParameters, 1.1, 100.0, 0.0, 30),
+                                         syntheticSlice(shortParameters, 1.0, 100.0, 0.0, 30)}};
+    SviCalibrator calibrator;
+    std::vector<SviFit> fits = calibrator.calibrate(quotes);
+    ASSERT(fits[0].calendarAdjustment > 0);
+    ASSERT(fits[1].calendarAdjustment == 0);
+    for (double k = -1.5; k <= 1.5; k += 0.05)
+    {
+        ASSERT(sviTotalVariance(fits[0].parameters, k) >= sviTotalVariance(fits[1].parameters, k) - 1e-12);
+    }
+}
+
+static void testSviRejectsBadQuotes()
+{
+    SviSliceQuotes good = syntheticSlice(sampleParameters(1.0), 1.0, 100.0, 0.02, 40);
+    SviSliceQuotes bad = good;
+    // above the spot, a call price no volatility gives
+    bad.callPrices[7] = 150.0;
+    SviSliceQuotes sparse = syntheticSlice(sampleParameters(2.0), 2.0, 100.0, 0.02, 6);
+    sparse.callPrices[0] = -1.0;
+    sparse.callPrices[1] = 500.0;
+    SviSurfaceQuotes quotes{100.0, 0.02, {bad, sparse}};
+    SviCalibrator calibrator;
+    std::vector<SviFit> fits = calibrator.calibrate(quotes);
+    ASSERT(fits[0].fitted);
+    ASSERT(fits[0].rejectedQuotes == std::vector<size_t>({7}));
+    ASSERT(fits[0].residuals.size() == 39);
+    ASSERT(fits[0].rmse < 1e-5);
+    ASSERT(!fits[1].fitted);
+    ASSERT(fits[1].rejectedQuotes == std::vector<size_t>({0, 1}));
+}
+
+static void testSviConstraints()
+{
+    SviParameters p;
+    p.a = -1.0;
+    p.b = 5.0;
+    p.rho = 1.5;
+    p.sigma = -0.1;
+    SviParameters projected = project(p);
+    ASSERT(projected.rho < 1.0);
+    ASSERT(projected.sigma > 0.0);
+    ASSERT(projected.b * (1 + std::fabs(projected.rho)) <= 2.0 + 1e-12);
+    ASSERT(projected.a + projected.b * projected.sigma * std::sqrt(1 - projected.rho * projected.rho) >= -1e-12);
+}
+
+void testSvi()
+{
+    TEST(testSviRecoversParameters);
+    TEST(testSviWarmStart);
+    TEST(testSviCalendarArbitrage);
+    TEST(testSviRejectsBadQuotes);
+    TEST(testSviConstraints);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+void benchmarkSvi()
+{
+    const int nMaturities = 50;
+    const int nStrikes = 100;
+    SviSurfaceQuotes quotes{100.0, 0.02, {}};
+    for (int i = 0; i < nMaturities; i++)
+    {
+        double maturity = 0.1 + 0.1 * i;
+        quotes.slices.push_back(syntheticSlice(sampleParameters(maturity), maturity, 100.0, 0.02, nStrikes));
+    }
+
+    SviCalibrator calibrator;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SviFit> fits = calibrator.calibrate(quotes);
+    double coldSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // move the market a little and recalibrate from the previous fits
+    for (int i = 0; i < nMaturities; i++)
+    {
+        SviParameters moved = sampleParameters(quotes.slices[i].maturity);
+        moved.a *= 1.01;
+        moved.rho += 0.01;
+        quotes.slices[i] = syntheticSlice(moved, quotes.slices[i].maturity, 100.0, 0.02, nStrikes);
+    }
+    start = std::chrono::steady_clock::now();
+    std::vector<SviFit> warmFits = calibrator.calibrate(quotes);
+    double warmSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double worstRmse = 0.0;
+    int coldIterations = 0;
+    int warmIterations = 0;
+    for (size_t i = 0; i < fits.size(); i++)
+    {
+        worstRmse = std::max(worstRmse, std::max(fits[i].rmse, warmFits[i].rmse));
+        coldIterations += fits[i].iterations;
+        warmIterations += warmFits[i].iterations;
+    }
+    std::cout << "svi " << nMaturities << "x" << nStrikes << " surface: cold " << coldSeconds * 1e3 << "ms ("
+              << coldIterations << " iterations), warm " << warmSeconds * 1e3 << "ms ("
+              << warmIterations << " iterations), worst rmse " << worstRmse << " on " << numThreads() << " threads\n";
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "stdafx.h"
+#include <string>
+
+/**
+ *  Raw SVI parameters of one maturity slice, giving the total implied
+ *  variance w(k) = a + b (rho (k - m) + sqrt((k - m)^2 + sigma^2))
+ *  at log-moneyness k = log(strike / forward)
+ */
+struct SviParameters
+{
+    double a = 0.0;
+    double b = 0.0;
+    double rho = 0.0;
+    double m = 0.0;
+    double sigma = 0.1;
+};
+
+/** Total implied variance of an SVI slice at log-moneyness k */
+double sviTotalVariance(const SviParameters &parameters, double k);
+
+/** Implied volatility of an SVI slice at log-moneyness k and maturity t */
+double sviImpliedVolatility(const SviParameters &parameters, double k, double t);
+
+/**
+ *  Call price quotes for one maturity
+ */
+struct SviSliceQuotes
+{
+    double maturity;
+    std::vector<double> strikes;
+    std::vector<double> callPrices;
+};
+
+/**
+ *  Call price quotes for a whole surface on a single underlying
+ */
+struct SviSurfaceQuotes
+{
+    double spot;
+    double rate;
+    std::vector<SviSliceQuotes> slices;
+};
+
+/**
+ *  Result and residual diagnostics of fitting one slice
+ */
+struct SviFit
+{
+    double maturity;
+    SviParameters parameters;
+    /** False if fewer quotes than parameters were left to fit, the parameters are then the starting guess */
+    bool fitted;
+    /** Indices of the quotes without an implied volatility, e.g. stale prices outside the no-arbitrage bounds, left out of the fit */
+    std::vector<size_t> rejectedQuotes;
+    /** Fitted minus quoted implied volatility at each strike that was fitted, in order */
+    std::vector<double> residuals;
+    double rmse;
+    double maxAbsResidual;
+    int iterations;
+    bool converged;
+    bool warmStarted;
+    /** Amount by which a was raised to remove calendar arbitrage with the previous slice */
+    double calendarAdjustment;
+    /** Minimum of Gatheral's density function g(k) on the check grid, negative means butterfly arbitrage */
+    double minDensity;
+};
+
+/**
+ *  Settings of the Levenberg-Marquardt fit
+ */
+struct SviSettings
+{
+    int maxIterations = 100;
+    double tolerance = 1e-12;
+    double initialDamping = 1e-3;
+    /** Log-moneyness range and number of points used for the arbitrage checks */
+    double checkRange = 1.5;
+    int checkPoints = 61;
+};
+
+/**
+ *  Fits SVI slices to a surface of call quotes with Levenberg-Marquardt
+ *  and analytic Jacobians, one slice per thread.  Each slice is warm
+ *  started from the last fit of the same maturity, so recalibrating to
+ *  slightly moved quotes takes only a few iterations.
+ *
+ *  No-arbitrage is enforced by projecting every step onto b >= 0,
+ *  |rho| < 1, sigma > 0, a + b sigma sqrt(1 - rho^2) >= 0 and Lee's wing
+ *  bound b (1 + |rho|) <= 2, and calendar spread arbitrage is removed by
+ *  raising a until each slice lies above the previous one on the check
+ *  grid.  Butterfly arbitrage is reported through SviFit::minDensity.
+ *
+ *  A quote without an implied volatility is left out of its slice and
+ *  listed in SviFit::rejectedQuotes rather than failing the surface, and a
+ *  slice left with too few quotes is not fitted nor used for the calendar
+ *  check.
+ */
+class SviCalibrator
+{
+public:
+    explicit SviCalibrator(const SviSettings &settings = SviSettings());
+
+    std::vector<SviFit> calibrate(const SviSurfaceQuotes &quotes);
+
+    /** Forgets the previous fits so the next calibration starts cold */
+    void reset();
+
+private:
+    SviSettings settings;
+    std::vector<SviFit> previousFits;
+};
+
+/**
+ *  Test function
+ */
+void testSvi();
+
+/**
+ *  Benchmark function
+ */
+void benchmarkSvi();
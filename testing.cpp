@@ -1,14 +1,248 @@
 #include "testing.h"
+#include "matlib.h"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
 
 /*  Whether debug messages are enabled */
-static bool debugEnabled = false;
+static std::atomic<bool> debugEnabled = false;
 
 bool isDebugEnabled()
 {
-    return debugEnabled;
+    return debugEnabled.load(std::memory_order_relaxed);
 }
 
 void setDebugEnabled(bool enable)
 {
-    debugEnabled = enable;
-}
\ No newline at end of file
+    debugEnabled.store(enable, std::memory_order_relaxed);
+}
+///////////////////////////////////////////////
+//
+//   BENCHMARK HARNESS
+//
+///////////////////////////////////////////////
+
+/*  The results of every benchmark run so far */
+static std::vector<BenchmarkResult> results;
+
+BenchmarkSettings &benchmarkSettings()
+{
+    static BenchmarkSettings settings;
+    return settings;
+}
+
+const std::vector<BenchmarkResult> &benchmarkResults()
+{
+    return results;
+}
+
+static double timeIterations(const std::function<void(size_t)> &f, size_t iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    f(iterations);
+    return secondsSince(start);
+}
+
+BenchmarkResult runBenchmark(const std::string &name,
+                             const std::function<void(size_t)> &f,
+                             double itemsPerIteration,
+                             double bytesPerIteration)
+{
+    const BenchmarkSettings &settings = benchmarkSettings();
+
+    // grow the iteration count until one sample is long enough to time reliably
+    size_t iterations = 1;
+    double elapsed = timeIterations(f, iterations);
+    while (elapsed < settings.sampleSeconds)
+    {
+        double factor = elapsed > 0 ? 1.4 * settings.sampleSeconds / elapsed : 100.0;
+        iterations = (size_t)(iterations * std::min(std::max(factor, 2.0), 100.0));
+        elapsed = timeIterations(f, iterations);
+    }
+    auto warmupStart = std::chrono::steady_clock::now();
+    while (std::chrono::duration<double>(std::chrono::steady_clock::now() - warmupStart).count() < settings.warmupSeconds)
+    {
+        timeIterations(f, iterations);
+    }
+
+    std::vector<double> nanos;
+    for (size_t sample = 0; sample < std::max<size_t>(settings.samples, 1); sample++)
+    {
+        nanos.push_back(timeIterations(f, iterations) * 1e9 / iterations);
+    }
+    BenchmarkResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.samples = nanos.size();
+    result.minNanos = *std::min_element(nanos.begin(), nanos.end());
+    result.medianNanos = prctile(nanos, 50);
+    result.p95Nanos = prctile(nanos, 95);
+    result.itemsPerSecond = itemsPerIteration * 1e9 / result.medianNanos;
+    result.bytesPerSecond = bytesPerIteration * 1e9 / result.medianNanos;
+    results.push_back(result);
+
+    std::cout << "BENCHMARK " << name << ": median " << result.medianNanos << " ns, min " << result.minNanos
+              << " ns, p95 " << result.p95Nanos << " ns";
+    if (itemsPerIteration > 0)
+    {
+        std::cout << ", " << result.itemsPerSecond * 1e-6 << " M items/s";
+    }
+    if (bytesPerIteration > 0)
+    {
+        std::cout << ", " << result.bytesPerSecond * 1e-6 << " MB/s";
+    }
+    std::cout << " (" << result.samples << " x " << iterations << " iterations)\n";
+    return result;
+}
+
+static std::string escapeJson(const std::string &text)
+{
+    std::string escaped;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+void writeBenchmarkJson(const std::string &file)
+{
+    std::ofstream out(file);
+    out << std::setprecision(17);
+    out << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchmarkResult &r = results[i];
+        out << "    {\"name\": \"" << escapeJson(r.name) << "\", \"iterations\": " << r.iterations
+            << ", \"samples\": " << r.samples << ", \"min_ns\": " << r.minNanos << ", \"median_ns\": " << r.medianNanos
+            << ", \"p95_ns\": " << r.p95Nanos << ", \"items_per_second\": " << r.itemsPerSecond
+            << ", \"bytes_per_second\": " << r.bytesPerSecond << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+/*  The number after "key": on a line written by writeBenchmarkJson */
+static double jsonNumber(const std::string &line, const std::string &key)
+{
+    size_t position = line.find("\"" + key + "\": ");
+    if (position == std::string::npos)
+    {
+        throw std::invalid_argument("Benchmark file has no " + key);
+    }
+    return std::strtod(line.c_str() + position + key.size() + 4, nullptr);
+}
+
+std::vector<BenchmarkResult> readBenchmarkJson(const std::string &file)
+{
+    std::ifstream in(file);
+    if (!in)
+    {
+        throw std::invalid_argument("Cannot read " + file);
+    }
+    std::vector<BenchmarkResult> read;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        size_t position = line.find("\"name\": \"");
+        if (position == std::string::npos)
+        {
+            continue;
+        }
+        BenchmarkResult r;
+        for (size_t i = position + 9; i < line.size() && line[i] != '"'; i++)
+        {
+            i += line[i] == '\\' ? 1 : 0;
+            r.name += line[i];
+        }
+        r.iterations = (size_t)jsonNumber(line, "iterations");
+        r.samples = (size_t)jsonNumber(line, "samples");
+        r.minNanos = jsonNumber(line, "min_ns");
+        r.medianNanos = jsonNumber(line, "median_ns");
+        r.p95Nanos = jsonNumber(line, "p95_ns");
+        r.itemsPerSecond = jsonNumber(line, "items_per_second");
+        r.bytesPerSecond = jsonNumber(line, "bytes_per_second");
+        read.push_back(r);
+    }
+    return read;
+}
+
+int compareWithBaseline(const std::vector<BenchmarkResult> &baseline, double threshold)
+{
+    int regressions = 0;
+    for (const BenchmarkResult &current : results)
+    {
+        auto found = std::find_if(baseline.begin(), baseline.end(), [&](const BenchmarkResult &r)
+        {
+            return r.name == current.name;
+        });
+        if (found == baseline.end())
+        {
+            std::cout << "  " << current.name << ": no baseline\n";
+            continue;
+        }
+        double change = current.medianNanos / found->medianNanos - 1.0;
+        bool regressed = change > threshold;
+        regressions += regressed ? 1 : 0;
+        std::cout << "  " << current.name << ": " << found->medianNanos << " ns -> " << current.medianNanos
+                  << " ns (" << (change >= 0 ? "+" : "") << change * 100 << "%)" << (regressed ? " REGRESSION" : "") << "\n";
+    }
+    return regressions;
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+static void sqrtChain(size_t iterations)
+{
+    double x = 1.0;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        doNotOptimize(x);
+        x = std::sqrt(x + 1.0);
+    }
+    doNotOptimize(x);
+}
+
+static void testHarnessStatistics()
+{
+    BenchmarkSettings saved = benchmarkSettings();
+    benchmarkSettings() = BenchmarkSettings{0.0, 1e-4, 5};
+    BenchmarkResult result = BENCHMARK_THROUGHPUT(sqrtChain, 1, 8);
+    benchmarkSettings() = saved;
+    ASSERT(result.iterations > 1);
+    ASSERT(result.samples == 5);
+    ASSERT(result.minNanos > 0);
+    ASSERT(result.minNanos <= result.medianNanos && result.medianNanos <= result.p95Nanos);
+    ASSERT_APPROX_EQUAL(result.bytesPerSecond, 8 * result.itemsPerSecond, 1e-6 * result.bytesPerSecond);
+    ASSERT(benchmarkResults().back().name == result.name);
+}
+
+static void testBaselineComparison()
+{
+    writeBenchmarkJson("BenchmarkTest.json");
+    std::vector<BenchmarkResult> baseline = readBenchmarkJson("BenchmarkTest.json");
+    std::remove("BenchmarkTest.json");
+    ASSERT(baseline.size() == benchmarkResults().size());
+    ASSERT(baseline.back().name == benchmarkResults().back().name);
+    ASSERT(baseline.back().medianNanos == benchmarkResults().back().medianNanos);
+    ASSERT(compareWithBaseline(baseline, 0.1) == 0);
+    for (BenchmarkResult &r : baseline)
+    {
+        r.medianNanos /= 2;
+    }
+    ASSERT(compareWithBaseline(baseline, 0.1) == (int)baseline.size());
+}
+
+void testBenchmarkHarness()
+{
+    TEST(testHarnessStatistics);
+    TEST(testBaselineComparison);
+}
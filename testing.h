@@ -5,6 +5,13 @@
 #include <iostream>
 #include <stdlib.h>
 #include <cassert>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
 
 /*  Is debugging currently enabled */
 bool isDebugEnabled();
@@ -38,6 +45,101 @@ void setDebugEnabled(bool enabled);
         std::cerr << "\n";                                            \
     } while (false)
 
+/*  Time f(iterations), which must run its body that many times, and record the statistics */
+#define BENCHMARK(f) runBenchmark(#f, f)
+/*  As BENCHMARK, also reporting the items and bytes processed per iteration per second */
+#define BENCHMARK_THROUGHPUT(f, items, bytes) runBenchmark(#f, f, items, bytes)
+
+/*  The timings of one benchmark, in nanoseconds per iteration */
+struct BenchmarkResult
+{
+    std::string name;
+    size_t iterations = 0;
+    size_t samples = 0;
+    double minNanos = 0.0;
+    double medianNanos = 0.0;
+    double p95Nanos = 0.0;
+    double itemsPerSecond = 0.0;
+    double bytesPerSecond = 0.0;
+};
+
+/*  How long benchmarks warm up and how many timed samples they take */
+struct BenchmarkSettings
+{
+    double warmupSeconds = 0.05;
+    double sampleSeconds = 0.01;
+    size_t samples = 30;
+};
+
+/*  Settings used by runBenchmark */
+BenchmarkSettings &benchmarkSettings();
+
+/*  Warms up, picks an iteration count so each sample takes about sampleSeconds,
+    then times the samples and prints min, median and 95th percentile per iteration */
+BenchmarkResult runBenchmark(const std::string &name,
+                             const std::function<void(size_t)> &f,
+                             double itemsPerIteration = 0.0,
+                             double bytesPerIteration = 0.0);
+
+/*  The results of every benchmark run so far */
+const std::vector<BenchmarkResult> &benchmarkResults();
+
+/*  Writes the results of every benchmark run so far as JSON */
+void writeBenchmarkJson(const std::string &file);
+
+/*  Reads the results from a file written by writeBenchmarkJson */
+std::vector<BenchmarkResult> readBenchmarkJson(const std::string &file);
+
+/*  Prints the change in median time against a baseline and returns the
+    number of benchmarks more than threshold (e.g. 0.1 for 10%) slower */
+int compareWithBaseline(const std::vector<BenchmarkResult> &baseline, double threshold);
+
+/*  Seconds elapsed on the steady clock since start, for timing benchmarks */
+inline double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*  Stops the compiler from removing a computation whose result is unused */
+template <typename T>
+inline void doNotOptimize(const T &value)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    static volatile const void *sink;
+    sink = &value;
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+/*  As doNotOptimize, also making the compiler assume the value has changed,
+    so computations using it are not hoisted out of the benchmark loop */
+template <typename T>
+inline void doNotOptimize(T &value)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    static volatile void *sink;
+    sink = &value;
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : "+r,m"(value) : : "memory");
+#endif
+}
+
+/*  Forces pending writes to memory to happen before the barrier */
+inline void clobberMemory()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : : "memory");
+#endif
+}
+
+/*  Test function */
+void testBenchmarkHarness();
+
 // on windows we define debug mode to be when _DEBUG is set
 #ifdef _DEBUG
 #define DEBUG_MODE 1
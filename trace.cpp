@@ -0,0 +1,372 @@
+#include "trace.h"
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/*  Every buffer ever registered, kept after their threads exit so their events can still be written.
+    Buffers of exited threads are reused by new ones, so there are only as many as the most threads
+    that ever ran at once, and threads that did not overlap may share a thread id in the trace. */
+static std::mutex buffersMutex;
+static std::vector<std::unique_ptr<TraceBuffer>> buffers;
+static std::vector<TraceBuffer *> freeBuffers;
+
+/*  A timestamp and clock reading taken together, to convert ticks to nanoseconds */
+struct ClockReading
+{
+    uint64_t ticks;
+    std::chrono::steady_clock::time_point time;
+};
+
+static ClockReading readClocks()
+{
+    return ClockReading{traceTimestamp(), std::chrono::steady_clock::now()};
+}
+
+/*  When tracing started, the origin of the times written */
+static const ClockReading traceStart = readClocks();
+
+/*  Timestamp ticks per nanosecond, measured against the steady clock since tracing started */
+static double ticksPerNanosecond()
+{
+    ClockReading now = readClocks();
+    double nanos = std::chrono::duration<double, std::nano>(now.time - traceStart.time).count();
+    if (nanos < 1e7)
+    {
+        // too short to calibrate accurately
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        now = readClocks();
+        nanos = std::chrono::duration<double, std::nano>(now.time - traceStart.time).count();
+    }
+    return (double)(now.ticks - traceStart.ticks) / nanos;
+}
+
+TraceBuffer *registerTraceBuffer()
+{
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    if (!freeBuffers.empty())
+    {
+        TraceBuffer *buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+        return buffer;
+    }
+    buffers.push_back(std::make_unique<TraceBuffer>((uint32_t)buffers.size()));
+    return buffers.back().get();
+}
+
+void releaseTraceBuffer(TraceBuffer *buffer)
+{
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    freeBuffers.push_back(buffer);
+}
+
+void TraceBuffer::copyEvents(std::vector<TraceEvent> &result) const
+{
+    uint64_t before = head.load(std::memory_order_acquire);
+    uint64_t first = std::max(cleared.load(std::memory_order_relaxed), before > CAPACITY ? before - CAPACITY : 0);
+    for (uint64_t position = first; position < before; position++)
+    {
+        const Slot &slot = slots[position & (CAPACITY - 1)];
+        // an event the thread overwrote, or is overwriting, while it was copied is dropped
+        if (slot.sequence.load(std::memory_order_acquire) != position + 1)
+        {
+            continue;
+        }
+        TraceEvent event{slot.name.load(std::memory_order_relaxed), slot.timestamp.load(std::memory_order_relaxed),
+                         slot.value.load(std::memory_order_relaxed), slot.type.load(std::memory_order_relaxed)};
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == position + 1)
+        {
+            result.push_back(event);
+        }
+    }
+}
+
+void TraceBuffer::clear()
+{
+    cleared.store(head.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
+
+std::vector<TraceRecord> collectTrace()
+{
+    double scale = 1.0 / ticksPerNanosecond();
+    std::vector<TraceRecord> records;
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    for (const std::unique_ptr<TraceBuffer> &buffer : buffers)
+    {
+        std::vector<TraceEvent> events;
+        buffer->copyEvents(events);
+        for (const TraceEvent &event : events)
+        {
+            TraceRecord record;
+            record.name = event.name;
+            record.type = event.type;
+            record.thread = buffer->threadId();
+            record.startNanos = (double)(int64_t)(event.timestamp - traceStart.ticks) * scale;
+            record.durationNanos = event.type == TraceEventType::Scope ? event.value * scale : 0.0;
+            record.value = event.type == TraceEventType::Counter ? event.value : 0;
+            records.push_back(record);
+        }
+    }
+    std::stable_sort(records.begin(), records.end(), [](const TraceRecord &a, const TraceRecord &b)
+    {
+        return a.startNanos < b.startNanos;
+    });
+    return records;
+}
+
+void clearTrace()
+{
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    for (const std::unique_ptr<TraceBuffer> &buffer : buffers)
+    {
+        buffer->clear();
+    }
+}
+
+void writeChromeTrace(const std::string &file)
+{
+    std::vector<TraceRecord> records = collectTrace();
+    std::ofstream out(file);
+    out << "{\"traceEvents\": [\n";
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const TraceRecord &r = records[i];
+        out << "{\"name\": \"" << r.name << "\", \"pid\": 1, \"tid\": " << r.thread << ", \"ts\": " << r.startNanos * 1e-3;
+        switch (r.type)
+        {
+        case TraceEventType::Scope:
+            out << ", \"ph\": \"X\", \"dur\": " << r.durationNanos * 1e-3 << "}";
+            break;
+        case TraceEventType::Counter:
+            out << ", \"ph\": \"C\", \"args\": {\"value\": " << r.value << "}}";
+            break;
+        default:
+            out << ", \"ph\": \"i\", \"s\": \"t\"}";
+        }
+        out << (i + 1 < records.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+}
+
+void printTraceSummary(std::ostream &out)
+{
+    struct Summary
+    {
+        TraceEventType type;
+        size_t count = 0;
+        double total = 0.0;
+        double lowest = 0.0;
+        double highest = 0.0;
+    };
+    std::map<std::string, Summary> summaries;
+    for (const TraceRecord &r : collectTrace())
+    {
+        Summary &summary = summaries[r.name];
+        double x = r.type == TraceEventType::Scope ? r.durationNanos : (double)r.value;
+        summary.type = r.type;
+        summary.lowest = summary.count == 0 ? x : std::min(summary.lowest, x);
+        summary.highest = summary.count == 0 ? x : std::max(summary.highest, x);
+        summary.total += x;
+        summary.count++;
+    }
+    for (const auto &[name, summary] : summaries)
+    {
+        out << name << ": " << summary.count;
+        if (summary.type == TraceEventType::Scope)
+        {
+            out << " scopes, total " << summary.total * 1e-6 << " ms, mean " << summary.total / summary.count
+                << " ns, max " << summary.highest << " ns";
+        }
+        else if (summary.type == TraceEventType::Counter)
+        {
+            out << " samples, min " << summary.lowest << ", mean " << summary.total / summary.count
+                << ", max " << summary.highest;
+        }
+        else
+        {
+            out << " points";
+        }
+        out << "\n";
+    }
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+static size_t countNamed(const std::vector<TraceRecord> &records, const std::string &name)
+{
+    return std::count_if(records.begin(), records.end(), [&](const TraceRecord &r)
+    {
+        return name == r.name;
+    });
+}
+
+static void testRecordsAcrossThreads()
+{
+    clearTrace();
+    // this thread takes its buffer first, otherwise it could reuse the worker's
+    traceBuffer();
+    std::thread worker([]()
+    {
+        for (int i = 0; i < 100; i++)
+        {
+            traceBuffer().record("worker point", TraceEventType::Point, traceTimestamp(), 0);
+        }
+    });
+    worker.join();
+    {
+        TraceScope scope("test scope");
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        traceBuffer().record("test counter", TraceEventType::Counter, traceTimestamp(), 42);
+    }
+    std::vector<TraceRecord> records = collectTrace();
+    ASSERT(countNamed(records, "worker point") == 100);
+    ASSERT(countNamed(records, "test scope") == 1);
+    ASSERT(countNamed(records, "test counter") == 1);
+    for (const TraceRecord &r : records)
+    {
+        if (r.type == TraceEventType::Scope)
+        {
+            ASSERT(r.durationNanos > 1e6 && r.durationNanos < 1e9);
+            ASSERT(r.thread != records.front().thread);
+        }
+        if (r.type == TraceEventType::Counter)
+        {
+            ASSERT(r.value == 42);
+        }
+    }
+    ASSERT(std::is_sorted(records.begin(), records.end(), [](const TraceRecord &a, const TraceRecord &b)
+    {
+        return a.startNanos < b.startNanos;
+    }));
+
+    std::stringstream summary;
+    printTraceSummary(summary);
+    ASSERT(summary.str().find("worker point: 100 points") != std::string::npos);
+
+    clearTrace();
+    ASSERT(collectTrace().empty());
+}
+
+static void testRingKeepsTheLatestEvents()
+{
+    clearTrace();
+    size_t n = TraceBuffer::CAPACITY + 1000;
+    for (size_t i = 0; i < n; i++)
+    {
+        traceBuffer().record("ring", TraceEventType::Counter, traceTimestamp(), (int64_t)i);
+    }
+    std::vector<TraceRecord> records = collectTrace();
+    ASSERT(records.size() == TraceBuffer::CAPACITY);
+    ASSERT(records.front().value == 1000);
+    ASSERT(records.back().value == (int64_t)n - 1);
+    clearTrace();
+}
+
+static void testExitedThreadsBuffersAreReused()
+{
+    clearTrace();
+    std::vector<const TraceBuffer *> used;
+    for (int i = 0; i < 10; i++)
+    {
+        std::thread worker([&used]()
+        {
+            traceBuffer().record("sequential point", TraceEventType::Point, traceTimestamp(), 0);
+            used.push_back(&traceBuffer());
+        });
+        worker.join();
+    }
+    // each thread takes the buffer the last one released, and the events stay
+    ASSERT(std::count(used.begin(), used.end(), used.front()) == 10);
+    ASSERT(countNamed(collectTrace(), "sequential point") == 10);
+    clearTrace();
+}
+
+static void testCopyWhileRecording()
+{
+    std::atomic<TraceBuffer *> buffer{nullptr};
+    std::atomic<bool> stop{false};
+    std::thread writer([&]()
+    {
+        buffer = &traceBuffer();
+        for (int64_t i = 0; !stop; i++)
+        {
+            traceBuffer().record("race", TraceEventType::Counter, (uint64_t)i, i);
+        }
+    });
+    while (!buffer)
+    {
+        std::this_thread::yield();
+    }
+    for (int copy = 0; copy < 50; copy++)
+    {
+        std::vector<TraceEvent> events;
+        buffer.load()->copyEvents(events);
+        // events torn by the writer are dropped, the rest are whole and in order
+        for (size_t i = 0; i < events.size(); i++)
+        {
+            ASSERT(events[i].value == (int64_t)events[i].timestamp);
+            ASSERT(i == 0 || events[i].value > events[i - 1].value);
+        }
+    }
+    stop = true;
+    writer.join();
+    clearTrace();
+}
+
+void testTrace()
+{
+    TEST(testRecordsAcrossThreads);
+    TEST(testRingKeepsTheLatestEvents);
+    TEST(testExitedThreadsBuffersAreReused);
+    TEST(testCopyWhileRecording);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+static void benchmarkTracePoint(size_t iterations)
+{
+    for (size_t i = 0; i < iterations; i++)
+    {
+        traceBuffer().record("benchmark point", TraceEventType::Point, traceTimestamp(), 0);
+    }
+}
+
+static void benchmarkTraceScope(size_t iterations)
+{
+    for (size_t i = 0; i < iterations; i++)
+    {
+        TraceScope scope("benchmark scope");
+    }
+}
+
+static void benchmarkDisabledDebugPrint(size_t iterations)
+{
+    for (size_t i = 0; i < iterations; i++)
+    {
+        double x = (double)i;
+        doNotOptimize(x);
+        // what DEBUG_PRINT costs in a debug build with debugging turned off
+        if (isDebugEnabled())
+        {
+            std::cerr << x;
+        }
+    }
+}
+
+void benchmarkTrace()
+{
+    BENCHMARK(benchmarkTracePoint);
+    BENCHMARK(benchmarkTraceScope);
+    BENCHMARK(benchmarkDisabledDebugPrint);
+    clearTrace();
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include "stdafx.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ *  Hot path instrumentation.  TRACE_SCOPE times the enclosing block,
+ *  TRACE_POINT marks an instant and TRACE_COUNTER samples a value.  The
+ *  names must be string literals.  Each thread records into its own ring
+ *  buffer without locks or allocation, so an event costs a few
+ *  nanoseconds, and the buffers are only read when a trace is written.
+ *  The macros compile to nothing unless ENABLE_TRACING is defined.
+ */
+#ifdef ENABLE_TRACING
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name)
+#define TRACE_POINT(name) traceBuffer().record(name, TraceEventType::Point, traceTimestamp(), 0)
+#define TRACE_COUNTER(name, value) traceBuffer().record(name, TraceEventType::Counter, traceTimestamp(), (int64_t)(value))
+#else
+#define TRACE_SCOPE(name) \
+    do                    \
+    {                     \
+    } while (0)
+#define TRACE_POINT(name) \
+    do                    \
+    {                     \
+    } while (0)
+#define TRACE_COUNTER(name, value) \
+    do                             \
+    {                              \
+    } while (0)
+#endif
+
+/*  The cheapest available timestamp, the time stamp counter on x86 */
+inline uint64_t traceTimestamp()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+enum class TraceEventType : uint32_t
+{
+    Scope,
+    Point,
+    Counter
+};
+
+/*  One recorded event, for scopes the value is the duration in timestamp ticks */
+struct TraceEvent
+{
+    const char *name;
+    uint64_t timestamp;
+    int64_t value;
+    TraceEventType type;
+};
+
+/**
+ *  A ring buffer of the most recent events of one thread.  Only the
+ *  owning thread writes, marking each slot with the position of the event
+ *  it holds once the event is complete, so readers can copy events out
+ *  while the thread keeps recording and drop any overwritten meanwhile.
+ */
+class TraceBuffer
+{
+public:
+    static const size_t CAPACITY = 1 << 16;
+
+    explicit TraceBuffer(uint32_t thread) : thread(thread) {}
+
+    void record(const char *name, TraceEventType type, uint64_t timestamp, int64_t value)
+    {
+        uint64_t position = head.load(std::memory_order_relaxed);
+        Slot &slot = slots[position & (CAPACITY - 1)];
+        // readers ignore the slot until its sequence is that of the new event
+        slot.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.timestamp.store(timestamp, std::memory_order_relaxed);
+        slot.value.store(value, std::memory_order_relaxed);
+        slot.type.store(type, std::memory_order_relaxed);
+        slot.sequence.store(position + 1, std::memory_order_release);
+        head.store(position + 1, std::memory_order_release);
+    }
+
+    /** Appends the events still in the buffer that were recorded since the last clear */
+    void copyEvents(std::vector<TraceEvent> &result) const;
+
+    /** Forgets the events recorded so far */
+    void clear();
+
+    uint32_t threadId() const { return thread; }
+
+private:
+    /*  Relaxed atomics so that reading a slot being written is not a data race */
+    struct Slot
+    {
+        std::atomic<const char *> name;
+        std::atomic<uint64_t> timestamp;
+        std::atomic<int64_t> value;
+        std::atomic<TraceEventType> type;
+        /*  One more than the position of the event in the slot, 0 while it is written */
+        std::atomic<uint64_t> sequence;
+    };
+
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> cleared{0};
+    uint32_t thread;
+    Slot slots[CAPACITY];
+};
+
+/*  Gives the calling thread a buffer, reusing one of an exited thread if there is one */
+TraceBuffer *registerTraceBuffer();
+
+/*  Makes the buffer of an exiting thread available again, its events are kept until overwritten */
+void releaseTraceBuffer(TraceBuffer *buffer);
+
+/*  Holds the buffer of a thread for as long as the thread runs */
+class TraceBufferOwner
+{
+public:
+    TraceBufferOwner() : buffer(registerTraceBuffer()) {}
+    ~TraceBufferOwner() { releaseTraceBuffer(buffer); }
+
+    TraceBufferOwner(const TraceBufferOwner &) = delete;
+    TraceBufferOwner &operator=(const TraceBufferOwner &) = delete;
+
+    TraceBuffer *const buffer;
+};
+
+/*  The buffer of the calling thread */
+inline TraceBuffer &traceBuffer()
+{
+    thread_local TraceBufferOwner owner;
+    return *owner.buffer;
+}
+
+/**
+ *  Records the time between its construction and destruction
+ */
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name) : name(name), start(traceTimestamp()) {}
+    ~TraceScope()
+    {
+        uint64_t end = traceTimestamp();
+        traceBuffer().record(name, TraceEventType::Scope, start, (int64_t)(end - start));
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *name;
+    uint64_t start;
+};
+
+/*  An event read back from the buffers, with times in nanoseconds since tracing started */
+struct TraceRecord
+{
+    const char *name;
+    TraceEventType type;
+    uint32_t thread;
+    double startNanos;
+    double durationNanos;
+    int64_t value;
+};
+
+/*  The events of every thread in timestamp order */
+std::vector<TraceRecord> collectTrace();
+
+/*  Forgets the events of every thread */
+void clearTrace();
+
+/*  Writes the events in the Chrome trace event format, for chrome://tracing or Perfetto */
+void writeChromeTrace(const std::string &file);
+
+/*  Prints the number, total and mean time of each scope and the statistics of each counter */
+void printTraceSummary(std::ostream &out);
+
+/*  Test function */
+void testTrace();
+
+/*  Benchmark function */
+void benchmarkTrace();
@@ -0,0 +1,458 @@
+#include "variancereduction.h"
+#include "matlib.h"
+#include "parallel.h"
+#include <chrono>
+
+/*  Minimum number of paths simulated by one thread */
+static const size_t MIN_PATHS_PER_THREAD = 1024;
+
+void VarianceReduction::transformNormals(double *, size_t nPaths, size_t, double *weights) const
+{
+    std::fill(weights, weights + nPaths, 1.0);
+}
+
+double VarianceReduction::control(const double *, size_t, size_t) const
+{
+    return 0.0;
+}
+
+ControlVariate::ControlVariate(const PathPayoff &control, double discountedMean)
+    : controlPayoff(control), mean(discountedMean)
+{
+}
+
+double ControlVariate::control(const double *prices, size_t nSteps, size_t nAssets) const
+{
+    return controlPayoff(prices, nSteps, nAssets);
+}
+
+ImportanceSampling::ImportanceSampling(double meanShift) : drift(meanShift)
+{
+}
+
+void ImportanceSampling::transformNormals(double *normals, size_t nPaths, size_t nNormals, double *weights) const
+{
+    // sampling z + drift instead of z changes the density by exp(-drift * z - drift^2 / 2) per normal
+    for (size_t p = 0; p < nPaths; p++)
+    {
+        double *z = normals + p * nNormals;
+        double sum = 0.0;
+        for (size_t i = 0; i < nNormals; i++)
+        {
+            z[i] += drift;
+            sum += z[i];
+        }
+        weights[p] = std::exp(-drift * sum + 0.5 * drift * drift * nNormals);
+    }
+}
+
+void MomentMatching::transformNormals(double *normals, size_t nPaths, size_t nNormals, double *weights) const
+{
+    std::fill(weights, weights + nPaths, 1.0);
+    if (nPaths < 2)
+    {
+        return;
+    }
+    std::vector<double> sum(nNormals, 0.0);
+    std::vector<double> sumSquares(nNormals, 0.0);
+    for (size_t p = 0; p < nPaths; p++)
+    {
+        const double *z = normals + p * nNormals;
+        for (size_t i = 0; i < nNormals; i++)
+        {
+            sum[i] += z[i];
+            sumSquares[i] += z[i] * z[i];
+        }
+    }
+    for (size_t i = 0; i < nNormals; i++)
+    {
+        double mean = sum[i] / nPaths;
+        double variance = (sumSquares[i] - nPaths * mean * mean) / nPaths;
+        sum[i] = mean;
+        sumSquares[i] = variance > 0 ? 1.0 / std::sqrt(variance) : 1.0;
+    }
+    for (size_t p = 0; p < nPaths; p++)
+    {
+        double *z = normals + p * nNormals;
+        for (size_t i = 0; i < nNormals; i++)
+        {
+            z[i] = (z[i] - sum[i]) * sumSquares[i];
+        }
+    }
+}
+
+/*  Running sums needed for the estimate, accumulated block by block */
+struct EstimateSums
+{
+    double n = 0;
+    double y = 0;          // weighted discounted payoff
+    double yy = 0;
+    double c = 0;          // discounted control
+    double cc = 0;
+    double yc = 0;
+    double plainSecondMoment = 0; // E[w * payoff^2], the second moment without the strategy
+    std::vector<double> blockMeans;
+};
+
+MonteCarloEstimate monteCarloPrice(const SimulationModel &model,
+                                   const PathPayoff &payoff,
+                                   int nPaths,
+                                   const VarianceReduction *strategy,
+                                   int blockSize)
+{
+    size_t nAssets = model.spots.size();
+    if (nAssets == 0 || model.volatilities.size() != nAssets)
+    {
+        throw std::invalid_argument("Spots and volatilities must be non-empty and of equal size");
+    }
+    if (nPaths < 2 || blockSize < 2 || model.timeSteps < 1 || model.maturity <= 0)
+    {
+        throw std::invalid_argument("Invalid simulation settings");
+    }
+    VarianceReduction plain;
+    if (!strategy)
+    {
+        strategy = &plain;
+    }
+    Matrix factor = model.correlation.rows() == 0 ? Matrix::identity(nAssets) : cholesky(model.correlation);
+    if (factor.rows() != nAssets)
+    {
+        throw std::invalid_argument("Correlation matrix does not match the number of assets");
+    }
+
+    size_t nSteps = model.timeSteps;
+    size_t nNormals = nSteps * nAssets;
+    double dt = model.maturity / nSteps;
+    double discount = std::exp(-model.rate * model.maturity);
+    std::vector<double> drift(nAssets);
+    std::vector<double> diffusion(nAssets);
+    for (size_t i = 0; i < nAssets; i++)
+    {
+        double vol = model.volatilities[i];
+        drift[i] = (model.rate - 0.5 * vol * vol) * dt;
+        diffusion[i] = vol * std::sqrt(dt);
+    }
+
+    EstimateSums sums;
+    std::vector<double> weights(blockSize);
+    std::vector<double> discountedPayoffs(blockSize);
+    std::vector<double> controls(blockSize);
+    for (int first = 0; first < nPaths; first += blockSize)
+    {
+        size_t count = std::min(blockSize, nPaths - first);
+        std::vector<double> z = randn((int)(count * nNormals));
+        strategy->transformNormals(z.data(), count, nNormals, weights.data());
+
+        parallelFor(count, [&](size_t begin, size_t end)
+        {
+            std::vector<double> prices(nNormals);
+            std::vector<double> logPrice(nAssets);
+            for (size_t p = begin; p < end; p++)
+            {
+                const double *zp = &z[p * nNormals];
+                for (size_t i = 0; i < nAssets; i++)
+                {
+                    logPrice[i] = std::log(model.spots[i]);
+                }
+                for (size_t step = 0; step < nSteps; step++)
+                {
+                    const double *zs = zp + step * nAssets;
+                    for (size_t i = 0; i < nAssets; i++)
+                    {
+                        const double *li = factor.row(i);
+                        double correlated = 0.0;
+                        for (size_t j = 0; j <= i; j++)
+                        {
+                            correlated += li[j] * zs[j];
+                        }
+                        logPrice[i] += drift[i] + diffusion[i] * correlated;
+                        prices[step * nAssets + i] = std::exp(logPrice[i]);
+                    }
+                }
+                discountedPayoffs[p] = discount * payoff(prices.data(), nSteps, nAssets);
+                controls[p] = strategy->hasControl() ? discount * strategy->control(prices.data(), nSteps, nAssets) : 0.0;
+            }
+        }, MIN_PATHS_PER_THREAD);
+
+        double blockSum = 0.0;
+        for (size_t p = 0; p < count; p++)
+        {
+            double y = weights[p] * discountedPayoffs[p];
+            double c = controls[p];
+            blockSum += y;
+            sums.y += y;
+            sums.yy += y * y;
+            sums.c += c;
+            sums.cc += c * c;
+            sums.yc += y * c;
+            sums.plainSecondMoment += weights[p] * discountedPayoffs[p] * discountedPayoffs[p];
+        }
+        sums.n += count;
+        sums.blockMeans.push_back(blockSum / count);
+    }
+
+    double n = sums.n;
+    double meanY = sums.y / n;
+    double varianceY = (sums.yy - n * meanY * meanY) / (n - 1);
+    MonteCarloEstimate estimate;
+    estimate.paths = nPaths;
+    estimate.price = meanY;
+    double variancePerPath = varianceY;
+    if (strategy->hasControl())
+    {
+        double meanC = sums.c / n;
+        double varianceC = (sums.cc - n * meanC * meanC) / (n - 1);
+        double covariance = (sums.yc - n * meanY * meanC) / (n - 1);
+        double beta = varianceC > 0 ? covariance / varianceC : 0.0;
+        estimate.price = meanY - beta * (meanC - strategy->controlMean());
+        variancePerPath = varianceY - beta * covariance;
+    }
+    if (!strategy->independentPaths())
+    {
+        // paths within a block are dependent, so use the variance of the block means
+        double meanOfBlocks = mean(sums.blockMeans);
+        double varianceOfBlocks = 0.0;
+        for (double blockMean : sums.blockMeans)
+        {
+            varianceOfBlocks += (blockMean - meanOfBlocks) * (blockMean - meanOfBlocks);
+        }
+        size_t nBlocks = sums.blockMeans.size();
+        if (nBlocks < 2)
+        {
+            throw std::invalid_argument("At least two blocks are needed for the standard error");
+        }
+        varianceOfBlocks /= nBlocks - 1;
+        variancePerPath = varianceOfBlocks * n / nBlocks;
+    }
+    double plainVariance = (sums.plainSecondMoment - n * meanY * meanY) / (n - 1);
+    estimate.standardError = std::sqrt(std::max(variancePerPath, 0.0) / n);
+    estimate.varianceReductionFactor = variancePerPath > 0 ? plainVariance / variancePerPath : 0.0;
+    DEBUG_PRINT(strategy->name() << " price " << estimate.price << " +/- " << estimate.standardError);
+    return estimate;
+}
+
+PathPayoff europeanCallPayoff(double strike, size_t asset)
+{
+    return [strike, asset](const double *prices, size_t nSteps, size_t nAssets)
+    {
+        return std::max(prices[(nSteps - 1) * nAssets + asset] - strike, 0.0);
+    };
+}
+
+PathPayoff arithmeticAsianCallPayoff(double strike)
+{
+    return [strike](const double *prices, size_t nSteps, size_t nAssets)
+    {
+        double sum = 0.0;
+        for (size_t step = 0; step < nSteps; step++)
+        {
+            sum += prices[step * nAssets];
+        }
+        return std::max(sum / nSteps - strike, 0.0);
+    };
+}
+
+PathPayoff basketCallPayoff(double strike, const std::vector<double> &weights)
+{
+    return [strike, weights](const double *prices, size_t nSteps, size_t nAssets)
+    {
+        const double *terminal = prices + (nSteps - 1) * nAssets;
+        double basket = 0.0;
+        for (size_t i = 0; i < nAssets; i++)
+        {
+            basket += weights[i] * terminal[i];
+        }
+        return std::max(basket - strike, 0.0);
+    };
+}
+
+ControlVariate europeanCallControl(const SimulationModel &model, double strike)
+{
+    double price = blackScholesCallPrice(strike, model.maturity, model.spots[0], model.volatilities[0], model.rate);
+    return ControlVariate(europeanCallPayoff(strike), price);
+}
+
+ControlVariate basketEuropeanCallControl(const SimulationModel &model,
+                                         double strike,
+                                         const std::vector<double> &weights)
+{
+    double price = 0.0;
+    for (size_t i = 0; i < model.spots.size(); i++)
+    {
+        price += weights[i] * blackScholesCallPrice(strike, model.maturity, model.spots[i], model.volatilities[i], model.rate);
+    }
+    PathPayoff control = [strike, weights](const double *prices, size_t nSteps, size_t nAssets)
+    {
+        const double *terminal = prices + (nSteps - 1) * nAssets;
+        double sum = 0.0;
+        for (size_t i = 0; i < nAssets; i++)
+        {
+            sum += weights[i] * std::max(terminal[i] - strike, 0.0);
+        }
+        return sum;
+    };
+    return ControlVariate(control, price);
+}
+
+ImportanceSampling europeanCallImportanceSampling(const SimulationModel &model, double strike)
+{
+    // the terminal log price moves by vol * sqrt(T * steps) * drift when every normal is shifted by drift
+    double vol = model.volatilities[0];
+    double distance = std::log(strike / model.spots[0]) - (model.rate - 0.5 * vol * vol) * model.maturity;
+    return ImportanceSampling(distance / (vol * std::sqrt(model.maturity * model.timeSteps)));
+}
+
+///////////////////////////////////////////////
+//
+//   TESTS
+//
+///////////////////////////////////////////////
+
+static SimulationModel singleAssetModel(int timeSteps)
+{
+    SimulationModel model;
+    model.spots = {100.0};
+    model.volatilities = {0.2};
+    model.rate = 0.05;
+    model.maturity = 1.0;
+    model.timeSteps = timeSteps;
+    return model;
+}
+
+static void testPlainMonteCarlo()
+{
+    SimulationModel model = singleAssetModel(1);
+    MonteCarloEstimate estimate = monteCarloPrice(model, europeanCallPayoff(100), 20000);
+    ASSERT_APPROX_EQUAL(estimate.price, blackScholesCallPrice(100, 1, 100, 0.2, 0.05), 4 * estimate.standardError);
+    ASSERT_APPROX_EQUAL(estimate.varianceReductionFactor, 1.0, 1e-9);
+}
+
+static void testControlVariate()
+{
+    SimulationModel model = singleAssetModel(12);
+    ControlVariate control = europeanCallControl(model, 100);
+    MonteCarloEstimate plain = monteCarloPrice(model, arithmeticAsianCallPayoff(100), 20000);
+    MonteCarloEstimate reduced = monteCarloPrice(model, arithmeticAsianCallPayoff(100), 20000, &control);
+    ASSERT(reduced.varianceReductionFactor > 2);
+    ASSERT(reduced.standardError < plain.standardError);
+    double combined = std::sqrt(plain.standardError * plain.standardError + reduced.standardError * reduced.standardError);
+    ASSERT_APPROX_EQUAL(reduced.price, plain.price, 4 * combined);
+
+    // a control identical to the payoff removes all the variance
+    ControlVariate perfect = europeanCallControl(model, 100);
+    MonteCarloEstimate exact = monteCarloPrice(model, europeanCallPayoff(100), 5000, &perfect);
+    ASSERT_APPROX_EQUAL(exact.price, blackScholesCallPrice(100, 1, 100, 0.2, 0.05), 1e-9);
+}
+
+static void testBasketControlVariate()
+{
+    SimulationModel model;
+    model.spots = {100.0, 100.0};
+    model.volatilities = {0.2, 0.3};
+    model.correlation = Matrix(2, 2, 0.5);
+    model.correlation(0, 0) = 1.0;
+    model.correlation(1, 1) = 1.0;
+    model.rate = 0.05;
+    std::vector<double> weights{0.5, 0.5};
+    ControlVariate control = basketEuropeanCallControl(model, 100, weights);
+    MonteCarloEstimate reduced = monteCarloPrice(model, basketCallPayoff(100, weights), 20000, &control);
+    ASSERT(reduced.varianceReductionFactor > 2);
+}
+
+static void testImportanceSampling()
+{
+    SimulationModel model = singleAssetModel(1);
+    double strike = 180;
+    ImportanceSampling shift = europeanCallImportanceSampling(model, strike);
+    ASSERT(shift.shift() > 0);
+    MonteCarloEstimate estimate = monteCarloPrice(model, europeanCallPayoff(strike), 20000, &shift);
+    double exact = blackScholesCallPrice(strike, 1.0, 100.0, 0.2, 0.05);
+    ASSERT_APPROX_EQUAL(estimate.price, exact, 4 * estimate.standardError);
+    ASSERT(estimate.varianceReductionFactor > 10);
+}
+
+static void testMomentMatching()
+{
+    std::vector<double> z = randn(3000);
+    std::vector<double> weights(1000);
+    MomentMatching matching;
+    matching.transformNormals(z.data(), 1000, 3, weights.data());
+    for (size_t i = 0; i < 3; i++)
+    {
+        std::vector<double> column;
+        for (size_t p = 0; p < 1000; p++)
+        {
+            column.push_back(z[p * 3 + i]);
+        }
+        ASSERT_APPROX_EQUAL(mean(column), 0.0, 1e-12);
+        ASSERT_APPROX_EQUAL(standardDeviation(column, false), 1.0, 1e-12);
+    }
+
+    SimulationModel model = singleAssetModel(1);
+    MonteCarloEstimate estimate = monteCarloPrice(model, europeanCallPayoff(100), 32768, &matching, 1024);
+    ASSERT_APPROX_EQUAL(estimate.price, blackScholesCallPrice(100, 1, 100, 0.2, 0.05), 4 * estimate.standardError);
+}
+
+void testVarianceReduction()
+{
+    TEST(testPlainMonteCarlo);
+    TEST(testControlVariate);
+    TEST(testBasketControlVariate);
+    TEST(testImportanceSampling);
+    TEST(testMomentMatching);
+}
+
+///////////////////////////////////////////////
+//
+//   BENCHMARKS
+//
+///////////////////////////////////////////////
+
+/*  Times how long it takes to reach the target standard error, sizing the run from a pilot */
+static void benchmarkTimeToError(const char *product,
+                                 const SimulationModel &model,
+                                 const PathPayoff &payoff,
+                                 const VarianceReduction *strategy,
+                                 double targetError)
+{
+    const int pilotPaths = 16384;
+    MonteCarloEstimate pilot = monteCarloPrice(model, payoff, pilotPaths, strategy);
+    double variancePerPath = pilot.standardError * pilot.standardError * pilotPaths;
+    int paths = std::max(pilotPaths, (int)std::ceil(variancePerPath / (targetError * targetError)));
+
+    auto start = std::chrono::steady_clock::now();
+    MonteCarloEstimate estimate = monteCarloPrice(model, payoff, paths, strategy);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "variance reduction " << product << " " << (strategy ? strategy->name() : "plain")
+              << ": " << paths << " paths, " << seconds << "s to standard error " << estimate.standardError
+              << " (factor " << estimate.varianceReductionFactor << ")\n";
+}
+
+void benchmarkVarianceReduction()
+{
+    SimulationModel asianModel = singleAssetModel(50);
+    ControlVariate asianControl = europeanCallControl(asianModel, 100);
+    MomentMatching matching;
+    benchmarkTimeToError("asian", asianModel, arithmeticAsianCallPayoff(100), nullptr, 0.01);
+    benchmarkTimeToError("asian", asianModel, arithmeticAsianCallPayoff(100), &asianControl, 0.01);
+    benchmarkTimeToError("asian", asianModel, arithmeticAsianCallPayoff(100), &matching, 0.01);
+
+    SimulationModel basketModel;
+    basketModel.spots.assign(5, 100.0);
+    basketModel.volatilities = {0.15, 0.2, 0.25, 0.3, 0.35};
+    basketModel.correlation = Matrix(5, 5, 0.6);
+    for (size_t i = 0; i < 5; i++)
+    {
+        basketModel.correlation(i, i) = 1.0;
+    }
+    basketModel.rate = 0.05;
+    std::vector<double> weights(5, 0.2);
+    ControlVariate basketControl = basketEuropeanCallControl(basketModel, 100, weights);
+    benchmarkTimeToError("basket", basketModel, basketCallPayoff(100, weights), nullptr, 0.01);
+    benchmarkTimeToError("basket", basketModel, basketCallPayoff(100, weights), &basketControl, 0.01);
+
+    SimulationModel otmModel = singleAssetModel(1);
+    ImportanceSampling shift = europeanCallImportanceSampling(otmModel, 200);
+    benchmarkTimeToError("deep otm call", otmModel, europeanCallPayoff(200), nullptr, 1e-4);
+    benchmarkTimeToError("deep otm call", otmModel, europeanCallPayoff(200), &shift, 1e-4);
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "matrix.h"
+#include <functional>
+#include <string>
+
+/**
+ *  Correlated geometric Brownian motions observed on an equally spaced
+ *  time grid under the risk neutral measure
+ */
+struct SimulationModel
+{
+    std::vector<double> spots;
+    std::vector<double> volatilities;
+    /** Correlation between the assets, leave empty for independent assets */
+    Matrix correlation;
+    double rate = 0.0;
+    double maturity = 1.0;
+    int timeSteps = 1;
+};
+
+/**
+ *  Payoff of a simulated path, prices[step * nAssets + asset] holding the
+ *  price of each asset after each of the nSteps time steps
+ */
+typedef std::function<double(const double *prices, size_t nSteps, size_t nAssets)> PathPayoff;
+
+/**
+ *  A Monte Carlo price with its standard error and the factor by which the
+ *  variance reduction strategy cut the variance per path
+ */
+struct MonteCarloEstimate
+{
+    double price;
+    double standardError;
+    double varianceReductionFactor;
+    int paths;
+};
+
+/**
+ *  Base class of the pluggable variance reduction strategies.  The default
+ *  implementation does nothing, so plain Monte Carlo is the base class.
+ */
+class VarianceReduction
+{
+public:
+    virtual ~VarianceReduction() = default;
+
+    virtual std::string name() const { return "plain"; }
+
+    /**
+     * Adjusts a block of independent standard normals, nNormals per path,
+     * before they are used, and sets the likelihood ratio of each path
+     */
+    virtual void transformNormals(double *normals, size_t nPaths, size_t nNormals, double *weights) const;
+
+    /** Whether the paths of a block are independent of each other */
+    virtual bool independentPaths() const { return true; }
+
+    /** Whether control() and controlMean() are used */
+    virtual bool hasControl() const { return false; }
+    /** The undiscounted control variate on a path */
+    virtual double control(const double *prices, size_t nSteps, size_t nAssets) const;
+    /** The known discounted expectation of the control */
+    virtual double controlMean() const { return 0.0; }
+};
+
+/**
+ *  Control variate with a known expectation, the coefficient is estimated
+ *  from the simulated paths
+ */
+class ControlVariate : public VarianceReduction
+{
+public:
+    ControlVariate(const PathPayoff &control, double discountedMean);
+
+    std::string name() const override { return "control variate"; }
+    bool hasControl() const override { return true; }
+    double control(const double *prices, size_t nSteps, size_t nAssets) const override;
+    double controlMean() const override { return mean; }
+
+private:
+    PathPayoff controlPayoff;
+    double mean;
+};
+
+/**
+ *  Importance sampling by shifting the mean of every driving normal by
+ *  drift and reweighting each path by its likelihood ratio
+ */
+class ImportanceSampling : public VarianceReduction
+{
+public:
+    explicit ImportanceSampling(double meanShift);
+
+    std::string name() const override { return "importance sampling"; }
+    void transformNormals(double *normals, size_t nPaths, size_t nNormals, double *weights) const override;
+
+    double shift() const { return drift; }
+
+private:
+    double drift;
+};
+
+/**
+ *  Moment matching: rescales each driving normal across a block of paths
+ *  to have sample mean 0 and variance 1
+ */
+class MomentMatching : public VarianceReduction
+{
+public:
+    std::string name() const override { return "moment matching"; }
+    void transformNormals(double *normals, size_t nPaths, size_t nNormals, double *weights) const override;
+    bool independentPaths() const override { return false; }
+};
+
+/**
+ * Prices the discounted expectation of payoff by simulating nPaths paths
+ * of the model in blocks of blockSize, applying the variance reduction
+ * strategy (plain Monte Carlo if it is null)
+ */
+MonteCarloEstimate monteCarloPrice(const SimulationModel &model,
+                                   const PathPayoff &payoff,
+                                   int nPaths,
+                                   const VarianceReduction *strategy = nullptr,
+                                   int blockSize = 4096);
+
+/** European call on one asset, paid at maturity */
+PathPayoff europeanCallPayoff(double strike, size_t asset = 0);
+
+/** Call on the arithmetic average of the first asset over the time steps */
+PathPayoff arithmeticAsianCallPayoff(double strike);
+
+/** Call on a weighted basket of the assets at maturity */
+PathPayoff basketCallPayoff(double strike, const std::vector<double> &weights);
+
+/**
+ * Control variate for Asian options: a European call on the first asset
+ * priced with blackScholesCallPrice
+ */
+ControlVariate europeanCallControl(const SimulationModel &model, double strike);
+
+/**
+ * Control variate for basket options: the weighted sum of European calls
+ * on each asset priced with blackScholesCallPrice
+ */
+ControlVariate basketEuropeanCallControl(const SimulationModel &model,
+                                         double strike,
+                                         const std::vector<double> &weights);
+
+/**
+ * Importance sampling for an out of the money European call on the first
+ * asset, shifting the drift so the terminal price is centred on the strike
+ */
+ImportanceSampling europeanCallImportanceSampling(const SimulationModel &model, double strike);
+
+/**
+ *  Test function
+ */
+void testVarianceReduction();
+
+/**
+ *  Benchmark function
+ */
+void benchmarkVarianceReduction();